@@ -114,6 +114,7 @@ public:
     que_mutex.unlock();
     trans.matrix() =
         ukf_pose_estimator->matrix() * Tli.inverse().matrix().cast<float>();
+    return true;
     /*
     std::cout << "count:" << count << "\n pos:" << ukf_pose_estimator->pos()
               << "\n vel:" << ukf_pose_estimator->vel()
@@ -129,7 +130,9 @@ public:
         ukf_pose_estimator->matrix() * Tli.inverse().matrix().cast<float>();
 
 
-    velocity = ukf_pose_estimator->vel();/*
+    velocity = ukf_pose_estimator->vel();
+    return true;
+    /*
     Eigen::Quaternionf q(imu_pose.rotation());
     std::cout << "correct:"
               << "\n pos:" << ukf_pose_estimator->pos()
@@ -140,6 +143,7 @@ public:
 
   bool reset(const Eigen::Vector3f &pos, const Eigen::Quaternionf &quat) {
     ukf_pose_estimator->reset(pos, quat);
+    return true;
   }
 
   const VectorXt &getMean() const { return ukf_pose_estimator->getMean(); }
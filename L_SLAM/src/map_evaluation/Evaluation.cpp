@@ -3,9 +3,17 @@
 
 namespace lidar_slam {
 
-Evaluation::Evaluation() {}
+Evaluation::Evaluation() : _lidarMsgNum(0), _reportedNum(0), _shutdown(false) {}
 
-Evaluation::~Evaluation() {}
+Evaluation::~Evaluation()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _shutdown = true;
+  }
+  _lidarCond.notify_all();
+  if(_spinThread.joinable()) _spinThread.join();
+}
 
 bool Evaluation::init(ros::NodeHandle &node,
                       ros::NodeHandle &privateNode)
@@ -15,6 +23,7 @@ bool Evaluation::init(ros::NodeHandle &node,
   _gpsNowId = 0;
   _gpsMsgNum = 0;
   _lidarMsgNum = 0;
+  _reportedNum = 0;
   _averageDifferX = _averageDifferY = _averageDifferZ = _averageDifferDis = 0;
   _varianceDifferX = _varianceDifferY = _varianceDifferZ = _varianceDifferDis = 0;
   _maxDifferX = _maxDifferY = _maxDifferZ = _maxDifferDis = 0;
@@ -38,6 +47,7 @@ void Evaluation::gpsHandler(const nav_msgs::Odometry::ConstPtr &gpsMsg)
 
 void Evaluation::lidarToMapHandler(const nav_msgs::Odometry::ConstPtr &lidarToMapMsg)
 {
+  std::unique_lock<std::mutex> lock(_mutex);
   _nowTime = lidarToMapMsg->header.stamp.toSec();
   _differTime[_lidarMsgNum] = -1;
   int tmpId, corId, i;
@@ -76,27 +86,37 @@ void Evaluation::lidarToMapHandler(const nav_msgs::Odometry::ConstPtr &lidarToMa
   //           << "Variance Different Distance: " << _varianceDifferDis << "\n";
 
   if(_lidarMsgNum > LidarNum) printf("Lidars' number outrange!");
+
+  lock.unlock();
+  _lidarCond.notify_one();
 }
 
 void Evaluation::spin()
 {
-  ros::Rate rate(20);
-  bool status = ros::ok();
-
-  while(status)
+  while(ros::ok())
   {
-    ros::spinOnce();
+    {
+      // the handler wakes this thread on every new lidar message, the timeout
+      // only serves to notice the node shutdown
+      std::unique_lock<std::mutex> lock(_mutex);
+      _lidarCond.wait_for(lock, std::chrono::milliseconds(100),
+                          [this] { return _lidarMsgNum != _reportedNum || _shutdown; });
+      if(_shutdown) break;
+    }
     process();
-    status = ros::ok();
-    rate.sleep();
   }
 }
 
 void Evaluation::process()
 {
+  std::lock_guard<std::mutex> lock(_mutex);
   int num = _lidarMsgNum;
   double nowTime = _nowTime;
-  if(num && num % 1000 == 0)
+  // report once whenever another 1000 lidar messages have been evaluated
+  bool report = num / 1000 > _reportedNum / 1000;
+  _reportedNum = num;
+
+  if(report)
   {
     _averageDifferX = _averageDifferY = _averageDifferZ = _averageDifferDis = _averageDifferTime = 0;
     _varianceDifferX = _varianceDifferY = _varianceDifferZ = _varianceDifferDis = 0;
@@ -1,6 +1,8 @@
 #include <ros/ros.h>
 
 #include "nav_msgs/Odometry.h"
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 
@@ -54,7 +56,11 @@ private:
   double _maxDifferDis;
 
   double _nowTime;
+  int _reportedNum; // the lidar message number of the last report
 
+  std::mutex _mutex;
+  std::condition_variable _lidarCond; // signals new lidar messages
+  bool _shutdown;
   std::thread _spinThread;
 
 };
@@ -0,0 +1,142 @@
+#include "BatchScanRegistration.h"
+
+#include <thread>
+
+namespace lidar_slam {
+
+BatchScanRegistration::BatchScanRegistration(const RegistrationParams &config,
+                                             const int &nWorkers,
+                                             const size_t &maxPending)
+    : _maxPending(maxPending), _sourceDone(false), _nextRead(0),
+      _nextDeliver(0), _nDelivered(0), _delivering(false) {
+  // the workers already run concurrently, so extract features serially
+  RegistrationParams workerConfig = config;
+  workerConfig.extractionThreads = 1;
+  workerConfig.adaptiveBudget = false;
+
+  for (int i = 0; i < std::max(nWorkers, 1); i++) {
+    _workers.emplace_back(new MultiScanRegistration(workerConfig));
+  }
+  if (_maxPending == 0) {
+    _maxPending = 2 * _workers.size();
+  }
+}
+
+bool BatchScanRegistration::setupScanMapper(const std::string &lidarName) {
+  for (size_t i = 0; i < _workers.size(); i++) {
+    if (!_workers[i]->setupScanMapper(lidarName)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t BatchScanRegistration::run(const SweepSource &source,
+                                  const SweepSink &sink) {
+  _sourceDone = false;
+  _nextRead = 0;
+  _nextDeliver = 0;
+  _nDelivered = 0;
+  _pending.clear();
+  _pending.resize(_maxPending);
+  _registered.assign(_maxPending, false);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < _workers.size(); i++) {
+    threads.emplace_back(&BatchScanRegistration::work, this,
+                         std::ref(*_workers[i]), std::cref(source),
+                         std::cref(sink));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  return _nDelivered;
+}
+
+void BatchScanRegistration::work(MultiScanRegistration &registration,
+                                 const SweepSource &source,
+                                 const SweepSink &sink) {
+  std::unique_ptr<SweepFeatures> result;
+  registration.setSweepSink([this, &result](SweepFeatures &sweep) {
+    result = recycle();
+    result->swap(sweep);
+  });
+
+  CloudI cloud;
+  ros::Time stamp;
+  while (true) {
+    size_t seq;
+    {
+      std::lock_guard<std::mutex> sourceLock(_sourceMutex);
+      if (_sourceDone) {
+        break;
+      }
+
+      // limit the number of sweeps ahead of the sink
+      {
+        std::unique_lock<std::mutex> deliverLock(_deliverMutex);
+        _delivered.wait(deliverLock, [this] {
+          return _nextRead < _nextDeliver + _maxPending;
+        });
+      }
+
+      if (!source(cloud, stamp)) {
+        _sourceDone = true;
+        break;
+      }
+      seq = _nextRead++;
+    }
+
+    result.reset();
+    registration.process(cloud, stamp);
+    deliver(seq, std::move(result), sink);
+  }
+}
+
+void BatchScanRegistration::deliver(const size_t &seq,
+                                    std::unique_ptr<SweepFeatures> sweep,
+                                    const SweepSink &sink) {
+  std::unique_lock<std::mutex> lock(_deliverMutex);
+  // the read limit keeps all pending sequence numbers in distinct slots
+  _pending[seq % _maxPending] = std::move(sweep);
+  _registered[seq % _maxPending] = true;
+  if (_delivering) {
+    // the delivering worker picks the sweep up in order
+    return;
+  }
+
+  _delivering = true;
+  while (_registered[_nextDeliver % _maxPending]) {
+    const size_t slot = _nextDeliver % _maxPending;
+    std::unique_ptr<SweepFeatures> next = std::move(_pending[slot]);
+    _registered[slot] = false;
+
+    // sweeps without result (e.g. empty clouds) are skipped
+    lock.unlock();
+    if (next) {
+      sink(*next);
+    }
+    lock.lock();
+
+    if (next) {
+      _recycled.push_back(std::move(next));
+      _nDelivered++;
+    }
+    _nextDeliver++;
+    _delivered.notify_all();
+  }
+  _delivering = false;
+}
+
+std::unique_ptr<SweepFeatures> BatchScanRegistration::recycle() {
+  std::lock_guard<std::mutex> lock(_deliverMutex);
+  if (_recycled.empty()) {
+    return std::unique_ptr<SweepFeatures>(new SweepFeatures());
+  }
+  std::unique_ptr<SweepFeatures> sweep = std::move(_recycled.back());
+  _recycled.pop_back();
+  return sweep;
+}
+
+} // end namespace lidar_slam
@@ -0,0 +1,97 @@
+#ifndef LIDAR_BATCHSCANREGISTRATION_H
+#define LIDAR_BATCHSCANREGISTRATION_H
+
+#include "MultiScanRegistration.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace lidar_slam {
+
+/** \brief Offline registration of a stream of multi laser sweeps.
+ *
+ * The sweeps are read from a source and registered concurrently by several
+ * workers, each owning its own MultiScanRegistration instance. The registered
+ * sweeps are handed to the sink strictly in input order, so the sink (e.g. a
+ * LaserOdometry instance) runs pipelined with the feature extraction of the
+ * following sweeps. No ROS spinning is involved.
+ *
+ * Delivered sweeps are recycled, so the cloud buffers are reused by the
+ * workers instead of being reallocated for every sweep.
+ *
+ * IMU de-skewing is not available in batch mode.
+ */
+class BatchScanRegistration {
+public:
+  typedef pcl::PointXYZI PointI;
+  typedef pcl::PointCloud<PointI> CloudI;
+
+  /** \brief Reader of raw sweeps, returning false at the end of the stream. */
+  typedef std::function<bool(CloudI &cloud, ros::Time &stamp)> SweepSource;
+
+  /** \brief Construct a new batch registration.
+   *
+   * @param config the registration parameters, extraction runs serial per
+   * worker
+   * @param nWorkers the number of concurrent workers
+   * @param maxPending the maximum number of sweeps ahead of the sink (0 = two
+   * per worker)
+   */
+  BatchScanRegistration(const RegistrationParams &config, const int &nWorkers,
+                        const size_t &maxPending = 0);
+
+  /** \brief Set up the scan mapper of all workers.
+   *
+   * @param lidarName the lidar model name
+   * @return true, if the lidar model is supported, false otherwise
+   */
+  bool setupScanMapper(const std::string &lidarName);
+
+  /** \brief Register all sweeps of the source.
+   *
+   * @param source the sweep source, only called by one worker at a time
+   * @param sink the sweep sink, called in input order by one worker at a time
+   * @return the number of sweeps delivered to the sink, without skipped
+   * sweeps (e.g. empty clouds)
+   */
+  size_t run(const SweepSource &source, const SweepSink &sink);
+
+private:
+  /** \brief Worker loop reading, registering and delivering sweeps. */
+  void work(MultiScanRegistration &registration, const SweepSource &source,
+            const SweepSink &sink);
+
+  /** \brief Queue a registered sweep and deliver all sweeps in order. */
+  void deliver(const size_t &seq, std::unique_ptr<SweepFeatures> sweep,
+               const SweepSink &sink);
+
+  /** \brief Take a delivered sweep for reuse, or a new one if none is left. */
+  std::unique_ptr<SweepFeatures> recycle();
+
+  std::vector<std::unique_ptr<MultiScanRegistration>>
+      _workers;       ///< registration per worker
+  size_t _maxPending; ///< maximum number of sweeps ahead of the sink
+
+  std::mutex _sourceMutex; ///< serializes reading from the source
+  bool _sourceDone;        ///< flag if the source reached its end
+  size_t _nextRead;        ///< sequence number of the next read sweep
+
+  std::mutex _deliverMutex; ///< serializes delivering to the sink
+  std::condition_variable _delivered; ///< signals delivered sweeps
+  size_t _nextDeliver;                ///< sequence number of the next delivery
+  size_t _nDelivered; ///< number of sweeps passed to the sink
+  bool _delivering; ///< flag if a worker is currently calling the sink
+  std::vector<std::unique_ptr<SweepFeatures>>
+      _pending; ///< registered sweeps waiting for delivery, by sequence number
+                /// modulo the maximum number of pending sweeps
+  std::vector<bool> _registered; ///< flag if a pending slot is filled
+  std::vector<std::unique_ptr<SweepFeatures>>
+      _recycled; ///< delivered sweeps, whose cloud buffers are reused
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_BATCHSCANREGISTRATION_H
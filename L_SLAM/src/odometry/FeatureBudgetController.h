@@ -0,0 +1,91 @@
+#ifndef LIDAR_FEATUREBUDGETCONTROLLER_H
+#define LIDAR_FEATUREBUDGETCONTROLLER_H
+
+#include <algorithm>
+#include <cmath>
+
+namespace lidar_slam {
+
+/** \brief Closed loop controller of the per sweep feature budget.
+ *
+ * The controller maintains a single budget scale, which multiplies the number
+ * of features extracted per sweep. After every sweep the odometry reports its
+ * scan matching time and number of correspondences. The scale is then moved
+ * towards the value meeting the correspondence target, while the predicted
+ * matching time is kept below the latency target.
+ *
+ * The scale is split evenly between the number of feature regions and the
+ * feature counts per region, and the less flat voxel size shrinks with the
+ * square root of the scale (surface density grows quadratically).
+ */
+class FeatureBudgetController {
+public:
+  /** \brief Set up the controller.
+   *
+   * @param targetMatchTime the scan matching time target (ms)
+   * @param targetCorrespondences the correspondence count target
+   * @param gain the exponent applied to the correction ratios (0, 1]
+   * @param minScale the lower bound of the budget scale
+   * @param maxScale the upper bound of the budget scale
+   */
+  void setup(const float &targetMatchTime, const float &targetCorrespondences,
+             const float &gain, const float &minScale = 0.25f,
+             const float &maxScale = 4.0f) {
+    _targetMatchTime = targetMatchTime;
+    _targetCorrespondences = targetCorrespondences;
+    _gain = gain;
+    _minScale = minScale;
+    _maxScale = maxScale;
+    _scale = 1;
+  }
+
+  /** \brief Update the budget scale from the matcher statistics of the
+   * previous sweep.
+   *
+   * @param matchTime the scan matching time (ms)
+   * @param correspondences the number of correspondences
+   */
+  void update(const float &matchTime, const float &correspondences) {
+    float ratio = 1;
+    if (matchTime > _targetMatchTime) {
+      ratio = _targetMatchTime / matchTime;
+    } else {
+      ratio = _targetCorrespondences / std::max(correspondences, 1.0f);
+      // the matching time grows about linearly with the budget
+      if (matchTime > 0) {
+        ratio = std::min(ratio, _targetMatchTime / matchTime);
+      }
+    }
+
+    _scale *= std::pow(ratio, _gain);
+    _scale = std::min(std::max(_scale, _minScale), _maxScale);
+  }
+
+  /** \brief The current budget scale. */
+  float scale() const { return _scale; }
+
+  /** \brief Scale the number of feature regions. */
+  int featureRegions(const int &base) const {
+    return std::max(1, int(std::lround(base * std::sqrt(_scale))));
+  }
+
+  /** \brief Scale a per region feature count. */
+  int featuresPerRegion(const int &base) const {
+    return std::max(1, int(std::lround(base * std::sqrt(_scale))));
+  }
+
+  /** \brief Scale the less flat voxel size. */
+  float filterSize(const float &base) const { return base / std::sqrt(_scale); }
+
+private:
+  float _targetMatchTime = 30;         ///< scan matching time target (ms)
+  float _targetCorrespondences = 1000; ///< correspondence count target
+  float _gain = 0.5f;                  ///< correction exponent
+  float _minScale = 0.25f;             ///< lower bound of the budget scale
+  float _maxScale = 4.0f;              ///< upper bound of the budget scale
+  float _scale = 1;                    ///< current budget scale
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_FEATUREBUDGETCONTROLLER_H
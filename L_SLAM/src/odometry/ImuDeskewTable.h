@@ -0,0 +1,121 @@
+#ifndef LIDAR_IMUDESKEWTABLE_H
+#define LIDAR_IMUDESKEWTABLE_H
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Dense table of IMU de-skew transforms over a sweep.
+ *
+ * The table samples the affine transform projecting a point measured at a
+ * given relative time to the start of the sweep at fixed time steps. A point
+ * is de-skewed by linearly interpolating the two neighboring samples and
+ * applying the result, which replaces the per point IMU history search and
+ * trigonometric rotations.
+ */
+class ImuDeskewTable {
+public:
+  /** \brief Set up the table for a time range.
+   *
+   * The step is widened if the range would need more than MAX_SIZE samples.
+   *
+   * @param step the time between two samples, > 0
+   * @param beginTime the relative time of the first sample
+   * @param endTime the relative time covered by the last sample
+   */
+  void reset(const float &step, const float &beginTime, const float &endTime) {
+    float range = std::max(endTime - beginTime, 0.0f);
+    _step = std::max(step, range / (MAX_SIZE - 1));
+    _invStep = 1 / _step;
+    _beginTime = beginTime;
+    _size = std::max<size_t>(2, size_t(std::ceil(range * _invStep)) + 1);
+    if (_size > MAX_SIZE) {
+      _size = MAX_SIZE;
+    }
+    _coeffs.resize(_size * COEFFS_PER_SAMPLE);
+  }
+
+  /** \brief The number of samples. */
+  size_t size() const { return _size; }
+
+  /** \brief The relative time of the sample k. */
+  float time(const size_t &k) const { return _beginTime + k * _step; }
+
+  /** \brief Set the transform of sample k.
+   *
+   * @param k the sample index
+   * @param rotation the rotation part of the transform
+   * @param translation the translation part of the transform
+   */
+  void set(const size_t &k, const Eigen::Matrix3f &rotation,
+           const Eigen::Vector3f &translation) {
+    float *c = &_coeffs[k * COEFFS_PER_SAMPLE];
+    for (int row = 0; row < 3; row++) {
+      c[4 * row] = rotation(row, 0);
+      c[4 * row + 1] = rotation(row, 1);
+      c[4 * row + 2] = rotation(row, 2);
+      c[4 * row + 3] = translation(row);
+    }
+  }
+
+  /** \brief De-skew a batch of points in place.
+   *
+   * Points with a negative mask entry are left untouched. Relative times
+   * outside the table range are clamped to the first or last sample.
+   *
+   * @param relTime the relative point times
+   * @param mask the point mask, negative for skipped points
+   * @param x the point x coordinates
+   * @param y the point y coordinates
+   * @param z the point z coordinates
+   * @param count the number of points
+   */
+  void apply(const float *relTime, const int16_t *mask, float *x, float *y,
+             float *z, const size_t &count) const {
+    const float maxPos = float(_size - 1);
+    const int lastInterval = int(_size) - 2;
+
+    for (size_t i = 0; i < count; i++) {
+      if (mask[i] < 0) {
+        continue;
+      }
+
+      float pos = (relTime[i] - _beginTime) * _invStep;
+      pos = std::min(std::max(pos, 0.0f), maxPos);
+      int k = std::min(int(pos), lastInterval);
+      float w = pos - k;
+
+      const float *a = &_coeffs[k * COEFFS_PER_SAMPLE];
+      const float *b = a + COEFFS_PER_SAMPLE;
+      float c[COEFFS_PER_SAMPLE];
+      for (int j = 0; j < COEFFS_PER_SAMPLE; j++) {
+        c[j] = a[j] + w * (b[j] - a[j]);
+      }
+
+      float px = x[i], py = y[i], pz = z[i];
+      x[i] = c[0] * px + c[1] * py + c[2] * pz + c[3];
+      y[i] = c[4] * px + c[5] * py + c[6] * pz + c[7];
+      z[i] = c[8] * px + c[9] * py + c[10] * pz + c[11];
+    }
+  }
+
+  static const size_t MAX_SIZE = 10000; ///< maximum number of samples
+
+private:
+  static const int COEFFS_PER_SAMPLE = 12; ///< row major 3x4 transform
+
+  float _step = 0.001f;       ///< time between two samples
+  float _invStep = 1000.0f;   ///< inverse sample step
+  float _beginTime = 0;       ///< relative time of the first sample
+  size_t _size = 0;           ///< number of samples
+  std::vector<float> _coeffs; ///< transform coefficients of all samples
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_IMUDESKEWTABLE_H
@@ -13,9 +13,17 @@
 
 namespace lidar_slam {
 
-LaserLocalization::LaserLocalization() {}
+LaserLocalization::LaserLocalization() {
+  // the scan is matched against the feature map, not the surround clouds
+  _surroundTrees = false;
+}
 
-LaserLocalization::~LaserLocalization() {}
+LaserLocalization::~LaserLocalization() {
+  _synchronizer.shutdown();
+  if (spin_thread.joinable()) {
+    spin_thread.join();
+  }
+}
 
 bool LaserLocalization::init(ros::NodeHandle &node,
                              ros::NodeHandle &privateNode) {
@@ -110,25 +118,30 @@ void LaserLocalization::handleInitialPoseMessage(
 }
 
 void LaserLocalization::spin() {
-  ros::Rate rate(500);
-  bool status = ros::ok();
-
-  while (status) {
-    ros::spinOnce();
-    process();
-    status = ros::ok();
-    rate.sleep();
+  // the subscriber callbacks run in the node spinner and wake this thread as
+  // soon as a complete frame is available
+  while (ros::ok() && !_synchronizer.isShutdown()) {
+    if (waitForFrame(0.1)) {
+      process();
+    }
   }
 }
 
 void LaserLocalization::optimizeTransform() {
 
-  if(_dynamicMode)
+  if(_dynamicMode) {
     _dynamic_feature_map.scanMatchScan(_laserCloudCornerStackDS, _laserCloudSurfStackDS,
                             _lidarMappedNew);
-  else
+    reportConvergence(_dynamic_feature_map.convergence());
+  } else if (_ndtMode) {
+    _feature_map->scanMatchNdt(_laserCloudCornerStackDS, _laserCloudSurfStackDS,
+                               _lidarMappedNew);
+    reportConvergence(_feature_map->convergence());
+  } else {
     _feature_map->scanMatchScan(_laserCloudCornerStackDS, _laserCloudSurfStackDS,
                             _lidarMappedNew);
+    reportConvergence(_feature_map->convergence());
+  }
  /*
   _scan_match.scanMatchScan(_laserCloudCornerFromMap, _laserCloudSurfFromMap,
                             _laserCloudCornerStackDS, _laserCloudSurfStackDS,
@@ -185,6 +198,7 @@ void LaserLocalization::process() {
   transformUpdate();
   // featureMapUpdate();
   publishResult();
+  prepareNextSurround();
 }
 
 } // end namespace lidar_slam
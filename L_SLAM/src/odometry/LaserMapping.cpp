@@ -11,28 +11,38 @@ using std::pow;
 
 LaserMapping::LaserMapping() {}
 
-LaserMapping::~LaserMapping() {}
+LaserMapping::~LaserMapping() {
+  _synchronizer.shutdown();
+  if (spin_thread.joinable()) {
+    spin_thread.join();
+  }
+}
 
 bool LaserMapping::init(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
   if (setup(node, privateNode)) {
-
-    _inputFrameSkip = 0;
-
     spin_thread = std::thread(&LaserMapping::spin, this);
     return true;
   }
   return false;
 }
 
+bool LaserMapping::configure(ros::NodeHandle &node,
+                             ros::NodeHandle &privateNode) {
+  if (!LaserMatcher::configure(node, privateNode)) {
+    return false;
+  }
+  // the mapping processes every frame
+  _inputFrameSkip = 0;
+  return true;
+}
+
 void LaserMapping::spin() {
-  ros::Rate rate(500);
-  bool status = ros::ok();
-
-  while (status) {
-    ros::spinOnce();
-    process();
-    status = ros::ok();
-    rate.sleep();
+  // the subscriber callbacks run in the node spinner and wake this thread as
+  // soon as a complete frame is available
+  while (ros::ok() && !_synchronizer.isShutdown()) {
+    if (waitForFrame(0.1)) {
+      process();
+    }
   }
 }
 
@@ -56,6 +66,7 @@ void LaserMapping::process() {
   transformUpdate();
   featureMapUpdate();
   publishResult();
+  prepareNextSurround();
 }
 
 } // end namespace lidar_slam
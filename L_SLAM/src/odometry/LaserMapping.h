@@ -19,6 +19,8 @@ public:
 
   virtual bool init(ros::NodeHandle &node, ros::NodeHandle &privateNode);
 
+  virtual bool configure(ros::NodeHandle &node, ros::NodeHandle &privateNode);
+
   void spin();
 
   virtual void process();
@@ -5,7 +5,12 @@ namespace lidar_slam {
 
 LaserMappingLocal::LaserMappingLocal() {}
 
-LaserMappingLocal::~LaserMappingLocal() {}
+LaserMappingLocal::~LaserMappingLocal() {
+  _synchronizer.shutdown();
+  if (spin_thread.joinable()) {
+    spin_thread.join();
+  }
+}
 
 bool LaserMappingLocal::init(ros::NodeHandle &node,
                                ros::NodeHandle &privateNode) {
@@ -19,14 +24,12 @@ bool LaserMappingLocal::init(ros::NodeHandle &node,
 }
 
 void LaserMappingLocal::spin() {
-  ros::Rate rate(500);
-  bool status = ros::ok();
-
-  while (status) {
-    ros::spinOnce();
-    process();
-    status = ros::ok();
-    rate.sleep();
+  // the subscriber callbacks run in the node spinner and wake this thread as
+  // soon as a complete frame is available
+  while (ros::ok() && !_synchronizer.isShutdown()) {
+    if (waitForFrame(0.1)) {
+      process();
+    }
   }
 }
 
@@ -8,6 +8,7 @@
 
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
+#include <pcl/common/io.h>
 
 namespace lidar_slam {
 
@@ -19,15 +20,25 @@ using std::pow;
 
 LaserMatcher::LaserMatcher()
     : _filesDirectory("~"), _sendRegisteredCloud(true),
-      _sendSurroundCloud(true), _useFullCloud(true), _inputFrameSkip(1),
+      _sendSurroundCloud(true), _useFullCloud(true), _ndtMode(false),
+      _asyncSurround(false), _asyncSurroundTolerance(5.0),
+      _surroundTrees(true),
+      _inputFrameSkip(1),
       _surroundMapPubSkip(20), _inputFrameCount(0), _surroundMapPubCount(0),
       _dynamic_feature_map(), _laserCloudCornerLast(new CloudI()), // 221 211 221 || 110 105 110
       _laserCloudSurfLast(new CloudI()), _laserCloudFullRes(new CloudI()),
+      _frameCornerLast(new CloudI()), _frameSurfLast(new CloudI()),
+      _frameFullRes(new CloudI()),
       _laserCloudCornerStack(new CloudI()), _laserCloudSurfStack(new CloudI()),
       _laserCloudCornerStackDS(new CloudI()),
       _laserCloudSurfStackDS(new CloudI()),
       _laserCloudCornerFromMap(new CloudI()),
-      _laserCloudSurfFromMap(new CloudI()) {
+      _laserCloudSurfFromMap(new CloudI()),
+      _surround(new ScanMatchReference()),
+      _nextSurround(new ScanMatchReference()),
+      _nextSurroundPosition(Eigen::Vector3f::Zero()),
+      _lastMappedPosition(Eigen::Vector3f::Zero()),
+      _hasLastMappedPosition(false), _surroundPrepared(false) {
 
   _lidarOdomNew = _lidarOdomLast = _lidarOdomLastMerged = _lidarMappedNew =
       _lidarMappedLast = _lidarPoseLast =Eigen::Isometry3f::Identity();
@@ -38,11 +49,41 @@ LaserMatcher::LaserMatcher()
 }
 
 LaserMatcher::~LaserMatcher() {
+  if (_nextSurroundReady.valid()) {
+    _nextSurroundReady.wait();
+  }
   ROS_INFO("[LaserMatcher] _inputFrameCount:%ld", _inputFrameCount);
   ROS_INFO("[LaserMatcher] cloudReceiveCount:%ld", cloudReceiveCount);
 }
 
 bool LaserMatcher::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
+  if (!configure(node, privateNode)) {
+    return false;
+  }
+  _synchronizer.setup(_useFullCloud ? FULL_RES + 1 : FULL_RES);
+
+  // subscribe to laser odometry topics
+  _subLaserCloudCornerLast = node.subscribe<CloudI>(
+      "/laser_cloud_corner_last", 2, &LaserMatcher::laserCloudCornerLastHandler,
+      this);
+
+  _subLaserCloudSurfLast = node.subscribe<CloudI>(
+      "/laser_cloud_surf_last", 2, &LaserMatcher::laserCloudSurfLastHandler,
+      this);
+
+  _subLaserOdometry = node.subscribe<nav_msgs::Odometry>(
+      "/laser_odom_to_init", 5, &LaserMatcher::laserOdometryHandler, this);
+
+  if (_useFullCloud) {
+    _subLaserCloudFullRes = node.subscribe<CloudI>(
+        "/velodyne_cloud_3", 2, &LaserMatcher::laserCloudFullResHandler, this);
+  }
+
+  return true;
+}
+
+bool LaserMatcher::configure(ros::NodeHandle &node,
+                             ros::NodeHandle &privateNode) {
 
   imu_que.setup(node, privateNode);
 
@@ -91,8 +132,121 @@ bool LaserMatcher::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
   privateNode.getParam("map_filter_surf", map_filter_surf);
   privateNode.getParam("map_filter", map_filter);
 
+  std::string robustKernel;
+  privateNode.param<std::string>("robustKernel", robustKernel, "none");
+  RobustKernel::Type kernelType;
+  if (!RobustKernel::parseType(robustKernel, kernelType)) {
+    ROS_ERROR("Invalid robustKernel parameter: %s (expected none, huber, "
+              "cauchy or tukey)",
+              robustKernel.c_str());
+    return false;
+  }
+  float kernelScale;
+  privateNode.param<float>("robustKernelScale", kernelScale, 0.2);
+  if (kernelScale <= 0) {
+    ROS_ERROR("Invalid robustKernelScale parameter: %f (expected > 0)",
+              kernelScale);
+    return false;
+  }
+  RobustKernel kernel(kernelType, kernelScale);
+  ROS_INFO("Set robustKernel: %s (scale %g)", robustKernel.c_str(),
+           kernelScale);
+
+  // reuse the correspondences of a scan match while the pose moved less
+  // than this since they were searched, 0 to search them every iteration
+  float reassociateDeltaR = 0.2;
+  float reassociateDeltaT = 2.0;
+  privateNode.getParam("reassociateDeltaR", reassociateDeltaR);
+  privateNode.getParam("reassociateDeltaT", reassociateDeltaT);
+  ROS_INFO("Set reassociate thresholds: %g deg, %g cm", reassociateDeltaR,
+           reassociateDeltaT);
+  ConvergenceManager convergence;
+  convergence.setReassociateThreshold(reassociateDeltaR, reassociateDeltaT);
+
+  // match each point against the precomputed voxel distributions of the map
+  // cubes (ndt) instead of fitting lines and planes to its neighbors (feature)
+  std::string matchMode;
+  privateNode.param<std::string>("matchMode", matchMode, "feature");
+  if (matchMode != "feature" && matchMode != "ndt") {
+    ROS_ERROR("Invalid matchMode parameter: %s (expected feature or ndt)",
+              matchMode.c_str());
+    return false;
+  }
+  _ndtMode = matchMode == "ndt";
+  if (_ndtMode && _dynamicMode) {
+    ROS_WARN("matchMode ndt is not supported in dynamicMode, using feature");
+    _ndtMode = false;
+  }
+  float ndtResolution = 2.0;
+  int ndtMinPoints = 5;
+  privateNode.getParam("ndtResolution", ndtResolution);
+  privateNode.getParam("ndtMinPoints", ndtMinPoints);
+  if (ndtResolution <= 0 || ndtMinPoints < 3) {
+    ROS_ERROR("Invalid NDT parameters: resolution %f, min points %d (expected "
+              "ndtResolution > 0 and ndtMinPoints >= 3)",
+              ndtResolution, ndtMinPoints);
+    return false;
+  }
+  ROS_INFO("Set matchMode: %s", matchMode.c_str());
+  if (_ndtMode) {
+    _surroundTrees = false;
+  }
+
+  // prepare the surround map of the next frame while the current frame is
+  // published and the next one is awaited, instead of before its scan match
+  privateNode.getParam("asyncSurround", _asyncSurround);
+  privateNode.getParam("asyncSurroundTolerance", _asyncSurroundTolerance);
+  if (_asyncSurroundTolerance < 0) {
+    ROS_ERROR("Invalid asyncSurroundTolerance parameter: %f (expected >= 0)",
+              _asyncSurroundTolerance);
+    return false;
+  }
+  ROS_INFO("Set asyncSurround: %s, tolerance %g m",
+           _asyncSurround ? "true" : "false", _asyncSurroundTolerance);
+
   _scan_match.setConvergeThreshold(0.1, 0.1);
+  _scan_match.setReassociateThreshold(reassociateDeltaT, reassociateDeltaR);
   _scan_match.setUseCore(false);
+  _scan_match.setRobustKernel(kernel);
+
+  int maxIterations = 10;
+  if (privateNode.getParam("maxIterations", maxIterations)) {
+    if (maxIterations < 1) {
+      ROS_ERROR("Invalid maxIterations parameter: %d (expected > 0)",
+                maxIterations);
+      return false;
+    }
+    ROS_INFO("Set maxIterations: %d", maxIterations);
+  }
+  _scan_match.setMaxIterations(maxIterations);
+
+  // coarse to fine scan match: voxel sizes of the coarse levels, coarsest
+  // first, and their iterations before the full resolution match
+  std::vector<float> pyramidLeafSizes;
+  std::vector<int> pyramidIterations;
+  privateNode.getParam("pyramidLeafSizes", pyramidLeafSizes);
+  privateNode.getParam("pyramidIterations", pyramidIterations);
+  if (pyramidLeafSizes.size() != pyramidIterations.size()) {
+    ROS_ERROR("Invalid pyramid parameters: %zu pyramidLeafSizes, %zu "
+              "pyramidIterations (expected the same number)",
+              pyramidLeafSizes.size(), pyramidIterations.size());
+    return false;
+  }
+  std::vector<ScanMatchLevel> pyramid(pyramidLeafSizes.size());
+  for (size_t i = 0; i < pyramid.size(); i++) {
+    if (pyramidLeafSizes[i] <= 0 || pyramidIterations[i] < 1 ||
+        (i > 0 && pyramidLeafSizes[i] >= pyramidLeafSizes[i - 1])) {
+      ROS_ERROR("Invalid pyramid level %zu: leaf size %f, %d iterations "
+                "(expected decreasing leaf sizes > 0 and iterations > 0)",
+                i, pyramidLeafSizes[i], pyramidIterations[i]);
+      return false;
+    }
+    pyramid[i].leafSize = pyramidLeafSizes[i];
+    pyramid[i].maxIterations = pyramidIterations[i];
+    ROS_INFO("Set pyramid level %zu: leaf size %g, %d iterations", i,
+             pyramidLeafSizes[i], pyramidIterations[i]);
+  }
+  _scan_match.setPyramid(pyramid);
 
 
 
@@ -102,6 +256,8 @@ bool LaserMatcher::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     _dynamic_feature_map.setupLidarFov(16, 7);
     _dynamic_feature_map.setupFilesDirectory(_filesDirectory);
     _dynamic_feature_map.setupFilterSize(map_filter_corner, map_filter_surf, map_filter);
+    _dynamic_feature_map.setupRobustKernel(kernel);
+    _dynamic_feature_map.setupConvergence(convergence);
   }
   else{
     int map_cube_x = 121;
@@ -114,6 +270,9 @@ bool LaserMatcher::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
 
     _feature_map->setupFilesDirectory(_filesDirectory);
     _feature_map->setupFilterSize(map_filter_corner, map_filter_surf, map_filter);
+    _feature_map->setupRobustKernel(kernel);
+    _feature_map->setupConvergence(convergence);
+    _feature_map->setupNdt(ndtResolution, ndtMinPoints);
     _feature_map->loadCloudFromFiles();
   }
 
@@ -145,22 +304,6 @@ bool LaserMatcher::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
 
   _pubLidarPoseMerged = node.advertise<nav_msgs::Odometry>("/lidar_to_map2", 5);
 
-  _subLaserCloudCornerLast = node.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_corner_last", 2, &LaserMatcher::laserCloudCornerLastHandler,
-      this);
-
-  _subLaserCloudSurfLast = node.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_surf_last", 2, &LaserMatcher::laserCloudSurfLastHandler,
-      this);
-
-  _subLaserOdometry = node.subscribe<nav_msgs::Odometry>(
-      "/laser_odom_to_init", 5, &LaserMatcher::laserOdometryHandler, this);
-
-  if (_useFullCloud) {
-    _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>(
-        "/velodyne_cloud_3", 2, &LaserMatcher::laserCloudFullResHandler, this);
-  }
-
   _fullMapPubSrv = privateNode.advertiseService(
       "pubFullMap", &LaserMatcher::pubFullMap, this);
   _mapSaveSrv =
@@ -188,61 +331,120 @@ bool LaserMatcher::saveMap(std_srvs::Empty::Request &req,
 }
 
 void LaserMatcher::laserCloudCornerLastHandler(
-    const sensor_msgs::PointCloud2ConstPtr &cornerPointsLastMsg) {
-  _timeLaserCloudCornerLast = cornerPointsLastMsg->header.stamp;
-
-  _laserCloudCornerLast->clear();
-  pcl::fromROSMsg(*cornerPointsLastMsg, *_laserCloudCornerLast);
-
-  _newLaserCloudCornerLast = true;
+    const CloudI::ConstPtr &cornerPointsLastMsg) {
+  _synchronizer.add(CORNER_LAST, cloudStamp(cornerPointsLastMsg->header),
+                    cornerPointsLastMsg);
 }
 
 void LaserMatcher::laserCloudSurfLastHandler(
-    const sensor_msgs::PointCloud2ConstPtr &surfacePointsLastMsg) {
-  _timeLaserCloudSurfLast = surfacePointsLastMsg->header.stamp;
-
-  _laserCloudSurfLast->clear();
-  pcl::fromROSMsg(*surfacePointsLastMsg, *_laserCloudSurfLast);
-
-  _newLaserCloudSurfLast = true;
+    const CloudI::ConstPtr &surfacePointsLastMsg) {
+  _synchronizer.add(SURF_LAST, cloudStamp(surfacePointsLastMsg->header),
+                    surfacePointsLastMsg);
 }
 
 void LaserMatcher::laserCloudFullResHandler(
-    const sensor_msgs::PointCloud2ConstPtr &laserCloudFullResMsg) {
-  _timeLaserCloudFullRes = laserCloudFullResMsg->header.stamp;
-
-  _laserCloudFullRes->clear();
-  pcl::fromROSMsg(*laserCloudFullResMsg, *_laserCloudFullRes);
-
-  _newLaserCloudFullRes = true;
-  cloudReceiveCount++;
+    const CloudI::ConstPtr &laserCloudFullResMsg) {
+  _synchronizer.add(FULL_RES, cloudStamp(laserCloudFullResMsg->header),
+                    laserCloudFullResMsg);
 }
 
 void LaserMatcher::laserOdometryHandler(
     const nav_msgs::Odometry::ConstPtr &laserOdometry) {
-  _timeLaserOdometry = laserOdometry->header.stamp;
+  // the merged pose follows every odometry pose right away, while the frame
+  // waits for its clouds
   Eigen::Isometry3d is3d;
   Odom2Isometry(laserOdometry, is3d);
+  publishMergedPose(laserOdometry->header.stamp, is3d.cast<float>());
+
+  // the clouds of the frame carry the odometry stamp in PCL resolution
+  ros::Time stamp = pcl_conversions::fromPCL(
+      pcl_conversions::toPCL(laserOdometry->header.stamp));
+  _synchronizer.add(ODOMETRY, stamp, laserOdometry);
+}
+
+bool LaserMatcher::waitForFrame(const double &timeout) {
+  MessageSynchronizer::MessageSet set;
+  ros::Time stamp;
+  if (!_synchronizer.wait(set, stamp, timeout)) {
+    return false;
+  }
+
+  _laserCloudCornerLast =
+      MessageSynchronizer::messagePtr<CloudI::ConstPtr>(set, CORNER_LAST);
+  _laserCloudSurfLast =
+      MessageSynchronizer::messagePtr<CloudI::ConstPtr>(set, SURF_LAST);
+  _timeLaserCloudCornerLast = stamp;
+  _timeLaserCloudSurfLast = stamp;
+  _newLaserCloudCornerLast = true;
+  _newLaserCloudSurfLast = true;
+
+  if (_useFullCloud) {
+    _laserCloudFullRes =
+        MessageSynchronizer::messagePtr<CloudI::ConstPtr>(set, FULL_RES);
+    _timeLaserCloudFullRes = stamp;
+    _newLaserCloudFullRes = true;
+    cloudReceiveCount++;
+  }
+
+  Eigen::Isometry3d is3d;
+  Odom2Isometry(MessageSynchronizer::message<nav_msgs::Odometry>(set, ODOMETRY),
+                is3d);
+  _timeLaserOdometry = stamp;
   _lidarOdomNew = is3d.cast<float>();
   _newLaserOdometry = true;
+  return true;
+}
+
+void LaserMatcher::processOdometry(OdometryFrame &frame) {
+  _frameCornerLast->swap(frame.cornerPointsLast);
+  _frameSurfLast->swap(frame.surfacePointsLast);
+  _laserCloudCornerLast = _frameCornerLast;
+  _laserCloudSurfLast = _frameSurfLast;
+  _timeLaserCloudCornerLast = frame.stamp;
+  _timeLaserCloudSurfLast = frame.stamp;
+  _newLaserCloudCornerLast = true;
+  _newLaserCloudSurfLast = true;
+
+  if (_useFullCloud) {
+    pcl::copyPointCloud(frame.laserCloud, *_frameFullRes);
+    _laserCloudFullRes = _frameFullRes;
+    _timeLaserCloudFullRes = frame.stamp;
+    _newLaserCloudFullRes = true;
+    cloudReceiveCount++;
+  }
+
+  odometryUpdate(frame.stamp, frame.pose);
+  process();
+}
+
+void LaserMatcher::odometryUpdate(const ros::Time &stamp,
+                                  const Eigen::Isometry3f &odometry) {
+  _timeLaserOdometry = stamp;
+  _lidarOdomNew = odometry;
+  _newLaserOdometry = true;
+  publishMergedPose(stamp, odometry);
+}
 
+void LaserMatcher::publishMergedPose(const ros::Time &stamp,
+                                     const Eigen::Isometry3f &odometry) {
   mtx_transform.lock();
 
+  Eigen::Isometry3f lidarOdom = odometry;
   Eigen::Isometry3f lidarPoseMerged;
-  transformAssociate(_lidarOdomLast, _lidarOdomNew, _lidarMappedLast,
+  transformAssociate(_lidarOdomLast, lidarOdom, _lidarMappedLast,
                      lidarPoseMerged);
   mtx_transform.unlock();
 
   tf::StampedTransform lidarTFMerged;
   lidarTFMerged.frame_id_ = map_frame;
   lidarTFMerged.child_frame_id_ = "/lidar";
-  lidarTFMerged.stamp_ = laserOdometry->header.stamp;
+  lidarTFMerged.stamp_ = stamp;
   Isometry2TFtransform(lidarPoseMerged.cast<double>(), lidarTFMerged);
   _tfBroadcaster.sendTransform(lidarTFMerged);
 
   nav_msgs::Odometry lidarOdomMerged;
   Isometry2Odom(lidarPoseMerged.cast<double>(), lidarOdomMerged);
-  lidarOdomMerged.header.stamp = laserOdometry->header.stamp;
+  lidarOdomMerged.header.stamp = stamp;
   lidarOdomMerged.header.frame_id = map_frame;
   lidarOdomMerged.child_frame_id = "/lidar";
   Eigen::Matrix<float, Eigen::Dynamic, 1> VectorXt = imu_que.getMean();
@@ -268,27 +470,15 @@ void LaserMatcher::reset() {
 }
 
 bool LaserMatcher::hasNewData() {
-  if (!_useFullCloud) {
-    return _newLaserCloudCornerLast && _newLaserCloudSurfLast &&
-           _newLaserOdometry &&
-           fabs((_timeLaserCloudCornerLast - _timeLaserOdometry).toSec()) <
-               0.005 &&
-           fabs((_timeLaserCloudSurfLast - _timeLaserOdometry).toSec()) < 0.005;
-  } else {
-    return _newLaserCloudCornerLast && _newLaserCloudSurfLast &&
-           _newLaserCloudFullRes && _newLaserOdometry &&
-           fabs((_timeLaserCloudCornerLast - _timeLaserOdometry).toSec()) <
-               0.005 &&
-           fabs((_timeLaserCloudSurfLast - _timeLaserOdometry).toSec()) <
-               0.005 &&
-           fabs((_timeLaserCloudFullRes - _timeLaserOdometry).toSec()) < 0.005;
-  }
+  // the clouds and the odometry of a frame share the exact same stamp
+  return _newLaserCloudCornerLast && _newLaserCloudSurfLast &&
+         _newLaserOdometry && (!_useFullCloud || _newLaserCloudFullRes);
 }
 
 void LaserMatcher::prepareFeatureFrame() {
 
-  _laserCloudCornerStack.swap(_laserCloudCornerLast);
-  _laserCloudSurfStack.swap(_laserCloudSurfLast);
+  _laserCloudCornerStack = _laserCloudCornerLast;
+  _laserCloudSurfStack = _laserCloudSurfLast;
 
   // down sample feature stack clouds
   _laserCloudCornerStackDS->clear();
@@ -301,33 +491,108 @@ void LaserMatcher::prepareFeatureFrame() {
 }
 
 void LaserMatcher::prepareFeatureSurround() {
+  const Eigen::Vector3f position = _lidarMappedNew.translation();
+
+  bool prepared = false;
+  if (_nextSurroundReady.valid()) {
+    _nextSurroundReady.get();
+    // a prepared surround map is only used if the prediction was close
+    prepared = (position - _nextSurroundPosition).norm() <=
+               _asyncSurroundTolerance;
+    if (prepared) {
+      _surround.swap(_nextSurround);
+    }
+  }
+  if (!prepared) {
+    buildSurround(position, *_surround);
+  }
+
+  _laserCloudCornerFromMap = _surround->cornerCloud;
+  _laserCloudSurfFromMap = _surround->surfCloud;
+  _surroundPrepared = true;
+}
+
+void LaserMatcher::prepareNextSurround() {
+  if (!_asyncSurround) {
+    return;
+  }
+
+  // predict the next position with the motion of the last frame
+  const Eigen::Vector3f position = _lidarMappedNew.translation();
+  if (!_hasLastMappedPosition) {
+    _lastMappedPosition = position;
+    _hasLastMappedPosition = true;
+  }
+  _nextSurroundPosition = 2.0f * position - _lastMappedPosition;
+  _lastMappedPosition = position;
 
+  _nextSurroundReady =
+      std::async(std::launch::async, &LaserMatcher::buildSurround, this,
+                 _nextSurroundPosition, std::ref(*_nextSurround));
+}
+
+void LaserMatcher::buildSurround(const Eigen::Vector3f &position,
+                                 ScanMatchReference &surround) {
   pcl::PointXYZI currentPos;
-  currentPos.getVector3fMap() = _lidarMappedNew.translation();
+  currentPos.getVector3fMap() = position;
 
   Eigen::Vector3d directionZNowD;
 
-  if(_dynamicMode)
+  if(_dynamicMode) {
     _dynamic_feature_map.update(currentPos, directionZNowD);
-  else
+    _dynamic_feature_map.getSurroundFeature(*surround.cornerCloud,
+                                            *surround.surfCloud);
+    surround.cornerSegments.clear();
+    surround.surfSegments.clear();
+  } else {
     _feature_map->update(currentPos);
+    _feature_map->getSurroundFeature(
+        *surround.cornerCloud, *surround.surfCloud, surround.cornerSegments,
+        surround.surfSegments);
+  }
 
-  if(_dynamicMode)
-    _dynamic_feature_map.getSurroundFeature(*_laserCloudCornerFromMap,
-                                    *_laserCloudSurfFromMap);
-  else
-    _feature_map->getSurroundFeature(*_laserCloudCornerFromMap,
-                                  *_laserCloudSurfFromMap);
-
-  if(_laserCloudSurfFromMap->points.size()<10){
+  if(surround.surfCloud->points.size()<10){
     ROS_WARN_STREAM("surround map points too few, currentPos:"<<currentPos);
   }
+
+  if (_surroundTrees) {
+    surround.buildTrees();
+    _scan_match.buildLevels(surround);
+  }
 }
 
 void LaserMatcher::optimizeTransform() {
-  _scan_match.scanMatchScan(_laserCloudCornerFromMap, _laserCloudSurfFromMap,
-                            _laserCloudCornerStackDS, _laserCloudSurfStackDS,
-                            _lidarMappedNew);
+  if (_ndtMode) {
+    _feature_map->scanMatchNdt(_laserCloudCornerStackDS, _laserCloudSurfStackDS,
+                               _lidarMappedNew);
+    reportConvergence(_feature_map->convergence());
+    return;
+  }
+
+  if (_surroundPrepared) {
+    // the KD-trees and coarse levels are prebuilt and the primitives fitted
+    // to unchanged map cubes are reused
+    _scan_match.scanMatchScan(*_surround, _laserCloudCornerStackDS,
+                              _laserCloudSurfStackDS, _lidarMappedNew);
+  } else {
+    _scan_match.scanMatchScan(_laserCloudCornerFromMap, _laserCloudSurfFromMap,
+                              _laserCloudCornerStackDS, _laserCloudSurfStackDS,
+                              _lidarMappedNew);
+  }
+  _surroundPrepared = false;
+  reportConvergence(_scan_match.convergence());
+  ROS_DEBUG("Scan match primitives fitted: %zu lines, %zu planes, reused "
+            "reference points: %zu corners, %zu surfaces",
+            _scan_match.lineCache().fits(), _scan_match.planeCache().fits(),
+            _scan_match.lineCache().reused(),
+            _scan_match.planeCache().reused());
+}
+
+void LaserMatcher::reportConvergence(const ConvergenceManager &convergence) {
+  ROS_DEBUG("Scan match iterations: %zu (%zu saved), associations: %zu "
+            "(%zu searches saved)",
+            convergence.iterations(), convergence.savedIterations(),
+            convergence.associations(), convergence.savedSearches());
 }
 
 void LaserMatcher::transformMerge() {
@@ -375,21 +640,37 @@ void LaserMatcher::publishResult() {
   if (_sendSurroundCloud) {
     _surroundMapPubCount++;
     if (_surroundMapPubCount % (_surroundMapPubSkip + 1) == 1) {
-      publishCloudMsg(_pubLaserCloudSurroundCorner, *_laserCloudCornerFromMap,
-                      _timeLaserOdometryMerged, map_frame);
-      publishCloudMsg(_pubLaserCloudSurroundSurf, *_laserCloudSurfFromMap,
-                      _timeLaserOdometryMerged, map_frame);
+      // the surround clouds are still matched against, so they are copied
+      publishCloudPtr(_pubLaserCloudSurroundCorner, *_laserCloudCornerFromMap,
+                      _timeLaserOdometryMerged, map_frame, _surroundCornerMsg);
+      publishCloudPtr(_pubLaserCloudSurroundSurf, *_laserCloudSurfFromMap,
+                      _timeLaserOdometryMerged, map_frame, _surroundSurfMsg);
     }
   }
 
   if (_sendRegisteredCloud) {
+    publishFrameCloud(_pubCloudCornerLast2, _laserCloudCornerStack,
+                      _frameCornerLast, _cornerLastMsg);
+    publishFrameCloud(_pubCloudSurfLast2, _laserCloudSurfStack,
+                      _frameSurfLast, _surfLastMsg);
+    if (_useFullCloud) {
+      publishFrameCloud(_pubLaserCloudFullRes, _laserCloudFullRes,
+                        _frameFullRes, _fullResMsg);
+    }
+  }
+}
 
-    publishCloudMsg(_pubCloudCornerLast2, *_laserCloudCornerStack,
-                    _timeLaserOdometryMerged, "/aft_mapped");
-    publishCloudMsg(_pubCloudSurfLast2, *_laserCloudSurfStack,
-                    _timeLaserOdometryMerged, "/aft_mapped");
-    publishCloudMsg(_pubLaserCloudFullRes, *_laserCloudFullRes,
-                    _timeLaserOdometryMerged, "/aft_mapped");
+void LaserMatcher::publishFrameCloud(ros::Publisher &publisher,
+                                     const CloudI::ConstPtr &cloud,
+                                     CloudI::Ptr &owned, CloudI::Ptr &message) {
+  if (cloud == owned) {
+    // the frame buffer of processOdometry() is not used anymore, the next
+    // frame is swapped into a new one
+    publishCloudPtr(publisher, owned, _timeLaserOdometryMerged, "/aft_mapped");
+  } else {
+    // the received clouds are shared with the sender and must not be changed
+    publishCloudPtr(publisher, *cloud, _timeLaserOdometryMerged, "/aft_mapped",
+                    message);
   }
 }
 
@@ -14,7 +14,9 @@
 #include <tf/transform_datatypes.h>
 
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -24,10 +26,12 @@
 #include "common/CircularBuffer.h"
 #include "common/FeatureMap.h"
 #include "common/DynamicFeatureMap.h"
+#include "common/MessageSynchronizer.h"
 #include "common/Twist.h"
 #include "io/LocalFeatureMap.h"
 #include "scan_match/ScanMatch.h"
 #include "fusion/imu_queue.h"
+#include "odom/LaserOdometry.h"
 
 namespace lidar_slam {
 
@@ -44,15 +48,29 @@ public:
   virtual bool setup(ros::NodeHandle &node, ros::NodeHandle &privateNode);
   virtual void process() = 0;
 
+  /** \brief Read the parameters, set up the feature map and advertise the
+   * result topics, without subscribing to the laser odometry.
+   *
+   * @param node the ROS node handle
+   * @param privateNode the private ROS node handle
+   */
+  virtual bool configure(ros::NodeHandle &node, ros::NodeHandle &privateNode);
+
+  /** \brief Process an odometry frame directly, e.g. in an in process
+   * pipeline.
+   *
+   * The clouds of the frame are swapped out.
+   *
+   * @param frame the odometry frame
+   */
+  void processOdometry(OdometryFrame &frame);
+
 public:
-  void laserCloudCornerLastHandler(
-      const sensor_msgs::PointCloud2ConstPtr &cornerPointsLastMsg);
+  void laserCloudCornerLastHandler(const CloudI::ConstPtr &cornerPointsLastMsg);
 
-  void laserCloudSurfLastHandler(
-      const sensor_msgs::PointCloud2ConstPtr &surfacePointsLastMsg);
+  void laserCloudSurfLastHandler(const CloudI::ConstPtr &surfacePointsLastMsg);
 
-  void laserCloudFullResHandler(
-      const sensor_msgs::PointCloud2ConstPtr &laserCloudFullResMsg);
+  void laserCloudFullResHandler(const CloudI::ConstPtr &laserCloudFullResMsg);
 
   void laserOdometryHandler(const nav_msgs::Odometry::ConstPtr &laserOdometry);
 
@@ -61,14 +79,55 @@ public:
   bool saveMap(std_srvs::Empty::Request &req, std_srvs::Empty::Response &resp);
 
 protected:
+  /** Channels of the frame synchronizer, the full resolution channel is only
+   * used with _useFullCloud. */
+  enum FrameChannel { CORNER_LAST, SURF_LAST, ODOMETRY, FULL_RES };
+
+  /** \brief Wait for the next synchronized laser odometry frame and take
+   * over its clouds and pose.
+   *
+   * @param timeout the maximum waiting time in seconds
+   * @return true, if a frame was taken, false on timeout or shutdown
+   */
+  bool waitForFrame(const double &timeout);
+
+  /** \brief Take over a new odometry pose and publish the merged pose. */
+  void odometryUpdate(const ros::Time &stamp,
+                      const Eigen::Isometry3f &odometry);
+  /** \brief Publish the mapped pose merged with a new odometry pose. */
+  void publishMergedPose(const ros::Time &stamp,
+                         const Eigen::Isometry3f &odometry);
   void reset();
   bool hasNewData();
   void prepareFeatureFrame();
   void prepareFeatureSurround();
+  /** \brief Start preparing the surround map of the next frame around its
+   * predicted position in the background, if enabled.
+   *
+   * Must be called after the feature map update of the current frame, the
+   * next prepareFeatureSurround() waits for the result.
+   */
+  void prepareNextSurround();
+  /** \brief Update the feature map around a position and extract its surround
+   * clouds into a scan match reference.
+   *
+   * Only touches the feature map and the reference, so it may run on a
+   * background thread while the feature map is not used otherwise.
+   */
+  void buildSurround(const Eigen::Vector3f &position,
+                     ScanMatchReference &surround);
   void optimizeTransform();
+  /** \brief Log the iteration statistics of the last scan match. */
+  void reportConvergence(const ConvergenceManager &convergence);
   void transformUpdate();
   void featureMapUpdate();
   void publishResult();
+  /** \brief Publish a cloud of the current frame, handing it over if it is
+   * the owned frame buffer and copying it into the reused message cloud
+   * otherwise. */
+  void publishFrameCloud(ros::Publisher &publisher,
+                         const CloudI::ConstPtr &cloud, CloudI::Ptr &owned,
+                         CloudI::Ptr &message);
   void transformMerge();
 protected:
   IMUQueue imu_que;
@@ -85,20 +144,52 @@ protected:
   bool _sendSurroundCloud;
   bool _useFullCloud;
   bool _dynamicMode; // use dynamic map manager or not
+  bool _ndtMode;     ///< match against the voxel distributions of the map
+  bool _asyncSurround; ///< prepare the surround map of the next frame in the
+                       ///< background
+  float _asyncSurroundTolerance; ///< max distance of the predicted to the
+                                 ///< actual position of a prepared surround
+  bool _surroundTrees; ///< flag if the surround KD-trees are used to match
 
   std::string map_frame;
 
-  CloudI::Ptr _laserCloudCornerLast; ///< last corner points cloud
-  CloudI::Ptr _laserCloudSurfLast;   ///< last surface points cloud
-  CloudI::Ptr _laserCloudFullRes;    ///< last full resolution cloud
-
-  CloudI::Ptr _laserCloudCornerStack;
-  CloudI::Ptr _laserCloudSurfStack;
+  // the received clouds are shared with the sender and never modified
+  CloudI::ConstPtr _laserCloudCornerLast; ///< last corner points cloud
+  CloudI::ConstPtr _laserCloudSurfLast;   ///< last surface points cloud
+  CloudI::ConstPtr _laserCloudFullRes;    ///< last full resolution cloud
+
+  // buffers of the clouds of processOdometry(), swapped with the frame
+  CloudI::Ptr _frameCornerLast;
+  CloudI::Ptr _frameSurfLast;
+  CloudI::Ptr _frameFullRes;
+
+  // message clouds of the published shared clouds, reused once released
+  CloudI::Ptr _surroundCornerMsg;
+  CloudI::Ptr _surroundSurfMsg;
+  CloudI::Ptr _cornerLastMsg;
+  CloudI::Ptr _surfLastMsg;
+  CloudI::Ptr _fullResMsg;
+
+  CloudI::ConstPtr _laserCloudCornerStack;
+  CloudI::ConstPtr _laserCloudSurfStack;
   CloudI::Ptr _laserCloudCornerStackDS; ///< down sampled
   CloudI::Ptr _laserCloudSurfStackDS;   ///< down sampled
   CloudI::Ptr _laserCloudCornerFromMap;
   CloudI::Ptr _laserCloudSurfFromMap;
 
+  std::unique_ptr<ScanMatchReference>
+      _surround; ///< surround map of the current frame
+  std::unique_ptr<ScanMatchReference>
+      _nextSurround; ///< surround map being prepared for the next frame
+  std::future<void> _nextSurroundReady; ///< background preparation of
+                                        ///< _nextSurround
+  Eigen::Vector3f _nextSurroundPosition; ///< position _nextSurround is
+                                         ///< prepared around
+  Eigen::Vector3f _lastMappedPosition; ///< mapped position of the last frame
+  bool _hasLastMappedPosition; ///< flag if _lastMappedPosition is set
+  bool _surroundPrepared; ///< flag if _surround holds the surround clouds of
+                          ///< the current frame
+
   ros::Time _timeLaserCloudCornerLast; ///< time of current last corner cloud
   ros::Time _timeLaserCloudSurfLast;   ///< time of current last surface cloud
   ros::Time _timeLaserCloudFullRes; ///< time of current full resolution cloud
@@ -114,6 +205,8 @@ protected:
                               /// received
   bool _newLaserOdometry; ///< flag if a new laser odometry has been received
 
+  MessageSynchronizer _synchronizer; ///< laser odometry frame synchronizer
+
   std::mutex mtx_transform;
 
   Twist _laserScanTransform;
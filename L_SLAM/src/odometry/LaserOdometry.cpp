@@ -1,5 +1,6 @@
 
 #include "LaserOdometry.h"
+#include "common/GaussNewtonAccumulator.h"
 #include "common/feature_utils.h"
 #include "common/math_utils.h"
 #include "common/ros_utils.h"
@@ -10,6 +11,9 @@
 #include <pcl/common/eigen.h>
 #include <pcl/filters/filter.h>
 
+#include <algorithm>
+#include <omp.h>
+
 namespace lidar_slam {
 
 using std::sin;
@@ -26,15 +30,64 @@ LaserOdometry::LaserOdometry()
       _scale_trans_z(1.05), _cornerPointsSharp(new CloudI()),
       _cornerPointsLessSharp(new CloudI()), _surfPointsFlat(new CloudI()),
       _surfPointsLessFlat(new CloudI()), _laserCloud(new CloudIN()),
-      _lastCornerCloud(new CloudI()), _lastSurfaceCloud(new CloudI()),
-      _laserCloudOri(new CloudI()), _coeffSel(new CloudI()) {
+      _groundPoints(new CloudI()), _sweepCornerPointsSharp(new CloudI()),
+      _sweepCornerPointsLessSharp(new CloudI()),
+      _sweepSurfPointsFlat(new CloudI()),
+      _sweepSurfPointsLessFlat(new CloudI()), _sweepLaserCloud(new CloudIN()),
+      _sweepGroundPoints(new CloudI()), _lastCornerCloud(new CloudI()),
+      _lastSurfaceCloud(new CloudI()), _lastGroundCloud(new CloudI()),
+      _matchThreads(0), _maxIterationsWithPrior(10), _groundConstrained(false),
+      _groundDofs(GaussNewtonAccumulator::ALL_DOF),
+      _cornerDofs(GaussNewtonAccumulator::ALL_DOF), _newGroundPoints(false),
+      _groundChannel(FULL_RES), _reportedDroppedSets(0),
+      _reportedMismatched(0), _reportedMissingGround(false), _cornerMatches(0), _surfaceMatches(0),
+      _iterations(0) {
   cloudReceiveCount = 0;
   _Tsum = Eigen::Isometry3f::Identity();
+  _imuCorrectedPose = _Tsum;
 }
 
 bool LaserOdometry::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
+  if (!configure(node, privateNode)) {
+    return false;
+  }
+
+  // subscribe to scan registration topics
+  _synchronizer.setup(_groundChannel + (_groundConstrained ? 1 : 0));
+  _subCornerPointsSharp = node.subscribe<CloudI>(
+      "/laser_cloud_sharp", 2, &LaserOdometry::laserCloudSharpHandler, this);
+
+  _subCornerPointsLessSharp = node.subscribe<CloudI>(
+      "/laser_cloud_less_sharp", 2, &LaserOdometry::laserCloudLessSharpHandler,
+      this);
+
+  _subSurfPointsFlat = node.subscribe<CloudI>(
+      "/laser_cloud_flat", 2, &LaserOdometry::laserCloudFlatHandler, this);
+
+  _subSurfPointsLessFlat = node.subscribe<CloudI>(
+      "/laser_cloud_less_flat", 2, &LaserOdometry::laserCloudLessFlatHandler,
+      this);
+
+  if(_receiveFullCloud){
+    _subLaserCloudFullRes = node.subscribe<CloudIN>(
+        "/velodyne_cloud_2", 2, &LaserOdometry::laserCloudFullResHandler, this);
+
+  }
+
+  if (_groundConstrained) {
+    _subGroundPoints = node.subscribe<CloudI>(
+        "/laser_cloud_ground", 2, &LaserOdometry::laserCloudGroundHandler,
+        this);
+  }
+
+  spin_thread = std::thread(&LaserOdometry::spin, this);
+
+  return true;
+}
+
+bool LaserOdometry::configure(ros::NodeHandle &node,
+                              ros::NodeHandle &privateNode) {
 
-  //imu_que.setup(node, privateNode);
 
   // fetch laser odometry params
   float fParam;
@@ -79,8 +132,99 @@ bool LaserOdometry::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     }
   }
 
+  if (privateNode.getParam("matchThreads", iParam)) {
+    if (iParam < 0) {
+      ROS_ERROR("Invalid matchThreads parameter: %d (expected >= 0)", iParam);
+      return false;
+    } else {
+      _matchThreads = iParam;
+      ROS_INFO("Set matchThreads: %d", iParam);
+    }
+  }
+
+  std::string motionPriorMode;
+  privateNode.param<std::string>("motionPrior", motionPriorMode,
+                                 "constant_velocity");
+  MotionPrior::Mode mode;
+  if (!MotionPrior::parseMode(motionPriorMode, mode)) {
+    ROS_ERROR("Invalid motionPrior parameter: %s (expected none, "
+              "constant_velocity, imu or external_odom)",
+              motionPriorMode.c_str());
+    return false;
+  }
+  float priorRotationTolerance, priorTranslationTolerance;
+  privateNode.param<float>("priorRotationTolerance", priorRotationTolerance,
+                           0.5);
+  privateNode.param<float>("priorTranslationTolerance",
+                           priorTranslationTolerance, 0.05);
+  _motionPrior.setup(mode, priorRotationTolerance, priorTranslationTolerance);
+  privateNode.param<std::string>("motionPriorTopic", _motionPriorTopic,
+                                 "/odom");
+  ROS_INFO("Set motionPrior: %s", motionPriorMode.c_str());
+  if (mode == MotionPrior::IMU) {
+    imu_que.setup(node, privateNode);
+  }
+  // the external odometry is also needed if the odometry is run by a pipeline
+  if (mode == MotionPrior::EXTERNAL_ODOM) {
+    _subMotionPrior = node.subscribe<nav_msgs::Odometry>(
+        _motionPriorTopic, 50, &LaserOdometry::motionPriorHandler, this);
+  }
+
+  if (privateNode.getParam("maxIterationsWithPrior", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid maxIterationsWithPrior parameter: %d (expected > 0)",
+                iParam);
+      return false;
+    } else {
+      _maxIterationsWithPrior = iParam;
+      ROS_INFO("Set maxIterationsWithPrior: %d", iParam);
+    }
+  }
+
+  std::string robustKernel;
+  privateNode.param<std::string>("robustKernel", robustKernel, "none");
+  RobustKernel::Type kernelType;
+  if (!RobustKernel::parseType(robustKernel, kernelType)) {
+    ROS_ERROR("Invalid robustKernel parameter: %s (expected none, huber, "
+              "cauchy or tukey)",
+              robustKernel.c_str());
+    return false;
+  }
+  float kernelScale;
+  privateNode.param<float>("robustKernelScale", kernelScale, 0.2);
+  if (kernelScale <= 0) {
+    ROS_ERROR("Invalid robustKernelScale parameter: %f (expected > 0)",
+              kernelScale);
+    return false;
+  }
+  _robustKernel = RobustKernel(kernelType, kernelScale);
+  ROS_INFO("Set robustKernel: %s (scale %g)", robustKernel.c_str(),
+           kernelScale);
+
   privateNode.param("sendRegisteredCloud", _sendRegisteredCloud, true);
   privateNode.param("receiveFullCloud", _receiveFullCloud, true);
+  _groundChannel = _receiveFullCloud ? FULL_RES + 1 : FULL_RES;
+
+  // the ground points fix the vertical position, roll and pitch, the corner
+  // points the horizontal position and yaw
+  privateNode.param("groundConstrained", _groundConstrained, false);
+  std::string groundUpAxis;
+  privateNode.param<std::string>("groundUpAxis", groundUpAxis, "y");
+  if (groundUpAxis == "y") {
+    _groundDofs = GaussNewtonAccumulator::ROT_X |
+                  GaussNewtonAccumulator::ROT_Z | GaussNewtonAccumulator::POS_Y;
+  } else if (groundUpAxis == "z") {
+    _groundDofs = GaussNewtonAccumulator::ROT_X |
+                  GaussNewtonAccumulator::ROT_Y | GaussNewtonAccumulator::POS_Z;
+  } else {
+    ROS_ERROR("Invalid groundUpAxis parameter: %s (expected y or z)",
+              groundUpAxis.c_str());
+    return false;
+  }
+  _cornerDofs = GaussNewtonAccumulator::ALL_DOF & ~_groundDofs;
+  if (_groundConstrained) {
+    ROS_INFO("Set groundConstrained with up axis %s", groundUpAxis.c_str());
+  }
 
 
   // initialize odometry and odometry tf messages
@@ -99,36 +243,24 @@ bool LaserOdometry::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
       node.advertise<sensor_msgs::PointCloud2>("/velodyne_cloud_3", 2);
   _pubLaserOdometry =
       node.advertise<nav_msgs::Odometry>("/laser_odom_to_init", 5);
-
-  // subscribe to scan registration topics
-  _subCornerPointsSharp = node.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_sharp", 2, &LaserOdometry::laserCloudSharpHandler, this);
-
-  _subCornerPointsLessSharp = node.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_less_sharp", 2, &LaserOdometry::laserCloudLessSharpHandler,
-      this);
-
-  _subSurfPointsFlat = node.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_flat", 2, &LaserOdometry::laserCloudFlatHandler, this);
-
-  _subSurfPointsLessFlat = node.subscribe<sensor_msgs::PointCloud2>(
-      "/laser_cloud_less_flat", 2, &LaserOdometry::laserCloudLessFlatHandler,
-      this);
-
-  if(_receiveFullCloud){
-    _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>(
-        "/velodyne_cloud_2", 2, &LaserOdometry::laserCloudFullResHandler, this);
-
-  }
-
-  spin_thread = std::thread(&LaserOdometry::spin, this);
+  _pubOdometryStats = node.advertise<std_msgs::Float32MultiArray>(
+      "/laser_odometry_stats", 5);
 
   return true;
 }
 
 LaserOdometry::~LaserOdometry() {
+  _synchronizer.shutdown();
+  if (spin_thread.joinable()) {
+    spin_thread.join();
+  }
+
   ROS_INFO("[LaserOdometry] _inputFrameCount:%ld", _inputFrameCount);
   ROS_INFO("[LaserOdometry] cloudReceiveCount:%ld", cloudReceiveCount);
+  ROS_INFO("[LaserOdometry] synchronized sets:%zu dropped:%zu "
+           "mismatched messages:%zu",
+           _synchronizer.completeSets(), _synchronizer.droppedSets(),
+           _synchronizer.mismatchedMessages());
 }
 
 
@@ -153,29 +285,36 @@ void LaserOdometry::transformToStart(const PointIN &pi, PointIN &po) {
   po.curvature = pi.curvature;
 }
 
-size_t LaserOdometry::transformToEnd(CloudI::Ptr &cloud) {
-  size_t cloudSize = cloud->points.size();
+size_t LaserOdometry::transformToEnd(const CloudI &cloud,
+                                     CloudI &transformed) {
+  size_t cloudSize = cloud.points.size();
   Eigen::Isometry3f it, it_inv;
   convertTransform(_transform, it);
   it_inv = it.inverse();
+  transformed.points.resize(cloudSize);
   for (size_t i = 0; i < cloudSize; i++) {
-    PointI &point = cloud->points[i];
-    transformToStart(point, point);
+    PointI &point = transformed.points[i];
+    transformToStart(cloud.points[i], point);
     point.getVector3fMap() = it_inv * point.getVector3fMap();
   }
+  transformed.width = cloudSize;
+  transformed.height = 1;
+  transformed.is_dense = cloud.is_dense;
 
   return cloudSize;
 }
 
-size_t LaserOdometry::transformToEnd(CloudIN::Ptr &cloud) {
-  size_t cloudSize = cloud->points.size();
+size_t LaserOdometry::transformToEnd(const CloudIN &cloud,
+                                     CloudIN &transformed) {
+  size_t cloudSize = cloud.points.size();
   Eigen::Isometry3f it, it_inv;
   convertTransform(_transform, it);
   it_inv = it.inverse();
 
+  transformed.points.resize(cloudSize);
   for (size_t i = 0; i < cloudSize; i++) {
-    PointIN &point = cloud->points[i];
-    transformToStart(point, point);
+    PointIN &point = transformed.points[i];
+    transformToStart(cloud.points[i], point);
     point.getVector3fMap() = it_inv * point.getVector3fMap();
 
     // swap to lidar frame
@@ -185,67 +324,168 @@ size_t LaserOdometry::transformToEnd(CloudIN::Ptr &cloud) {
     point.z = point.y;
     point.y = temp_x;*/
   }
+  transformed.width = cloudSize;
+  transformed.height = 1;
+  transformed.is_dense = cloud.is_dense;
 
   return cloudSize;
 }
 
 void LaserOdometry::laserCloudSharpHandler(
-    const sensor_msgs::PointCloud2ConstPtr &cornerPointsSharpMsg) {
-  _timeCornerPointsSharp = cornerPointsSharpMsg->header.stamp;
-
-  _cornerPointsSharp->clear();
-  pcl::fromROSMsg(*cornerPointsSharpMsg, *_cornerPointsSharp);
-
-  _newCornerPointsSharp = true;
+    const CloudI::ConstPtr &cornerPointsSharpMsg) {
+  _synchronizer.add(CORNER_SHARP, cloudStamp(cornerPointsSharpMsg->header),
+                    cornerPointsSharpMsg);
 }
 
 void LaserOdometry::laserCloudLessSharpHandler(
-    const sensor_msgs::PointCloud2ConstPtr &cornerPointsLessSharpMsg) {
-  _timeCornerPointsLessSharp = cornerPointsLessSharpMsg->header.stamp;
-
-  _cornerPointsLessSharp->clear();
-  pcl::fromROSMsg(*cornerPointsLessSharpMsg, *_cornerPointsLessSharp);
-  _newCornerPointsLessSharp = true;
+    const CloudI::ConstPtr &cornerPointsLessSharpMsg) {
+  _synchronizer.add(CORNER_LESS_SHARP,
+                    cloudStamp(cornerPointsLessSharpMsg->header),
+                    cornerPointsLessSharpMsg);
 }
 
 void LaserOdometry::laserCloudFlatHandler(
-    const sensor_msgs::PointCloud2ConstPtr &surfPointsFlatMsg) {
-  _timeSurfPointsFlat = surfPointsFlatMsg->header.stamp;
+    const CloudI::ConstPtr &surfPointsFlatMsg) {
+  _synchronizer.add(SURFACE_FLAT, cloudStamp(surfPointsFlatMsg->header),
+                    surfPointsFlatMsg);
+}
 
-  _surfPointsFlat->clear();
-  pcl::fromROSMsg(*surfPointsFlatMsg, *_surfPointsFlat);
+void LaserOdometry::laserCloudLessFlatHandler(
+    const CloudI::ConstPtr &surfPointsLessFlatMsg) {
+  _synchronizer.add(SURFACE_LESS_FLAT,
+                    cloudStamp(surfPointsLessFlatMsg->header),
+                    surfPointsLessFlatMsg);
+}
 
-  _newSurfPointsFlat = true;
+void LaserOdometry::laserCloudFullResHandler(
+    const CloudIN::ConstPtr &laserCloudFullResMsg) {
+  _synchronizer.add(FULL_RES, cloudStamp(laserCloudFullResMsg->header),
+                    laserCloudFullResMsg);
 }
 
-void LaserOdometry::laserCloudLessFlatHandler(
-    const sensor_msgs::PointCloud2ConstPtr &surfPointsLessFlatMsg) {
-  _timeSurfPointsLessFlat = surfPointsLessFlatMsg->header.stamp;
+void LaserOdometry::laserCloudGroundHandler(
+    const CloudI::ConstPtr &groundPointsMsg) {
+  _synchronizer.add(_groundChannel, cloudStamp(groundPointsMsg->header),
+                    groundPointsMsg);
+}
 
-  _surfPointsLessFlat->clear();
-  pcl::fromROSMsg(*surfPointsLessFlatMsg, *_surfPointsLessFlat);
+void LaserOdometry::takeFeatureSet(const MessageSynchronizer::MessageSet &set,
+                                   const ros::Time &stamp) {
+  _cornerPointsSharp =
+      MessageSynchronizer::messagePtr<CloudI::ConstPtr>(set, CORNER_SHARP);
+  _cornerPointsLessSharp = MessageSynchronizer::messagePtr<CloudI::ConstPtr>(
+      set, CORNER_LESS_SHARP);
+  _surfPointsFlat =
+      MessageSynchronizer::messagePtr<CloudI::ConstPtr>(set, SURFACE_FLAT);
+  _surfPointsLessFlat = MessageSynchronizer::messagePtr<CloudI::ConstPtr>(
+      set, SURFACE_LESS_FLAT);
+  _timeCornerPointsSharp = stamp;
+  _timeCornerPointsLessSharp = stamp;
+  _timeSurfPointsFlat = stamp;
+  _timeSurfPointsLessFlat = stamp;
+  _newCornerPointsSharp = true;
+  _newCornerPointsLessSharp = true;
+  _newSurfPointsFlat = true;
   _newSurfPointsLessFlat = true;
+
+  if (_receiveFullCloud) {
+    _laserCloud =
+        MessageSynchronizer::messagePtr<CloudIN::ConstPtr>(set, FULL_RES);
+    _timeLaserCloudFullRes = stamp;
+    _newLaserCloudFullRes = true;
+    cloudReceiveCount++;
+  }
+
+  if (_groundConstrained) {
+    _groundPoints =
+        MessageSynchronizer::messagePtr<CloudI::ConstPtr>(set, _groundChannel);
+    _timeGroundPoints = stamp;
+    _newGroundPoints = true;
+  }
 }
 
-void LaserOdometry::laserCloudFullResHandler(
-    const sensor_msgs::PointCloud2ConstPtr &laserCloudFullResMsg) {
-  _timeLaserCloudFullRes = laserCloudFullResMsg->header.stamp;
+void LaserOdometry::reportSynchronization() {
+  size_t droppedSets = _synchronizer.droppedSets();
+  size_t mismatched = _synchronizer.mismatchedMessages();
+  if (droppedSets > _reportedDroppedSets || mismatched > _reportedMismatched) {
+    ROS_WARN("[LaserOdometry] dropped %zu feature sets and %zu mismatched "
+             "feature clouds (total %zu / %zu)",
+             droppedSets - _reportedDroppedSets,
+             mismatched - _reportedMismatched, droppedSets, mismatched);
+    _reportedDroppedSets = droppedSets;
+    _reportedMismatched = mismatched;
+  }
+}
 
-  _laserCloud->clear();
-  pcl::fromROSMsg(*laserCloudFullResMsg, *_laserCloud);
-  _newLaserCloudFullRes = true;
-  cloudReceiveCount++;
+void LaserOdometry::reportMissingGround() {
+  // without ground points no feature set is ever complete
+  if (!_groundConstrained || _reportedMissingGround ||
+      _synchronizer.receivedMessages(_groundChannel) > 0) {
+    return;
+  }
+  size_t received = _synchronizer.receivedMessages(SURFACE_LESS_FLAT);
+  if (received >= MISSING_GROUND_SWEEPS) {
+    ROS_ERROR("[LaserOdometry] received %zu sweeps but no ground points on "
+              "/laser_cloud_ground, the odometry is stalled (enable "
+              "groundSegmentation of the scan registration or disable "
+              "groundConstrained)",
+              received);
+    _reportedMissingGround = true;
+  }
 }
 
-void LaserOdometry::spin() {
-  ros::Rate rate(500);
-  bool status = ros::ok();
+void LaserOdometry::processSweep(SweepFeatures &sweep) {
+  // the buffers are only referenced by the input clouds until the next sweep
+  _sweepCornerPointsSharp->swap(sweep.cornerPointsSharp);
+  _sweepCornerPointsLessSharp->swap(sweep.cornerPointsLessSharp);
+  _sweepSurfPointsFlat->swap(sweep.surfacePointsFlat);
+  _sweepSurfPointsLessFlat->swap(sweep.surfacePointsLessFlat);
+  _cornerPointsSharp = _sweepCornerPointsSharp;
+  _cornerPointsLessSharp = _sweepCornerPointsLessSharp;
+  _surfPointsFlat = _sweepSurfPointsFlat;
+  _surfPointsLessFlat = _sweepSurfPointsLessFlat;
+  _timeCornerPointsSharp = sweep.stamp;
+  _timeCornerPointsLessSharp = sweep.stamp;
+  _timeSurfPointsFlat = sweep.stamp;
+  _timeSurfPointsLessFlat = sweep.stamp;
+  _newCornerPointsSharp = true;
+  _newCornerPointsLessSharp = true;
+  _newSurfPointsFlat = true;
+  _newSurfPointsLessFlat = true;
+
+  if (_receiveFullCloud) {
+    _sweepLaserCloud->swap(sweep.laserCloud);
+    _laserCloud = _sweepLaserCloud;
+    _timeLaserCloudFullRes = sweep.stamp;
+    _newLaserCloudFullRes = true;
+    cloudReceiveCount++;
+  }
+
+  if (_groundConstrained) {
+    _sweepGroundPoints->swap(sweep.groundPoints);
+    _groundPoints = _sweepGroundPoints;
+    _timeGroundPoints = sweep.stamp;
+    _newGroundPoints = true;
+  }
 
-  while (status) {
-    ros::spinOnce();
+  process();
+}
+
+void LaserOdometry::spin() {
+  // the subscriber callbacks run in the node spinner and wake this thread as
+  // soon as a complete feature set is available, the timeout only serves to
+  // notice the node shutdown
+  MessageSynchronizer::MessageSet set;
+  ros::Time stamp;
+  while (ros::ok() && !_synchronizer.isShutdown()) {
+    if (!_synchronizer.wait(set, stamp, 0.1)) {
+      reportMissingGround();
+      continue;
+    }
+    takeFeatureSet(set, stamp);
+    set.clear();
     process();
-    status = ros::ok();
-    rate.sleep();
+    reportSynchronization();
   }
 }
 
@@ -255,9 +495,15 @@ void LaserOdometry::reset() {
   _newSurfPointsFlat = false;
   _newSurfPointsLessFlat = false;
   _newLaserCloudFullRes = false;
+  _newGroundPoints = false;
 }
 
 bool LaserOdometry::hasNewData() {
+  if (_groundConstrained &&
+      (!_newGroundPoints ||
+       fabs((_timeGroundPoints - _timeSurfPointsLessFlat).toSec()) >= 0.005)) {
+    return false;
+  }
 
   if(_receiveFullCloud){
     return _newCornerPointsSharp && _newCornerPointsLessSharp &&
@@ -293,26 +539,65 @@ void LaserOdometry::process() {
   reset();
 
   if (!_systemInited) {
-    _cornerPointsLessSharp.swap(_lastCornerCloud);
-    _surfPointsLessFlat.swap(_lastSurfaceCloud);
+    _lastCornerCloud.reset(new CloudI(*_cornerPointsLessSharp));
+    _lastSurfaceCloud.reset(new CloudI(*_surfPointsLessFlat));
 
     _lastCornerKDTree.setInputCloud(_lastCornerCloud);
     _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
+    if (_groundConstrained) {
+      _lastGroundCloud.reset(new CloudI(*_groundPoints));
+      _lastGroundKDTree.setInputCloud(_lastGroundCloud);
+    }
+    if (_motionPrior.mode() == MotionPrior::IMU) {
+      // drop the IMU data before the first sweep and seed the filter with the
+      // odometry pose
+      Eigen::Isometry3f predictedPose;
+      imu_que.predict(_timeSurfPointsLessFlat, predictedPose);
+      Eigen::Quaternionf quat(_Tsum.rotation());
+      imu_que.reset(_Tsum.translation(), quat);
+      _imuCorrectedPose = _Tsum;
+    }
+    _lastSweepTime = _timeSurfPointsLessFlat;
     _systemInited = true;
     return;
   }
-  Eigen::Isometry3f pre_pos, cor_pos;
-  Eigen::Vector3f velocity;
-  //imu_que.predict(_timeSurfPointsLessFlat, pre_pos);
+
+  predictMotion();
+  ros::WallTime matchStart = ros::WallTime::now();
   scanMatch();
+  float matchTime = (ros::WallTime::now() - matchStart).toSec() * 1000;
   transformUpdate();
-  //imu_que.correct(_Tsum, cor_pos, velocity);
 
-  transformToEnd(_cornerPointsLessSharp);
-  transformToEnd(_surfPointsLessFlat);
+  Eigen::Isometry3f motion;
+  convertTransform(_transform, motion);
+  _motionPrior.update(motion);
+  if (_motionPrior.mode() == MotionPrior::IMU) {
+    // velocity of the matched sweep motion in the odometry frame
+    Eigen::Vector3f velocity = Eigen::Vector3f::Zero();
+    double dt = (_timeSurfPointsLessFlat - _lastSweepTime).toSec();
+    if (dt > 0) {
+      velocity = (_Tsum * motion.inverse()).linear() * motion.translation() /
+                 float(dt);
+      if (velocity.norm() > 30) {
+        velocity = Eigen::Vector3f::Zero();
+      }
+    }
+    imu_que.correct(_Tsum, _imuCorrectedPose, velocity);
+  }
+  _lastSweepTime = _timeSurfPointsLessFlat;
 
-  _cornerPointsLessSharp.swap(_lastCornerCloud);
-  _surfPointsLessFlat.swap(_lastSurfaceCloud);
+  // the last clouds may still be shared with subscribers, so the transformed
+  // clouds are written to the spare clouds instead of overwriting them
+  ros::Time sweepTime = _timeSurfPointsLessFlat;
+  reuseReleasedCloud(_spareCornerCloud);
+  reuseReleasedCloud(_spareSurfaceCloud);
+  transformToEnd(*_cornerPointsLessSharp, *_spareCornerCloud);
+  transformToEnd(*_surfPointsLessFlat, *_spareSurfaceCloud);
+  _spareCornerCloud->header.stamp = pcl_conversions::toPCL(sweepTime);
+  _spareCornerCloud->header.frame_id = "/laser_odom";
+  _spareSurfaceCloud->header = _spareCornerCloud->header;
+  _lastCornerCloud.swap(_spareCornerCloud);
+  _lastSurfaceCloud.swap(_spareSurfaceCloud);
 
   size_t lastCornerCloudSize = _lastCornerCloud->points.size();
   size_t lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
@@ -322,289 +607,341 @@ void LaserOdometry::process() {
     _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
   }
 
+  if (_groundConstrained) {
+    reuseReleasedCloud(_spareGroundCloud);
+    transformToEnd(*_groundPoints, *_spareGroundCloud);
+    _lastGroundCloud.swap(_spareGroundCloud);
+    if (_lastGroundCloud->points.size() > 100) {
+      _lastGroundKDTree.setInputCloud(_lastGroundCloud);
+    }
+  }
+
   publishResult();
+
+  // publish the matcher statistics, e.g. for the adaptive feature budget of
+  // the scan registration: [time (ms), corner matches, surface matches,
+  // iterations, dropped feature sets, mismatched feature clouds]; the first
+  // four describe this sweep, the last two are totals since the start
+  _statsMsg.data.resize(6);
+  _statsMsg.data[0] = matchTime;
+  _statsMsg.data[1] = _cornerMatches;
+  _statsMsg.data[2] = _surfaceMatches;
+  _statsMsg.data[3] = _iterations;
+  _statsMsg.data[4] = _synchronizer.droppedSets();
+  _statsMsg.data[5] = _synchronizer.mismatchedMessages();
+  _pubOdometryStats.publish(_statsMsg);
 }
 
-void LaserOdometry::scanMatch() {
-  PointI coeff;
-  bool isDegenerate = false;
-  Eigen::Matrix<float, 6, 6> matP;
+void LaserOdometry::predictMotion() {
+  // the transform still holds the motion of the previous sweep
+  Eigen::Isometry3f lastMotion, motion;
+  convertTransform(_transform, lastMotion);
+
+  switch (_motionPrior.mode()) {
+  case MotionPrior::IMU: {
+    Eigen::Isometry3f predictedPose;
+    if (imu_que.predict(_timeSurfPointsLessFlat, predictedPose)) {
+      // the IMU motion since the last correction, without the remaining
+      // offset between the filter and the odometry pose
+      _motionPrior.setPrediction(_imuCorrectedPose.inverse() * predictedPose);
+    } else {
+      _motionPrior.predict(lastMotion);
+    }
+    break;
+  }
+  case MotionPrior::EXTERNAL_ODOM:
+    _motionPrior.predict(_lastSweepTime, _timeSurfPointsLessFlat, lastMotion,
+                         motion);
+    break;
+  default:
+    _motionPrior.predict(lastMotion);
+  }
 
-  _inputFrameCount++;
-  size_t lastCornerCloudSize = _lastCornerCloud->points.size();
-  size_t lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
+  // constant velocity keeps the transform as is
+  if (_motionPrior.measured() || _motionPrior.mode() == MotionPrior::NONE) {
+    motion = _motionPrior.prediction();
+    convertTransform(motion, _transform);
+  }
+}
 
-  if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100) {
-    std::vector<int> pointSearchInd(1);
-    std::vector<float> pointSearchSqDis(1);
+void LaserOdometry::motionPriorHandler(
+    const nav_msgs::Odometry::ConstPtr &odomMsg) {
+  Eigen::Isometry3d pose;
+  Odom2Isometry(odomMsg, pose);
+  _motionPrior.addPose(odomMsg->header.stamp, pose.cast<float>());
+}
 
-    size_t cornerPointsSharpNum = _cornerPointsSharp->points.size();
-    size_t surfPointsFlatNum = _surfPointsFlat->points.size();
+bool LaserOdometry::matchCorner(const size_t &i, const size_t &iterCount,
+                                std::vector<int> &pointSearchInd,
+                                std::vector<float> &pointSearchSqDis,
+                                PointI &coeff) {
+  PointI pointSel;
+  transformToStart(_cornerPointsSharp->points[i], pointSel);
+
+  // refresh the correspondence every 5 iterations
+  if (iterCount % 5 == 0) {
+    _lastCornerKDTree.nearestKSearch(pointSel, 1, pointSearchInd,
+                                     pointSearchSqDis);
+
+    int closestPointInd = -1, minPointInd2 = -1;
+    if (pointSearchSqDis[0] < 25) {
+      closestPointInd = pointSearchInd[0];
+      int closestPointScan =
+          int(_lastCornerCloud->points[closestPointInd].intensity);
+
+      float pointSqDis, minPointSqDis2 = 25;
+      int lastCornerCloudSize = _lastCornerCloud->points.size();
+      for (int j = closestPointInd + 1; j < lastCornerCloudSize; j++) {
+        if (int(_lastCornerCloud->points[j].intensity) >
+            closestPointScan + 2.5) {
+          break;
+        }
 
-    _pointSearchCornerInd1.resize(cornerPointsSharpNum);
-    _pointSearchCornerInd2.resize(cornerPointsSharpNum);
-    _pointSearchSurfInd1.resize(surfPointsFlatNum);
-    _pointSearchSurfInd2.resize(surfPointsFlatNum);
-    _pointSearchSurfInd3.resize(surfPointsFlatNum);
+        pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
 
-    for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++) {
-      PointI pointSel, pointProj, tripod1, tripod2, tripod3;
-      _laserCloudOri->clear();
-      _coeffSel->clear();
-
-      for (int i = 0; i < cornerPointsSharpNum; i++) {
-        transformToStart(_cornerPointsSharp->points[i], pointSel);
-
-        if (iterCount % 5 == 0) {
-
-          _lastCornerKDTree.nearestKSearch(pointSel, 1, pointSearchInd,
-                                           pointSearchSqDis);
-
-          int closestPointInd = -1, minPointInd2 = -1;
-          if (pointSearchSqDis[0] < 25) {
-            closestPointInd = pointSearchInd[0];
-            int closestPointScan =
-                int(_lastCornerCloud->points[closestPointInd].intensity);
-
-            float pointSqDis, minPointSqDis2 = 25;
-            for (int j = closestPointInd + 1; j < cornerPointsSharpNum; j++) {
-              if (int(_lastCornerCloud->points[j].intensity) >
-                  closestPointScan + 2.5) {
-                break;
-              }
-
-              pointSqDis =
-                  calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
-
-              if (int(_lastCornerCloud->points[j].intensity) >
-                  closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              }
-            }
-            for (int j = closestPointInd - 1; j >= 0; j--) {
-              if (int(_lastCornerCloud->points[j].intensity) <
-                  closestPointScan - 2.5) {
-                break;
-              }
-
-              pointSqDis =
-                  calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
-
-              if (int(_lastCornerCloud->points[j].intensity) <
-                  closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              }
-            }
+        if (int(_lastCornerCloud->points[j].intensity) > closestPointScan) {
+          if (pointSqDis < minPointSqDis2) {
+            minPointSqDis2 = pointSqDis;
+            minPointInd2 = j;
           }
-
-          _pointSearchCornerInd1[i] = closestPointInd;
-          _pointSearchCornerInd2[i] = minPointInd2;
         }
-        if (_pointSearchCornerInd2[i] >= 0) {
-          const PointI &A = _lastCornerCloud->points[_pointSearchCornerInd1[i]];
-          const PointI &B = _lastCornerCloud->points[_pointSearchCornerInd2[i]];
-          PointI coefficients;
-          if (getCornerFeatureCoefficients(A, B, pointSel, iterCount,
-                                           coefficients)) {
-            _laserCloudOri->push_back(_cornerPointsSharp->points[i]);
-            _coeffSel->push_back(coefficients);
+      }
+      for (int j = closestPointInd - 1; j >= 0; j--) {
+        if (int(_lastCornerCloud->points[j].intensity) <
+            closestPointScan - 2.5) {
+          break;
+        }
+
+        pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
+
+        if (int(_lastCornerCloud->points[j].intensity) < closestPointScan) {
+          if (pointSqDis < minPointSqDis2) {
+            minPointSqDis2 = pointSqDis;
+            minPointInd2 = j;
           }
         }
       }
+    }
 
-      for (int i = 0; i < surfPointsFlatNum; i++) {
-        transformToStart(_surfPointsFlat->points[i], pointSel);
-
-        if (iterCount % 5 == 0) {
-          _lastSurfaceKDTree.nearestKSearch(pointSel, 1, pointSearchInd,
-                                            pointSearchSqDis);
-          int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
-          if (pointSearchSqDis[0] < 25) {
-            closestPointInd = pointSearchInd[0];
-            int closestPointScan =
-                int(_lastSurfaceCloud->points[closestPointInd].intensity);
-
-            float pointSqDis, minPointSqDis2 = 25, minPointSqDis3 = 25;
-            for (int j = closestPointInd + 1; j < surfPointsFlatNum; j++) {
-              if (int(_lastSurfaceCloud->points[j].intensity) >
-                  closestPointScan + 2.5) {
-                break;
-              }
-
-              pointSqDis =
-                  calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
-
-              if (int(_lastSurfaceCloud->points[j].intensity) <=
-                  closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              } else {
-                if (pointSqDis < minPointSqDis3) {
-                  minPointSqDis3 = pointSqDis;
-                  minPointInd3 = j;
-                }
-              }
-            }
-            for (int j = closestPointInd - 1; j >= 0; j--) {
-              if (int(_lastSurfaceCloud->points[j].intensity) <
-                  closestPointScan - 2.5) {
-                break;
-              }
-
-              pointSqDis =
-                  calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
-
-              if (int(_lastSurfaceCloud->points[j].intensity) >=
-                  closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              } else {
-                if (pointSqDis < minPointSqDis3) {
-                  minPointSqDis3 = pointSqDis;
-                  minPointInd3 = j;
-                }
-              }
-            }
-          }
+    _pointSearchCornerInd1[i] = closestPointInd;
+    _pointSearchCornerInd2[i] = minPointInd2;
+  }
 
-          _pointSearchSurfInd1[i] = closestPointInd;
-          _pointSearchSurfInd2[i] = minPointInd2;
-          _pointSearchSurfInd3[i] = minPointInd3;
+  if (_pointSearchCornerInd2[i] < 0) {
+    return false;
+  }
+  const PointI &A = _lastCornerCloud->points[_pointSearchCornerInd1[i]];
+  const PointI &B = _lastCornerCloud->points[_pointSearchCornerInd2[i]];
+  // a robust kernel replaces the distance based weighting
+  return getCornerFeatureCoefficients(A, B, pointSel, iterCount, coeff,
+                                      !_robustKernel.enabled());
+}
+
+bool LaserOdometry::matchSurface(const size_t &i, const size_t &iterCount,
+                                 std::vector<int> &pointSearchInd,
+                                 std::vector<float> &pointSearchSqDis,
+                                 PointI &coeff) {
+  PointI pointSel;
+  transformToStart(_surfPointsFlat->points[i], pointSel);
+
+  // refresh the correspondence every 5 iterations
+  if (iterCount % 5 == 0) {
+    _lastSurfaceKDTree.nearestKSearch(pointSel, 1, pointSearchInd,
+                                      pointSearchSqDis);
+    int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
+    if (pointSearchSqDis[0] < 25) {
+      closestPointInd = pointSearchInd[0];
+      int closestPointScan =
+          int(_lastSurfaceCloud->points[closestPointInd].intensity);
+
+      float pointSqDis, minPointSqDis2 = 25, minPointSqDis3 = 25;
+      int lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
+      for (int j = closestPointInd + 1; j < lastSurfaceCloudSize; j++) {
+        if (int(_lastSurfaceCloud->points[j].intensity) >
+            closestPointScan + 2.5) {
+          break;
         }
 
-        if (_pointSearchSurfInd2[i] >= 0 && _pointSearchSurfInd3[i] >= 0) {
-          const PointI &A = _lastSurfaceCloud->points[_pointSearchSurfInd1[i]];
-          const PointI &B = _lastSurfaceCloud->points[_pointSearchSurfInd2[i]];
-          const PointI &C = _lastSurfaceCloud->points[_pointSearchSurfInd3[i]];
+        pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
 
-          PointI coefficients;
-          if (getSurfaceFeatureCoefficients(A, B, C, pointSel, iterCount,
-                                            coefficients)) {
-            _laserCloudOri->push_back(_surfPointsFlat->points[i]);
-            _coeffSel->push_back(coefficients);
+        if (int(_lastSurfaceCloud->points[j].intensity) <= closestPointScan) {
+          if (pointSqDis < minPointSqDis2) {
+            minPointSqDis2 = pointSqDis;
+            minPointInd2 = j;
+          }
+        } else {
+          if (pointSqDis < minPointSqDis3) {
+            minPointSqDis3 = pointSqDis;
+            minPointInd3 = j;
           }
         }
       }
+      for (int j = closestPointInd - 1; j >= 0; j--) {
+        if (int(_lastSurfaceCloud->points[j].intensity) <
+            closestPointScan - 2.5) {
+          break;
+        }
 
-      int pointSelNum = _laserCloudOri->points.size();
-      //cout << "iterCount,pointSelNum:" << iterCount << "," << pointSelNum << std::endl;
-      if (pointSelNum < 10) {
-        continue;
+        pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
+
+        if (int(_lastSurfaceCloud->points[j].intensity) >= closestPointScan) {
+          if (pointSqDis < minPointSqDis2) {
+            minPointSqDis2 = pointSqDis;
+            minPointInd2 = j;
+          }
+        } else {
+          if (pointSqDis < minPointSqDis3) {
+            minPointSqDis3 = pointSqDis;
+            minPointInd3 = j;
+          }
+        }
+      }
+    }
+
+    _pointSearchSurfInd1[i] = closestPointInd;
+    _pointSearchSurfInd2[i] = minPointInd2;
+    _pointSearchSurfInd3[i] = minPointInd3;
+  }
+
+  if (_pointSearchSurfInd2[i] < 0 || _pointSearchSurfInd3[i] < 0) {
+    return false;
+  }
+  const PointI &A = _lastSurfaceCloud->points[_pointSearchSurfInd1[i]];
+  const PointI &B = _lastSurfaceCloud->points[_pointSearchSurfInd2[i]];
+  const PointI &C = _lastSurfaceCloud->points[_pointSearchSurfInd3[i]];
+  return getSurfaceFeatureCoefficients(A, B, C, pointSel, iterCount, coeff,
+                                       !_robustKernel.enabled());
+}
+
+bool LaserOdometry::matchGround(const size_t &i, const size_t &iterCount,
+                                std::vector<int> &pointSearchInd,
+                                std::vector<float> &pointSearchSqDis,
+                                PointI &coeff) {
+  PointI pointSel;
+  transformToStart(_groundPoints->points[i], pointSel);
+
+  // refresh the correspondence every 5 iterations
+  if (iterCount % 5 == 0) {
+    _groundPlaneFound[i] =
+        _lastGroundKDTree.nearestKSearch(pointSel, 5, pointSearchInd,
+                                         pointSearchSqDis) == 5 &&
+        pointSearchSqDis[4] < 25 &&
+        findPlane(*_lastGroundCloud, pointSearchInd, 0.2, _groundPlanes[i]);
+  }
+
+  if (!_groundPlaneFound[i]) {
+    return false;
+  }
+  return getSurfaceFeatureCoefficients(_groundPlanes[i], pointSel, coeff,
+                                       !_robustKernel.enabled());
+}
+
+bool LaserOdometry::updateTransform(const Eigen::Matrix<float, 6, 1> &matX) {
+  _transform.rot_x += matX(0, 0);
+  _transform.rot_y += matX(1, 0);
+  _transform.rot_z += matX(2, 0);
+  _transform.pos.x() += matX(3, 0);
+  _transform.pos.y() += matX(4, 0);
+  _transform.pos.z() += matX(5, 0);
+
+  if (!pcl_isfinite(_transform.rot_x.rad()))
+    _transform.rot_x = Angle();
+  if (!pcl_isfinite(_transform.rot_y.rad()))
+    _transform.rot_y = Angle();
+  if (!pcl_isfinite(_transform.rot_z.rad()))
+    _transform.rot_z = Angle();
+
+  if (!pcl_isfinite(_transform.pos.x()))
+    _transform.pos.x() = 0.0;
+  if (!pcl_isfinite(_transform.pos.y()))
+    _transform.pos.y() = 0.0;
+  if (!pcl_isfinite(_transform.pos.z()))
+    _transform.pos.z() = 0.0;
+
+  float deltaR =
+      sqrt(pow(rad2deg(matX(0, 0)), 2) + pow(rad2deg(matX(1, 0)), 2) +
+           pow(rad2deg(matX(2, 0)), 2));
+  float deltaT = sqrt(pow(matX(3, 0) * 100, 2) + pow(matX(4, 0) * 100, 2) +
+                      pow(matX(5, 0) * 100, 2));
+
+  return deltaR < _deltaRAbort && deltaT < _deltaTAbort;
+}
+
+void LaserOdometry::optimize(const size_t &cornerNum, const size_t &surfaceNum,
+                             const bool &ground, const unsigned &dofs,
+                             const size_t &maxIterations) {
+  bool isDegenerate = false;
+  Eigen::Matrix<float, 6, 6> matP;
+
+  int nPoints = int(cornerNum + surfaceNum);
+  int nThreads = _matchThreads > 0 ? _matchThreads : omp_get_max_threads();
+  _pointCoeffs.resize(nPoints);
+  _pointMatched.resize(nPoints);
+  const CloudI &surfaceCloud = ground ? *_groundPoints : *_surfPointsFlat;
+
+  GaussNewtonAccumulator normalEquations(_robustKernel);
+  for (size_t iterCount = 0; iterCount < maxIterations; iterCount++) {
+    _iterations++;
+
+    // search the correspondences and compute the coefficients of all
+    // feature points in parallel, every point only writes its own slots
+#pragma omp parallel num_threads(nThreads)
+    {
+      std::vector<int> pointSearchInd(1);
+      std::vector<float> pointSearchSqDis(1);
+
+#pragma omp for schedule(dynamic, 64)
+      for (int k = 0; k < nPoints; k++) {
+        if (k < int(cornerNum)) {
+          _pointMatched[k] = matchCorner(k, iterCount, pointSearchInd,
+                                         pointSearchSqDis, _pointCoeffs[k]);
+        } else if (ground) {
+          _pointMatched[k] =
+              matchGround(k - cornerNum, iterCount, pointSearchInd,
+                          pointSearchSqDis, _pointCoeffs[k]);
+        } else {
+          _pointMatched[k] =
+              matchSurface(k - cornerNum, iterCount, pointSearchInd,
+                           pointSearchSqDis, _pointCoeffs[k]);
+        }
       }
+    }
 
-      Eigen::Matrix<float, Eigen::Dynamic, 6> matA(pointSelNum, 6);
-      Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, pointSelNum);
-      Eigen::Matrix<float, 6, 6> matAtA;
-      Eigen::VectorXf matB(pointSelNum);
-      Eigen::Matrix<float, 6, 1> matAtB;
-      Eigen::Matrix<float, 6, 1> matX;
-
-      float s = 1;
-      /**/
-      float srx = sin(s * _transform.rot_x.rad());
-      float crx = cos(s * _transform.rot_x.rad());
-      float sry = sin(s * _transform.rot_y.rad());
-      float cry = cos(s * _transform.rot_y.rad());
-      float srz = sin(s * _transform.rot_z.rad());
-      float crz = cos(s * _transform.rot_z.rad());
-      float tx = s * _transform.pos.x();
-      float ty = s * _transform.pos.y();
-      float tz = s * _transform.pos.z();
-
-      for (int i = 0; i < pointSelNum; i++) {
-        const PointI &pointOri = _laserCloudOri->points[i];
-        coeff = _coeffSel->points[i];
-        /*
-        float arx = (crx * sry * srz * pointOri.x +
-                     crx * crz * sry * pointOri.y - srx * sry * pointOri.z) *
-                        coeff.x +
-                    (-srx * srz * pointOri.x - crz * srx * pointOri.y -
-                     crx * pointOri.z) *
-                        coeff.y +
-                    (crx * cry * srz * pointOri.x +
-                     crx * cry * crz * pointOri.y - cry * srx * pointOri.z) *
-                        coeff.z;
-
-        float ary = ((cry * srx * srz - crz * sry) * pointOri.x +
-                     (sry * srz + cry * crz * srx) * pointOri.y +
-                     crx * cry * pointOri.z) *
-                        coeff.x +
-                    ((-cry * crz - srx * sry * srz) * pointOri.x +
-                     (cry * srz - crz * srx * sry) * pointOri.y -
-                     crx * sry * pointOri.z) *
-                        coeff.z;
-
-        float arz =
-            ((crz * srx * sry - cry * srz) * pointOri.x +
-             (-cry * crz - srx * sry * srz) * pointOri.y) *
-                coeff.x +
-            (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y +
-            ((sry * srz + cry * crz * srx) * pointOri.x +
-             (crz * sry - cry * srx * srz) * pointOri.y) *
-                coeff.z;
-
-        */
-        float arx = ((crz*sry*crx + srz*srx)* pointOri.y +(srz*crx-crz*sry*srx)* pointOri.z)*coeff.x +
-        ((srz*sry*crx-crz*srx)*pointOri.y -(srz*sry*srx+crz*crx)*pointOri.z)*coeff.y +
-        (cry*crx*pointOri.y-cry*srx*pointOri.z)*coeff.z;
-
-        float ary = (-crz*sry*pointOri.x+crz*cry*srx*pointOri.y+crz*cry*crx*pointOri.z)*coeff.x +
-        (-srz*sry*pointOri.x+srz*cry*srx*pointOri.y +srz*cry*crx*pointOri.z)*coeff.y +
-        (-cry*pointOri.x-sry*srx*pointOri.y-sry*crx*pointOri.z)*coeff.z;
-
-        float arz = (-srz*cry*pointOri.x -(srz*sry*srx+crz*crx)*pointOri.y+(crz*srx-srz*sry*crx)*pointOri.z)*coeff.x+
-        (crz*cry*pointOri.x+ (crz*sry*srx-srz*crx)*pointOri.y+crz*sry*crx+srz*srx*pointOri.z)*coeff.y+
-        0*coeff.z;
-
-        matA(i, 0) = arx;
-        matA(i, 1) = ary;
-        matA(i, 2) = arz;
-        matA(i, 3) = coeff.x;
-        matA(i, 4) = coeff.y;
-        matA(i, 5) = coeff.z;
-        matB(i, 0) = -0.05 * coeff.intensity;
+    // accumulate the normal equations in point order, so the result does
+    // not depend on the thread scheduling
+    normalEquations.reset(_transform);
+    for (size_t k = 0; k < size_t(nPoints); k++) {
+      if (!_pointMatched[k]) {
+        continue;
       }
-      matAt = matA.transpose();
-      matAtA = matAt * matA;
-      matAtB = matAt * matB;
+      const PointI &pointOri = k < cornerNum
+                                   ? _cornerPointsSharp->points[k]
+                                   : surfaceCloud.points[k - cornerNum];
+      // residuals rejected by the robust kernel do not count as matches
+      _pointMatched[k] =
+          normalEquations.addPoint(pointOri, _pointCoeffs[k], 0.05f);
+    }
+    size_t cornerMatches = std::count(
+        _pointMatched.begin(), _pointMatched.begin() + cornerNum, 1);
+    if (cornerNum > 0) {
+      _cornerMatches = cornerMatches;
+    }
+    if (surfaceNum > 0) {
+      _surfaceMatches = normalEquations.size() - cornerMatches;
+    }
 
-      matX = matAtA.colPivHouseholderQr().solve(matAtB);
+    int pointSelNum = normalEquations.size();
+    //cout << "iterCount,pointSelNum:" << iterCount << "," << pointSelNum << std::endl;
+    if (pointSelNum < 10) {
+      continue;
+    }
+
+    Eigen::Matrix<float, 6, 1> matX = normalEquations.solve(dofs);
 
+    // the fixed parameters of a partial solve are not degenerate
+    if (dofs == GaussNewtonAccumulator::ALL_DOF) {
       if (iterCount == 0) {
-        Eigen::Matrix<float, 1, 6> matE;
-        Eigen::Matrix<float, 6, 6> matV;
-        Eigen::Matrix<float, 6, 6> matV2;
-
-        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> esolver(
-            matAtA);
-        matE = esolver.eigenvalues().real();
-        matV = esolver.eigenvectors().real();
-
-        matV2 = matV;
-
-        isDegenerate = false;
-        float eignThre[6] = {10, 10, 10, 10, 10, 10};
-        for (int i = 0; i < 6; i++) {
-          if (matE(0, i) < eignThre[i]) {
-            for (int j = 0; j < 6; j++) {
-              matV2(i, j) = 0;
-            }
-            isDegenerate = true;
-          } else {
-            break;
-          }
-        }
-        matP = matV.inverse() * matV2;
+        isDegenerate = normalEquations.degeneracyProjection(10, matP);
       }
 
       if (isDegenerate) {
@@ -612,36 +949,48 @@ void LaserOdometry::scanMatch() {
         matX2 = matX;
         matX = matP * matX2;
       }
-      _transform.rot_x += matX(0, 0);
-      _transform.rot_y += matX(1, 0);
-      _transform.rot_z += matX(2, 0);
-      _transform.pos.x() += matX(3, 0);
-      _transform.pos.y() += matX(4, 0);
-      _transform.pos.z() += matX(5, 0);
-
-      if (!pcl_isfinite(_transform.rot_x.rad()))
-        _transform.rot_x = Angle();
-      if (!pcl_isfinite(_transform.rot_y.rad()))
-        _transform.rot_y = Angle();
-      if (!pcl_isfinite(_transform.rot_z.rad()))
-        _transform.rot_z = Angle();
-
-      if (!pcl_isfinite(_transform.pos.x()))
-        _transform.pos.x() = 0.0;
-      if (!pcl_isfinite(_transform.pos.y()))
-        _transform.pos.y() = 0.0;
-      if (!pcl_isfinite(_transform.pos.z()))
-        _transform.pos.z() = 0.0;
-
-      float deltaR =
-          sqrt(pow(rad2deg(matX(0, 0)), 2) + pow(rad2deg(matX(1, 0)), 2) +
-               pow(rad2deg(matX(2, 0)), 2));
-      float deltaT = sqrt(pow(matX(3, 0) * 100, 2) + pow(matX(4, 0) * 100, 2) +
-                          pow(matX(5, 0) * 100, 2));
-
-      if (deltaR < _deltaRAbort && deltaT < _deltaTAbort) {
-        break;
-      }
+    }
+
+    if (updateTransform(matX)) {
+      break;
+    }
+  }
+}
+
+void LaserOdometry::scanMatch() {
+  _inputFrameCount++;
+  _cornerMatches = 0;
+  _surfaceMatches = 0;
+  _iterations = 0;
+  size_t lastCornerCloudSize = _lastCornerCloud->points.size();
+  size_t lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
+
+  if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100) {
+    size_t cornerPointsSharpNum = _cornerPointsSharp->points.size();
+    size_t surfPointsFlatNum = _surfPointsFlat->points.size();
+
+    _pointSearchCornerInd1.resize(cornerPointsSharpNum);
+    _pointSearchCornerInd2.resize(cornerPointsSharpNum);
+    _pointSearchSurfInd1.resize(surfPointsFlatNum);
+    _pointSearchSurfInd2.resize(surfPointsFlatNum);
+    _pointSearchSurfInd3.resize(surfPointsFlatNum);
+
+    // a good prior needs fewer iterations
+    size_t maxIterations = _motionPrior.trusted()
+                               ? std::min(_maxIterations, _maxIterationsWithPrior)
+                               : _maxIterations;
+
+    if (_groundConstrained && _lastGroundCloud->points.size() > 100) {
+      // two step solve: the ground points fix the vertical position, roll and
+      // pitch, then the corner points fix the remaining parameters
+      size_t groundPointsNum = _groundPoints->points.size();
+      _groundPlanes.resize(groundPointsNum);
+      _groundPlaneFound.resize(groundPointsNum);
+      optimize(0, groundPointsNum, true, _groundDofs, maxIterations);
+      optimize(cornerPointsSharpNum, 0, false, _cornerDofs, maxIterations);
+    } else {
+      optimize(cornerPointsSharpNum, surfPointsFlatNum, false,
+               GaussNewtonAccumulator::ALL_DOF, maxIterations);
     }
   }
 }
@@ -672,16 +1021,41 @@ void LaserOdometry::publishResult() {
   _tfBroadcaster.sendTransform(_laserOdometryTrans);
 
   ros::Time sweepTime = _timeSurfPointsLessFlat;
-  publishCloudMsg(_pubLaserCloudCornerLast, *_lastCornerCloud, sweepTime,
-                  "/laser_odom");
-  publishCloudMsg(_pubLaserCloudSurfLast, *_lastSurfaceCloud, sweepTime,
-                  "/laser_odom");
+  publishCloudPtr(_pubLaserCloudCornerLast, CloudI::ConstPtr(_lastCornerCloud));
+  publishCloudPtr(_pubLaserCloudSurfLast, CloudI::ConstPtr(_lastSurfaceCloud));
+
+  if (_odometrySink) {
+    _odometryFrame.stamp = sweepTime;
+    _odometryFrame.pose = _Tsum;
+    _odometryFrame.cornerPointsLast = *_lastCornerCloud;
+    _odometryFrame.surfacePointsLast = *_lastSurfaceCloud;
+    _odometryFrame.laserCloud.clear();
+  }
 
-  if (_receiveFullCloud && _sendRegisteredCloud) {
-    transformToEnd(_laserCloud); // transform full resolution cloud to sweep end
-                               // before sending it
-    publishCloudMsg(_pubLaserCloudFullRes, *_laserCloud, sweepTime, "/laser_odom");
+  if (_receiveFullCloud && (_sendRegisteredCloud || _odometrySink)) {
+    // transform full resolution cloud to sweep end before sending it
+    reuseReleasedCloud(_spareRegisteredCloud);
+    CloudIN &laserCloud = *_spareRegisteredCloud;
+    transformToEnd(*_laserCloud, laserCloud);
+    if (_odometrySink) {
+      if (_sendRegisteredCloud) {
+        _odometryFrame.laserCloud = laserCloud;
+      } else {
+        _odometryFrame.laserCloud.swap(laserCloud);
+      }
+    }
+    if (_sendRegisteredCloud) {
+      // publish the full resolution cloud as it is
+      laserCloud.header.stamp = pcl_conversions::toPCL(sweepTime);
+      laserCloud.header.frame_id = "/laser_odom";
+      publishCloudPtr(_pubLaserCloudFullRes,
+                      CloudIN::ConstPtr(_spareRegisteredCloud));
+      _registeredCloud.swap(_spareRegisteredCloud);
+    }
+  }
 
+  if (_odometrySink) {
+    _odometrySink(_odometryFrame);
   }
 }
 
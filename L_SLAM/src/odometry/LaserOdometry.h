@@ -8,20 +8,51 @@
 #include <pcl/point_types.h>
 #include <ros/node_handle.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Float32MultiArray.h>
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_datatypes.h>
 #include <tf/transform_listener.h>
 
+#include <functional>
 #include <mutex>
 #include <thread>
 
+#include "common/MessageSynchronizer.h"
+#include "common/RobustKernel.h"
 #include "common/Twist.h"
 #include "common/nanoflann_pcl.h"
 #include "fusion/imu_queue.h"
+#include "MotionPrior.h"
+#include "ScanRegistration.h"
 namespace lidar_slam {
 
+/** \brief Feature clouds and pose of a sweep after the laser odometry, in the
+ * frame of the sweep end. */
+struct OdometryFrame {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  ros::Time stamp;         ///< time stamp of the sweep
+  Eigen::Isometry3f pose;  ///< accumulated odometry pose
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsLast;  ///< less sharp corners
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsLast; ///< less flat surfaces
+  pcl::PointCloud<pcl::PointXYZINormal> laserCloud;  ///< full resolution cloud
+
+  void swap(OdometryFrame &other) {
+    std::swap(stamp, other.stamp);
+    std::swap(pose, other.pose);
+    cornerPointsLast.swap(other.cornerPointsLast);
+    surfacePointsLast.swap(other.surfacePointsLast);
+    laserCloud.swap(other.laserCloud);
+  }
+};
+
+/** \brief Receiver of odometry frames, which may take over the clouds. */
+typedef std::function<void(OdometryFrame &)> OdometrySink;
+
 class LaserOdometry {
 public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
   typedef pcl::PointXYZI PointI;
   typedef pcl::PointCloud<PointI> CloudI;
   typedef pcl::PointXYZINormal PointIN;
@@ -32,20 +63,46 @@ public:
 
   virtual bool setup(ros::NodeHandle &node, ros::NodeHandle &privateNode);
 
-  void laserCloudSharpHandler(
-      const sensor_msgs::PointCloud2ConstPtr &cornerPointsSharpMsg);
+  /** \brief Read the parameters and advertise the result topics, without
+   * subscribing to the scan registration or spinning.
+   *
+   * @param node the ROS node handle
+   * @param privateNode the private ROS node handle
+   */
+  bool configure(ros::NodeHandle &node, ros::NodeHandle &privateNode);
+
+  /** \brief Process a registered sweep directly, e.g. for batch processing.
+   *
+   * The clouds of the sweep are swapped out.
+   *
+   * @param sweep the registered sweep
+   */
+  void processSweep(SweepFeatures &sweep);
+
+  /** \brief Set an in process receiver of the odometry result of every
+   * sweep, in addition to the published topics.
+   *
+   * @param sink the odometry frame receiver
+   */
+  void setOdometrySink(const OdometrySink &sink) { _odometrySink = sink; }
 
-  void laserCloudLessSharpHandler(
-      const sensor_msgs::PointCloud2ConstPtr &cornerPointsLessSharpMsg);
+  /** \brief The accumulated odometry pose. */
+  const Eigen::Isometry3f &pose() const { return _Tsum; }
 
-  void laserCloudFlatHandler(
-      const sensor_msgs::PointCloud2ConstPtr &surfPointsFlatMsg);
+  void laserCloudSharpHandler(const CloudI::ConstPtr &cornerPointsSharpMsg);
 
-  void laserCloudLessFlatHandler(
-      const sensor_msgs::PointCloud2ConstPtr &surfPointsLessFlatMsg);
+  void
+  laserCloudLessSharpHandler(const CloudI::ConstPtr &cornerPointsLessSharpMsg);
 
-  void laserCloudFullResHandler(
-      const sensor_msgs::PointCloud2ConstPtr &laserCloudFullResMsg);
+  void laserCloudFlatHandler(const CloudI::ConstPtr &surfPointsFlatMsg);
+
+  void laserCloudLessFlatHandler(const CloudI::ConstPtr &surfPointsLessFlatMsg);
+
+  void laserCloudFullResHandler(const CloudIN::ConstPtr &laserCloudFullResMsg);
+
+  void laserCloudGroundHandler(const CloudI::ConstPtr &groundPointsMsg);
+
+  void motionPriorHandler(const nav_msgs::Odometry::ConstPtr &odomMsg);
 
   void spin();
 
@@ -54,26 +111,115 @@ public:
   void scanMatch();
 
 protected:
+  /** Channels of the feature cloud synchronizer, the ground channel follows
+   * the last enabled channel. */
+  enum FeatureChannel {
+    CORNER_SHARP,
+    CORNER_LESS_SHARP,
+    SURFACE_FLAT,
+    SURFACE_LESS_FLAT,
+    FULL_RES
+  };
+
   void reset();
 
   bool hasNewData();
 
+  /** \brief Take over the clouds of a synchronized feature set.
+   *
+   * @param set the feature clouds, indexed by FeatureChannel
+   * @param stamp the time of the set
+   */
+  void takeFeatureSet(const MessageSynchronizer::MessageSet &set,
+                      const ros::Time &stamp);
+
+  /** \brief Warn about newly dropped or mismatched feature sets. */
+  void reportSynchronization();
+
+  /** \brief Report a ground constrained odometry never receiving ground
+   * points, as it would wait for complete feature sets forever. */
+  void reportMissingGround();
+
   void transformToStart(const PointI &pi, PointI &po);
 
-  size_t transformToEnd(CloudI::Ptr &cloud);
+  /** \brief Transform a cloud to the end of the sweep.
+   *
+   * @param cloud the cloud relative to the sweep start
+   * @param transformed the output cloud relative to the sweep end
+   */
+  size_t transformToEnd(const CloudI &cloud, CloudI &transformed);
 
   void transformToStart(const PointIN &pi, PointIN &po);
 
-  size_t transformToEnd(CloudIN::Ptr &cloud);
+  size_t transformToEnd(const CloudIN &cloud, CloudIN &transformed);
 
   void transformUpdate();
 
+  /** \brief Seed the transform with the motion prior of the current sweep. */
+  void predictMotion();
+
+  /** \brief Match a sharp corner point against the last corner cloud.
+   *
+   * Only writes the correspondence slots of the point, so different points
+   * can be matched concurrently.
+   *
+   * @param i the index of the sharp corner point
+   * @param iterCount the current scan matching iteration
+   * @param pointSearchInd the KD-tree search index buffer of the caller
+   * @param pointSearchSqDis the KD-tree search distance buffer of the caller
+   * @param coeff the output point coefficients
+   * @return true, if a valid correspondence was found, false otherwise
+   */
+  bool matchCorner(const size_t &i, const size_t &iterCount,
+                   std::vector<int> &pointSearchInd,
+                   std::vector<float> &pointSearchSqDis, PointI &coeff);
+
+  /** \brief Match a flat surface point against the last surface cloud.
+   *
+   * @see matchCorner
+   */
+  bool matchSurface(const size_t &i, const size_t &iterCount,
+                    std::vector<int> &pointSearchInd,
+                    std::vector<float> &pointSearchSqDis, PointI &coeff);
+
+  /** \brief Match a ground point against a plane fitted to its nearest
+   * neighbors in the last ground cloud.
+   *
+   * @see matchCorner
+   */
+  bool matchGround(const size_t &i, const size_t &iterCount,
+                   std::vector<int> &pointSearchInd,
+                   std::vector<float> &pointSearchSqDis, PointI &coeff);
+
+  /** \brief Run the scan matching iterations for a set of feature points.
+   *
+   * The feature points are the first cornerNum sharp corner points, followed
+   * by the first surfaceNum flat surface or ground points.
+   *
+   * @param cornerNum the number of sharp corner points
+   * @param surfaceNum the number of flat surface or ground points
+   * @param ground match ground instead of flat surface points
+   * @param dofs the GaussNewtonAccumulator::Dof flags of the free parameters
+   * @param maxIterations the maximum number of iterations
+   */
+  void optimize(const size_t &cornerNum, const size_t &surfaceNum,
+                const bool &ground, const unsigned &dofs,
+                const size_t &maxIterations);
+
+  /** \brief Apply a transform update.
+   *
+   * @param matX the transform update (rot_x, rot_y, rot_z, x, y, z)
+   * @return true, if the update is below the abort thresholds, false otherwise
+   */
+  bool updateTransform(const Eigen::Matrix<float, 6, 1> &matX);
+
   void publishResult();
 
 
 private:
   std::thread spin_thread;
-  //IMUQueue imu_que;
+  IMUQueue imu_que; ///< IMU pose prediction of the imu motion prior
+  Eigen::Isometry3f _imuCorrectedPose; ///< IMU filter pose of the last sweep
 
   bool _systemInited;    ///< initialization flag
   long _inputFrameCount; ///< counter for input frames
@@ -82,32 +228,65 @@ private:
   size_t _maxIterations; ///< maximum number of iterations
   float _deltaTAbort;    ///< optimization abort threshold for deltaT
   float _deltaRAbort;    ///< optimization abort threshold for deltaR
+  int _matchThreads; ///< number of correspondence search threads (0 = OpenMP
+                     /// default, 1 = serial)
+  size_t _maxIterationsWithPrior; ///< maximum number of iterations with a
+                                  /// trusted motion prior
+  RobustKernel _robustKernel;     ///< robust kernel of the match residuals
+  bool _groundConstrained; ///< solve the ground and the corner parameters in
+                           /// two separate steps
+  unsigned _groundDofs;    ///< parameters fixed by the ground points
+  unsigned _cornerDofs;    ///< parameters fixed by the corner points
+
+  MotionPrior _motionPrior;      ///< sweep motion prediction
+  std::string _motionPriorTopic; ///< external odometry topic
+  ros::Time _lastSweepTime;      ///< time of the previous sweep
   float _scale_rot_y;
   float _scale_trans_z; ///< optimization abort threshold for deltaT
   bool _sendRegisteredCloud;
   bool _receiveFullCloud;
-  CloudI::Ptr _cornerPointsSharp;     ///< sharp corner points cloud
-  CloudI::Ptr _cornerPointsLessSharp; ///< less sharp corner points cloud
-  CloudI::Ptr _surfPointsFlat;        ///< flat surface points cloud
-  CloudI::Ptr _surfPointsLessFlat;    ///< less flat surface points cloud
-  CloudIN::Ptr _laserCloud;           ///< full resolution cloud
-
-  CloudI::Ptr _lastCornerCloud;  ///< last corner points cloud
-  CloudI::Ptr _lastSurfaceCloud; ///< last surface points cloud
-
-  CloudI::Ptr _laserCloudOri; ///< point selection
-  CloudI::Ptr _coeffSel;      ///< point selection coefficients
+  // the input clouds are shared with the sender and never modified
+  CloudI::ConstPtr _cornerPointsSharp;     ///< sharp corner points cloud
+  CloudI::ConstPtr _cornerPointsLessSharp; ///< less sharp corner points cloud
+  CloudI::ConstPtr _surfPointsFlat;        ///< flat surface points cloud
+  CloudI::ConstPtr _surfPointsLessFlat;    ///< less flat surface points cloud
+  CloudIN::ConstPtr _laserCloud;           ///< full resolution cloud
+  CloudI::ConstPtr _groundPoints;          ///< ground points cloud
+
+  // buffers of the input clouds of processSweep(), swapped with the sweep
+  CloudI::Ptr _sweepCornerPointsSharp;
+  CloudI::Ptr _sweepCornerPointsLessSharp;
+  CloudI::Ptr _sweepSurfPointsFlat;
+  CloudI::Ptr _sweepSurfPointsLessFlat;
+  CloudIN::Ptr _sweepLaserCloud;
+  CloudI::Ptr _sweepGroundPoints;
+
+  // the last clouds are published as they are and never modified once
+  // published, every output alternates between two clouds and refills the
+  // cloud of the sweep before once it has been released
+  CloudI::Ptr _lastCornerCloud;       ///< last corner points cloud
+  CloudI::Ptr _lastSurfaceCloud;      ///< last surface points cloud
+  CloudI::Ptr _lastGroundCloud;       ///< last ground points cloud
+  CloudIN::Ptr _registeredCloud;      ///< last full resolution cloud
+  CloudI::Ptr _spareCornerCloud;      ///< corner cloud of the sweep before
+  CloudI::Ptr _spareSurfaceCloud;     ///< surface cloud of the sweep before
+  CloudI::Ptr _spareGroundCloud;      ///< ground cloud of the sweep before
+  CloudIN::Ptr _spareRegisteredCloud; ///< full resolution cloud of the sweep
+                                      ///< before
 
   nanoflann::KdTreeFLANN<PointI>
       _lastCornerKDTree; ///< last corner cloud KD-tree
   nanoflann::KdTreeFLANN<PointI>
       _lastSurfaceKDTree; ///< last surface cloud KD-tree
+  nanoflann::KdTreeFLANN<PointI>
+      _lastGroundKDTree; ///< last ground cloud KD-tree
 
   ros::Time _timeCornerPointsSharp;     ///< time of current sharp corner
   ros::Time _timeCornerPointsLessSharp; ///< time of current less sharp corner
   ros::Time _timeSurfPointsFlat;        ///< time of current flat surface
   ros::Time _timeSurfPointsLessFlat;    ///< time of current less flat surface
   ros::Time _timeLaserCloudFullRes;     ///< time of current full resolution
+  ros::Time _timeGroundPoints;          ///< time of current ground points
   ros::Time _timeImuTrans; ///< time of current IMU transformation information
 
   bool _newCornerPointsSharp;     ///< flag if a new sharp corner cloud has been
@@ -120,9 +299,21 @@ private:
                                   /// been received
   bool _newLaserCloudFullRes; ///< flag if a new full resolution cloud has been
                               /// received
+  bool _newGroundPoints;      ///< flag if a new ground cloud has been received
   bool _newImuTrans; ///< flag if a new IMU transformation information cloud has
                      /// been received
 
+  OdometrySink _odometrySink;         ///< optional receiver of the results
+  OdometryFrame _odometryFrame;      ///< frame handed over to the sink
+  MessageSynchronizer _synchronizer; ///< feature cloud synchronizer
+  size_t _groundChannel;             ///< synchronizer channel of the ground
+  size_t _reportedDroppedSets;       ///< dropped sets already warned about
+  size_t _reportedMismatched; ///< mismatched messages already warned about
+  bool _reportedMissingGround; ///< flag if the missing ground was reported
+  /** number of sweeps without any ground points until the missing ground
+   * channel is reported */
+  static const size_t MISSING_GROUND_SWEEPS = 10;
+
   std::vector<int>
       _pointSearchCornerInd1; ///< first corner point search index buffer
   std::vector<int>
@@ -135,6 +326,21 @@ private:
   std::vector<int>
       _pointSearchSurfInd3; ///< third surface point search index buffer
 
+  std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f>>
+      _groundPlanes; ///< plane correspondence per ground point
+  std::vector<uint8_t>
+      _groundPlaneFound; ///< flag if a ground point has a plane correspondence
+
+  std::vector<PointI, Eigen::aligned_allocator<PointI>>
+      _pointCoeffs; ///< coefficients per feature point, corners first
+  std::vector<uint8_t>
+      _pointMatched; ///< flag if a feature point has a valid correspondence
+
+  size_t _cornerMatches;  ///< corner correspondences of the last iteration
+  size_t _surfaceMatches; ///< surface correspondences of the last iteration
+  size_t _iterations;     ///< number of scan matching iterations
+  std_msgs::Float32MultiArray _statsMsg; ///< odometry statistics message
+
   Twist _transform;    ///< optimized pose transformation
   Eigen::Isometry3f _Tsum; ///< accumulated optimized pose transformation
 
@@ -148,6 +354,7 @@ private:
   ros::Publisher
       _pubLaserCloudFullRes;        ///< full resolution cloud message publisher
   ros::Publisher _pubLaserOdometry; ///< laser odometry publisher
+  ros::Publisher _pubOdometryStats; ///< odometry statistics publisher
   tf::TransformBroadcaster
       _tfBroadcaster; ///< laser odometry transform broadcaster
 
@@ -160,6 +367,8 @@ private:
       _subSurfPointsLessFlat; ///< less flat surface cloud message subscriber
   ros::Subscriber
       _subLaserCloudFullRes; ///< full resolution cloud message subscriber
+  ros::Subscriber _subMotionPrior; ///< external odometry subscriber
+  ros::Subscriber _subGroundPoints; ///< ground cloud message subscriber
 };
 
 } // end namespace lidar_slam
@@ -0,0 +1,217 @@
+#ifndef LIDAR_MOTIONPRIOR_H
+#define LIDAR_MOTIONPRIOR_H
+
+#include <ros/time.h>
+
+#include <Eigen/Geometry>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace lidar_slam {
+
+/** \brief Prediction of the sweep to sweep motion, used to seed the laser
+ * odometry scan matching.
+ *
+ * Supported modes are:
+ * - none: every sweep starts from zero motion
+ * - constant_velocity: the motion of the previous sweep is repeated
+ * - imu: the motion between the IMU predicted poses of the two sweeps
+ * - external_odom: the motion between the poses of an external odometry
+ *   source at the two sweep times, interpolated from its pose history
+ *
+ * Modes based on pose measurements fall back to constant velocity while no
+ * measurement covers a sweep. The prior is trusted, when the previous
+ * prediction agreed with the matched motion within the given tolerances.
+ *
+ * Pose measurements may be added from another thread than the predictions.
+ */
+class MotionPrior {
+public:
+  enum Mode { NONE, CONSTANT_VELOCITY, IMU, EXTERNAL_ODOM };
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  MotionPrior()
+      : _mode(CONSTANT_VELOCITY), _historySize(200),
+        _rotationTolerance(0.5), _translationTolerance(0.05),
+        _trusted(false), _measured(false),
+        _lastPrediction(Eigen::Isometry3f::Identity()) {}
+
+  /** \brief Parse a mode name.
+   *
+   * @param name the mode name
+   * @param mode the parsed mode
+   * @return true, if the name is a valid mode, false otherwise
+   */
+  static bool parseMode(const std::string &name, Mode &mode) {
+    if (name == "none") {
+      mode = NONE;
+    } else if (name == "constant_velocity") {
+      mode = CONSTANT_VELOCITY;
+    } else if (name == "imu") {
+      mode = IMU;
+    } else if (name == "external_odom") {
+      mode = EXTERNAL_ODOM;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  /** \brief Set up the prior.
+   *
+   * @param mode the prediction mode
+   * @param rotationTolerance the rotation error (deg) of a trusted prediction
+   * @param translationTolerance the translation error (m) of a trusted
+   * prediction
+   * @param historySize the number of buffered pose measurements
+   */
+  void setup(const Mode &mode, const float &rotationTolerance,
+             const float &translationTolerance,
+             const size_t &historySize = 200) {
+    _mode = mode;
+    _rotationTolerance = rotationTolerance;
+    _translationTolerance = translationTolerance;
+    _historySize = historySize;
+    _trusted = false;
+    std::lock_guard<std::mutex> lock(_historyMutex);
+    _history.clear();
+  }
+
+  /** \brief The prediction mode. */
+  const Mode &mode() const { return _mode; }
+
+  /** \brief Add a pose measurement of the external odometry source.
+   *
+   * @param stamp the measurement time, measurements have to be added in time
+   * order
+   * @param pose the measured pose
+   */
+  void addPose(const ros::Time &stamp, const Eigen::Isometry3f &pose) {
+    std::lock_guard<std::mutex> lock(_historyMutex);
+    if (!_history.empty() && stamp <= _history.back().stamp) {
+      return;
+    }
+    _history.push_back(StampedPose{stamp, pose});
+    while (_history.size() > _historySize) {
+      _history.pop_front();
+    }
+  }
+
+  /** \brief Interpolate the measured pose at a time.
+   *
+   * @param stamp the time
+   * @param pose the interpolated pose
+   * @return true, if the time is covered by the measurements, false otherwise
+   */
+  bool poseAt(const ros::Time &stamp, Eigen::Isometry3f &pose) const {
+    std::lock_guard<std::mutex> lock(_historyMutex);
+    if (_history.size() < 2 || stamp < _history.front().stamp ||
+        stamp > _history.back().stamp) {
+      return false;
+    }
+
+    size_t i = 1;
+    while (_history[i].stamp < stamp) {
+      i++;
+    }
+    const StampedPose &before = _history[i - 1];
+    const StampedPose &after = _history[i];
+    float ratio = float((stamp - before.stamp).toSec() /
+                        (after.stamp - before.stamp).toSec());
+
+    Eigen::Quaternionf q0(before.pose.rotation());
+    Eigen::Quaternionf q1(after.pose.rotation());
+    pose.setIdentity();
+    pose.linear() = q0.slerp(ratio, q1).toRotationMatrix();
+    pose.translation() = (1 - ratio) * before.pose.translation() +
+                         ratio * after.pose.translation();
+    return true;
+  }
+
+  /** \brief Predict the motion of the current sweep from the external
+   * odometry poses.
+   *
+   * @param lastStamp the time of the previous sweep
+   * @param stamp the time of the current sweep
+   * @param lastMotion the matched motion of the previous sweep
+   * @param motion the predicted motion
+   */
+  void predict(const ros::Time &lastStamp, const ros::Time &stamp,
+               const Eigen::Isometry3f &lastMotion,
+               Eigen::Isometry3f &motion) {
+    Eigen::Isometry3f lastPose, pose;
+    if (poseAt(lastStamp, lastPose) && poseAt(stamp, pose)) {
+      setPrediction(lastPose.inverse() * pose);
+    } else {
+      predict(lastMotion);
+    }
+    motion = _lastPrediction;
+  }
+
+  /** \brief Predict the motion of the current sweep without pose
+   * measurements.
+   *
+   * @param lastMotion the matched motion of the previous sweep
+   */
+  void predict(const Eigen::Isometry3f &lastMotion) {
+    _measured = false;
+    _lastPrediction =
+        _mode == NONE ? Eigen::Isometry3f::Identity() : lastMotion;
+  }
+
+  /** \brief Set a motion predicted from a pose measurement (e.g. the IMU). */
+  void setPrediction(const Eigen::Isometry3f &motion) {
+    _measured = true;
+    _lastPrediction = motion;
+  }
+
+  /** \brief The last predicted motion. */
+  const Eigen::Isometry3f &prediction() const { return _lastPrediction; }
+
+  /** \brief Compare the last prediction against the matched motion.
+   *
+   * @param motion the matched motion of the current sweep
+   */
+  void update(const Eigen::Isometry3f &motion) {
+    Eigen::Isometry3f error = _lastPrediction.inverse() * motion;
+    float rotationError =
+        Eigen::AngleAxisf(error.rotation()).angle() * 180 / float(M_PI);
+    float translationError = error.translation().norm();
+    _trusted = _mode != NONE && rotationError < _rotationTolerance &&
+               translationError < _translationTolerance;
+  }
+
+  /** \brief Check if the prior is good enough to shorten the scan matching.
+   */
+  bool trusted() const { return _trusted; }
+
+  /** \brief Check if the last prediction came from a pose measurement. */
+  bool measured() const { return _measured; }
+
+private:
+  /** Pose measurement of the external odometry. */
+  struct StampedPose {
+    ros::Time stamp;
+    Eigen::Isometry3f pose;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  Mode _mode;                   ///< prediction mode
+  size_t _historySize;          ///< maximum number of buffered measurements
+  float _rotationTolerance;     ///< rotation error of a trusted prior (deg)
+  float _translationTolerance;  ///< translation error of a trusted prior (m)
+  bool _trusted;                ///< flag if the last prediction was good
+  bool _measured;               ///< flag if the last prediction was measured
+  Eigen::Isometry3f _lastPrediction; ///< last predicted sweep motion
+  std::deque<StampedPose, Eigen::aligned_allocator<StampedPose>>
+      _history; ///< pose measurements of the external odometry
+  mutable std::mutex _historyMutex; ///< lock of the pose measurements
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_MOTIONPRIOR_H
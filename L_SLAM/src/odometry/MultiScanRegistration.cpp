@@ -7,12 +7,24 @@
 namespace lidar_slam {
 
 MultiScanRegistration::MultiScanRegistration(const RegistrationParams &config)
-    : ScanRegistration(config), _systemDelay(SYSTEM_DELAY) {
+    : ScanRegistration(config), _systemDelay(SYSTEM_DELAY), _scanMapper(NULL) {
   cloudReceiveCount = 0;
 };
 
 MultiScanRegistration:: ~MultiScanRegistration(){
   ROS_INFO("[MultiScanRegistration] cloudReceiveCount:%d",cloudReceiveCount);
+  delete _scanMapper;
+}
+
+bool MultiScanRegistration::setupScanMapper(const std::string &lidarName) {
+  delete _scanMapper;
+  _scanMapper = createScanMapper(lidarName, SupportedLidarModels());
+  if (!_scanMapper) {
+    ROS_ERROR("Invalid lidar parameter: %s (supported:%s)", lidarName.c_str(),
+              lidarModelNames(SupportedLidarModels()).c_str());
+    return false;
+  }
+  return true;
 }
 
 bool MultiScanRegistration::setup(ros::NodeHandle &node,
@@ -25,18 +37,7 @@ bool MultiScanRegistration::setup(ros::NodeHandle &node,
   std::string lidarName;
 
   if (privateNode.getParam("lidar", lidarName)) {
-    if (lidarName == "VLP-16") {
-      _scanMapper = MultiScanMapper::Velodyne_VLP_16();
-    } else if (lidarName == "HDL-32") {
-      _scanMapper = MultiScanMapper::Velodyne_HDL_32();
-    } else if (lidarName == "HDL-64E") {
-      _scanMapper = MultiScanMapper::Velodyne_HDL_64E();
-    } else if (lidarName == "Pandar40") {
-      _scanMapper = MultiScanMapperP::Pandar40();
-    } else {
-      ROS_ERROR("Invalid lidar parameter: %s (only \"VLP-16\", \"HDL-32\" ,"
-                "\"HDL-64E\ and \"Pandar40\ are supported)",
-                lidarName.c_str());
+    if (!setupScanMapper(lidarName)) {
       return false;
     }
 
@@ -60,7 +61,8 @@ bool MultiScanRegistration::setup(ros::NodeHandle &node,
         return false;
       }
 
-      //_scanMapper.set(vAngleMin, vAngleMax, nScanRings);
+      delete _scanMapper;
+      _scanMapper = new MultiScanMapper(vAngleMin, vAngleMax, nScanRings);
       ROS_INFO(
           "Set linear scan mapper from %g to %g degrees with %d scan rings.",
           vAngleMin, vAngleMax, nScanRings);
@@ -84,65 +86,66 @@ void MultiScanRegistration::handleCloudMessage(
     return;
   }
 
-  // fetch new input cloud
-  CloudI cloud_in;
-  pcl::fromROSMsg(*laserCloudMsg, cloud_in);
+  // read the new input cloud in place
+  if (!_cloudView.reset(laserCloudMsg)) {
+    ROS_ERROR("Input cloud requires float x, y, z and intensity fields");
+    return;
+  }
 
-  // process(laserCloudIn, laserCloudMsg->header.stamp);
-  process(cloud_in, laserCloudMsg->header.stamp);
+  process(_cloudView, laserCloudMsg->header.stamp);
 }
 
 void MultiScanRegistration::process(const CloudI &in,
                                     const ros::Time &scanTime) {
-  size_t cloudSize = in.size();
+  _ringBuffer.load(in);
+  processRingBuffer(scanTime);
+}
+
+void MultiScanRegistration::process(const PointCloud2View &in,
+                                    const ros::Time &scanTime) {
+  _ringBuffer.load(in);
+  processRingBuffer(scanTime);
+}
+
+void MultiScanRegistration::processRingBuffer(const ros::Time &scanTime) {
+  size_t cloudSize = _ringBuffer.size();
+  if (cloudSize == 0 || !_scanMapper) {
+    return;
+  }
+  const uint16_t nRings = _scanMapper->getNumberOfScanRings();
 
   // reset internal buffers and set IMU start state based on current scan time
   reset(scanTime);
 
-  // determine scan start and end orientations
-  float startOri = -std::atan2(in[0].y, in[0].x);
-  float endOri =
-      -std::atan2(in[cloudSize - 1].y, in[cloudSize - 1].x) + 2 * float(M_PI);
+  // determine scan start and end orientations (buffer axes are swapped)
+  float startOri = -std::atan2(_ringBuffer.x[0], _ringBuffer.z[0]);
+  float endOri = -std::atan2(_ringBuffer.x[cloudSize - 1],
+                             _ringBuffer.z[cloudSize - 1]) +
+                 2 * float(M_PI);
   if (endOri - startOri > 3 * M_PI) {
     endOri -= 2 * M_PI;
   } else if (endOri - startOri < M_PI) {
     endOri += 2 * M_PI;
   }
-  //_scanMapper._azimuth_resolution = (endOri -
-  // startOri)*_scanMapper.getNumberOfScanRings()/cloudSize;
-  // ROS_INFO("_scanMapper._azimuth_resolution:%f,%f,%f,%d",_scanMapper._azimuth_resolution,startOri,endOri,cloudSize);
-  bool halfPassed = false;
-  PointIN point;
-  std::vector<CloudIN> laserCloudScans(_scanMapper->getNumberOfScanRings());
-
-  // extract valid points from input cloud
-  for (int i = 0; i < cloudSize; i++) {
-    point.x = in[i].y;
-    point.y = in[i].z;
-    point.z = in[i].x;
-    point.intensity = in[i].intensity;
-
-    // skip NaN and INF valued points
-    if (!pcl_isfinite(point.x) || !pcl_isfinite(point.y) ||
-        !pcl_isfinite(point.z)) {
-      continue;
-    }
 
-    // skip zero valued points
-    if (point.x * point.x + point.y * point.y + point.z * point.z < 0.0001) {
-      continue;
-    }
+  // compute all point angles in one batch
+  _ringBuffer.computeAngles();
+
+  // calculate scan IDs, skipping NaN, INF and zero valued points
+  _scanMapper->assignRings(_ringBuffer.vertAngle.data(),
+                           _ringBuffer.ring.data(), cloudSize);
 
-    // calculate vertical point angle and scan ID
-    float angle =
-        std::atan(point.y / std::sqrt(point.x * point.x + point.z * point.z));
-    int scanID = _scanMapper->getRingForAngle(angle);
-    if (scanID >= _scanMapper->getNumberOfScanRings() || scanID < 0) {
+  // calculate relative scan times based on point orientations
+  bool halfPassed = false;
+  float minRelTime = _config.scanPeriod;
+  float maxRelTime = 0;
+  float lastRelTime = 0;
+  for (size_t i = 0; i < cloudSize; i++) {
+    if (_ringBuffer.ring[i] < 0) {
       continue;
     }
 
-    // calculate horizontal point angle
-    float ori = -std::atan2(point.x, point.z);
+    float ori = _ringBuffer.horiAngle[i];
     if (!halfPassed) {
       if (ori < startOri - M_PI / 2) {
         ori += 2 * M_PI;
@@ -163,35 +166,44 @@ void MultiScanRegistration::process(const CloudI &in,
       }
     }
 
-    // calculate relative scan time based on point orientation
     float relTime = _config.scanPeriod * (ori - startOri) / (endOri - startOri);
-    point.curvature = scanID + relTime;
+    _ringBuffer.relTime[i] = relTime;
+    minRelTime = std::min(minRelTime, relTime);
+    maxRelTime = std::max(maxRelTime, relTime);
+    lastRelTime = relTime;
+  }
 
-    // project point to the start of the sweep using corresponding IMU data
-    if (hasIMUData()) {
-      setIMUTransformFor(relTime);
-      transformToStartIMU(point);
-    }
+  // project points to the start of the sweep using corresponding IMU data
+  if (hasIMUData()) {
+    if (_config.deskewTable) {
+      buildDeskewTable(minRelTime, maxRelTime);
+      _deskewTable.apply(_ringBuffer.relTime.data(), _ringBuffer.ring.data(),
+                         _ringBuffer.x.data(), _ringBuffer.y.data(),
+                         _ringBuffer.z.data(), cloudSize);
 
-    laserCloudScans[scanID].push_back(point);
+      // leave the IMU state at the last point for publishing
+      setIMUTransformFor(lastRelTime);
+    } else {
+      PointIN point;
+      for (size_t i = 0; i < cloudSize; i++) {
+        if (_ringBuffer.ring[i] < 0) {
+          continue;
+        }
+        point.x = _ringBuffer.x[i];
+        point.y = _ringBuffer.y[i];
+        point.z = _ringBuffer.z[i];
+        setIMUTransformFor(_ringBuffer.relTime[i]);
+        transformToStartIMU(point);
+        _ringBuffer.x[i] = point.x;
+        _ringBuffer.y[i] = point.y;
+        _ringBuffer.z[i] = point.z;
+      }
+    }
   }
 
   // construct sorted full resolution cloud
-  cloudSize = 0;
-  // for (int i = 13; i < 14; i++) {
-  for (int i = 0; i < _scanMapper->getNumberOfScanRings(); i++) {
-    // std::cout<<i<<":"<<laserCloudScans[i].size()<<std::endl;
-    _laserCloud += laserCloudScans[i];
-
-    IndexRange range(cloudSize, 0);
-    cloudSize += laserCloudScans[i].size();
-    range.second = cloudSize > 0 ? cloudSize - 1 : 0;
-    _scanIndices.push_back(range);
-  }
+  _ringBuffer.scatter(nRings, _laserCloud, _scanIndices);
 
-  // for(int i = 0; i < _scanIndices.size(); i++) {
-  //  std::cout<<i<<":"<<_scanIndices[i].first<<","<<_scanIndices[i].second<<std::endl;
-  //}
   // extract features
   extractFeatures();
 
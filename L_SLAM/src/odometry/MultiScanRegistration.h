@@ -3,6 +3,7 @@
 #define LIDAR_MULTISCANREGISTRATION_H
 
 #include "ScanRegistration.h"
+#include "ScanRingBuffer.h"
 
 #include <sensor_msgs/PointCloud2.h>
 #include "common/math_utils.h"
@@ -14,7 +15,34 @@ namespace lidar_slam {
 class MultiScanMapperBase {
 public:
   MultiScanMapperBase(){};
-  virtual inline int getRingForAngle(const float &angle){};
+  virtual ~MultiScanMapperBase(){};
+
+  /** \brief Map the specified vertical point angle to its ring ID.
+   *
+   * @param angle the vertical point angle (in rad)
+   * @return the ring ID
+   */
+  virtual int getRingForAngle(const float &angle) = 0;
+
+  /** \brief Map a batch of vertical point angles to their ring IDs.
+   *
+   * Entries with a ring ID of -1 on input are skipped. Angles mapping outside
+   * the valid ring range get a ring ID of -1.
+   *
+   * @param angles the vertical point angles (in rad)
+   * @param rings the input / output ring IDs
+   * @param count the number of points
+   */
+  virtual void assignRings(const float *angles, int16_t *rings,
+                           const size_t &count) {
+    for (size_t i = 0; i < count; i++) {
+      if (rings[i] < 0) {
+        continue;
+      }
+      int scanID = getRingForAngle(angles[i]);
+      rings[i] = (scanID >= 0 && scanID < _nScanRings) ? scanID : -1;
+    }
+  }
 
   virtual const float &getLowerBound() { return _lowerBound; }
   virtual const float &getUpperBound() { return _upperBound; }
@@ -26,21 +54,95 @@ protected:
   uint16_t _nScanRings; ///< number of scan rings
 };
 
-class MultiScanMapperP : public MultiScanMapperBase {
+/** \brief Scan mapper for a lidar model descriptor (see lidar_type.h).
+ *
+ * The angle to ring mapping of the model is tabulated once at construction,
+ * so almost every lookup is a single table access. Only angles in the few bins
+ * containing a ring boundary are mapped by the descriptor itself, which keeps
+ * the result identical to the direct mapping. The batch lookup is not virtual
+ * per point, so it gets inlined into the loop.
+ */
+template <typename LidarT> class MultiScanMapperT : public MultiScanMapperBase {
 public:
-  MultiScanMapperP(const float &lowerBound, const float &upperBound,
-                   const uint16_t &nScanRings) {
-    _lowerBound = lowerBound;
-    _upperBound = upperBound;
-    _nScanRings = nScanRings;
-  };
-  int getRingForAngle(const float &angle) { return scanID_pandar(rad2deg(angle)); }
+  MultiScanMapperT() {
+    _lowerBound = LidarT::lowerBound();
+    _upperBound = LidarT::upperBound();
+    _nScanRings = LidarT::nScanRings();
 
-  static inline MultiScanMapperP *Pandar40() {
-    return new MultiScanMapperP(-15.444, 6.96, 40);
-  };
+    _tableBegin = _lowerBound - TABLE_MARGIN;
+    size_t tableSize =
+        size_t((_upperBound - _lowerBound + 2 * TABLE_MARGIN) /
+               TABLE_RESOLUTION) + 1;
+    _ringTable.resize(tableSize);
+    for (size_t i = 0; i < tableSize; i++) {
+      int first = LidarT::ringForAngle(_tableBegin + i * TABLE_RESOLUTION);
+      int last = LidarT::ringForAngle(_tableBegin + (i + 1) * TABLE_RESOLUTION);
+      _ringTable[i] = first == last ? first : RING_BOUNDARY;
+    }
+  }
+
+  inline int getRingForAngle(const float &angle) {
+    float angleDeg = rad2deg(angle);
+    float pos = (angleDeg - _tableBegin) * (1.0f / TABLE_RESOLUTION);
+    if (pos >= 0 && pos < float(_ringTable.size()) &&
+        _ringTable[size_t(pos)] != RING_BOUNDARY) {
+      return _ringTable[size_t(pos)];
+    }
+    return LidarT::ringForAngle(angleDeg);
+  }
+
+  void assignRings(const float *angles, int16_t *rings, const size_t &count) {
+    for (size_t i = 0; i < count; i++) {
+      if (rings[i] < 0) {
+        continue;
+      }
+      int scanID = MultiScanMapperT::getRingForAngle(angles[i]);
+      rings[i] = (scanID >= 0 && scanID < _nScanRings) ? scanID : -1;
+    }
+  }
+
+private:
+  static constexpr float TABLE_RESOLUTION = 0.01f; ///< table bin size (deg)
+  static constexpr float TABLE_MARGIN = 2.0f; ///< table margin around the fov
+  static const int16_t RING_BOUNDARY = -32768; ///< marks bins with a boundary
+
+  float _tableBegin;               ///< the vertical angle of the first bin
+  std::vector<int16_t> _ringTable; ///< ring ID per vertical angle bin
 };
 
+template <typename LidarT>
+constexpr float MultiScanMapperT<LidarT>::TABLE_RESOLUTION;
+template <typename LidarT>
+constexpr float MultiScanMapperT<LidarT>::TABLE_MARGIN;
+
+/** \brief Create the scan mapper for the lidar model of the given name.
+ *
+ * @param name the lidar model name
+ * @return the new scan mapper, or NULL if no model matches the name
+ */
+inline MultiScanMapperBase *createScanMapper(const std::string &name,
+                                             LidarModelList<>) {
+  return NULL;
+}
+
+template <typename LidarT, typename... Models>
+inline MultiScanMapperBase *createScanMapper(const std::string &name,
+                                             LidarModelList<LidarT, Models...>) {
+  if (name == LidarT::name()) {
+    return new MultiScanMapperT<LidarT>();
+  }
+  return createScanMapper(name, LidarModelList<Models...>());
+}
+
+/** \brief List the names of the given lidar models. */
+inline std::string lidarModelNames(LidarModelList<>) { return ""; }
+
+template <typename LidarT, typename... Models>
+inline std::string lidarModelNames(LidarModelList<LidarT, Models...>) {
+  return std::string(" \"") + LidarT::name() + "\"" +
+         lidarModelNames(LidarModelList<Models...>());
+}
+
 /** \brief Class realizing a linear mapping from
  * vertical point angle to the
  * corresponding scan ring.
@@ -86,21 +188,6 @@ public:
     return int(((angle * 180 / M_PI) - _lowerBound) * _factor + 0.5);
   };
 
-  /** Multi scan mapper for Velodyne VLP-16 according to data sheet. */
-  static inline MultiScanMapper *Velodyne_VLP_16() {
-    return new MultiScanMapper(-15, 15, 16);
-  };
-
-  /** Multi scan mapper for Velodyne HDL-32 according to data sheet. */
-  static inline MultiScanMapper *Velodyne_HDL_32() {
-    return new MultiScanMapper(-30.67f, 10.67f, 32);
-  };
-
-  /** Multi scan mapper for Velodyne HDL-64E according to data sheet. */
-  static inline MultiScanMapper *Velodyne_HDL_64E() {
-    return new MultiScanMapper(-24.9f, 2, 64);
-  };
-
 private:
   // float _lowerBound;    ///< the vertical angle of the first scan ring
   // float _upperBound;    ///< the vertical angle of the last scan ring
@@ -129,6 +216,13 @@ public:
    */
   bool setup(ros::NodeHandle &node, ros::NodeHandle &privateNode);
 
+  /** \brief Set up the scan mapper of a supported lidar model.
+   *
+   * @param lidarName the lidar model name
+   * @return true, if the lidar model is supported, false otherwise
+   */
+  bool setupScanMapper(const std::string &lidarName);
+
   /** \brief Handler method for input cloud messages.
    *
    * @param laserCloudMsg the new input cloud message to process
@@ -143,7 +237,20 @@ public:
    */
   void process(const CloudI &in, const ros::Time &scanTime);
 
+  /** \brief Process a new raw input cloud message in place.
+   *
+   * @param in the view on the input cloud message
+   * @param scanTime the scan (message) timestamp
+   */
+  void process(const PointCloud2View &in, const ros::Time &scanTime);
+
 protected:
+  /** \brief Register the sweep loaded into the ring buffer.
+   *
+   * @param scanTime the scan (message) timestamp
+   */
+  void processRingBuffer(const ros::Time &scanTime);
+
   int _systemDelay; ///< system startup delay counter
   MultiScanMapperBase
       *_scanMapper; ///< mapper for mapping vertical point angles to
@@ -151,6 +258,8 @@ protected:
 
   ros::Subscriber _subLaserCloud; ///< input cloud message subscriber
   int cloudReceiveCount;
+  ScanRingBuffer _ringBuffer; ///< reusable buffer for binning points to rings
+  PointCloud2View _cloudView; ///< view on the current input cloud message
 private:
   static const int SYSTEM_DELAY = 2;
 };
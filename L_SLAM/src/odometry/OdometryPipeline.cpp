@@ -0,0 +1,105 @@
+#include "OdometryPipeline.h"
+
+namespace lidar_slam {
+
+bool OdometryPipeline::parseBackPressure(const std::string &name,
+                                         BackPressure &policy) {
+  if (name == "block") {
+    policy = BLOCK;
+  } else if (name == "drop_oldest") {
+    policy = DROP_OLDEST;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+void OdometryPipeline::enqueue(BoundedQueue<std::unique_ptr<T>> &queue,
+                               std::unique_ptr<T> &item,
+                               BoundedQueue<std::unique_ptr<T>> &recycled,
+                               std::atomic<size_t> &dropped) {
+  if (_policy == DROP_OLDEST) {
+    queue.pushEvict(std::move(item), [&](std::unique_ptr<T> &evicted) {
+      dropped++;
+      recycled.tryPush(std::move(evicted));
+    });
+  } else {
+    queue.push(std::move(item));
+  }
+}
+
+template <typename T>
+std::unique_ptr<T>
+OdometryPipeline::reuse(BoundedQueue<std::unique_ptr<T>> &recycled) {
+  std::unique_ptr<T> item;
+  if (!recycled.tryPop(item)) {
+    item.reset(new T());
+  }
+  return item;
+}
+
+OdometryPipeline::OdometryPipeline(LaserOdometry &odometry,
+                                   LaserMatcher &matcher,
+                                   const size_t &queueSize,
+                                   const BackPressure &policy)
+    : _odometry(odometry), _matcher(matcher), _policy(policy),
+      _sweeps(queueSize), _recycledSweeps(queueSize + 2), _frames(queueSize),
+      _recycledFrames(queueSize + 2), _droppedSweeps(0), _droppedFrames(0),
+      _mappedFrames(0) {
+  // called on the odometry thread at the end of every processed sweep
+  _odometry.setOdometrySink([this](OdometryFrame &frame) {
+    std::unique_ptr<OdometryFrame> result = reuse(_recycledFrames);
+    result->swap(frame);
+    enqueue(_frames, result, _recycledFrames, _droppedFrames);
+  });
+}
+
+OdometryPipeline::~OdometryPipeline() {
+  stop();
+  _odometry.setOdometrySink(OdometrySink());
+}
+
+void OdometryPipeline::start() {
+  _odometryThread = std::thread(&OdometryPipeline::runOdometry, this);
+  _mappingThread = std::thread(&OdometryPipeline::runMapping, this);
+}
+
+void OdometryPipeline::stop() {
+  // the stages drain their inputs before they finish
+  _sweeps.close();
+  if (_odometryThread.joinable()) {
+    _odometryThread.join();
+  }
+  if (_mappingThread.joinable()) {
+    _mappingThread.join();
+  }
+}
+
+void OdometryPipeline::pushSweep(SweepFeatures &sweep) {
+  std::unique_ptr<SweepFeatures> input = reuse(_recycledSweeps);
+  input->swap(sweep);
+  enqueue(_sweeps, input, _recycledSweeps, _droppedSweeps);
+}
+
+void OdometryPipeline::runOdometry() {
+  std::unique_ptr<SweepFeatures> sweep;
+  while (_sweeps.pop(sweep)) {
+    _odometry.processSweep(*sweep);
+    _recycledSweeps.tryPush(std::move(sweep));
+    sweep.reset();
+  }
+  _frames.close();
+}
+
+void OdometryPipeline::runMapping() {
+  std::unique_ptr<OdometryFrame> frame;
+  while (_frames.pop(frame)) {
+    _matcher.processOdometry(*frame);
+    _mappedFrames++;
+    _recycledFrames.tryPush(std::move(frame));
+    frame.reset();
+  }
+}
+
+} // end namespace lidar_slam
@@ -0,0 +1,121 @@
+#ifndef LIDAR_ODOMETRYPIPELINE_H
+#define LIDAR_ODOMETRYPIPELINE_H
+
+#include "LaserMatcher.h"
+#include "LaserOdometry.h"
+#include "ScanRegistration.h"
+#include "common/BoundedQueue.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace lidar_slam {
+
+/** \brief In process pipeline of the laser odometry and the laser mapping.
+ *
+ * Registered sweeps are passed to the odometry stage, and the odometry
+ * frames to the mapping stage, through bounded lock free queues. Each stage
+ * runs on a dedicated thread, so the odometry of a sweep overlaps with the
+ * mapping of the previous one, and no message (de)serialization is involved.
+ *
+ * The odometry and the matcher have to be configured without subscribing,
+ * i.e. through their configure() methods.
+ */
+class OdometryPipeline {
+public:
+  /** \brief Behavior of a stage input queue when its stage falls behind. */
+  enum BackPressure {
+    BLOCK,      ///< wait for the stage, so every sweep is processed
+    DROP_OLDEST ///< replace the oldest queued element, to bound the latency
+  };
+
+  /** \brief Parse a back pressure policy name.
+   *
+   * @param name the policy name (block or drop_oldest)
+   * @param policy the parsed policy
+   * @return true, if the name is a valid policy, false otherwise
+   */
+  static bool parseBackPressure(const std::string &name,
+                                BackPressure &policy);
+
+  /** \brief Construct a new pipeline.
+   *
+   * @param odometry the configured laser odometry
+   * @param matcher the configured laser mapping / localization
+   * @param queueSize the capacity of the stage input queues
+   * @param policy the back pressure policy of the stage input queues
+   */
+  OdometryPipeline(LaserOdometry &odometry, LaserMatcher &matcher,
+                   const size_t &queueSize = 4,
+                   const BackPressure &policy = BLOCK);
+
+  ~OdometryPipeline();
+
+  /** \brief Start the stage threads. */
+  void start();
+
+  /** \brief Process all queued sweeps and stop the stage threads, the
+   * pipeline can not be started again. */
+  void stop();
+
+  /** \brief Pass a registered sweep to the odometry stage, e.g. from the
+   * sweep sink of a scan registration.
+   *
+   * The clouds of the sweep are swapped out. Only one thread may push.
+   *
+   * @param sweep the registered sweep
+   */
+  void pushSweep(SweepFeatures &sweep);
+
+  /** \brief The number of sweeps dropped before the odometry stage. */
+  size_t droppedSweeps() const { return _droppedSweeps; }
+
+  /** \brief The number of frames dropped before the mapping stage. */
+  size_t droppedFrames() const { return _droppedFrames; }
+
+  /** \brief The number of frames processed by the mapping stage. */
+  size_t mappedFrames() const { return _mappedFrames; }
+
+private:
+  /** \brief Odometry stage loop. */
+  void runOdometry();
+
+  /** \brief Mapping stage loop. */
+  void runMapping();
+
+  /** \brief Pass an element to a stage input queue, applying the back
+   * pressure policy. */
+  template <typename T>
+  void enqueue(BoundedQueue<std::unique_ptr<T>> &queue,
+               std::unique_ptr<T> &item,
+               BoundedQueue<std::unique_ptr<T>> &recycled,
+               std::atomic<size_t> &dropped);
+
+  /** \brief Take a recycled element, or a new one if none is left. */
+  template <typename T>
+  static std::unique_ptr<T> reuse(BoundedQueue<std::unique_ptr<T>> &recycled);
+
+  LaserOdometry &_odometry; ///< odometry stage
+  LaserMatcher &_matcher;   ///< mapping stage
+  BackPressure _policy;     ///< back pressure policy of the stage inputs
+
+  BoundedQueue<std::unique_ptr<SweepFeatures>> _sweeps; ///< odometry input
+  BoundedQueue<std::unique_ptr<SweepFeatures>>
+      _recycledSweeps; ///< processed sweeps for reuse
+  BoundedQueue<std::unique_ptr<OdometryFrame>> _frames; ///< mapping input
+  BoundedQueue<std::unique_ptr<OdometryFrame>>
+      _recycledFrames; ///< processed frames for reuse
+
+  std::thread _odometryThread; ///< odometry stage thread
+  std::thread _mappingThread;  ///< mapping stage thread
+
+  std::atomic<size_t> _droppedSweeps; ///< sweeps dropped by the policy
+  std::atomic<size_t> _droppedFrames; ///< frames dropped by the policy
+  std::atomic<size_t> _mappedFrames;  ///< frames processed by the mapping
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_ODOMETRYPIPELINE_H
@@ -2,6 +2,7 @@
 #ifndef LIDAR_ORGANIZED_SCANREGISTRATION_H
 #define LIDAR_ORGANIZED_SCANREGISTRATION_H
 
+#include "RangeImage.h"
 #include "ScanRegistration.h"
 
 #include "common/math_utils.h"
@@ -42,10 +43,10 @@ public:
 
   /** \brief Process a new input cloud.
    *
-   * @param laserCloudIn the new input cloud to process
+   * @param in the view on the organised input cloud message
    * @param scanTime the scan (message) timestamp
    */
-  void process(const CloudT &in, const ros::Time &scanTime);
+  void process(const PointCloud2View &in, const ros::Time &scanTime);
 
   void spin();
 
@@ -58,9 +59,12 @@ protected:
   int _scanRings;
   float _blindRaduis;
   bool _checkTimeDelay;
+  bool _rangeImageMode;    ///< process sweeps as dense range images
+  RangeImage _rangeImage; ///< range image of the current sweep
 private:
   static const int SYSTEM_DELAY = 2;
-  CloudT _cloud_in;
+  sensor_msgs::PointCloud2ConstPtr _cloud_msg; ///< latest input cloud message
+  PointCloud2View _cloudView; ///< view on the latest input cloud message
   ros::Time _cloud_time;
   bool _cloud_new;
   int _last_seq;
@@ -11,6 +11,8 @@ namespace lidar_slam {
 OrganisedScanRegistration::OrganisedScanRegistration(const RegistrationParams &config)
     : ScanRegistration(config), _scanRings(64), _systemDelay(SYSTEM_DELAY) {
   cloudReceiveCount = 0;
+  // organised clouds are registered in the lidar frame
+  _upAxis = 2;
 };
 
 OrganisedScanRegistration:: ~OrganisedScanRegistration(){
@@ -29,6 +31,7 @@ bool OrganisedScanRegistration::setup(ros::NodeHandle &node,
 
   _blindRaduis = privateNode.param<float>("blindRaduis", 2.5);
   _checkTimeDelay = privateNode.param<bool>("checkTimeDelay", false);
+  _rangeImageMode = privateNode.param<bool>("rangeImageMode", false);
 
    // subscribe to input cloud topic
   _subLaserCloud = node.subscribe<sensor_msgs::PointCloud2>(
@@ -46,8 +49,14 @@ void OrganisedScanRegistration::spin() {
 
   while (status) {
     ros::spinOnce();
-    if(_cloud_new)
-      process(_cloud_in, _cloud_time);
+    if(_cloud_new) {
+      _cloud_new = false;
+      // read the input cloud in place
+      if (_cloudView.reset(_cloud_msg))
+        process(_cloudView, _cloud_time);
+      else
+        ROS_ERROR("Input cloud requires float x, y, z and intensity fields");
+    }
     status = ros::ok();
     rate.sleep();
   }
@@ -66,8 +75,8 @@ void OrganisedScanRegistration::handleCloudMessage(
   if((laserCloudMsg->header.seq - _last_seq)!=1){
     ROS_WARN("PointCloud seq jump: %d", laserCloudMsg->header.seq - _last_seq);
   }
-  // fetch new input cloud
-  pcl::fromROSMsg(*laserCloudMsg, _cloud_in);
+  // keep the new input cloud message, it is read in place when processed
+  _cloud_msg = laserCloudMsg;
   _cloud_time = laserCloudMsg->header.stamp;
   _last_seq = laserCloudMsg->header.seq;
   _cloud_new = true;
@@ -79,9 +88,8 @@ void OrganisedScanRegistration::handleCloudMessage(
   // std::cout << "process time: " << 1.0 * (endT - beginT) / CLOCKS_PER_SEC << "s\n";
 }
 
-void OrganisedScanRegistration::process(const CloudT &in,
+void OrganisedScanRegistration::process(const PointCloud2View &in,
                                     const ros::Time &scanTime) {
-  _cloud_new = false;
   if(_checkTimeDelay){
     float time_delay = (ros::Time::now().toSec() - scanTime.toSec());
     if(fabs(time_delay)>0.05){
@@ -90,11 +98,24 @@ void OrganisedScanRegistration::process(const CloudT &in,
   }
 
   size_t cloudSize = in.size();
-  int height = in.height;
-  int width  = in.width;
+  int height = in.height();
+  int width  = in.width();
   // reset internal buffers and set IMU start state based on current scan time
   reset(scanTime);
 
+  if (_rangeImageMode) {
+    // compact the dense image and precompute all neighbor terms
+    _rangeImage.load(in);
+    _rangeImage.compact(_config.scanPeriod, _blindRaduis, _laserCloud,
+                        _scanIndices);
+    _rangeImage.computeNeighborTerms(_config.curvatureRegion, _scanIndices,
+                                     _neighborTerms);
+
+    extractFeatures();
+    publishResult();
+    return;
+  }
+
   PointIN point;
   std::vector<CloudIN> laserCloudScans(height);
 
@@ -102,14 +123,14 @@ void OrganisedScanRegistration::process(const CloudT &in,
   for(int row =0; row< height; row++)
   for(int col = 0; col<width; col++){
   //for (int i = 0; i < cloudSize; i++) {
-    const auto& p= in.at(col, row);
-    point.x = p.x;
-    point.y = p.y;
-    point.z = p.z;
-    point.intensity = p.intensity;
+    const size_t idx = in.index(col, row);
+    point.x = in.x(idx);
+    point.y = in.y(idx);
+    point.z = in.z(idx);
+    point.intensity = in.intensity(idx);
     // calculate relative scan time based on point orientation
     float relTime = _config.scanPeriod * static_cast<double>(col)/width;
-    point.curvature = p.ring + relTime;
+    point.curvature = in.ring(idx) + relTime;
 
     // skip NaN and INF valued points
     if (!pcl_isfinite(point.x) || !pcl_isfinite(point.y) ||
@@ -0,0 +1,210 @@
+#ifndef LIDAR_RANGEIMAGE_H
+#define LIDAR_RANGEIMAGE_H
+
+#include "ScanRegistration.h"
+#include "common/curvature_utils.h"
+#include "common/pointcloud2_view.h"
+
+#include <pcl/point_cloud.h>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Dense H x W image of an organised lidar sweep.
+ *
+ * The image rows are the scan rings and the columns the firing sequence. The
+ * valid points of each row are compacted into the full resolution cloud, for
+ * which all neighbor terms used by the feature extraction (curvature, angle,
+ * distance and depth to the next point) are computed with branch free passes
+ * over contiguous arrays. The curvature uses sliding window sums along each
+ * row, so its cost is independent of the curvature region size.
+ *
+ * All buffers keep their capacity between sweeps.
+ */
+class RangeImage {
+public:
+  typedef pcl::PointXYZINormal PointIN;
+  typedef pcl::PointCloud<PointIN> CloudIN;
+
+  /** \brief Load an organised cloud into the dense image.
+   *
+   * @param in the organised input cloud, providing x, y, z, intensity and ring
+   */
+  template <typename PointT> void load(const pcl::PointCloud<PointT> &in) {
+    _height = in.height;
+    _width = in.width;
+    const size_t imageSize = size_t(_height) * _width;
+
+    _x.resize(imageSize);
+    _y.resize(imageSize);
+    _z.resize(imageSize);
+    _intensity.resize(imageSize);
+    _ring.resize(imageSize);
+    _valid.resize(imageSize);
+    for (size_t idx = 0; idx < imageSize; idx++) {
+      const PointT &p = in.points[idx];
+      _x[idx] = p.x;
+      _y[idx] = p.y;
+      _z[idx] = p.z;
+      _intensity[idx] = p.intensity;
+      _ring[idx] = p.ring;
+    }
+  }
+
+  /** \brief Load the points of a raw organised cloud message in place.
+   *
+   * @param in the view on the organised input cloud message
+   */
+  void load(const PointCloud2View &in) {
+    _height = in.height();
+    _width = in.width();
+    const size_t imageSize = in.size();
+
+    _x.resize(imageSize);
+    _y.resize(imageSize);
+    _z.resize(imageSize);
+    _intensity.resize(imageSize);
+    _ring.resize(imageSize);
+    _valid.resize(imageSize);
+    for (size_t idx = 0; idx < imageSize; idx++) {
+      _x[idx] = in.x(idx);
+      _y[idx] = in.y(idx);
+      _z[idx] = in.z(idx);
+      _intensity[idx] = in.intensity(idx);
+      _ring[idx] = in.ring(idx);
+    }
+  }
+
+  /** \brief Compact the valid pixels of each row into the output cloud.
+   *
+   * Pixels which are NaN, INF or closer than minRange are skipped.
+   *
+   * @param scanPeriod the time per sweep
+   * @param minRange the blind radius around the sensor
+   * @param out the output full resolution cloud
+   * @param scanIndices the output start and end indices of each row
+   */
+  void compact(const float &scanPeriod, const float &minRange, CloudIN &out,
+               std::vector<IndexRange> &scanIndices) {
+    const size_t imageSize = size_t(_height) * _width;
+    const float minRange2 = minRange * minRange;
+
+    // mask invalid pixels, (d - d) is NaN for NaN and INF valued points
+    size_t validCount = 0;
+    for (size_t idx = 0; idx < imageSize; idx++) {
+      float d = _x[idx] * _x[idx] + _y[idx] * _y[idx] + _z[idx] * _z[idx];
+      _valid[idx] = (d >= minRange2 && d - d == 0.0f);
+      validCount += _valid[idx];
+    }
+
+    out.resize(validCount);
+    _cx.resize(validCount);
+    _cy.resize(validCount);
+    _cz.resize(validCount);
+    scanIndices.clear();
+
+    size_t k = 0;
+    for (uint32_t row = 0; row < _height; row++) {
+      size_t rowStart = k;
+      const size_t offset = size_t(row) * _width;
+      for (uint32_t col = 0; col < _width; col++) {
+        const size_t idx = offset + col;
+        if (!_valid[idx]) {
+          continue;
+        }
+        PointIN &point = out[k];
+        point.x = _cx[k] = _x[idx];
+        point.y = _cy[k] = _y[idx];
+        point.z = _cz[k] = _z[idx];
+        point.intensity = _intensity[idx];
+        point.curvature = _ring[idx] +
+                          float(scanPeriod * static_cast<double>(col) / _width);
+        k++;
+      }
+      scanIndices.push_back(IndexRange(rowStart, k > 0 ? k - 1 : 0));
+    }
+  }
+
+  /** \brief Compute the neighbor terms of the compacted cloud.
+   *
+   * @param curvatureRegion the number of points on each side of a point used
+   * for its curvature
+   * @param scanIndices the start and end indices of each row
+   * @param terms the output neighbor terms
+   */
+  void computeNeighborTerms(const int &curvatureRegion,
+                            const std::vector<IndexRange> &scanIndices,
+                            NeighborTerms &terms) {
+    const size_t cloudSize = _cx.size();
+    terms.resize(cloudSize);
+    if (cloudSize == 0) {
+      return;
+    }
+
+    const float *x = _cx.data();
+    const float *y = _cy.data();
+    const float *z = _cz.data();
+    float *depth = terms.depth.data();
+    float *cosNext = terms.cosNext.data();
+    float *diffNext = terms.diffNext.data();
+    float *curvature = terms.curvature.data();
+
+    for (size_t k = 0; k < cloudSize; k++) {
+      depth[k] = std::sqrt(x[k] * x[k] + y[k] * y[k] + z[k] * z[k]);
+    }
+
+    // terms to the next point, the last point of a row is never queried
+    for (size_t k = 0; k + 1 < cloudSize; k++) {
+      float dx = x[k + 1] - x[k];
+      float dy = y[k + 1] - y[k];
+      float dz = z[k + 1] - z[k];
+      diffNext[k] = dx * dx + dy * dy + dz * dz;
+      cosNext[k] = (x[k] * x[k + 1] + y[k] * y[k + 1] + z[k] * z[k + 1]) /
+                   (depth[k] * depth[k + 1]);
+    }
+    diffNext[cloudSize - 1] = 0;
+    cosNext[cloudSize - 1] = 1;
+
+    // curvature from sliding window sums along each row
+    std::fill(terms.curvature.begin(), terms.curvature.end(), 0);
+    for (size_t r = 0; r < scanIndices.size(); r++) {
+      const size_t start = scanIndices[r].first;
+      const size_t end = scanIndices[r].second;
+      if (end < start) {
+        continue;
+      }
+      slidingWindowCurvature(x + start, y + start, z + start, end - start + 1,
+                             curvatureRegion, curvature + start, _scratch);
+    }
+  }
+
+  /** \brief The number of image rows. */
+  uint32_t height() const { return _height; }
+
+  /** \brief The number of image columns. */
+  uint32_t width() const { return _width; }
+
+private:
+  uint32_t _height = 0; ///< number of rows (scan rings)
+  uint32_t _width = 0;  ///< number of columns per row
+
+  std::vector<float> _x;         ///< dense image x coordinates
+  std::vector<float> _y;         ///< dense image y coordinates
+  std::vector<float> _z;         ///< dense image z coordinates
+  std::vector<float> _intensity; ///< dense image intensities
+  std::vector<uint16_t> _ring;   ///< dense image ring IDs
+  std::vector<uint8_t> _valid;   ///< dense image validity mask
+
+  std::vector<float> _cx; ///< compacted x coordinates
+  std::vector<float> _cy; ///< compacted y coordinates
+  std::vector<float> _cz; ///< compacted z coordinates
+
+  CurvatureScratch _scratch; ///< curvature kernel scratch buffers
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_RANGEIMAGE_H
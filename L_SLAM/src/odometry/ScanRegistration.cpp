@@ -1,12 +1,12 @@
 
 #include "ScanRegistration.h"
+#include "common/eigen_utils.h"
 #include "common/math_utils.h"
 #include "common/pcl_util.h"
-#include <pcl/filters/voxel_grid.h>
 #include <tf/transform_datatypes.h>
 
-#include <Eigen/Eigenvalues>
 #include <Eigen/QR>
+#include <omp.h>
 
 namespace lidar_slam {
 
@@ -25,7 +25,12 @@ RegistrationParams::RegistrationParams(
       cornerCheckEnable(cornerCheckEnable_),
       blindDegreeThreshold(blindDegreeThreshold_),
       blindThreshold(cos(deg2rad(blindDegreeThreshold))),
-      curvatureEstimateMethod(curvatureEstimateMethod_){
+      curvatureEstimateMethod(curvatureEstimateMethod_),
+      extractionThreads(1), deskewTable(true), deskewTableStep(0.001),
+      adaptiveBudget(false),
+      budgetTargetMatchTime(30), budgetTargetCorrespondences(1000),
+      budgetGain(0.5), groundSegmentation(false), groundScanRings(8),
+      groundColumns(1800), groundMaxAngle(10), groundFilterSize(0.4){
 
       };
 
@@ -43,6 +48,43 @@ bool RegistrationParams::initialize_params(ros::NodeHandle &nh) {
   lessFlatFilterSize = nh.param<float>("lessFlatFilterSize", 0.2);
   cornerCheckEnable = nh.param<bool>("cornerCheckEnable", true);
   blindDegreeThreshold = nh.param<float>("blindDegreeThreshold", 0.5);
+  extractionThreads = nh.param<int>("extractionThreads", 1);
+  deskewTable = nh.param<bool>("deskewTable", true);
+  deskewTableStep = nh.param<float>("deskewTableStep", 0.001);
+  if (!(deskewTableStep > 0)) {
+    ROS_ERROR("Invalid deskewTableStep parameter: %f (expected > 0)",
+              deskewTableStep);
+    return false;
+  }
+  adaptiveBudget = nh.param<bool>("adaptiveBudget", false);
+  budgetTargetMatchTime = nh.param<float>("budgetTargetMatchTime", 30);
+  budgetTargetCorrespondences =
+      nh.param<float>("budgetTargetCorrespondences", 1000);
+  budgetGain = nh.param<float>("budgetGain", 0.5);
+  if (budgetTargetMatchTime <= 0 || budgetTargetCorrespondences <= 0 ||
+      budgetGain <= 0 || budgetGain > 1) {
+    ROS_ERROR("Invalid adaptive budget parameters (expected targets > 0 and "
+              "0 < budgetGain <= 1)");
+    return false;
+  }
+  groundSegmentation = nh.param<bool>("groundSegmentation", false);
+  groundScanRings = nh.param<int>("groundScanRings", 8);
+  groundColumns = nh.param<int>("groundColumns", 1800);
+  groundMaxAngle = nh.param<float>("groundMaxAngle", 10);
+  groundMaxAngles = nh.param<std::vector<float>>("groundMaxAngles",
+                                                 std::vector<float>());
+  groundFilterSize = nh.param<float>("groundFilterSize", 0.4);
+  bool validAngles = groundMaxAngle > 0 && groundMaxAngle < 90;
+  for (size_t i = 0; i < groundMaxAngles.size(); i++) {
+    validAngles &= groundMaxAngles[i] > 0 && groundMaxAngles[i] < 90;
+  }
+  if (groundScanRings < 2 || groundColumns < 1 || groundFilterSize < 0 ||
+      !validAngles) {
+    ROS_ERROR("Invalid ground segmentation parameters (expected "
+              "groundScanRings >= 2, groundColumns >= 1, groundFilterSize >= "
+              "0 and ground angles in (0, 90) deg)");
+    return false;
+  }
   blindThreshold = (cos(deg2rad(blindDegreeThreshold))), param_print();
 
   return true;
@@ -52,8 +94,8 @@ ScanRegistration::ScanRegistration(const RegistrationParams &config)
     : _config(config), _sweepStart(), _scanTime(), _imuStart(), _imuCur(),
       _imuIdx(0), _imuHistory(_config.imuHistorySize), _laserCloud(),
       _cornerPointsSharp(), _cornerPointsLessSharp(), _surfacePointsFlat(),
-      _surfacePointsLessFlat(), _imuTrans(4, 1), _regionCurvature(),
-      _regionLabel(), _regionSortIndices(), _scanNeighborPicked() {}
+      _surfacePointsLessFlat(), _imuTrans(4, 1), _upAxis(1), _scanBuffers(),
+      _scanFeatures() {}
 
 bool ScanRegistration::setup(ros::NodeHandle &node,
                              ros::NodeHandle &privateNode) {
@@ -83,6 +125,24 @@ bool ScanRegistration::setup(ros::NodeHandle &node,
   _pubPointsSlop = node.advertise<sensor_msgs::PointCloud2>("/point_slop", 2);
   _pubCurvature =
       node.advertise<sensor_msgs::PointCloud2>("/point_curvature", 2);
+
+  // close the feature budget loop over the laser odometry statistics
+  if (_config.adaptiveBudget) {
+    _budgetBase = _config;
+    _budgetController.setup(_config.budgetTargetMatchTime,
+                            _config.budgetTargetCorrespondences,
+                            _config.budgetGain);
+    _subOdometryStats = node.subscribe<std_msgs::Float32MultiArray>(
+        "/laser_odometry_stats", 5, &ScanRegistration::handleOdometryStats,
+        this);
+    _pubFeatureBudget =
+        node.advertise<std_msgs::Float32MultiArray>("/feature_budget", 5);
+  }
+
+  if (_config.groundSegmentation) {
+    _pubGroundPoints =
+        node.advertise<sensor_msgs::PointCloud2>("/laser_cloud_ground", 2);
+  }
   return true;
 }
 
@@ -119,6 +179,16 @@ void ScanRegistration::handleIMUMessage(
   _imuHistory.push(newState);
 }
 
+void ScanRegistration::handleOdometryStats(
+    const std_msgs::Float32MultiArray::ConstPtr &statsIn) {
+  if (statsIn->data.size() < 3) {
+    return;
+  }
+
+  float correspondences = statsIn->data[1] + statsIn->data[2];
+  _budgetController.update(statsIn->data[0], correspondences);
+}
+
 void ScanRegistration::reset(const ros::Time &scanTime, const bool &newSweep) {
   _scanTime = scanTime;
 
@@ -142,8 +212,10 @@ void ScanRegistration::reset(const ros::Time &scanTime, const bool &newSweep) {
     _pointsBlock.clear();
     _pointsSlop.clear();
     _pointsCurvature.clear();
+    _groundPoints.clear();
     // clear scan indices vector
     _scanIndices.clear();
+    _neighborTerms.clear();
   }
 }
 
@@ -168,6 +240,33 @@ void ScanRegistration::transformToStartIMU(PointIN &point) {
   rotateYXZ(point, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
 }
 
+void ScanRegistration::buildDeskewTable(const float &beginTime,
+                                        const float &endTime) {
+  _deskewTable.reset(_config.deskewTableStep, beginTime, endTime);
+
+  for (size_t k = 0; k < _deskewTable.size(); k++) {
+    setIMUTransformFor(_deskewTable.time(k));
+
+    // the de-skew transform is affine, so sample it on the basis vectors
+    Eigen::Matrix3f rotation;
+    for (int axis = 0; axis < 3; axis++) {
+      Vector3 basis;
+      basis(axis) = 1;
+      rotateZXY(basis, _imuCur.roll, _imuCur.pitch, _imuCur.yaw);
+      rotateYXZ(basis, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
+      rotation.col(axis) = basis.head<3>();
+    }
+
+    Vector3 translation = _imuPositionShift;
+    rotateYXZ(translation, -_imuStart.yaw, -_imuStart.pitch, -_imuStart.roll);
+
+    _deskewTable.set(k, rotation, translation.head<3>());
+  }
+
+  // restart the forward IMU history search
+  _imuIdx = 0;
+}
+
 void ScanRegistration::interpolateIMUStateFor(const float &relTime,
                                               IMUState &outputState) {
   double timeDiff = (_scanTime - _imuHistory[_imuIdx].stamp).toSec() + relTime;
@@ -187,298 +286,476 @@ void ScanRegistration::interpolateIMUStateFor(const float &relTime,
   }
 }
 
+void ScanRegistration::applyFeatureBudget() {
+  _config.nFeatureRegions =
+      _budgetController.featureRegions(_budgetBase.nFeatureRegions);
+  _config.maxCornerSharp =
+      _budgetController.featuresPerRegion(_budgetBase.maxCornerSharp);
+  _config.maxCornerLessSharp =
+      _budgetController.featuresPerRegion(_budgetBase.maxCornerLessSharp);
+  _config.maxSurfaceFlat =
+      _budgetController.featuresPerRegion(_budgetBase.maxSurfaceFlat);
+  _config.lessFlatFilterSize =
+      _budgetController.filterSize(_budgetBase.lessFlatFilterSize);
+
+  // publish the chosen budget for monitoring
+  _featureBudgetMsg.data.resize(6);
+  _featureBudgetMsg.data[0] = _budgetController.scale();
+  _featureBudgetMsg.data[1] = _config.nFeatureRegions;
+  _featureBudgetMsg.data[2] = _config.maxCornerSharp;
+  _featureBudgetMsg.data[3] = _config.maxCornerLessSharp;
+  _featureBudgetMsg.data[4] = _config.maxSurfaceFlat;
+  _featureBudgetMsg.data[5] = _config.lessFlatFilterSize;
+  _pubFeatureBudget.publish(_featureBudgetMsg);
+}
+
 void ScanRegistration::extractFeatures(const uint16_t &beginIdx) {
-  // extract features from individual scans
+  if (_config.adaptiveBudget) {
+    applyFeatureBudget();
+  }
 
-  int blind_points = 0;
-  int slope_points = 0;
-  int block_points = 0;
-  int lessFlat_points = 0;
-  int mindis_points = 0;
+  segmentGround();
+
+  // extract features from individual scans
   size_t nScans = _scanIndices.size();
+  if (_scanFeatures.size() < nScans) {
+    _scanFeatures.resize(nScans);
+  }
+
+  int nThreads = _config.extractionThreads > 0 ? _config.extractionThreads
+                                               : omp_get_max_threads();
+  if (_scanBuffers.size() < size_t(nThreads)) {
+    _scanBuffers.resize(nThreads);
+  }
+
+  if (nThreads > 1) {
+#pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+    for (int i = beginIdx; i < int(nScans); i++) {
+      extractScanFeatures(i, _scanBuffers[omp_get_thread_num()],
+                          _scanFeatures[i]);
+    }
+  } else {
+    for (size_t i = beginIdx; i < nScans; i++) {
+      extractScanFeatures(i, _scanBuffers[0], _scanFeatures[i]);
+    }
+  }
+
+  // merge the scan features in scan order, so the result does not depend on
+  // the thread scheduling
   for (size_t i = beginIdx; i < nScans; i++) {
-    CloudI::Ptr surfPointsLessFlatScan(new CloudI);
-    size_t scanStartIdx = _scanIndices[i].first;
-    size_t scanEndIdx = _scanIndices[i].second;
+    const ScanFeatures &features = _scanFeatures[i];
+    _cornerPointsSharp += features.cornerPointsSharp;
+    _cornerPointsLessSharp += features.cornerPointsLessSharp;
+    _surfacePointsFlat += features.surfacePointsFlat;
+    _surfacePointsLessFlat += features.surfacePointsLessFlat;
+    _pointsBlind += features.pointsBlind;
+    _pointsBlock += features.pointsBlock;
+    _pointsSlop += features.pointsSlop;
+    _pointsCurvature += features.pointsCurvature;
+  }
+/*
+  ROS_WARN("sharp:%zu, less sharp:%zu", _cornerPointsSharp.points.size(),
+           _cornerPointsLessSharp.points.size());
+  ROS_WARN("surf:%zu, less surf:%zu", _surfacePointsFlat.points.size(),
+           _surfacePointsLessFlat.points.size());
+  ROS_WARN("blind:%zu, slop:%zu", _pointsBlind.points.size(),
+           _pointsSlop.points.size());
+  ROS_WARN("block:%zu", _pointsBlock.points.size());
+  ROS_WARN("Curv:%zu", _pointsCurvature.points.size());*/
+}
 
-    // skip empty scans
-    if (scanEndIdx <= scanStartIdx + 2 * _config.curvatureRegion) {
+void ScanRegistration::segmentGround() {
+  _groundLabel.clear();
+  if (!_config.groundSegmentation || _scanIndices.size() < 2) {
+    return;
+  }
+  _groundLabel.assign(_laserCloud.size(), 0);
+
+  // the horizontal axes of the cloud
+  const int axisA = _upAxis == 1 ? 2 : 0;
+  const int axisB = _upAxis == 1 ? 0 : 1;
+
+  // the rings are ordered bottom up or top down depending on the front end,
+  // compare the elevation of the first points of the outermost rings
+  const size_t nScans = _scanIndices.size();
+  const size_t lastScan = nScans - 1;
+  size_t first = 0, last = lastScan;
+  while (first < last &&
+         _scanIndices[first].second <= _scanIndices[first].first) {
+    first++;
+  }
+  while (last > first &&
+         _scanIndices[last].second <= _scanIndices[last].first) {
+    last--;
+  }
+  if (first == last) {
+    return;
+  }
+  const PointIN &firstPoint = _laserCloud[_scanIndices[first].first];
+  const PointIN &lastPoint = _laserCloud[_scanIndices[last].first];
+  const bool bottomUp =
+      firstPoint.data[_upAxis] / calcPointDistance(firstPoint) <=
+      lastPoint.data[_upAxis] / calcPointDistance(lastPoint);
+
+  // bin the points of the lowest rings into azimuth columns
+  const size_t nRings = std::min(nScans, size_t(_config.groundScanRings));
+  const size_t nColumns = _config.groundColumns;
+  _groundImage.assign(nRings * nColumns, -1);
+  for (size_t r = 0; r < nRings; r++) {
+    const IndexRange &range = _scanIndices[bottomUp ? r : lastScan - r];
+    if (range.second <= range.first) {
       continue;
     }
+    int *row = &_groundImage[r * nColumns];
+    for (size_t idx = range.first; idx <= range.second; idx++) {
+      const PointIN &point = _laserCloud[idx];
+      float azimuth = fastAtan2(point.data[axisB], point.data[axisA]);
+      int col = int((azimuth + float(M_PI)) * nColumns / float(2 * M_PI));
+      col = std::max(0, std::min(int(nColumns) - 1, col));
+      if (row[col] < 0) {
+        row[col] = int(idx);
+      }
+    }
+  }
 
-    // reset scan buffers
-    setScanBuffersFor(scanStartIdx, scanEndIdx);
+  // compare the slope between vertically adjacent points with the ring pair
+  // threshold
+  for (size_t r = 0; r + 1 < nRings; r++) {
+    float maxAngle = _config.groundMaxAngle;
+    if (!_config.groundMaxAngles.empty()) {
+      maxAngle = _config.groundMaxAngles[std::min(
+          r, _config.groundMaxAngles.size() - 1)];
+    }
+    const float maxSlope = std::tan(deg2rad(maxAngle));
 
-    // for debug
-    /*
-    for (int i = scanStartIdx; i <= scanEndIdx; i++) {
-      switch (_scanNeighborPicked[i]) {
-      case 4: {
-        blind_points++;
-        break;
-      }
-      case 3: {
-        blind_points++;
-        break;
-      }
-      case 2: {
-        blind_points++;
-        break;
-      }
-      case 1: {
-        slope_points++;
-        break;
+    const int *lower = &_groundImage[r * nColumns];
+    const int *upper = &_groundImage[(r + 1) * nColumns];
+    for (size_t col = 0; col < nColumns; col++) {
+      if (lower[col] < 0 || upper[col] < 0) {
+        continue;
       }
+      const PointIN &p1 = _laserCloud[lower[col]];
+      const PointIN &p2 = _laserCloud[upper[col]];
+      float dA = p2.data[axisA] - p1.data[axisA];
+      float dB = p2.data[axisB] - p1.data[axisB];
+      float dUp = p2.data[_upAxis] - p1.data[_upAxis];
+      if (std::fabs(dUp) <= maxSlope * std::sqrt(dA * dA + dB * dB)) {
+        _groundLabel[lower[col]] = 1;
+        _groundLabel[upper[col]] = 1;
       }
     }
-    */
-    // for debug visulization
-    /*
-    for (int ii = scanStartIdx; ii <= scanEndIdx; ii++) {
-      if (_scanNeighborPicked[ii - scanStartIdx] == 4) {
-        _pointsBlind.push_back(toXYZI(_laserCloud[ii]));
-      } else if (_scanNeighborPicked[ii - scanStartIdx] > 1) {
-        _pointsBlock.push_back(toXYZI(_laserCloud[ii]));
-      } else if (_scanNeighborPicked[ii - scanStartIdx] == 1) {
-        _pointsSlop.push_back(toXYZI(_laserCloud[ii]));
-      }
-    }*/
-
-    // extract features from equally sized scan regions
-    for (int j = 0; j < _config.nFeatureRegions; j++) {
-      size_t sp = ((scanStartIdx + _config.curvatureRegion) *
-                       (_config.nFeatureRegions - j) +
-                   (scanEndIdx - _config.curvatureRegion) * j) /
-                  _config.nFeatureRegions;
-      size_t ep = ((scanStartIdx + _config.curvatureRegion) *
-                       (_config.nFeatureRegions - 1 - j) +
-                   (scanEndIdx - _config.curvatureRegion) * (j + 1)) /
-                      _config.nFeatureRegions -
-                  1;
-
-      // skip empty regions
-      if (ep <= sp) {
-        continue;
+  }
+
+  // collect the ground points ring by ring, so the cloud stays sorted by ring
+  _groundFilter.setLeafSize(_config.groundFilterSize);
+  for (size_t r = 0; r < nRings; r++) {
+    const IndexRange &range = _scanIndices[bottomUp ? r : lastScan - r];
+    if (range.second <= range.first) {
+      continue;
+    }
+    _groundScan.clear();
+    for (size_t idx = range.first; idx <= range.second; idx++) {
+      if (_groundLabel[idx]) {
+        _groundScan.push_back(toXYZI(_laserCloud[idx]));
       }
+    }
+    if (_config.groundFilterSize > 0) {
+      _groundFilter.filter(_groundScan, _groundScanDS);
+      _groundPoints += _groundScanDS;
+    } else {
+      _groundPoints += _groundScan;
+    }
+  }
+}
+
+void ScanRegistration::extractScanFeatures(const size_t &scanIdx,
+                                           ScanBuffers &buffers,
+                                           ScanFeatures &features) {
+  features.clear();
+  buffers.lessFlatScan.clear();
 
-      size_t regionSize = ep - sp + 1;
-      setRegionBuffersFor(sp, ep);
+  size_t scanStartIdx = _scanIndices[scanIdx].first;
+  size_t scanEndIdx = _scanIndices[scanIdx].second;
 
-      // extract flat surface features
-      int surfPickedNum = 0;
-      for (int k = 0; k < regionSize && surfPickedNum < _config.maxSurfaceFlat;
-           k++) {
-        size_t idx = _regionSortIndices[k];
-        size_t scanIdx = idx - scanStartIdx;
-        size_t regionIdx = idx - sp;
+  // skip empty scans
+  if (scanEndIdx <= scanStartIdx + 2 * _config.curvatureRegion) {
+    return;
+  }
 
-        if (_scanNeighborPicked[scanIdx] != SURF_PICKED_NEAR &&
-            _regionCurvature[regionIdx] < _config.surfaceCurvatureThreshold) {
+  // reset scan buffers
+  setScanBuffersFor(scanStartIdx, scanEndIdx, buffers);
 
-          surfPickedNum++;
-          _regionLabel[regionIdx] = SURFACE_FLAT;
-          _surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
+  // for debug
+  /*
+  for (int i = scanStartIdx; i <= scanEndIdx; i++) {
+    switch (buffers.scanNeighborPicked[i]) {
+    case 4: {
+      blind_points++;
+      break;
+    }
+    case 3: {
+      blind_points++;
+      break;
+    }
+    case 2: {
+      blind_points++;
+      break;
+    }
+    case 1: {
+      slope_points++;
+      break;
+    }
+    }
+  }
+  */
+  // for debug visulization
+  /*
+  for (int ii = scanStartIdx; ii <= scanEndIdx; ii++) {
+    if (buffers.scanNeighborPicked[ii - scanStartIdx] == 4) {
+      features.pointsBlind.push_back(toXYZI(_laserCloud[ii]));
+    } else if (buffers.scanNeighborPicked[ii - scanStartIdx] > 1) {
+      features.pointsBlock.push_back(toXYZI(_laserCloud[ii]));
+    } else if (buffers.scanNeighborPicked[ii - scanStartIdx] == 1) {
+      features.pointsSlop.push_back(toXYZI(_laserCloud[ii]));
+    }
+  }*/
+
+  // extract features from equally sized scan regions
+  for (int j = 0; j < _config.nFeatureRegions; j++) {
+    size_t sp = ((scanStartIdx + _config.curvatureRegion) *
+                     (_config.nFeatureRegions - j) +
+                 (scanEndIdx - _config.curvatureRegion) * j) /
+                _config.nFeatureRegions;
+    size_t ep = ((scanStartIdx + _config.curvatureRegion) *
+                     (_config.nFeatureRegions - 1 - j) +
+                 (scanEndIdx - _config.curvatureRegion) * (j + 1)) /
+                    _config.nFeatureRegions -
+                1;
+
+    // skip empty regions
+    if (ep <= sp) {
+      continue;
+    }
 
-          markAsPicked(idx, scanIdx, SURF_PICKED_NEAR);
-        }
+    size_t regionSize = ep - sp + 1;
+    setRegionBuffersFor(sp, ep, buffers);
+
+    // extract flat surface features
+    int surfPickedNum = 0;
+    for (int k = 0; k < regionSize && surfPickedNum < _config.maxSurfaceFlat;
+         k++) {
+      size_t idx = buffers.regionSortIndices[k];
+      size_t scanIdx = idx - scanStartIdx;
+      size_t regionIdx = idx - sp;
+
+      if (buffers.scanNeighborPicked[scanIdx] != SURF_PICKED_NEAR &&
+          buffers.regionCurvature[regionIdx] < _config.surfaceCurvatureThreshold) {
+
+        surfPickedNum++;
+        buffers.regionLabel[regionIdx] = SURFACE_FLAT;
+        features.surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
+
+        markAsPicked(idx, scanIdx, buffers, SURF_PICKED_NEAR);
       }
+    }
 
-      // extract less flat surface features and edge_broken
-      for (int k = 0; k < regionSize; k++) {
-        size_t idx = sp + k;
-        size_t scanIdx = idx - scanStartIdx;
+    // extract less flat surface features and edge_broken
+    for (int k = 0; k < regionSize; k++) {
+      size_t idx = sp + k;
+      size_t scanIdx = idx - scanStartIdx;
 
-        if (_regionCurvature[k] < _config.surfaceCurvatureThreshold) {
-          surfPointsLessFlatScan->push_back(toXYZI(_laserCloud[idx]));
-          mindis_points++;
-          if (_regionLabel[k] != SURFACE_FLAT)
-            _regionLabel[k] = SURFACE_LESS_FLAT;
-        }
-        if (_scanNeighborPicked[scanIdx] == EDGE_BROKEN) {
-          _cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
-          _cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
-          _regionLabel[k] = CORNER_SHARP;
-          _pointsBlock.push_back(toXYZI(_laserCloud[idx]));
-        }
+      if (buffers.regionCurvature[k] < _config.surfaceCurvatureThreshold) {
+        buffers.lessFlatScan.push_back(toXYZI(_laserCloud[idx]));
+        if (buffers.regionLabel[k] != SURFACE_FLAT)
+          buffers.regionLabel[k] = SURFACE_LESS_FLAT;
       }
+      if (buffers.scanNeighborPicked[scanIdx] == EDGE_BROKEN &&
+          !isGround(idx)) {
+        features.cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
+        features.cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
+        buffers.regionLabel[k] = CORNER_SHARP;
+        features.pointsBlock.push_back(toXYZI(_laserCloud[idx]));
+      }
+    }
 
-      // extract  features
-      int cornerPickedNum = 0;
-      surfPickedNum = 0;
-      for (size_t k = regionSize; k > 0;) {
-        size_t idx = _regionSortIndices[--k];
-        size_t scanIdx = idx - scanStartIdx;
-        size_t regionIdx = idx - sp;
+    // extract  features
+    int cornerPickedNum = 0;
+    surfPickedNum = 0;
+    for (size_t k = regionSize; k > 0;) {
+      size_t idx = buffers.regionSortIndices[--k];
+      size_t scanIdx = idx - scanStartIdx;
+      size_t regionIdx = idx - sp;
 
-        if (_regionCurvature[regionIdx] < _config.surfaceCurvatureThreshold)
-          break;
+      if (buffers.regionCurvature[regionIdx] < _config.surfaceCurvatureThreshold)
+        break;
 
-        int point_label = pointClassify(idx);
-        switch (point_label) {
-        case MESSY: {
-          //_pointsBlock.push_back(toXYZI(_laserCloud[idx]));
-          break;
-        }
-        case SURFACE_FLAT: {
-          _regionLabel[regionIdx] = SURFACE_FLAT;
-          if (surfPickedNum < _config.maxSurfaceFlat) {
-            surfPickedNum++;
-            //_surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
-          }
-          surfPointsLessFlatScan->push_back(toXYZI(_laserCloud[idx]));
-          _pointsBlind.push_back(toXYZI(_laserCloud[idx]));
-          break;
-        }
-        case CORNER_SHARP: {
-          if (_scanNeighborPicked[scanIdx] > EDGE_BROKEN) {
-            _regionLabel[regionIdx] = CORNER_SHARP;
-            if (cornerPickedNum < _config.maxCornerSharp) {
-              cornerPickedNum++;
-              _cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
-            }
-            _cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
-            _pointsSlop.push_back(toXYZI(_laserCloud[idx]));
-          }
-          break;
+      int point_label = pointClassify(idx);
+      switch (point_label) {
+      case MESSY: {
+        //features.pointsBlock.push_back(toXYZI(_laserCloud[idx]));
+        break;
+      }
+      case SURFACE_FLAT: {
+        buffers.regionLabel[regionIdx] = SURFACE_FLAT;
+        if (surfPickedNum < _config.maxSurfaceFlat) {
+          surfPickedNum++;
+          //features.surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
         }
-        case ONESIDE_FLAT: {
-          _regionLabel[regionIdx] = ONESIDE_FLAT;
-          if (surfPickedNum < _config.maxSurfaceFlat) {
-            surfPickedNum++;
-            _surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
+        buffers.lessFlatScan.push_back(toXYZI(_laserCloud[idx]));
+        features.pointsBlind.push_back(toXYZI(_laserCloud[idx]));
+        break;
+      }
+      case CORNER_SHARP: {
+        if (buffers.scanNeighborPicked[scanIdx] > EDGE_BROKEN &&
+            !isGround(idx)) {
+          buffers.regionLabel[regionIdx] = CORNER_SHARP;
+          if (cornerPickedNum < _config.maxCornerSharp) {
+            cornerPickedNum++;
+            features.cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
           }
-          surfPointsLessFlatScan->push_back(toXYZI(_laserCloud[idx]));
-          _pointsCurvature.push_back(toXYZI(_laserCloud[idx]));
-          break;
+          features.cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
+          features.pointsSlop.push_back(toXYZI(_laserCloud[idx]));
         }
+        break;
+      }
+      case ONESIDE_FLAT: {
+        buffers.regionLabel[regionIdx] = ONESIDE_FLAT;
+        if (surfPickedNum < _config.maxSurfaceFlat) {
+          surfPickedNum++;
+          features.surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
         }
-        /*
-        if (point_label == 0) {
-          _pointsBlock.push_back(toXYZI(_laserCloud[idx]));
-          continue;
-
-        } else if (point_label == 1) {
-          _regionLabel[regionIdx] = SURFACE_FLAT;
-          //_surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
-          surfPointsLessFlatScan->push_back(toXYZI(_laserCloud[idx]));
-          _pointsBlind.push_back(toXYZI(_laserCloud[idx]));
-
-          // markAsPicked(idx, scanIdx, 12);
-        } else if (point_label == 2 && _scanNeighborPicked[scanIdx] == 0) {
-          _regionLabel[regionIdx] = CORNER_SHARP;
-          _cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
-          _cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
-          _pointsSlop.push_back(toXYZI(_laserCloud[idx]));
-
-        } else if (point_label == 3) {
-          _regionLabel[regionIdx] = SURFACE_FLAT;
-          //_surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
-          surfPointsLessFlatScan->push_back(toXYZI(_laserCloud[idx]));
-
-          if (_scanNeighborPicked[scanIdx] == 0 &&
-              _regionCurvature[regionIdx] > 9.0) {
-            _regionLabel[regionIdx] = CORNER_SHARP;
-            _cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
-            _cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
-            // markAsPicked(idx, scanIdx, 13);
-            _pointsCurvature.push_back(toXYZI(_laserCloud[idx]));
-          }
-        }*/
+        buffers.lessFlatScan.push_back(toXYZI(_laserCloud[idx]));
+        features.pointsCurvature.push_back(toXYZI(_laserCloud[idx]));
+        break;
       }
-    }
+      }
+      /*
+      if (point_label == 0) {
+        features.pointsBlock.push_back(toXYZI(_laserCloud[idx]));
+        continue;
 
-    // down size less flat surface point cloud of current scan
-    CloudI surfPointsLessFlatScanDS;
-    pcl::VoxelGrid<PointI> downSizeFilter;
-    downSizeFilter.setInputCloud(surfPointsLessFlatScan);
-    downSizeFilter.setLeafSize(_config.lessFlatFilterSize,
-                               _config.lessFlatFilterSize,
-                               _config.lessFlatFilterSize);
-    downSizeFilter.filter(surfPointsLessFlatScanDS);
-    lessFlat_points += surfPointsLessFlatScan->points.size();
-    _surfacePointsLessFlat += surfPointsLessFlatScanDS;
+      } else if (point_label == 1) {
+        buffers.regionLabel[regionIdx] = SURFACE_FLAT;
+        //features.surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
+        buffers.lessFlatScan.push_back(toXYZI(_laserCloud[idx]));
+        features.pointsBlind.push_back(toXYZI(_laserCloud[idx]));
+
+        // markAsPicked(idx, scanIdx, 12);
+      } else if (point_label == 2 && buffers.scanNeighborPicked[scanIdx] == 0) {
+        buffers.regionLabel[regionIdx] = CORNER_SHARP;
+        features.cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
+        features.cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
+        features.pointsSlop.push_back(toXYZI(_laserCloud[idx]));
+
+      } else if (point_label == 3) {
+        buffers.regionLabel[regionIdx] = SURFACE_FLAT;
+        //features.surfacePointsFlat.push_back(toXYZI(_laserCloud[idx]));
+        buffers.lessFlatScan.push_back(toXYZI(_laserCloud[idx]));
+
+        if (buffers.scanNeighborPicked[scanIdx] == 0 &&
+            buffers.regionCurvature[regionIdx] > 9.0) {
+          buffers.regionLabel[regionIdx] = CORNER_SHARP;
+          features.cornerPointsSharp.push_back(toXYZI(_laserCloud[idx]));
+          features.cornerPointsLessSharp.push_back(toXYZI(_laserCloud[idx]));
+          // markAsPicked(idx, scanIdx, 13);
+          features.pointsCurvature.push_back(toXYZI(_laserCloud[idx]));
+        }
+      }*/
+    }
   }
-/*
-  std::cout << "[Features:]\n"
-            << " ,blind_points:" << blind_points
-            << " ,slope_points:" << slope_points
-            << " ,block_points:" << block_points
-            << " ,totoal_points:" << _scanIndices[nScans - 1].second
-            << " ,lessFlat_points:" << lessFlat_points
-            << " ,mindis_points:" << mindis_points << std::endl;
 
-  ROS_WARN("sharp:%zu, less sharp:%zu", _cornerPointsSharp.points.size(),
-           _cornerPointsLessSharp.points.size());
-  ROS_WARN("surf:%zu, less surf:%zu", _surfacePointsFlat.points.size(),
-           _surfacePointsLessFlat.points.size());
-  ROS_WARN("blind:%zu, slop:%zu", _pointsBlind.points.size(),
-           _pointsSlop.points.size());
-  ROS_WARN("block:%zu", _pointsBlock.points.size());
-  ROS_WARN("Curv:%zu", _pointsCurvature.points.size());*/
+  // down size less flat surface point cloud of current scan
+  buffers.downSizeFilter.setLeafSize(_config.lessFlatFilterSize);
+  buffers.downSizeFilter.filter(buffers.lessFlatScan,
+                                features.surfacePointsLessFlat);
 }
 
 void ScanRegistration::setRegionBuffersFor(const size_t &startIdx,
-                                           const size_t &endIdx) {
+                                           const size_t &endIdx,
+                                           ScanBuffers &buffers) {
   // resize buffers
   size_t regionSize = endIdx - startIdx + 1;
-  _regionCurvature.resize(regionSize);
-  _regionSortIndices.resize(regionSize);
-  _swapRegionSortIndices.resize(regionSize);
-  _regionLabel.assign(regionSize, UNKNOW);
-
-  // calculate point curvatures and reset sort indices
-  float pointWeight = -2 * _config.curvatureRegion;
-
-  for (size_t i = startIdx, regionIdx = 0; i <= endIdx; i++, regionIdx++) {
-    float diffX = pointWeight * _laserCloud[i].x;
-    float diffY = pointWeight * _laserCloud[i].y;
-    float diffZ = pointWeight * _laserCloud[i].z;
-
-    for (int j = 1; j <= _config.curvatureRegion; j++) {
-      diffX += _laserCloud[i + j].x + _laserCloud[i - j].x;
-      diffY += _laserCloud[i + j].y + _laserCloud[i - j].y;
-      diffZ += _laserCloud[i + j].z + _laserCloud[i - j].z;
-    }
-
-    _regionCurvature[regionIdx] = diffX * diffX + diffY * diffY + diffZ * diffZ;
-    _regionSortIndices[regionIdx] = i - startIdx;
+  buffers.regionCurvature.resize(regionSize);
+  buffers.regionSortIndices.resize(regionSize);
+  buffers.swapRegionSortIndices.resize(regionSize);
+  buffers.regionLabel.assign(regionSize, UNKNOW);
+
+  // copy the point curvatures computed per scan and reset sort indices
+  std::copy(buffers.scanCurvature.begin() + (startIdx - buffers.scanStartIdx),
+            buffers.scanCurvature.begin() + (endIdx + 1 - buffers.scanStartIdx),
+            buffers.regionCurvature.begin());
+  for (size_t regionIdx = 0; regionIdx < regionSize; regionIdx++) {
+    buffers.regionSortIndices[regionIdx] = regionIdx;
   }
 
   // printf("40 * %d * %d * 8.5 = %d\n", _config.nFeatureRegions, regionSize, 40 * _config.nFeatureRegions * regionSize * 8.5);
   // sort point curvatures
-  mergeSort(_regionSortIndices, 0, regionSize - 1, _swapRegionSortIndices);
+  mergeSort(buffers.regionCurvature, buffers.regionSortIndices, 0,
+            regionSize - 1, buffers.swapRegionSortIndices);
   for(int i = 0; i < regionSize; i ++)
-    _regionSortIndices[i] = _regionSortIndices[i] + startIdx;
+    buffers.regionSortIndices[i] = buffers.regionSortIndices[i] + startIdx;
   // for (size_t i = 1; i < regionSize; i++) {
   //   for (size_t j = i; j >= 1; j--) {
-  //     if (_regionCurvature[_regionSortIndices[j] - startIdx] <
-  //         _regionCurvature[_regionSortIndices[j - 1] - startIdx]) {
-  //       std::swap(_regionSortIndices[j], _regionSortIndices[j - 1]);
+  //     if (buffers.regionCurvature[buffers.regionSortIndices[j] - startIdx] <
+  //         buffers.regionCurvature[buffers.regionSortIndices[j - 1] - startIdx]) {
+  //       std::swap(buffers.regionSortIndices[j], buffers.regionSortIndices[j - 1]);
   //     }
   //   }
   // }
 }
 
 void ScanRegistration::setScanBuffersFor(const size_t &startIdx,
-                                         const size_t &endIdx) {
+                                         const size_t &endIdx,
+                                         ScanBuffers &buffers) {
   // resize buffers
   size_t scanSize = endIdx - startIdx + 1;
-  _scanNeighborPicked.assign(scanSize, 0);
+  buffers.scanNeighborPicked.assign(scanSize, 0);
+
+  // use the neighbor terms of a range image front end if available
+  const bool precomputed = _neighborTerms.size() == _laserCloud.size();
+
+  // calculate the curvature of all scan points in a single pass
+  buffers.scanStartIdx = startIdx;
+  buffers.scanCurvature.resize(scanSize);
+  if (precomputed) {
+    std::copy(_neighborTerms.curvature.begin() + startIdx,
+              _neighborTerms.curvature.begin() + endIdx + 1,
+              buffers.scanCurvature.begin());
+  } else {
+    buffers.scanX.resize(scanSize);
+    buffers.scanY.resize(scanSize);
+    buffers.scanZ.resize(scanSize);
+    for (size_t i = 0; i < scanSize; i++) {
+      const PointIN &point = _laserCloud[startIdx + i];
+      buffers.scanX[i] = point.x;
+      buffers.scanY[i] = point.y;
+      buffers.scanZ[i] = point.z;
+    }
+    slidingWindowCurvature(buffers.scanX.data(), buffers.scanY.data(),
+                           buffers.scanZ.data(), scanSize,
+                           _config.curvatureRegion,
+                           buffers.scanCurvature.data(),
+                           buffers.curvatureScratch);
+  }
 
   for (int i = 0; i < _config.curvatureRegion; ++i) {
     const PointIN &point = (_laserCloud[startIdx + i]);
     const PointIN &nextPoint = (_laserCloud[startIdx + i + 1]);
-    if (calcCosAngleDiff(point, nextPoint) < _config.blindThreshold) {
-      std::fill_n(&_scanNeighborPicked[i], _config.curvatureRegion + 1,
+    float cosNext = precomputed ? _neighborTerms.cosNext[startIdx + i]
+                                : calcCosAngleDiff(point, nextPoint);
+    if (cosNext < _config.blindThreshold) {
+      std::fill_n(&buffers.scanNeighborPicked[i], _config.curvatureRegion + 1,
                   BLIND_BLOCK);
     }
   }
   for (int i = 0; i < _config.curvatureRegion; ++i) {
     const PointIN &point = (_laserCloud[endIdx - i]);
     const PointIN &previousPoint = (_laserCloud[endIdx - i - 1]);
-    if (calcCosAngleDiff(point, previousPoint) < _config.blindThreshold) {
+    float cosPrev = precomputed ? _neighborTerms.cosNext[endIdx - i - 1]
+                                : calcCosAngleDiff(point, previousPoint);
+    if (cosPrev < _config.blindThreshold) {
       std::fill_n(
-          &_scanNeighborPicked[endIdx - i - startIdx - _config.curvatureRegion],
+          &buffers.scanNeighborPicked[endIdx - i - startIdx - _config.curvatureRegion],
           _config.curvatureRegion + 1, BLIND_BLOCK);
     }
   }
@@ -490,31 +767,37 @@ void ScanRegistration::setScanBuffersFor(const size_t &startIdx,
     const PointIN &point = (_laserCloud[i]);
     const PointIN &nextPoint = (_laserCloud[i + 1]);
 
-    float diffNext = calcSquaredDiff(nextPoint, point);
-    if (calcCosAngleDiff(point, nextPoint) < _config.blindThreshold) {
+    float diffNext = precomputed ? _neighborTerms.diffNext[i]
+                                 : calcSquaredDiff(nextPoint, point);
+    float cosNext = precomputed ? _neighborTerms.cosNext[i]
+                                : calcCosAngleDiff(point, nextPoint);
+    if (cosNext < _config.blindThreshold) {
       std::fill_n(
-          &_scanNeighborPicked[i - startIdx - _config.curvatureRegion + 1],
+          &buffers.scanNeighborPicked[i - startIdx - _config.curvatureRegion + 1],
           _config.curvatureRegion * 2, BLIND_BLOCK);
       continue;
     }
 
     if (diffNext > 1.0) {
-      float depth1 = calcPointDistance(point);
-      float depth2 = calcPointDistance(nextPoint);
-      float diffPrev = calcSquaredDiff(previousPoint, point);
+      float depth1 = precomputed ? _neighborTerms.depth[i]
+                                 : calcPointDistance(point);
+      float depth2 = precomputed ? _neighborTerms.depth[i + 1]
+                                 : calcPointDistance(nextPoint);
+      float diffPrev = precomputed ? _neighborTerms.diffNext[i - 1]
+                                   : calcSquaredDiff(previousPoint, point);
       if (depth1 > depth2) {
-        if (_scanNeighborPicked[i - startIdx + 1] > NEAR_BLOCK &&
+        if (buffers.scanNeighborPicked[i - startIdx + 1] > NEAR_BLOCK &&
             diffPrev / diffNext < 0.2)
-          _scanNeighborPicked[i - startIdx + 1] = EDGE_BROKEN;
+          buffers.scanNeighborPicked[i - startIdx + 1] = EDGE_BROKEN;
         std::fill_n(
-            &_scanNeighborPicked[i - startIdx - _config.curvatureRegion + 1],
+            &buffers.scanNeighborPicked[i - startIdx - _config.curvatureRegion + 1],
             _config.curvatureRegion, NEAR_BLOCK);
 
       } else {
-        if (_scanNeighborPicked[i - startIdx] > NEAR_BLOCK &&
+        if (buffers.scanNeighborPicked[i - startIdx] > NEAR_BLOCK &&
             diffPrev / diffNext < 0.2)
-          _scanNeighborPicked[i - startIdx] = EDGE_BROKEN;
-        std::fill_n(&_scanNeighborPicked[i - startIdx + 1],
+          buffers.scanNeighborPicked[i - startIdx] = EDGE_BROKEN;
+        std::fill_n(&buffers.scanNeighborPicked[i - startIdx + 1],
                     _config.curvatureRegion, NEAR_BLOCK);
       }
     }
@@ -522,8 +805,9 @@ void ScanRegistration::setScanBuffersFor(const size_t &startIdx,
 }
 
 void ScanRegistration::markAsPicked(const size_t &cloudIdx,
-                                    const size_t &scanIdx, int label) {
-  _scanNeighborPicked[scanIdx] = label;
+                                    const size_t &scanIdx,
+                                    ScanBuffers &buffers, int label) {
+  buffers.scanNeighborPicked[scanIdx] = label;
 
   for (int i = 1; i <= _config.curvatureRegion; i++) {
     // if (calcSquaredDiff(_laserCloud[cloudIdx + i],
@@ -531,7 +815,7 @@ void ScanRegistration::markAsPicked(const size_t &cloudIdx,
     //  break;
     //}
 
-    _scanNeighborPicked[scanIdx + i] = label;
+    buffers.scanNeighborPicked[scanIdx + i] = label;
   }
 
   for (int i = 1; i <= _config.curvatureRegion; i++) {
@@ -540,114 +824,77 @@ void ScanRegistration::markAsPicked(const size_t &cloudIdx,
     //  break;
     //}
 
-    _scanNeighborPicked[scanIdx - i] = label;
+    buffers.scanNeighborPicked[scanIdx - i] = label;
   }
 }
 
 int ScanRegistration::pointClassify(const size_t &cloudIdx) {
 
-  Eigen::Matrix3f _lineMatA;
-  Eigen::Matrix<float, 1, 3> _lineMatD;
-  Eigen::Matrix3f _lineMatV;
-  Eigen::Vector3f _lineCentroid;
+  // the window before (index 0) and after (index 1) the point
+  Eigen::Matrix3f lineMatA[2];
+  Eigen::Vector3f lineMatD[2];
+  Eigen::Matrix3f lineMatV[2];
+  Eigen::Vector3f lineCentroid[2];
+  const int windowSign[2] = {1, -1};
+  const int windowSize = _config.curvatureRegion + 1;
 
-  Eigen::Vector3f v1, v2;
-  bool line1 = false;
-  bool line2 = false;
-  if (1) {
+  for (int w = 0; w < 2; w++) {
     // compute mean
-    _lineCentroid.setZero();
+    lineCentroid[w].setZero();
     for (int j = 0; j <= _config.curvatureRegion; j++) {
-      _lineCentroid += _laserCloud[cloudIdx - j].getVector3fMap();
+      lineCentroid[w] +=
+          _laserCloud[cloudIdx - windowSign[w] * j].getVector3fMap();
     }
-    _lineCentroid /= (_config.curvatureRegion + 1);
+    lineCentroid[w] /= windowSize;
 
     // compute CovarianceMatrix
-    _lineMatA.setZero();
+    lineMatA[w].setZero();
     for (int j = 0; j <= _config.curvatureRegion; j++) {
       Eigen::Vector3f a =
-          _laserCloud[cloudIdx - j].getVector3fMap() - _lineCentroid;
-      _lineMatA(0, 0) += a(0) * a(0);
-      _lineMatA(1, 0) += a(0) * a(1);
-      _lineMatA(2, 0) += a(0) * a(2);
-      _lineMatA(1, 1) += a(1) * a(1);
-      _lineMatA(2, 1) += a(1) * a(2);
-      _lineMatA(2, 2) += a(2) * a(2);
+          _laserCloud[cloudIdx - windowSign[w] * j].getVector3fMap() -
+          lineCentroid[w];
+      lineMatA[w](0, 0) += a(0) * a(0);
+      lineMatA[w](1, 0) += a(0) * a(1);
+      lineMatA[w](2, 0) += a(0) * a(2);
+      lineMatA[w](1, 1) += a(1) * a(1);
+      lineMatA[w](2, 1) += a(1) * a(2);
+      lineMatA[w](2, 2) += a(2) * a(2);
     }
-    _lineMatA /= (_config.curvatureRegion + 1);
-
-    // compute eigenvalues and eigenvectors
-    _lineMatD.setZero();
-    _lineMatV.setZero();
-    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(_lineMatA);
-    _lineMatD = esolver.eigenvalues().real();
-    _lineMatV = esolver.eigenvectors().real();
-
-    // compute corner line and coefficients
-    if (_lineMatD(0, 2) > 100 * _lineMatD(0, 1) &&
-        _lineMatD(0, 2) > 10000 * _lineMatD(0, 0)) {
-      v1 = _lineMatV.col(2);
-      line1 = true;
-      for (int j = 0; j <= _config.curvatureRegion; j++) {
-        Eigen::Vector3f a =
-            _laserCloud[cloudIdx - j].getVector3fMap() - _lineCentroid;
+    lineMatA[w] /= windowSize;
+  }
 
-        float distance = (a.cross(v1)).norm() / v1.norm();
-        if (fabs(distance) > 0.08) {
-          line1 = false;
-          break;
-        }
-      }
-    }
+  // compute eigenvalues and eigenvectors of both windows
+  for (int w = 0; w < 2; w++) {
+    symmetricEigen3(lineMatA[w], lineMatD[w], lineMatV[w]);
   }
-  if (1) {
-    _lineCentroid.setZero();
-    for (int j = -1.0 * _config.curvatureRegion; j <= 0; j++) {
-      _lineCentroid += _laserCloud[cloudIdx - j].getVector3fMap();
-    }
-    _lineCentroid /= (_config.curvatureRegion + 1);
 
-    // compute CovarianceMatrix
-    _lineMatA.setZero();
-    for (int j = -1.0 * _config.curvatureRegion; j <= 0; j++) {
-      Eigen::Vector3f a =
-          _laserCloud[cloudIdx - j].getVector3fMap() - _lineCentroid;
-
-      _lineMatA(0, 0) += a(0) * a(0);
-      _lineMatA(1, 0) += a(0) * a(1);
-      _lineMatA(2, 0) += a(0) * a(2);
-      _lineMatA(1, 1) += a(1) * a(1);
-      _lineMatA(2, 1) += a(1) * a(2);
-      _lineMatA(2, 2) += a(2) * a(2);
-    }
-    _lineMatA /= (_config.curvatureRegion + 1);
-
-    // compute eigenvalues and eigenvectors
-    _lineMatD.setZero();
-    _lineMatV.setZero();
-    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(_lineMatA);
-    _lineMatD = esolver.eigenvalues().real();
-    _lineMatV = esolver.eigenvectors().real();
-
-    // compute corner line and coefficients
-    if (_lineMatD(0, 2) > 100 * _lineMatD(0, 1) &&
-        _lineMatD(0, 2) > 10000 * _lineMatD(0, 0)) {
-
-      v2 = _lineMatV.col(2);
-      line2 = true;
-      for (int j = -1.0 * _config.curvatureRegion; j <= 0; j++) {
+  // compute corner lines and coefficients
+  Eigen::Vector3f lineDir[2];
+  bool isLine[2] = {false, false};
+  for (int w = 0; w < 2; w++) {
+    if (lineMatD[w](2) > 100 * lineMatD[w](1) &&
+        lineMatD[w](2) > 10000 * lineMatD[w](0)) {
+      lineDir[w] = lineMatV[w].col(2);
+      isLine[w] = true;
+      for (int j = 0; j <= _config.curvatureRegion; j++) {
         Eigen::Vector3f a =
-            _laserCloud[cloudIdx - j].getVector3fMap() - _lineCentroid;
+            _laserCloud[cloudIdx - windowSign[w] * j].getVector3fMap() -
+            lineCentroid[w];
 
-        float distance = (a.cross(v2)).norm() / v2.norm();
+        float distance = (a.cross(lineDir[w])).norm() / lineDir[w].norm();
         if (fabs(distance) > 0.08) {
-          line2 = false;
+          isLine[w] = false;
           break;
         }
       }
     }
   }
 
+  const bool line1 = isLine[0];
+  const bool line2 = isLine[1];
+  const Eigen::Vector3f &v1 = lineDir[0];
+  const Eigen::Vector3f &v2 = lineDir[1];
+
   if (line1 && line2) {
     float diff = calcCosAngleDiff(v1, v2);
     if (diff < cos(deg2rad(175.0)) || diff > cos(deg2rad(5.0))) {
@@ -667,19 +914,28 @@ int ScanRegistration::pointClassify(const size_t &cloudIdx) {
 
 void ScanRegistration::publishResult() {
   // publish full resolution and feature point clouds
-  publishCloudMsg(_pubLaserCloud, _laserCloud, _sweepStart, "/lidar");
-  publishCloudMsg(_pubCornerPointsSharp, _cornerPointsSharp, _sweepStart,
-                  "/lidar");
-  publishCloudMsg(_pubCornerPointsLessSharp, _cornerPointsLessSharp,
-                  _sweepStart, "/lidar");
-  publishCloudMsg(_pubSurfPointsFlat, _surfacePointsFlat, _sweepStart,
-                  "/lidar");
-  publishCloudMsg(_pubSurfPointsLessFlat, _surfacePointsLessFlat, _sweepStart,
-                  "/lidar");
-  publishCloudMsg(_pubPointsBlind, _pointsBlind, _sweepStart, "/lidar");
-  publishCloudMsg(_pubPointsBlock, _pointsBlock, _sweepStart, "/lidar");
-  publishCloudMsg(_pubPointsSlop, _pointsSlop, _sweepStart, "/lidar");
-  publishCloudMsg(_pubCurvature, _pointsCurvature, _sweepStart, "/lidar");
+  publishCloudPtr(_pubLaserCloud, _laserCloud, _sweepStart, "/lidar",
+                  _laserCloudMsg);
+  publishCloudPtr(_pubCornerPointsSharp, _cornerPointsSharp, _sweepStart,
+                  "/lidar", _cornerPointsSharpMsg);
+  publishCloudPtr(_pubCornerPointsLessSharp, _cornerPointsLessSharp,
+                  _sweepStart, "/lidar", _cornerPointsLessSharpMsg);
+  publishCloudPtr(_pubSurfPointsFlat, _surfacePointsFlat, _sweepStart,
+                  "/lidar", _surfacePointsFlatMsg);
+  publishCloudPtr(_pubSurfPointsLessFlat, _surfacePointsLessFlat, _sweepStart,
+                  "/lidar", _surfacePointsLessFlatMsg);
+  publishCloudPtr(_pubPointsBlind, _pointsBlind, _sweepStart, "/lidar",
+                  _pointsBlindMsg);
+  publishCloudPtr(_pubPointsBlock, _pointsBlock, _sweepStart, "/lidar",
+                  _pointsBlockMsg);
+  publishCloudPtr(_pubPointsSlop, _pointsSlop, _sweepStart, "/lidar",
+                  _pointsSlopMsg);
+  publishCloudPtr(_pubCurvature, _pointsCurvature, _sweepStart, "/lidar",
+                  _pointsCurvatureMsg);
+  if (_config.groundSegmentation) {
+    publishCloudPtr(_pubGroundPoints, _groundPoints, _sweepStart, "/lidar",
+                    _groundPointsMsg);
+  }
 
   // publish corresponding IMU transformation information
   _imuTrans[0].x = _imuStart.pitch.rad();
@@ -706,7 +962,21 @@ void ScanRegistration::publishResult() {
   _imuTrans[3].y = imuVelocityFromStart.y();
   _imuTrans[3].z = imuVelocityFromStart.z();
 
-  publishCloudMsg(_pubImuTrans, _imuTrans, _sweepStart, "/lidar");
+  publishCloudPtr(_pubImuTrans, _imuTrans, _sweepStart, "/lidar",
+                  _imuTransMsg);
+
+  // hand the sweep over, the clouds are rebuilt for the next sweep anyway
+  if (_sweepSink) {
+    _sweepFeatures.stamp = _sweepStart;
+    _sweepFeatures.laserCloud.swap(_laserCloud);
+    _sweepFeatures.cornerPointsSharp.swap(_cornerPointsSharp);
+    _sweepFeatures.cornerPointsLessSharp.swap(_cornerPointsLessSharp);
+    _sweepFeatures.surfacePointsFlat.swap(_surfacePointsFlat);
+    _sweepFeatures.surfacePointsLessFlat.swap(_surfacePointsLessFlat);
+    _sweepFeatures.groundPoints.swap(_groundPoints);
+    _sweepFeatures.imuTrans = _imuTrans;
+    _sweepSink(_sweepFeatures);
+  }
 }
 
 } // end namespace lidar_slam
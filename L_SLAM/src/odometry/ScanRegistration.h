@@ -4,15 +4,22 @@
 
 #include "common/Angle.h"
 #include "common/CircularBuffer.h"
+#include "common/curvature_utils.h"
 #include "common/Vector3.h"
 #include "common/ros_utils.h"
+#include "common/voxel_downsampler.h"
+#include "FeatureBudgetController.h"
+#include "ImuDeskewTable.h"
 
 #include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
 #include <ros/node_handle.h>
 #include <sensor_msgs/Imu.h>
+#include <std_msgs/Float32MultiArray.h>
 #include <stdint.h>
 #include <vector>
 #include <algorithm>
+#include <functional>
 
 namespace lidar_slam {
 
@@ -72,7 +79,19 @@ public:
               << " ,lessFlatFilterSize:" << lessFlatFilterSize
               << " ,surfaceCurvatureThreshold:" << surfaceCurvatureThreshold
               << " ,cornerCurvatureThreshold:" << cornerCurvatureThreshold
-              << " ,cornerCheckEnable:" << cornerCheckEnable << std::endl;
+              << " ,cornerCheckEnable:" << cornerCheckEnable
+              << " ,extractionThreads:" << extractionThreads
+              << " ,deskewTable:" << deskewTable
+              << " ,deskewTableStep:" << deskewTableStep
+              << " ,adaptiveBudget:" << adaptiveBudget
+              << " ,budgetTargetMatchTime:" << budgetTargetMatchTime
+              << " ,budgetTargetCorrespondences:" << budgetTargetCorrespondences
+              << " ,budgetGain:" << budgetGain
+              << " ,groundSegmentation:" << groundSegmentation
+              << " ,groundScanRings:" << groundScanRings
+              << " ,groundColumns:" << groundColumns
+              << " ,groundMaxAngle:" << groundMaxAngle
+              << " ,groundFilterSize:" << groundFilterSize << std::endl;
   }
   /** The time per scan. */
   float scanPeriod;
@@ -116,6 +135,48 @@ public:
 
   /** The curvature estimate method. */
   std::string curvatureEstimateMethod;
+
+  /** The number of threads extracting scan features in parallel (0 = OpenMP
+   * default, 1 = serial). */
+  int extractionThreads;
+
+  /** De-skew points with the IMU de-skew table (false interpolates the IMU
+   * history per point). */
+  bool deskewTable;
+
+  /** The time step of the IMU de-skew table (> 0). */
+  float deskewTableStep;
+
+  /** Retune the feature budget per sweep from the odometry statistics. */
+  bool adaptiveBudget;
+
+  /** The scan matching time targeted by the adaptive budget (ms). */
+  float budgetTargetMatchTime;
+
+  /** The number of correspondences targeted by the adaptive budget. */
+  float budgetTargetCorrespondences;
+
+  /** The exponent applied to the adaptive budget corrections (0, 1]. */
+  float budgetGain;
+
+  /** Separate the ground points of the lowest scan rings. */
+  bool groundSegmentation;
+
+  /** The number of lowest scan rings searched for ground points. */
+  int groundScanRings;
+
+  /** The number of azimuth columns pairing the points of adjacent rings. */
+  int groundColumns;
+
+  /** The maximum slope (deg) between vertically adjacent ground points. */
+  float groundMaxAngle;
+
+  /** Optional maximum slopes (deg) per ring pair, starting at the lowest
+   * ring, the last value applies to all higher ring pairs. */
+  std::vector<float> groundMaxAngles;
+
+  /** The voxel size used for down sizing the ground points of each ring. */
+  float groundFilterSize;
 };
 
 /** IMU state data. */
@@ -169,6 +230,104 @@ typedef struct IMUState {
   };
 } IMUState;
 
+/** \brief Per point neighbor terms of the full resolution cloud, as
+ * precomputed by range image front ends.
+ *
+ * Terms relating a point to its successor are only meaningful within a scan.
+ */
+struct NeighborTerms {
+  std::vector<float> curvature; ///< point curvature
+  std::vector<float> cosNext;  ///< cosine of the angle to the next point
+  std::vector<float> diffNext; ///< squared distance to the next point
+  std::vector<float> depth;    ///< distance of the point to the origin
+
+  size_t size() const { return curvature.size(); }
+
+  void resize(const size_t &size) {
+    curvature.resize(size);
+    cosNext.resize(size);
+    diffNext.resize(size);
+    depth.resize(size);
+  }
+
+  void clear() { resize(0); }
+};
+
+/** \brief Scratch buffers for extracting the features of a single scan.
+ *
+ * Every extraction thread owns one instance, which is reused for all scans it
+ * processes. Like the sweep clouds of the registration, all buffers keep their
+ * capacity between sweeps, so the steady state extraction does not allocate.
+ */
+struct ScanBuffers {
+  size_t scanStartIdx;             ///< cloud index of the first scan point
+  std::vector<float> scanX;        ///< x coordinates of the scan points
+  std::vector<float> scanY;        ///< y coordinates of the scan points
+  std::vector<float> scanZ;        ///< z coordinates of the scan points
+  std::vector<float> scanCurvature; ///< curvature of the scan points
+  CurvatureScratch curvatureScratch; ///< curvature kernel scratch buffers
+  std::vector<float> regionCurvature;  ///< point curvature buffer
+  std::vector<PointLabel> regionLabel; ///< point label buffer
+  std::vector<size_t>
+      regionSortIndices; ///< sorted region indices based on point curvature
+  std::vector<size_t> swapRegionSortIndices; ///< merge sort swap buffer
+  std::vector<int>
+      scanNeighborPicked; ///< flag if neighboring point was already picked
+  pcl::PointCloud<pcl::PointXYZI>
+      lessFlatScan; ///< less flat points before down sizing
+  VoxelDownsampler<pcl::PointXYZI>
+      downSizeFilter; ///< less flat points down size filter
+};
+
+/** \brief Feature clouds extracted from a single scan. */
+struct ScanFeatures {
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsSharp;
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsLessSharp;
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsFlat;
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsLessFlat;
+  pcl::PointCloud<pcl::PointXYZI> pointsBlind;
+  pcl::PointCloud<pcl::PointXYZI> pointsBlock;
+  pcl::PointCloud<pcl::PointXYZI> pointsSlop;
+  pcl::PointCloud<pcl::PointXYZI> pointsCurvature;
+
+  void clear() {
+    cornerPointsSharp.clear();
+    cornerPointsLessSharp.clear();
+    surfacePointsFlat.clear();
+    surfacePointsLessFlat.clear();
+    pointsBlind.clear();
+    pointsBlock.clear();
+    pointsSlop.clear();
+    pointsCurvature.clear();
+  }
+};
+
+/** \brief Full resolution cloud and features of a registered sweep. */
+struct SweepFeatures {
+  ros::Time stamp; ///< time stamp of the sweep start
+  pcl::PointCloud<pcl::PointXYZINormal> laserCloud; ///< full resolution cloud
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsSharp;
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsLessSharp;
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsFlat;
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsLessFlat;
+  pcl::PointCloud<pcl::PointXYZI> groundPoints; ///< optional ground points
+  pcl::PointCloud<pcl::PointXYZ> imuTrans; ///< IMU transformation information
+
+  void swap(SweepFeatures &other) {
+    std::swap(stamp, other.stamp);
+    laserCloud.swap(other.laserCloud);
+    cornerPointsSharp.swap(other.cornerPointsSharp);
+    cornerPointsLessSharp.swap(other.cornerPointsLessSharp);
+    surfacePointsFlat.swap(other.surfacePointsFlat);
+    surfacePointsLessFlat.swap(other.surfacePointsLessFlat);
+    groundPoints.swap(other.groundPoints);
+    imuTrans.swap(other.imuTrans);
+  }
+};
+
+/** \brief Receiver of registered sweeps, which may take over the clouds. */
+typedef std::function<void(SweepFeatures &)> SweepSink;
+
 /** \brief Base class for LIDAR scan registration implementations.
  *
  * As there exist various sensor devices, producing differently formatted point
@@ -200,8 +359,29 @@ public:
    */
   virtual void handleIMUMessage(const sensor_msgs::Imu::ConstPtr &imuIn);
 
+  /** \brief Set a receiver of the registered sweeps for library use.
+   *
+   * The sink is called after the results of a sweep have been published, and
+   * may swap the clouds out of the passed features.
+   *
+   * @param sink the sweep receiver
+   */
+  void setSweepSink(const SweepSink &sink) { _sweepSink = sink; }
+
+  /** \brief Handler method for laser odometry statistics.
+   *
+   * The statistics are the scan matching time (ms), the number of corner and
+   * surface correspondences and the number of iterations of the last sweep.
+   *
+   * @param statsIn the new odometry statistics message
+   */
+  void handleOdometryStats(
+      const std_msgs::Float32MultiArray::ConstPtr &statsIn);
+
 protected:
   /** \brief Prepare for next scan / sweep.
+   *
+   * The sweep buffers are only cleared, so they keep their capacity.
    *
    * @param scanTime the current scan time
    * @param newSweep indicator if a new sweep has started
@@ -225,12 +405,55 @@ protected:
    */
   void transformToStartIMU(PointIN &point);
 
+  /** \brief Sample the IMU de-skew transforms of the current sweep into the
+   * de-skew table.
+   *
+   * The IMU state is left at the end of the sweep (the last sample), and
+   * the IMU history search is restarted, so the next setIMUTransformFor()
+   * call may use any relative time.
+   *
+   * @param beginTime the smallest relative point time of the sweep
+   * @param endTime the largest relative point time of the sweep
+   */
+  void buildDeskewTable(const float &beginTime, const float &endTime);
+
   /** \brief Extract features from current laser cloud.
+   *
+   * The scans are processed in parallel if more than one extraction thread is
+   * configured. The scan features are merged in scan order, so the result is
+   * identical to the serial extraction.
    *
    * @param beginIdx the index of the first scan to extract features from
    */
   void extractFeatures(const uint16_t &beginIdx = 0);
 
+  /** \brief Apply the adaptive feature budget to the configuration. */
+  void applyFeatureBudget();
+
+  /** \brief Label the ground points of the current sweep.
+   *
+   * The points of the lowest scan rings are binned into azimuth columns, and
+   * two vertically adjacent points of a column are ground if the slope
+   * between them stays below the threshold of their ring pair. Ground points
+   * are excluded from the corner features and collected, down sized per
+   * ring, in the ground cloud.
+   */
+  void segmentGround();
+
+  /** \brief Check if a point of the full resolution cloud is ground. */
+  bool isGround(const size_t &cloudIdx) const {
+    return cloudIdx < _groundLabel.size() && _groundLabel[cloudIdx];
+  }
+
+  /** \brief Extract the features of a single scan.
+   *
+   * @param scanIdx the index of the scan
+   * @param buffers the scratch buffers of the calling thread
+   * @param features the output features of the scan
+   */
+  void extractScanFeatures(const size_t &scanIdx, ScanBuffers &buffers,
+                           ScanFeatures &features);
+
   /** \brief handle the region for the specified point range.
    *
    * Set up region buffers for the specified point range.
@@ -239,8 +462,10 @@ protected:
    *
    * @param startIdx the region start index
    * @param endIdx the region end index
+   * @param buffers the scratch buffers to set up
    */
-  void setRegionBuffersFor(const size_t &startIdx, const size_t &endIdx);
+  void setRegionBuffersFor(const size_t &startIdx, const size_t &endIdx,
+                           ScanBuffers &buffers);
 
   /** \brief handle the scan for the specified point range.
    *
@@ -249,8 +474,10 @@ protected:
    *
    * @param startIdx the scan start index
    * @param endIdx the scan start index
+   * @param buffers the scratch buffers to set up
    */
-  void setScanBuffersFor(const size_t &startIdx, const size_t &endIdx);
+  void setScanBuffersFor(const size_t &startIdx, const size_t &endIdx,
+                         ScanBuffers &buffers);
 
   /** \brief Mark a point and its neighbors as picked.
    *
@@ -260,9 +487,10 @@ protected:
    *
    * @param cloudIdx the index of the picked point in the full resolution cloud
    * @param scanIdx the index of the picked point relative to the current scan
+   * @param buffers the scratch buffers of the current scan
    */
   void markAsPicked(const size_t &cloudIdx, const size_t &scanIdx,
-                    int label = 1);
+                    ScanBuffers &buffers, int label = 1);
 
   /** \brief Check a point if is corner.
 *
@@ -277,14 +505,14 @@ protected:
   void publishResult();
 
 
-  void mergeArray(std::vector<size_t> &sortArray, int first, int mid, int last, std::vector<size_t> &tmp)
+  void mergeArray(const std::vector<float> &curvature, std::vector<size_t> &sortArray, int first, int mid, int last, std::vector<size_t> &tmp)
   {
     int i = first, j = mid + 1;
     int m = mid, n = last;
     int k = 0;
     while(i <= m && j <= n)
     {
-      if(_regionCurvature[sortArray[i]] <= _regionCurvature[sortArray[j]])
+      if(curvature[sortArray[i]] <= curvature[sortArray[j]])
         tmp[k ++] = sortArray[i ++];
       else
         tmp[k ++] = sortArray[j ++];
@@ -299,14 +527,14 @@ protected:
       sortArray[first + i] = tmp[i];
   }
 
-  void mergeSort(std::vector<size_t> &sortArray, int first, int last, std::vector<size_t> &tmp)
+  void mergeSort(const std::vector<float> &curvature, std::vector<size_t> &sortArray, int first, int last, std::vector<size_t> &tmp)
   {
     if(first < last)
     {
       int mid = (first + last) / 2;
-      mergeSort(sortArray, first, mid, tmp);
-      mergeSort(sortArray, mid + 1, last, tmp);
-      mergeArray(sortArray, first, mid, last, tmp);
+      mergeSort(curvature, sortArray, first, mid, tmp);
+      mergeSort(curvature, sortArray, mid + 1, last, tmp);
+      mergeArray(curvature, sortArray, first, mid, last, tmp);
     }
   }
 
@@ -332,11 +560,18 @@ protected:
   size_t _imuIdx;            ///< the current index in the IMU history
   CircularBuffer<IMUState>
       _imuHistory; ///< history of IMU states for cloud registration
+  ImuDeskewTable _deskewTable; ///< IMU de-skew transforms of current sweep
+
+  RegistrationParams _budgetBase; ///< configured feature budget parameters
+  FeatureBudgetController _budgetController; ///< adaptive budget controller
+  std_msgs::Float32MultiArray _featureBudgetMsg; ///< feature budget message
 
   CloudIN _laserCloud;                  ///< full resolution input cloud
   std::vector<IndexRange> _scanIndices; ///< start and end indices of the
                                         /// individual scans withing the full
   /// resolution cloud
+  NeighborTerms _neighborTerms; ///< optional precomputed neighbor terms of
+                                /// the full resolution cloud
 
   CloudI _cornerPointsSharp;                ///< sharp corner points cloud
   CloudI _cornerPointsLessSharp;            ///< less sharp corner points cloud
@@ -344,16 +579,24 @@ protected:
   CloudI _surfacePointsLessFlat;            ///< less flat surface points cloud
   pcl::PointCloud<pcl::PointXYZ> _imuTrans; ///< IMU transformation information
 
-  std::vector<float> _regionCurvature;  ///< point curvature buffer
-  std::vector<PointLabel> _regionLabel; ///< point label buffer
-  std::vector<size_t>
-      _regionSortIndices; ///< sorted region indices based on point curvature
-  std::vector<size_t>
-      _swapRegionSortIndices;
-  std::vector<int>
-      _scanNeighborPicked; ///< flag if neighboring point was already picked
+  int _upAxis; ///< index of the vertical axis of the full resolution cloud
+               /// (1 = y in the LOAM convention, 2 = z in the lidar frame)
+  std::vector<uint8_t> _groundLabel; ///< ground flag per cloud point
+  std::vector<int> _groundImage; ///< cloud index per ring and azimuth column
+  CloudI _groundPoints;          ///< down sized ground points cloud
+  CloudI _groundScan;            ///< ground points of a single ring
+  CloudI _groundScanDS;          ///< down sized ground points of a ring
+  VoxelDownsampler<PointI> _groundFilter; ///< ground points down size filter
+
+  std::vector<ScanBuffers> _scanBuffers;   ///< scratch buffers per thread
+  std::vector<ScanFeatures> _scanFeatures; ///< extracted features per scan
+
+  SweepSink _sweepSink;         ///< optional receiver of registered sweeps
+  SweepFeatures _sweepFeatures; ///< sweep handed over to the sweep sink
 
   ros::Subscriber _subImu; ///< IMU message subscriber
+  ros::Subscriber
+      _subOdometryStats; ///< laser odometry statistics message subscriber
 
   ros::Publisher _pubLaserCloud; ///< full resolution cloud message publisher
   ros::Publisher
@@ -364,6 +607,8 @@ protected:
   ros::Publisher
       _pubSurfPointsLessFlat;  ///< less flat surface cloud message publisher
   ros::Publisher _pubImuTrans; ///< IMU transformation message publisher
+  ros::Publisher _pubFeatureBudget; ///< feature budget message publisher
+  ros::Publisher _pubGroundPoints;  ///< ground points message publisher
 
   // for debug
   CloudI _pointsBlind;
@@ -375,6 +620,19 @@ protected:
   ros::Publisher _pubPointsBlock; ///< sharp corner cloud message publisher
   ros::Publisher _pubPointsSlop;  ///< less sharp corner cloud message publisher
   ros::Publisher _pubCurvature;   ///< less sharp corner cloud message publisher
+
+  // message clouds of the publishers, reused once no subscriber holds them
+  CloudIN::Ptr _laserCloudMsg;
+  CloudI::Ptr _cornerPointsSharpMsg;
+  CloudI::Ptr _cornerPointsLessSharpMsg;
+  CloudI::Ptr _surfacePointsFlatMsg;
+  CloudI::Ptr _surfacePointsLessFlatMsg;
+  CloudI::Ptr _groundPointsMsg;
+  CloudI::Ptr _pointsBlindMsg;
+  CloudI::Ptr _pointsBlockMsg;
+  CloudI::Ptr _pointsSlopMsg;
+  CloudI::Ptr _pointsCurvatureMsg;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr _imuTransMsg;
 };
 
 } // end namespace lidar_slam
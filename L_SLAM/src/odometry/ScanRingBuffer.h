@@ -0,0 +1,159 @@
+#ifndef LIDAR_SCANRINGBUFFER_H
+#define LIDAR_SCANRINGBUFFER_H
+
+#include "common/math_utils.h"
+#include "common/pointcloud2_view.h"
+
+#include <pcl/point_cloud.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Structure of arrays staging buffer for binning a sweep into its scan
+ * rings.
+ *
+ * The per point attributes are kept in separate contiguous arrays, so that the
+ * angle computation runs as a single vectorized pass over the sweep. Points
+ * are finally scattered ring by ring into the output cloud with a stable
+ * counting sort. All arrays keep their capacity between sweeps, so after the
+ * first sweep no heap allocation is performed.
+ */
+class ScanRingBuffer {
+public:
+  /** \brief Resize all per point arrays to the given number of points.
+   *
+   * @param size the number of points of the current sweep
+   */
+  void resize(const size_t &size) {
+    x.resize(size);
+    y.resize(size);
+    z.resize(size);
+    intensity.resize(size);
+    vertAngle.resize(size);
+    horiAngle.resize(size);
+    relTime.resize(size);
+    ring.resize(size);
+  }
+
+  /** \brief The number of points of the current sweep. */
+  size_t size() const { return x.size(); }
+
+  /** \brief Load the given input cloud, swapping its axes to the LOAM
+   * convention (x = lidar y, y = lidar z, z = lidar x).
+   *
+   * @param in the raw input cloud
+   */
+  template <typename PointT> void load(const pcl::PointCloud<PointT> &in) {
+    size_t cloudSize = in.size();
+    resize(cloudSize);
+    for (size_t i = 0; i < cloudSize; i++) {
+      x[i] = in[i].y;
+      y[i] = in[i].z;
+      z[i] = in[i].x;
+      intensity[i] = in[i].intensity;
+    }
+  }
+
+  /** \brief Load the points of a raw cloud message in place, swapping its axes
+   * to the LOAM convention.
+   *
+   * @param in the view on the raw input cloud message
+   */
+  void load(const PointCloud2View &in) {
+    size_t cloudSize = in.size();
+    resize(cloudSize);
+    for (size_t i = 0; i < cloudSize; i++) {
+      x[i] = in.y(i);
+      y[i] = in.z(i);
+      z[i] = in.x(i);
+      intensity[i] = in.intensity(i);
+    }
+  }
+
+  /** \brief Compute the vertical and horizontal angle of every point.
+   *
+   * Points which are NaN, INF or too close to the origin get their ring set to
+   * -1. All other rings are left to be assigned by the caller.
+   */
+  void computeAngles() {
+    const size_t cloudSize = size();
+    const float *px = x.data();
+    const float *py = y.data();
+    const float *pz = z.data();
+    float *pv = vertAngle.data();
+    float *ph = horiAngle.data();
+    int16_t *pr = ring.data();
+
+    for (size_t i = 0; i < cloudSize; i++) {
+      float distXZ = px[i] * px[i] + pz[i] * pz[i];
+      float dist = distXZ + py[i] * py[i];
+      pv[i] = fastAtan2(py[i], std::sqrt(distXZ));
+      ph[i] = -fastAtan2(px[i], pz[i]);
+      // dist - dist is NaN for NaN and INF valued points
+      pr[i] = (dist >= 0.0001f && dist - dist == 0.0f) ? 0 : -1;
+    }
+  }
+
+  /** \brief Scatter all points with a valid ring into the output cloud, sorted
+   * by ring while keeping the input order within each ring.
+   *
+   * @param nRings the number of scan rings
+   * @param out the output cloud
+   * @param scanIndices the output start and end indices of each ring
+   */
+  template <typename PointT>
+  void scatter(const uint16_t &nRings, pcl::PointCloud<PointT> &out,
+               std::vector<std::pair<size_t, size_t>> &scanIndices) {
+    const size_t cloudSize = size();
+
+    _ringOffset.assign(nRings + 1, 0);
+    for (size_t i = 0; i < cloudSize; i++) {
+      if (ring[i] >= 0) {
+        _ringOffset[ring[i] + 1]++;
+      }
+    }
+    for (uint16_t r = 0; r < nRings; r++) {
+      _ringOffset[r + 1] += _ringOffset[r];
+    }
+
+    out.resize(_ringOffset[nRings]);
+    _ringCursor.assign(_ringOffset.begin(), _ringOffset.end() - 1);
+    for (size_t i = 0; i < cloudSize; i++) {
+      if (ring[i] < 0) {
+        continue;
+      }
+      PointT &point = out[_ringCursor[ring[i]]++];
+      point.x = x[i];
+      point.y = y[i];
+      point.z = z[i];
+      point.intensity = intensity[i];
+      point.curvature = ring[i] + relTime[i];
+    }
+
+    scanIndices.clear();
+    for (uint16_t r = 0; r < nRings; r++) {
+      size_t end = _ringOffset[r + 1];
+      scanIndices.push_back(
+          std::make_pair(_ringOffset[r], end > 0 ? end - 1 : 0));
+    }
+  }
+
+  std::vector<float> x;         ///< point x coordinates (LOAM frame)
+  std::vector<float> y;         ///< point y coordinates (LOAM frame)
+  std::vector<float> z;         ///< point z coordinates (LOAM frame)
+  std::vector<float> intensity; ///< point intensities
+  std::vector<float> vertAngle; ///< vertical point angles (rad)
+  std::vector<float> horiAngle; ///< horizontal point angles (rad)
+  std::vector<float> relTime;   ///< relative point times within the sweep
+  std::vector<int16_t> ring;    ///< scan ring IDs, -1 for skipped points
+
+private:
+  std::vector<size_t> _ringOffset; ///< start index of each ring in the output
+  std::vector<size_t> _ringCursor; ///< next free index of each ring
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_SCANRINGBUFFER_H
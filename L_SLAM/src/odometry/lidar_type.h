@@ -1,6 +1,10 @@
 #ifndef LIDAR_TYPE_DATASHEET_H
 #define LIDAR_TYPE_DATASHEET_H
 
+#include <cmath>
+#include <iostream>
+#include <stdint.h>
+
 namespace lidar_slam
 {
     const int id_reorder_hdl32e[32] = {0,2,4,6,8,10,12,14,16,18,20,22,24,26,28,30,1,3,5,7,9,11,13,15,17,19,21,23,25,27,29,31};
@@ -53,12 +57,12 @@ namespace lidar_slam
     };
 
 
-    int scanID_hdl32e(float angle)
+    inline int scanID_hdl32e(float angle)
     {
         return (int)((angle + 30.66667)/1.33333 + 0.5);
     }
 
-    int scanID_pandar40(float angle) {
+    inline int scanID_pandar40(float angle) {
         int scanID  = 0;
         for(unsigned i = 0 ; i < 40 ; i++ )
         {
@@ -75,7 +79,7 @@ namespace lidar_slam
         return scanID;
     }
 
-    int scanID_pandar(float angle)
+    inline int scanID_pandar(float angle)
     {
         int scanID = 0;
 
@@ -103,6 +107,69 @@ namespace lidar_slam
         return scanID;
     }
 
+    /** \brief Linear mapping of a vertical angle (degrees) to its ring ID for
+     * lidars with equally spaced scan rings.
+     */
+    template <typename LidarT>
+    inline int linearScanID(float angle)
+    {
+        const float factor = (LidarT::nScanRings() - 1) /
+                             (LidarT::upperBound() - LidarT::lowerBound());
+        return int((angle - LidarT::lowerBound()) * factor + 0.5);
+    }
+
+    /** \brief Lidar model descriptors.
+     *
+     * A descriptor provides the name used for the "lidar" parameter, the
+     * vertical field of view (degrees), the number of scan rings and the
+     * mapping of a vertical angle (degrees) to its ring ID. The mapping is
+     * tabulated once per model by MultiScanMapperT. A new sensor is supported
+     * by adding its descriptor here and to SupportedLidarModels.
+     */
+    struct VelodyneVLP16
+    {
+        static const char *name() { return "VLP-16"; }
+        static constexpr float lowerBound() { return -15; }
+        static constexpr float upperBound() { return 15; }
+        static constexpr uint16_t nScanRings() { return 16; }
+        static int ringForAngle(float angle) { return linearScanID<VelodyneVLP16>(angle); }
+    };
+
+    struct VelodyneHDL32
+    {
+        static const char *name() { return "HDL-32"; }
+        static constexpr float lowerBound() { return -30.67f; }
+        static constexpr float upperBound() { return 10.67f; }
+        static constexpr uint16_t nScanRings() { return 32; }
+        static int ringForAngle(float angle) { return linearScanID<VelodyneHDL32>(angle); }
+    };
+
+    struct VelodyneHDL64E
+    {
+        static const char *name() { return "HDL-64E"; }
+        static constexpr float lowerBound() { return -24.9f; }
+        static constexpr float upperBound() { return 2; }
+        static constexpr uint16_t nScanRings() { return 64; }
+        static int ringForAngle(float angle) { return linearScanID<VelodyneHDL64E>(angle); }
+    };
+
+    struct Pandar40
+    {
+        static const char *name() { return "Pandar40"; }
+        static constexpr float lowerBound() { return -15.444f; }
+        static constexpr float upperBound() { return 6.96f; }
+        static constexpr uint16_t nScanRings() { return 40; }
+        static int ringForAngle(float angle) { return angle < 7.5f ? scanID_pandar(angle) : -1; }
+    };
+
+    /** \brief Compile time list of lidar model descriptors. */
+    template <typename... Models>
+    struct LidarModelList {};
+
+    /** The lidar models selectable with the "lidar" parameter. */
+    typedef LidarModelList<VelodyneVLP16, VelodyneHDL32, VelodyneHDL64E, Pandar40>
+        SupportedLidarModels;
+
 }
 
 #endif // LIDAR_TYPE_DATASHEET_H
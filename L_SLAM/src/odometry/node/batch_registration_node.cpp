@@ -0,0 +1,95 @@
+#include "odom/BatchScanRegistration.h"
+#include "odom/LaserOdometry.h"
+#include <ros/ros.h>
+
+#include <boost/filesystem.hpp>
+#include <pcl/io/pcd_io.h>
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+/** Batch registration entry point.
+ *
+ * Registers all PCD sweeps of a directory (in file name order) and runs the
+ * laser odometry on them as fast as possible. The odometry poses are written
+ * to a text file (time x y z qx qy qz qw).
+ */
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "batchRegistration");
+  ros::NodeHandle node;
+  ros::NodeHandle privateNode("~");
+
+  std::string pcdDirectory, posesFile, lidarName;
+  privateNode.param<std::string>("pcdDirectory", pcdDirectory, "");
+  privateNode.param<std::string>("posesFile", posesFile, "poses.txt");
+  privateNode.param<std::string>("lidar", lidarName, "VLP-16");
+  int nWorkers = privateNode.param<int>(
+      "workers", std::max(1, int(std::thread::hardware_concurrency()) - 1));
+
+  if (!boost::filesystem::is_directory(pcdDirectory)) {
+    ROS_ERROR("Invalid pcdDirectory parameter: %s", pcdDirectory.c_str());
+    return 1;
+  }
+
+  std::vector<std::string> files;
+  boost::filesystem::directory_iterator end;
+  for (boost::filesystem::directory_iterator it(pcdDirectory); it != end;
+       ++it) {
+    if (it->path().extension() == ".pcd") {
+      files.push_back(it->path().string());
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  lidar_slam::RegistrationParams config;
+  if (!config.initialize_params(privateNode)) {
+    return 1;
+  }
+
+  lidar_slam::BatchScanRegistration registration(config, nWorkers);
+  if (!registration.setupScanMapper(lidarName)) {
+    return 1;
+  }
+
+  lidar_slam::LaserOdometry laserOdom;
+  if (!laserOdom.configure(node, privateNode)) {
+    return 1;
+  }
+
+  std::ofstream poses(posesFile.c_str());
+  size_t fileIdx = 0;
+  ros::WallTime startTime = ros::WallTime::now();
+
+  // sweeps are stamped by their index, as PCD files carry no reliable time
+  size_t nSweeps = registration.run(
+      [&](lidar_slam::BatchScanRegistration::CloudI &cloud, ros::Time &stamp) {
+        while (fileIdx < files.size()) {
+          const std::string &file = files[fileIdx];
+          stamp = ros::Time(fileIdx * config.scanPeriod + 1);
+          fileIdx++;
+          if (pcl::io::loadPCDFile(file, cloud) == 0 && !cloud.empty()) {
+            return true;
+          }
+          ROS_WARN("Skipping unreadable PCD file: %s", file.c_str());
+        }
+        return false;
+      },
+      [&](lidar_slam::SweepFeatures &sweep) {
+        ros::Time stamp = sweep.stamp;
+        laserOdom.processSweep(sweep);
+
+        const Eigen::Isometry3f &pose = laserOdom.pose();
+        Eigen::Quaternionf q(pose.rotation());
+        Eigen::Vector3f t(pose.translation());
+        poses << std::fixed << stamp.toSec() << " " << t.x() << " " << t.y()
+              << " " << t.z() << " " << q.x() << " " << q.y() << " " << q.z()
+              << " " << q.w() << std::endl;
+      });
+
+  double elapsed = (ros::WallTime::now() - startTime).toSec();
+  ROS_INFO("Registered %lu sweeps in %.2f s (%.1f sweeps/s) with %d workers",
+           nSweeps, elapsed, nSweeps / std::max(elapsed, 1e-6), nWorkers);
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "odom/LaserMapping.h"
+#include "odom/LaserOdometry.h"
+#include "odom/MultiScanRegistration.h"
+#include "odom/OdometryPipeline.h"
+#include <ros/ros.h>
+
+/** Pipeline entry point.
+ *
+ * Runs the multi scan registration, the laser odometry and the laser mapping
+ * in one process. The registration runs in the subscriber callbacks, the
+ * odometry and the mapping on dedicated pipeline threads.
+ */
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "odometryPipeline");
+  ros::NodeHandle node;
+  ros::NodeHandle privateNode("~");
+
+  int queueSize = privateNode.param<int>("pipelineQueueSize", 4);
+  if (queueSize < 1) {
+    ROS_ERROR("Invalid pipelineQueueSize parameter: %d (expected > 0)",
+              queueSize);
+    return 1;
+  }
+  std::string backPressure =
+      privateNode.param<std::string>("backPressure", "block");
+  lidar_slam::OdometryPipeline::BackPressure policy;
+  if (!lidar_slam::OdometryPipeline::parseBackPressure(backPressure, policy)) {
+    ROS_ERROR("Invalid backPressure parameter: %s (expected block or "
+              "drop_oldest)",
+              backPressure.c_str());
+    return 1;
+  }
+
+  lidar_slam::LaserOdometry laserOdom;
+  if (!laserOdom.configure(node, privateNode)) {
+    return 1;
+  }
+  // the registration shares the parameters, so its ground points are known
+  if (privateNode.param<bool>("groundConstrained", false) &&
+      !privateNode.param<bool>("groundSegmentation", false)) {
+    ROS_ERROR("Invalid groundConstrained parameter: the ground constrained "
+              "odometry requires groundSegmentation of the scan registration");
+    return 1;
+  }
+
+  lidar_slam::LaserMapping laserMapping;
+  if (!laserMapping.configure(node, privateNode)) {
+    return 1;
+  }
+
+  lidar_slam::OdometryPipeline pipeline(laserOdom, laserMapping, queueSize,
+                                        policy);
+  pipeline.start();
+
+  lidar_slam::MultiScanRegistration multiScan;
+  multiScan.setSweepSink(
+      [&](lidar_slam::SweepFeatures &sweep) { pipeline.pushSweep(sweep); });
+  if (multiScan.setup(node, privateNode)) {
+    ros::spin();
+  }
+
+  // stop the registration before draining the pipeline
+  multiScan.setSweepSink(lidar_slam::SweepSink());
+  pipeline.stop();
+  ROS_INFO("[OdometryPipeline] mapped frames:%zu dropped sweeps:%zu dropped "
+           "frames:%zu",
+           pipeline.mappedFrames(), pipeline.droppedSweeps(),
+           pipeline.droppedFrames());
+
+  return 0;
+}
@@ -5,7 +5,8 @@
 namespace pose_graph {
 
 Graph::Graph()
-    : solver_g2o(new SolverG2O()), loop_detector(new LoopDetector()),
+    : shutdown(false), solver_g2o(new SolverG2O()),
+      loop_detector(new LoopDetector()),
       keyframe_updater(new KeyframeUpdater()),
       max_keyframes_per_update(1), _laserCloudCornerLast2(new CloudI()),
       _laserCloudSurfLast2(new CloudI()), _laserCloudFullRes2(new CloudI()),
@@ -16,11 +17,26 @@ Graph::Graph()
   tf_odom2graph.setIdentity();
 }
 
-Graph::~Graph() {}
+Graph::~Graph() {
+  _synchronizer.shutdown();
+  {
+    std::lock_guard<std::mutex> lock(keyframe_queue_mutex);
+    shutdown = true;
+  }
+  keyframe_queue_cond.notify_all();
+
+  if (spin_thread.joinable()) {
+    spin_thread.join();
+  }
+  if (optimize_thread.joinable()) {
+    optimize_thread.join();
+  }
+}
 
 bool Graph::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
   _odomAftGraph.header.frame_id = "/lidar_init";
   _odomAftGraph.child_frame_id = "/aft_graph";
+  _synchronizer.setup(FULL_RES + 1);
 
   _subLaserCloudCornerLast2 = node.subscribe<sensor_msgs::PointCloud2>(
       "/laser_cloud_corner_last2", 2, &Graph::laserCloudCornerLastHandler,
@@ -45,6 +61,7 @@ bool Graph::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     ROS_INFO("Set filesDirectory: %s", _filesDirectory.c_str());
   }
 
+  spin_thread = std::thread(&Graph::spin, this);
   optimize_thread = std::thread(&Graph::optimize, this);
 
   return true;
@@ -52,55 +69,66 @@ bool Graph::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
 
 void Graph::laserCloudCornerLastHandler(
     const sensor_msgs::PointCloud2ConstPtr &cornerPointsLastMsg) {
-  _timeLaserCloudCornerLast2 = cornerPointsLastMsg->header.stamp;
-
-  _laserCloudCornerLast2->clear();
-  pcl::fromROSMsg(*cornerPointsLastMsg, *_laserCloudCornerLast2);
-
-  _newLaserCloudCornerLast2 = true;
+  _synchronizer.add(CORNER_LAST, cornerPointsLastMsg->header.stamp,
+                    cornerPointsLastMsg);
 }
 
 void Graph::laserCloudSurfLastHandler(
     const sensor_msgs::PointCloud2ConstPtr &surfacePointsLastMsg) {
-  _timeLaserCloudSurfLast2 = surfacePointsLastMsg->header.stamp;
-
-  _laserCloudSurfLast2->clear();
-  pcl::fromROSMsg(*surfacePointsLastMsg, *_laserCloudSurfLast2);
-
-  _newLaserCloudSurfLast2 = true;
+  _synchronizer.add(SURF_LAST, surfacePointsLastMsg->header.stamp,
+                    surfacePointsLastMsg);
 }
 
 void Graph::laserCloudFullResHandler(
     const sensor_msgs::PointCloud2ConstPtr &laserCloudFullResMsg) {
-  _timeLaserCloudFullRes2 = laserCloudFullResMsg->header.stamp;
-
-  _laserCloudFullRes2->clear();
-  pcl::fromROSMsg(*laserCloudFullResMsg, *_laserCloudFullRes2);
-
-  _newLaserCloudFullRes2 = true;
+  _synchronizer.add(FULL_RES, laserCloudFullResMsg->header.stamp,
+                    laserCloudFullResMsg);
 }
 
 void Graph::laserOdometryHandler(
     const nav_msgs::Odometry::ConstPtr &laserOdometry) {
-  _timeLaserOdometry2 = laserOdometry->header.stamp;
+  _synchronizer.add(ODOMETRY, laserOdometry->header.stamp, laserOdometry);
+}
 
-  geometry_msgs::Quaternion q = laserOdometry->pose.pose.orientation;
+bool Graph::waitForFrame(const double &timeout) {
+  lidar_slam::MessageSynchronizer::MessageSet set;
+  ros::Time stamp;
+  if (!_synchronizer.wait(set, stamp, timeout)) {
+    return false;
+  }
+
+  typedef lidar_slam::MessageSynchronizer Sync;
+  _laserCloudCornerLast2->clear();
+  pcl::fromROSMsg(Sync::message<sensor_msgs::PointCloud2>(set, CORNER_LAST),
+                  *_laserCloudCornerLast2);
+  _laserCloudSurfLast2->clear();
+  pcl::fromROSMsg(Sync::message<sensor_msgs::PointCloud2>(set, SURF_LAST),
+                  *_laserCloudSurfLast2);
+  _laserCloudFullRes2->clear();
+  pcl::fromROSMsg(Sync::message<sensor_msgs::PointCloud2>(set, FULL_RES),
+                  *_laserCloudFullRes2);
+
+  const nav_msgs::Odometry &laserOdometry =
+      Sync::message<nav_msgs::Odometry>(set, ODOMETRY);
+  geometry_msgs::Quaternion q = laserOdometry.pose.pose.orientation;
   Eigen::Quaterniond equat(q.w, q.x, q.y, q.z);
-  // std::cout<<"equat:"<<equat.coeffs()<<std::endl;
 
-  geometry_msgs::Point v = laserOdometry->pose.pose.position;
+  geometry_msgs::Point v = laserOdometry.pose.pose.position;
   Eigen::Matrix3d rotation_matrix = equat.toRotationMatrix();
   Eigen::Vector3d v3d(v.x, v.y, v.z);
   tf_odomd.setIdentity();
   tf_odomd.translate(v3d);
   tf_odomd.rotate(rotation_matrix);
 
+  _timeLaserCloudCornerLast2 = stamp;
+  _timeLaserCloudSurfLast2 = stamp;
+  _timeLaserCloudFullRes2 = stamp;
+  _timeLaserOdometry2 = stamp;
+  _newLaserCloudCornerLast2 = true;
+  _newLaserCloudSurfLast2 = true;
+  _newLaserCloudFullRes2 = true;
   _newLaserOdometry2 = true;
-
-  // std::cout<<"tf_odomd:"<<tf_odomd.matrix()<<std::endl;
-  // Eigen::Quaterniond quat(tf_odomd.rotation());
-  // std::cout<<"tf_odomd quat:"<<quat.coeffs()<<"\n vec:"<<quat.vec()<<"
-  // "<<quat.w()<<std::endl;
+  return true;
 }
 
 bool Graph::save(std_srvs::Empty::Request &req,
@@ -199,13 +227,9 @@ void Graph::getFinalFeatureMap() {
 }
 
 bool Graph::hasNewData() {
+  // the clouds and the odometry of a frame share the exact same stamp
   return _newLaserCloudCornerLast2 && _newLaserCloudSurfLast2 &&
-         _newLaserCloudFullRes2 && _newLaserOdometry2 &&
-         fabs((_timeLaserCloudCornerLast2 - _timeLaserOdometry2).toSec()) <
-             0.005 &&
-         fabs((_timeLaserCloudSurfLast2 - _timeLaserOdometry2).toSec()) <
-             0.005 &&
-         fabs((_timeLaserCloudFullRes2 - _timeLaserOdometry2).toSec()) < 0.005;
+         _newLaserCloudFullRes2 && _newLaserOdometry2;
 }
 
 void Graph::reset() {
@@ -216,14 +240,12 @@ void Graph::reset() {
 }
 
 void Graph::spin() {
-  ros::Rate rate(100);
-  bool status = ros::ok();
-
-  while (status) {
-    ros::spinOnce();
-    process();
-    status = ros::ok();
-    rate.sleep();
+  // the subscriber callbacks run in the node spinner and wake this thread as
+  // soon as a complete frame is available
+  while (ros::ok() && !_synchronizer.isShutdown()) {
+    if (waitForFrame(0.1)) {
+      process();
+    }
   }
 }
 
@@ -240,8 +262,11 @@ void Graph::add_frame(KeyFrame::Ptr &keyframe) {
   //    std::to_string(keyframe->stamp.toSec());
   // saveTrajectoryCloud(*_laserCloudFullResStack, "/home/hr/.lidar/full",
   // name);
-  std::lock_guard<std::mutex> lock(keyframe_queue_mutex);
-  keyframe_queue.push_back(keyframe);
+  {
+    std::lock_guard<std::mutex> lock(keyframe_queue_mutex);
+    keyframe_queue.push_back(keyframe);
+  }
+  keyframe_queue_cond.notify_one();
 }
 
 bool Graph::flush_keyframe_queue() {
@@ -312,16 +337,19 @@ void Graph::process() {
 }
 
 void Graph::optimize() {
-
-  ros::Rate rate(100);
-  bool status = ros::ok();
-
-  while (status) {
+  while (ros::ok()) {
 
     // add keyframes and floor coeffs in the queues to the pose graph
     if (!flush_keyframe_queue()) {
-      status = ros::ok();
-      rate.sleep();
+      // sleep until a new keyframe is queued, the timeout only serves to
+      // notice the node shutdown
+      std::unique_lock<std::mutex> lock(keyframe_queue_mutex);
+      keyframe_queue_cond.wait_for(
+          lock, std::chrono::milliseconds(100),
+          [this] { return !keyframe_queue.empty() || shutdown; });
+      if (shutdown) {
+        break;
+      }
       continue;
     }
 
@@ -371,9 +399,6 @@ void Graph::optimize() {
     tf_odom2graph_mutex.lock();
     tf_odom2graph = trans;
     tf_odom2graph_mutex.unlock();
-
-    status = ros::ok();
-    rate.sleep();
   }
 }
 } // end namespace graph
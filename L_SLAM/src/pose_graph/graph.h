@@ -15,6 +15,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
+#include <condition_variable>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
@@ -24,6 +25,7 @@
 #include <unordered_map>
 
 #include "common/FeatureMap.h"
+#include "common/MessageSynchronizer.h"
 #include "common/ros_utils.h"
 #include "common/feature_utils.h"
 #include "common/math_utils.h"
@@ -105,6 +107,14 @@ public:
 
 void getFinalFeatureMap();
 
+  /** \brief Wait for the next synchronized mapping frame and take over its
+   * clouds and pose.
+   *
+   * @param timeout the maximum waiting time in seconds
+   * @return true, if a frame was taken, false on timeout or shutdown
+   */
+  bool waitForFrame(const double &timeout);
+
   bool hasNewData();
 
   void reset();
@@ -122,12 +132,18 @@ void getFinalFeatureMap();
   void process();
 
 private:
+  /** Channels of the frame synchronizer. */
+  enum FrameChannel { CORNER_LAST, SURF_LAST, ODOMETRY, FULL_RES };
+
+  std::thread spin_thread;
   std::thread optimize_thread;
   Eigen::Isometry3d tf_odomd;
   std::mutex tf_odom2graph_mutex;
   Eigen::Isometry3d tf_odom2graph;
   std::mutex keyframe_queue_mutex;
+  std::condition_variable keyframe_queue_cond; ///< signals new keyframes
   std::deque<KeyFrame::Ptr> keyframe_queue;
+  bool shutdown; ///< flag if the optimization was stopped
 
   int max_keyframes_per_update;
   std::deque<KeyFrame::Ptr> new_keyframes;
@@ -151,6 +167,8 @@ private:
 
   ros::ServiceServer _saveSrv;
 
+  lidar_slam::MessageSynchronizer _synchronizer; ///< mapping frame synchronizer
+
   CloudI::Ptr _laserCloudCornerLast2;
   CloudI::Ptr _laserCloudSurfLast2;
   CloudI::Ptr _laserCloudFullRes2;
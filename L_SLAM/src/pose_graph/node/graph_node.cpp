@@ -10,7 +10,8 @@ int main(int argc, char **argv) {
   pose_graph::Graph graph;
 
   if (graph.setup(node, privateNode)) {
-    graph.spin();
+    // the graph processes the frames on its own threads
+    ros::spin();
   }
 
   return 0;
@@ -1,4 +1,5 @@
 #include "ScanMatch.h"
+#include "common/GaussNewtonAccumulator.h"
 #include "common/feature_utils.h"
 #include "common/math_utils.h"
 #include "common/nanoflann_pcl.h"
@@ -9,6 +10,7 @@
 
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
+#include <algorithm>
 
 namespace lidar_slam {
 
@@ -19,12 +21,12 @@ using std::atan2;
 using std::pow;
 
 ScanMatch::ScanMatch(const size_t maxIterations)
-    : _maxIterations(maxIterations), _deltaTAbort(0.05), _deltaRAbort(0.05),
-      _useScore(true), _match_count(0), _fail_match_count(0), _total_score(0),
+    : _convergence(maxIterations, 0.05, 0.05), _useScore(true), _match_count(0), _fail_match_count(0), _total_score(0),
       _score_threshold(800), _match_percentage_threshold(0.4),
       _referenceCornerCloudDS(new CloudI()),
       _referenceSurfCloudDS(new CloudI()), _CornerCloudDS(new CloudI()),
-      _SurfCloudDS(new CloudI()) {
+      _SurfCloudDS(new CloudI()), _levelCorner(new CloudI()),
+      _levelSurf(new CloudI()) {
 
   _downSizeFilterCorner.setLeafSize(0.2, 0.2, 0.2);
   _downSizeFilterSurf.setLeafSize(0.4, 0.4, 0.4);
@@ -53,6 +55,196 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
                               const CloudIConPtr &CornerCloud,
                               const CloudIConPtr &SurfCloud,
                               Twist &transformf) {
+  nanoflann::KdTreeFLANN<PointI> kdtreeCorner;
+  nanoflann::KdTreeFLANN<PointI> kdtreeSurf;
+  kdtreeCorner.setInputCloud(referenceCornerCloud);
+  kdtreeSurf.setInputCloud(referenceSurfCloud);
+  if (!_pyramid.empty()) {
+    buildLevels(referenceCornerCloud, referenceSurfCloud, CloudSegments(),
+                CloudSegments(), _levelReferences);
+    matchCoarseLevels(_levelReferences, CornerCloud, SurfCloud, transformf);
+  }
+  return matchLevel(referenceCornerCloud, referenceSurfCloud, kdtreeCorner,
+                    kdtreeSurf, CornerCloud, SurfCloud, transformf);
+}
+
+bool ScanMatch::scanMatchScan(const ScanMatchReference &reference,
+                              const CloudIConPtr &CornerCloud,
+                              const CloudIConPtr &SurfCloud,
+                              Eigen::Isometry3f &relative_pose) {
+  _cornerSegments = reference.cornerSegments;
+  _surfSegments = reference.surfSegments;
+  Twist transform;
+  convertTransform(relative_pose, transform);
+  if (reference.levels.size() == _pyramid.size()) {
+    matchCoarseLevels(reference.levels, CornerCloud, SurfCloud, transform);
+  } else {
+    buildLevels(reference.cornerCloud, reference.surfCloud, CloudSegments(),
+                CloudSegments(), _levelReferences);
+    matchCoarseLevels(_levelReferences, CornerCloud, SurfCloud, transform);
+  }
+  bool success = matchLevel(reference.cornerCloud, reference.surfCloud,
+                            reference.cornerTree, reference.surfTree,
+                            CornerCloud, SurfCloud, transform);
+  convertTransform(transform, relative_pose);
+  return success;
+}
+
+void ScanMatch::buildLevels(ScanMatchReference &reference) {
+  buildLevels(reference.cornerCloud, reference.surfCloud,
+              reference.cornerSegments, reference.surfSegments,
+              reference.levels);
+}
+
+void ScanMatch::buildLevels(const CloudIConPtr &referenceCornerCloud,
+                            const CloudIConPtr &referenceSurfCloud,
+                            const CloudSegments &cornerSegments,
+                            const CloudSegments &surfSegments,
+                            ScanMatchReferenceLevels &levels) {
+  // segments not describing their cloud are ignored
+  auto describes = [](const CloudSegments &segments, const CloudI &cloud) {
+    size_t segmentsSize = 0;
+    for (size_t s = 0; s < segments.size(); s++) {
+      segmentsSize += segments[s].size;
+    }
+    return !segments.empty() && segmentsSize == cloud.points.size();
+  };
+  const CloudSegments none;
+  const CloudSegments &corners =
+      describes(cornerSegments, *referenceCornerCloud) ? cornerSegments : none;
+  const CloudSegments &surfs =
+      describes(surfSegments, *referenceSurfCloud) ? surfSegments : none;
+
+  levels.resize(_pyramid.size());
+  for (size_t l = 0; l < _pyramid.size(); l++) {
+    if (!levels[l]) {
+      levels[l].reset(new ScanMatchReferenceLevel());
+    }
+    ScanMatchReferenceLevel &level = *levels[l];
+
+    // the corner and surface revisions never collide, so both share a cache
+    SegmentPoints used;
+    downSizeReference(referenceCornerCloud, corners, _pyramid[l].leafSize,
+                      _levelSegmentPoints[l], used, *level.cornerCloud);
+    downSizeReference(referenceSurfCloud, surfs, _pyramid[l].leafSize,
+                      _levelSegmentPoints[l], used, *level.surfCloud);
+    if (!corners.empty() || !surfs.empty()) {
+      _levelSegmentPoints[l].swap(used);
+    }
+
+    level.cornerTree.setInputCloud(level.cornerCloud);
+    level.surfTree.setInputCloud(level.surfCloud);
+  }
+}
+
+void ScanMatch::downSizeReference(const CloudIConPtr &reference,
+                                  const CloudSegments &segments,
+                                  const float &leafSize,
+                                  const SegmentPoints &cache,
+                                  SegmentPoints &used, CloudI &output) {
+  // a local filter, as the levels may be built on another thread
+  pcl::VoxelGrid<PointI> filter;
+  filter.setLeafSize(leafSize, leafSize, leafSize);
+  filter.setInputCloud(reference);
+  output.clear();
+  if (segments.empty()) {
+    filter.filter(output);
+    return;
+  }
+
+  size_t begin = 0;
+  for (size_t s = 0; s < segments.size(); s++) {
+    const CloudSegment &segment = segments[s];
+    if (segment.size == 0) {
+      continue;
+    }
+
+    CloudI::Ptr points;
+    SegmentPoints::const_iterator cached = cache.find(segment.revision);
+    if (cached != cache.end() && cached->second.size == segment.size) {
+      points = cached->second.points;
+    } else {
+      boost::shared_ptr<std::vector<int>> indices(
+          new std::vector<int>(segment.size));
+      for (size_t i = 0; i < segment.size; i++) {
+        (*indices)[i] = begin + i;
+      }
+      points.reset(new CloudI());
+      filter.setIndices(indices);
+      filter.filter(*points);
+    }
+    CachedSegment &entry = used[segment.revision];
+    entry.size = segment.size;
+    entry.points = points;
+    output += *points;
+    begin += segment.size;
+  }
+}
+
+void ScanMatch::matchCoarseLevels(const ScanMatchReferenceLevels &levels,
+                                  const CloudIConPtr &CornerCloud,
+                                  const CloudIConPtr &SurfCloud,
+                                  Twist &transform) {
+  auto downSize = [&](const CloudIConPtr &input, CloudI &output) {
+    output.clear();
+    _levelFilter.setInputCloud(input);
+    _levelFilter.filter(output);
+  };
+
+  const size_t maxIterations = _convergence.maxIterations();
+  const size_t scanSize =
+      CornerCloud->points.size() + SurfCloud->points.size();
+  for (size_t l = 0; l < _pyramid.size() && l < levels.size(); l++) {
+    const ScanMatchLevel &level = _pyramid[l];
+    const ScanMatchReferenceLevel &reference = *levels[l];
+    if (reference.cornerCloud->points.size() < 50 ||
+        reference.surfCloud->points.size() < 100) {
+      continue;
+    }
+    _levelFilter.setLeafSize(level.leafSize, level.leafSize, level.leafSize);
+    downSize(CornerCloud, *_levelCorner);
+    downSize(SurfCloud, *_levelSurf);
+
+    // a coarse scan needs the share of matched points of the full resolution
+    // scan, but at least one per degree of freedom
+    const size_t levelSize =
+        _levelCorner->points.size() + _levelSurf->points.size();
+    const size_t minMatches =
+        std::max<size_t>(6, 50 * levelSize / std::max<size_t>(scanSize, 1));
+
+    _convergence.setMaxIterations(level.maxIterations);
+    matchLevel(reference.cornerCloud, reference.surfCloud, reference.cornerTree,
+               reference.surfTree, _levelCorner, _levelSurf, transform,
+               level.leafSize, minMatches);
+  }
+  _convergence.setMaxIterations(maxIterations);
+}
+
+bool ScanMatch::matchLevel(const CloudIConPtr &referenceCornerCloud,
+                           const CloudIConPtr &referenceSurfCloud,
+                           const nanoflann::KdTreeFLANN<PointI> &kdtreeCorner,
+                           const nanoflann::KdTreeFLANN<PointI> &kdtreeSurf,
+                           const CloudIConPtr &CornerCloud,
+                           const CloudIConPtr &SurfCloud, Twist &transformf,
+                           const float &leafSize, const size_t &minMatches) {
+  // a coarse level only refines the transform, with its own primitives and a
+  // search radius growing with its voxel size
+  const bool coarse = leafSize > 0;
+  PrimitiveCache<LinePrimitive> &lineCache =
+      coarse ? _levelLineCache : _lineCache;
+  PrimitiveCache<PlanePrimitive> &planeCache =
+      coarse ? _levelPlaneCache : _planeCache;
+  const float maxSqDis = std::max(5.0f, 5.0f * leafSize * leafSize);
+  if (coarse) {
+    lineCache.reset(referenceCornerCloud->points.size(), CloudSegments());
+    planeCache.reset(referenceSurfCloud->points.size(), CloudSegments());
+  } else {
+    // the segments only describe the current reference clouds
+    lineCache.reset(referenceCornerCloud->points.size(), _cornerSegments);
+    planeCache.reset(referenceSurfCloud->points.size(), _surfSegments);
+    _cornerSegments.clear();
+    _surfSegments.clear();
+  }
 
   if (referenceCornerCloud->points.size() < 50 ||
       referenceSurfCloud->points.size() < 100) {
@@ -61,19 +253,39 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
   }
   Twist transform = transformf;
 
-  PointI pointSel, pointOri, pointProj, coeff;
+  PointI pointSel, pointOri, pointProj;
   std::vector<int> pointSearchInd(5, 0);
   std::vector<float> pointSearchSqDis(5, 0);
 
-    nanoflann::KdTreeFLANN<PointI> kdtreeCorner;
-    nanoflann::KdTreeFLANN<PointI> kdtreeSurf;
-      /*
-  pcl::KdTreeFLANN<PointI> kdtreeCorner;
-  pcl::KdTreeFLANN<PointI> kdtreeSurf;
-  */
-
-  kdtreeCorner.setInputCloud(referenceCornerCloud);
-  kdtreeSurf.setInputCloud(referenceSurfCloud);
+  // fit the primitives to the neighbors of a reference point, so all query
+  // points matching that reference point share it; a primitive is only kept
+  // for the next reference cloud if its neighbors can not change with the
+  // adjacent segments
+  std::vector<int> fitSearchInd(5, 0);
+  std::vector<float> fitSearchSqDis(5, 0);
+  auto fitLine = [&](size_t index, LinePrimitive &line, bool &local) {
+    const PointI &point = referenceCornerCloud->points[index];
+    if (kdtreeCorner.nearestKSearch(point, 5, fitSearchInd, fitSearchSqDis) !=
+        5) {
+      return false;
+    }
+    local = lineCache.withinSegment(index, point.getVector3fMap(),
+                                    std::sqrt(fitSearchSqDis[4]));
+    return fitSearchSqDis[4] < maxSqDis &&
+           findLine(*referenceCornerCloud, fitSearchInd, line.pointA,
+                    line.pointB);
+  };
+  auto fitPlane = [&](size_t index, PlanePrimitive &plane, bool &local) {
+    const PointI &point = referenceSurfCloud->points[index];
+    if (kdtreeSurf.nearestKSearch(point, 5, fitSearchInd, fitSearchSqDis) !=
+        5) {
+      return false;
+    }
+    local = planeCache.withinSegment(index, point.getVector3fMap(),
+                                     std::sqrt(fitSearchSqDis[4]));
+    return fitSearchSqDis[4] < maxSqDis &&
+           findPlane(*referenceSurfCloud, fitSearchInd, 0.2, plane.plane);
+  };
 
   bool converge = false;
   bool isDegenerate = false;
@@ -82,156 +294,104 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
   size_t CornerNum = CornerCloud->points.size();
   size_t SurfNum = SurfCloud->points.size();
 
-  pcl::PointCloud<PointI> laserCloudOri;
-  pcl::PointCloud<PointI> coeffSel;
+  // the score of the last iteration, summed up with its residuals
+  const bool scored = !coarse && _useScore;
+  double score = 0;
 
   int line_match_count = 0;
   int plane_match_count = 0;
   size_t iterCount;
-  for (iterCount = 0; iterCount < _maxIterations; iterCount++) {
-    laserCloudOri.clear();
-    coeffSel.clear();
-    line_match_count = 0;
-    plane_match_count = 0;
-
-    for (int i = 0; i < CornerNum; i++) {
-      pointOri = CornerCloud->points[i];
-      pointAssociateToMap(transform, pointOri, pointSel);
-      kdtreeCorner.nearestKSearch(pointSel, 5, pointSearchInd,
+  _convergence.reset(CornerNum + SurfNum);
+  for (iterCount = 0; iterCount < _convergence.maxIterations(); iterCount++) {
+    if (_convergence.reassociate()) {
+      // search new correspondences
+      _convergence.associate();
+      line_match_count = 0;
+      plane_match_count = 0;
+
+      for (int i = 0; i < CornerNum; i++) {
+        pointOri = CornerCloud->points[i];
+        pointAssociateToMap(transform, pointOri, pointSel);
+        kdtreeCorner.nearestKSearch(pointSel, 1, pointSearchInd,
+                                    pointSearchSqDis);
+        if (pointSearchSqDis[0] < maxSqDis) {
+          const LinePrimitive *line =
+              lineCache.get(pointSearchInd[0], fitLine);
+          if (line) {
+            _convergence.addLine(i, line->pointA, line->pointB);
+            line_match_count++;
+          }
+        }
+      }
+
+      for (int i = 0; i < SurfNum; i++) {
+        pointOri = SurfCloud->points[i];
+        pointAssociateToMap(transform, pointOri, pointSel);
+        kdtreeSurf.nearestKSearch(pointSel, 1, pointSearchInd,
                                   pointSearchSqDis);
-      if (pointSearchSqDis[4] < 5.0) {
-        const Eigen::Vector3f &point = pointSel.getVector3fMap();
-        Eigen::Vector3f lineA, lineB;
-        if (findLine(*referenceCornerCloud, pointSearchInd, lineA, lineB)) {
-          PointI coefficients;
-          if (getCornerFeatureCoefficients(lineA, lineB, point, coefficients)) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coefficients);
+        if (pointSearchSqDis[0] < maxSqDis) {
+          const PlanePrimitive *plane =
+              planeCache.get(pointSearchInd[0], fitPlane);
+          if (plane) {
+            _convergence.addPlane(i, plane->plane);
+            plane_match_count++;
           }
-          line_match_count++;
         }
       }
     }
 
-    for (int i = 0; i < SurfNum; i++) {
-      pointOri = SurfCloud->points[i];
+    // residuals of the correspondences at the current pose, added straight
+    // into the normal equations
+    GaussNewtonAccumulator normalEquations(_robustKernel);
+    normalEquations.reset(transform);
+    size_t laserCloudSelNum = 0;
+    score = 0;
+
+    const std::vector<ConvergenceManager::LineMatch> &lines =
+        _convergence.lines();
+    for (size_t i = 0; i < lines.size(); i++) {
+      pointOri = CornerCloud->points[lines[i].index];
       pointAssociateToMap(transform, pointOri, pointSel);
-      kdtreeSurf.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-      if (pointSearchSqDis[4] < 5.0) {
-        Eigen::Vector4f planeCoef;
-        if (findPlane(*referenceSurfCloud, pointSearchInd, 0.2, planeCoef)) {
-          PointI coefficients;
-          if (getSurfaceFeatureCoefficients(planeCoef, pointSel,
-                                            coefficients)) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coefficients);
-          }
-          plane_match_count++;
+      PointI coefficients;
+      if (getCornerFeatureCoefficients(lines[i].pointA, lines[i].pointB,
+                                       pointSel.getVector3fMap(), coefficients,
+                                       !_robustKernel.enabled())) {
+        normalEquations.addPoint(pointOri, coefficients);
+        laserCloudSelNum++;
+        if (scored) {
+          score += std::exp(-fabs(coefficients.intensity));
         }
       }
     }
 
-    float srx = transform.rot_x.sin();
-    float crx = transform.rot_x.cos();
-    float sry = transform.rot_y.sin();
-    float cry = transform.rot_y.cos();
-    float srz = transform.rot_z.sin();
-    float crz = transform.rot_z.cos();
-
-    size_t laserCloudSelNum = laserCloudOri.points.size();
-    if (laserCloudSelNum < 50) {
-      ROS_WARN("matched cloud points too few. Matched/Input:  %d / %d", laserCloudSelNum, CornerNum+SurfNum);
-      break;
+    const ConvergenceManager::PlaneMatches &planes = _convergence.planes();
+    for (size_t i = 0; i < planes.size(); i++) {
+      pointOri = SurfCloud->points[planes[i].index];
+      pointAssociateToMap(transform, pointOri, pointSel);
+      PointI coefficients;
+      if (getSurfaceFeatureCoefficients(planes[i].plane, pointSel,
+                                        coefficients,
+                                        !_robustKernel.enabled())) {
+        normalEquations.addPoint(pointOri, coefficients);
+        laserCloudSelNum++;
+        if (scored) {
+          score += std::exp(-fabs(coefficients.intensity));
+        }
+      }
     }
 
-    Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-    Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-    Eigen::Matrix<float, 6, 6> matAtA;
-    Eigen::VectorXf matB(laserCloudSelNum);
-    Eigen::VectorXf matAtB;
-    Eigen::VectorXf matX;
-
-    for (int i = 0; i < laserCloudSelNum; i++) {
-      pointOri = laserCloudOri.points[i];
-      coeff = coeffSel.points[i];
-      /*
-      float arx = (crx * sry * srz * pointOri.x + crx * crz * sry * pointOri.y -
-                   srx * sry * pointOri.z) *
-                      coeff.x +
-                  (-srx * srz * pointOri.x - crz * srx * pointOri.y -
-                   crx * pointOri.z) *
-                      coeff.y +
-                  (crx * cry * srz * pointOri.x + crx * cry * crz * pointOri.y -
-                   cry * srx * pointOri.z) *
-                      coeff.z;
-
-      float ary = ((cry * srx * srz - crz * sry) * pointOri.x +
-                   (sry * srz + cry * crz * srx) * pointOri.y +
-                   crx * cry * pointOri.z) *
-                      coeff.x +
-                  ((-cry * crz - srx * sry * srz) * pointOri.x +
-                   (cry * srz - crz * srx * sry) * pointOri.y -
-                   crx * sry * pointOri.z) *
-                      coeff.z;
-
-      float arz = ((crz * srx * sry - cry * srz) * pointOri.x +
-                   (-cry * crz - srx * sry * srz) * pointOri.y) *
-                      coeff.x +
-                  (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y +
-                  ((sry * srz + cry * crz * srx) * pointOri.x +
-                   (crz * sry - cry * srx * srz) * pointOri.y) *
-                      coeff.z;
-        */
-        float arx = ((crz*sry*crx + srz*srx)* pointOri.y +(srz*crx-crz*sry*srx)* pointOri.z)*coeff.x +
-        ((srz*sry*crx-crz*srx)*pointOri.y -(srz*sry*srx+crz*crx)*pointOri.z)*coeff.y +
-        (cry*crx*pointOri.y-cry*srx*pointOri.z)*coeff.z;
-
-        float ary = (-crz*sry*pointOri.x+crz*cry*srx*pointOri.y+crz*cry*crx*pointOri.z)*coeff.x +
-        (-srz*sry*pointOri.x+srz*cry*srx*pointOri.y +srz*cry*crx*pointOri.z)*coeff.y +
-        (-cry*pointOri.x-sry*srx*pointOri.y-sry*crx*pointOri.z)*coeff.z;
-
-        float arz = (-srz*cry*pointOri.x -(srz*sry*srx+crz*crx)*pointOri.y+(crz*srx-srz*sry*crx)*pointOri.z)*coeff.x+
-        (crz*cry*pointOri.x+ (crz*sry*srx-srz*crx)*pointOri.y+crz*sry*crx+srz*srx*pointOri.z)*coeff.y+
-        0*coeff.z;
-
-      matA(i, 0) = arx;
-      matA(i, 1) = ary;
-      matA(i, 2) = arz;
-      matA(i, 3) = coeff.x;
-      matA(i, 4) = coeff.y;
-      matA(i, 5) = coeff.z;
-      matB(i, 0) = -coeff.intensity;
+    if (laserCloudSelNum < minMatches) {
+      // a coarse level just leaves the transform to the finer levels
+      if (!coarse) {
+        ROS_WARN("matched cloud points too few. Matched/Input:  %d / %d", laserCloudSelNum, CornerNum+SurfNum);
+      }
+      break;
     }
 
-    matAt = matA.transpose();
-    matAtA = matAt * matA;
-    matAtB = matAt * matB;
-    matX = matAtA.colPivHouseholderQr().solve(matAtB);
+    Eigen::Matrix<float, 6, 1> matX = normalEquations.solve();
 
     if (iterCount == 0) {
-      Eigen::Matrix<float, 1, 6> matE;
-      Eigen::Matrix<float, 6, 6> matV;
-      Eigen::Matrix<float, 6, 6> matV2;
-
-      Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> esolver(matAtA);
-      matE = esolver.eigenvalues().real();
-      matV = esolver.eigenvectors().real();
-
-      matV2 = matV;
-
-      isDegenerate = false;
-      float eignThre[6] = {100, 100, 100, 100, 100, 100};
-      for (int i = 0; i < 6; i++) {
-        if (matE(0, i) < eignThre[i]) {
-          for (int j = 0; j < 6; j++) {
-            matV2(i, j) = 0;
-          }
-          isDegenerate = true;
-        } else {
-          break;
-        }
-      }
-      matP = matV.inverse() * matV2;
+      isDegenerate = normalEquations.degeneracyProjection(100, matP);
     }
 
     if (isDegenerate) {
@@ -246,23 +406,20 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
     transform.pos.y() += matX(4, 0);
     transform.pos.z() += matX(5, 0);
 
-    float deltaR =
-        sqrt(pow(rad2deg(matX(0, 0)), 2) + pow(rad2deg(matX(1, 0)), 2) +
-             pow(rad2deg(matX(2, 0)), 2));
-    float deltaT = sqrt(pow(matX(3, 0) * 100, 2) + pow(matX(4, 0) * 100, 2) +
-                        pow(matX(5, 0) * 100, 2));
-
     // std::cout << "iterator:" << iterCount << std::endl;
     // transform.print();
-    if (deltaR < _deltaRAbort && deltaT < _deltaTAbort) {
+    if (_convergence.update(matX)) {
       converge = true;
       break;
     }
   }
 
-  if (converge && _useScore) {
+  if (coarse) {
+    transformf = transform;
+    return converge;
+  }
 
-    double score = getScore(coeffSel);
+  if (converge && _useScore) {
 
     double match_count = line_match_count + plane_match_count;
     float percent = match_count / (CornerNum + SurfNum);
@@ -270,8 +427,8 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
               << std::endl;
 
     if (_fineScore) {
-      laserCloudOri.clear();
-      coeffSel.clear();
+      // only the scoring pass keeps its coefficients
+      pcl::PointCloud<PointI> coeffSel;
       line_match_count = 0;
       plane_match_count = 0;
       for (int i = 0; i < CornerNum; i++) {
@@ -286,7 +443,6 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
             PointI coefficients;
             if (getCornerFeatureCoefficients(lineA, lineB, point,
                                              coefficients)) {
-              laserCloudOri.push_back(pointOri);
               coeffSel.push_back(coefficients);
             }
             line_match_count++;
@@ -305,7 +461,6 @@ bool ScanMatch::scanMatchScan(const CloudIConPtr &referenceCornerCloud,
             PointI coefficients;
             if (getSurfaceFeatureCoefficients(planeCoef, pointSel,
                                               coefficients)) {
-              laserCloudOri.push_back(pointOri);
               coeffSel.push_back(coefficients);
             }
             plane_match_count++;
@@ -377,6 +532,10 @@ bool ScanMatch::scanMatchLocal(const CloudIConPtr &referenceCornerCloud,
                                const CloudIConPtr &CornerCloud,
                                const CloudIConPtr &SurfCloud,
                                Twist &transform) {
+  // the down sized reference clouds do not match any given segments
+  _cornerSegments.clear();
+  _surfSegments.clear();
+
   _referenceCornerCloudDS->clear();
   _downSizeFilterCorner.setInputCloud(referenceCornerCloud);
   _downSizeFilterCorner.filter(*_referenceCornerCloudDS);
@@ -2,13 +2,68 @@
 #include <pcl/common/transforms.h>
 #include <pcl/filters/voxel_grid.h>
 
+#include <common/ConvergenceManager.h>
+#include <common/PrimitiveCache.h>
+#include <common/RobustKernel.h>
 #include <common/Twist.h>
 #include <common/math_utils.h>
+#include <common/nanoflann_pcl.h>
+
+#include <memory>
+#include <unordered_map>
 
 #ifndef SCAN_MATCH_H__
 #define SCAN_MATCH_H__
 namespace lidar_slam {
 
+/** \brief Reference clouds of a coarse scan match level, down sized to the
+ * voxel size of the level, with their KD-trees. */
+struct ScanMatchReferenceLevel {
+  typedef pcl::PointXYZI PointI;
+  typedef pcl::PointCloud<PointI> CloudI;
+
+  ScanMatchReferenceLevel()
+      : cornerCloud(new CloudI()), surfCloud(new CloudI()) {}
+
+  CloudI::Ptr cornerCloud;                    ///< down sized corner cloud
+  CloudI::Ptr surfCloud;                      ///< down sized surface cloud
+  nanoflann::KdTreeFLANN<PointI> cornerTree; ///< KD-tree of the corner cloud
+  nanoflann::KdTreeFLANN<PointI> surfTree;   ///< KD-tree of the surface cloud
+};
+
+typedef std::vector<std::unique_ptr<ScanMatchReferenceLevel>>
+    ScanMatchReferenceLevels;
+
+/** \brief Reference clouds of a scan match with their KD-trees, so they can be
+ * prepared ahead of the match, e.g. on another thread. */
+struct ScanMatchReference {
+  typedef pcl::PointXYZI PointI;
+  typedef pcl::PointCloud<PointI> CloudI;
+
+  ScanMatchReference() : cornerCloud(new CloudI()), surfCloud(new CloudI()) {}
+
+  /** \brief (Re)build the KD-trees after the clouds changed. */
+  void buildTrees() {
+    cornerTree.setInputCloud(cornerCloud);
+    surfTree.setInputCloud(surfCloud);
+  }
+
+  CloudI::Ptr cornerCloud;                    ///< reference corner cloud
+  CloudI::Ptr surfCloud;                      ///< reference surface cloud
+  nanoflann::KdTreeFLANN<PointI> cornerTree; ///< KD-tree of the corner cloud
+  nanoflann::KdTreeFLANN<PointI> surfTree;   ///< KD-tree of the surface cloud
+  CloudSegments cornerSegments; ///< segments of the corner cloud, if known
+  CloudSegments surfSegments;   ///< segments of the surface cloud, if known
+  ScanMatchReferenceLevels
+      levels; ///< coarse pyramid levels, see ScanMatch::buildLevels()
+};
+
+/** \brief Coarse level of a scan match pyramid. */
+struct ScanMatchLevel {
+  float leafSize;       ///< voxel size of the scan and reference clouds
+  size_t maxIterations; ///< maximum number of iterations on the level
+};
+
 class ScanMatch {
 public:
   typedef pcl::PointXYZI PointI;
@@ -27,12 +82,75 @@ public:
   inline void setFineScore(bool enable) { _fineScore = enable; }
 
   inline void setConvergeThreshold(float deltaTAbort, float deltaRAbort) {
-    _deltaTAbort = deltaTAbort;
-    _deltaRAbort = deltaRAbort;
+    _convergence.setConvergeThreshold(deltaRAbort, deltaTAbort);
+  }
+
+  /** \brief Set the maximum number of iterations of the full resolution
+   * match. */
+  inline void setMaxIterations(const size_t &maxIterations) {
+    _convergence.setMaxIterations(maxIterations);
+  }
+
+  /** \brief Set the coarse levels of a coarse to fine scan match.
+   *
+   * Before matching the full resolution clouds, the transform is refined on
+   * the scan and reference clouds down sized to the voxel size of each level,
+   * coarsest first. Only the full resolution match is scored. No levels, the
+   * default, disables the pyramid.
+   */
+  inline void setPyramid(const std::vector<ScanMatchLevel> &levels) {
+    _pyramid = levels;
+    _levelSegmentPoints.assign(levels.size(), SegmentPoints());
+  }
+
+  /** \brief Down size the reference clouds to the coarse pyramid levels and
+   * build their KD-trees, so the scanMatchScan() against the reference does
+   * not have to.
+   *
+   * The clouds are down sized per reference segment, reusing the down sized
+   * points of the segments whose revision did not change since the last call.
+   * May run on another thread than the scan matches, but not concurrently to
+   * another buildLevels() call.
+   */
+  void buildLevels(ScanMatchReference &reference);
+
+  inline void setReassociateThreshold(float deltaTReassociate,
+                                      float deltaRReassociate) {
+    _convergence.setReassociateThreshold(deltaRReassociate, deltaTReassociate);
   }
 
+  /** \brief The iteration statistics of the last scan match. */
+  inline const ConvergenceManager &convergence() const { return _convergence; }
+
   inline void setUseCore(bool useScore) { _useScore = useScore; }
 
+  inline void setRobustKernel(const RobustKernel &kernel) {
+    _robustKernel = kernel;
+  }
+
+  /** \brief Describe the reference clouds of the next scanMatchScan() call
+   * as segments with revisions, e.g. the cubes of a feature map.
+   *
+   * The lines and planes fitted in a segment are kept for later scan matches
+   * as long as the segment revision stays the same. Without segments, the
+   * fitted primitives are only shared within a single scan match.
+   */
+  inline void setReferenceSegments(const CloudSegments &cornerSegments,
+                                   const CloudSegments &surfSegments) {
+    _cornerSegments = cornerSegments;
+    _surfSegments = surfSegments;
+  }
+
+  /** \brief The line primitives of the last reference corner cloud. */
+  inline const PrimitiveCache<LinePrimitive> &lineCache() const {
+    return _lineCache;
+  }
+
+  /** \brief The plane primitives of the last reference surface cloud. */
+  inline const PrimitiveCache<PlanePrimitive> &planeCache() const {
+    return _planeCache;
+  }
+
   explicit ScanMatch(const size_t maxIterations = 10);
   ~ScanMatch();
   bool scanMatchLocal(const CloudIConPtr &referenceCornerCloud,
@@ -54,6 +172,15 @@ public:
                      const CloudIConPtr &CornerCloud,
                      const CloudIConPtr &SurfCloud, Twist &transform);
 
+  /** \brief Scan match against prepared reference clouds, using their
+   * KD-trees and segments instead of building them. The trees have to be
+   * built for the current clouds.
+   */
+  bool scanMatchScan(const ScanMatchReference &reference,
+                     const CloudIConPtr &CornerCloud,
+                     const CloudIConPtr &SurfCloud,
+                     Eigen::Isometry3f &relative_pose);
+
   double getScore(const CloudI &coeffCloud);
 
   inline double getAverageScore() {
@@ -61,9 +188,70 @@ public:
   }
 
 private:
-  size_t _maxIterations; ///< maximum number of iterations
-  float _deltaTAbort;    ///< optimization abort threshold for deltaT
-  float _deltaRAbort;    ///< optimization abort threshold for deltaR
+  /** \brief Down sized points of a reference segment. */
+  struct CachedSegment {
+    size_t size;        ///< the number of points of the segment
+    CloudI::Ptr points; ///< the down sized points of the segment
+  };
+
+  /** \brief Down sized points of reference segments per revision, only
+   * reused for segments of the same revision and size (like PrimitiveCache). */
+  typedef std::unordered_map<size_t, CachedSegment> SegmentPoints;
+
+  /** \brief Down size the reference clouds to the coarse pyramid levels,
+   * see buildLevels(). Without segments the whole clouds are down sized. */
+  void buildLevels(const CloudIConPtr &referenceCornerCloud,
+                   const CloudIConPtr &referenceSurfCloud,
+                   const CloudSegments &cornerSegments,
+                   const CloudSegments &surfSegments,
+                   ScanMatchReferenceLevels &levels);
+
+  /** \brief Down size a reference cloud, per segment if segments are given.
+   *
+   * @param cache the down sized segment points of the last call
+   * @param used receives the down sized points of the given segments
+   */
+  void downSizeReference(const CloudIConPtr &reference,
+                         const CloudSegments &segments, const float &leafSize,
+                         const SegmentPoints &cache, SegmentPoints &used,
+                         CloudI &output);
+
+  /** \brief Match on the coarse pyramid levels, see setPyramid(). */
+  void matchCoarseLevels(const ScanMatchReferenceLevels &levels,
+                         const CloudIConPtr &CornerCloud,
+                         const CloudIConPtr &SurfCloud, Twist &transform);
+
+  /** \brief Match against reference clouds with built KD-trees.
+   *
+   * @param leafSize the voxel size of a coarse level, 0 for full resolution
+   * @param minMatches the minimum number of matched points per iteration
+   */
+  bool matchLevel(const CloudIConPtr &referenceCornerCloud,
+                  const CloudIConPtr &referenceSurfCloud,
+                  const nanoflann::KdTreeFLANN<PointI> &kdtreeCorner,
+                  const nanoflann::KdTreeFLANN<PointI> &kdtreeSurf,
+                  const CloudIConPtr &CornerCloud,
+                  const CloudIConPtr &SurfCloud, Twist &transform,
+                  const float &leafSize = 0, const size_t &minMatches = 50);
+
+  ConvergenceManager _convergence; ///< iteration control of the scan match
+  RobustKernel _robustKernel; ///< robust kernel of the match residuals
+
+  CloudSegments _cornerSegments; ///< segments of the next corner reference
+  CloudSegments _surfSegments;   ///< segments of the next surface reference
+  PrimitiveCache<LinePrimitive> _lineCache;   ///< lines per reference corner
+  PrimitiveCache<PlanePrimitive> _planeCache; ///< planes per reference surface
+
+  std::vector<ScanMatchLevel> _pyramid; ///< coarse levels, coarsest first
+  std::vector<SegmentPoints>
+      _levelSegmentPoints; ///< down sized reference segments per level
+  ScanMatchReferenceLevels
+      _levelReferences;                ///< coarse levels of plain references
+  pcl::VoxelGrid<PointI> _levelFilter; ///< voxel filter of the coarse scans
+  CloudI::Ptr _levelCorner;            ///< coarse corner cloud
+  CloudI::Ptr _levelSurf;              ///< coarse surface cloud
+  PrimitiveCache<LinePrimitive> _levelLineCache;   ///< lines of a coarse level
+  PrimitiveCache<PlanePrimitive> _levelPlaneCache; ///< planes of a coarse level
 
   pcl::VoxelGrid<PointI>
       _downSizeFilterCorner; ///< voxel filter for down sizing corner clouds
@@ -0,0 +1,124 @@
+#include "odom/MultiScanRegistration.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+
+// the allocation functions of glibc behind malloc and friends
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+namespace {
+
+std::atomic<bool> countAllocations(false);
+std::atomic<size_t> allocations(0);
+
+inline void countAllocation() {
+  if (countAllocations) {
+    allocations++;
+  }
+}
+
+} // end namespace
+
+// Count the allocations at the C level, so operator new as well as the Eigen
+// aligned allocator of the PCL clouds, which calls malloc directly, are seen.
+extern "C" {
+
+void *malloc(size_t size) noexcept {
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+  countAllocation();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  countAllocation();
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept {
+  if (alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  countAllocation();
+  void *memory = __libc_memalign(alignment, size);
+  if (!memory) {
+    return ENOMEM;
+  }
+  *ptr = memory;
+  return 0;
+}
+
+} // extern "C"
+
+namespace lidar_slam {
+
+/** \brief Build a sweep of a VLP-16 inside a box shaped room. */
+void makeRoomSweep(pcl::PointCloud<pcl::PointXYZI> &cloud) {
+  const int columns = 1800;
+  const float halfWidth = 10.0f;
+  cloud.clear();
+  for (int c = 0; c < columns; c++) {
+    const float azimuth = 2.0f * float(M_PI) * c / columns;
+    const float horizontal =
+        halfWidth / std::max(std::fabs(std::cos(azimuth)),
+                             std::fabs(std::sin(azimuth)));
+    for (int ring = 0; ring < 16; ring++) {
+      const float vertical = (-15.0f + 2.0f * ring) * float(M_PI) / 180.0f;
+      pcl::PointXYZI point;
+      point.x = horizontal * std::cos(azimuth);
+      point.y = horizontal * std::sin(azimuth);
+      point.z = horizontal * std::tan(vertical);
+      point.intensity = ring;
+      cloud.push_back(point);
+    }
+  }
+}
+
+TEST(ScanRegistration, SteadyStateSweepDoesNotAllocate) {
+  MultiScanRegistration registration;
+  ASSERT_TRUE(registration.setupScanMapper("VLP-16"));
+
+  pcl::PointCloud<pcl::PointXYZI> sweep;
+  makeRoomSweep(sweep);
+
+  // the first sweep sizes all buffers
+  registration.process(sweep, ros::Time(1.0));
+
+  allocations = 0;
+  countAllocations = true;
+  registration.process(sweep, ros::Time(1.1));
+  countAllocations = false;
+
+  EXPECT_EQ(size_t(0), allocations.load());
+}
+
+} // end namespace lidar_slam
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
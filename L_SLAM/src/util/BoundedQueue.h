@@ -0,0 +1,237 @@
+#ifndef LIDAR_BOUNDEDQUEUE_H
+#define LIDAR_BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lidar_slam {
+
+/** \brief Bounded multi producer / multi consumer queue.
+ *
+ * tryPush() and tryPop() are lock free (array based queue with per cell
+ * sequence numbers after D. Vyukov). The blocking push() and pop() only fall
+ * back to a mutex and condition variable while a thread actually has to
+ * sleep, so passing an element to a waiting thread wakes it immediately,
+ * without polling.
+ *
+ * The capacity is rounded up to the next power of two.
+ */
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(const size_t &capacity = 8)
+      : _closed(false), _waitingPop(0), _waitingPush(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    _mask = size - 1;
+    _cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _enqueuePos.store(0, std::memory_order_relaxed);
+    _dequeuePos.store(0, std::memory_order_relaxed);
+  }
+
+  /** \brief The maximum number of queued elements. */
+  size_t capacity() const { return _mask + 1; }
+
+  /** \brief Try to append an element, without blocking.
+   *
+   * @param item the element, only moved from on success
+   * @return true, if the element was queued, false if the queue is full or
+   * closed
+   */
+  bool tryPush(T &&item) {
+    if (_closed.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    Cell *cell;
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &_cells[pos & _mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = intptr_t(seq) - intptr_t(pos);
+      if (dif == 0) {
+        if (_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->item = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    wake(_waitingPop, _notEmpty);
+    return true;
+  }
+
+  /** \brief Try to take the oldest element, without blocking.
+   *
+   * @param item the output element
+   * @return true, if an element was taken, false if the queue is empty
+   */
+  bool tryPop(T &item) {
+    Cell *cell;
+    size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &_cells[pos & _mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+      if (dif == 0) {
+        if (_dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    item = std::move(cell->item);
+    cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+    wake(_waitingPush, _notFull);
+    return true;
+  }
+
+  /** \brief Append an element, blocking while the queue is full.
+   *
+   * @param item the element
+   * @return true, if the element was queued, false if the queue was closed
+   */
+  bool push(T &&item) {
+    while (!tryPush(std::move(item))) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _waitingPush.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool full = !_closed && isFull();
+      if (full) {
+        _notFull.wait(lock);
+      }
+      _waitingPush.fetch_sub(1);
+      if (_closed) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** \brief Append an element, removing the oldest elements while the queue
+   * is full.
+   *
+   * Every removed element is passed to the evict function, so none is lost
+   * if other producers fill the queue again before the element is queued.
+   *
+   * @param item the element
+   * @param evict the function called with every removed element (T &)
+   * @return true, if the element was queued, false if the queue was closed
+   */
+  template <typename EvictFunction>
+  bool pushEvict(T &&item, EvictFunction evict) {
+    T evicted;
+    while (!tryPush(std::move(item))) {
+      if (_closed.load(std::memory_order_acquire)) {
+        return false;
+      }
+      if (tryPop(evicted)) {
+        evict(evicted);
+      }
+    }
+    return true;
+  }
+
+  /** \brief Take the oldest element, blocking while the queue is empty.
+   *
+   * @param item the output element
+   * @return true, if an element was taken, false if the queue was closed and
+   * is empty
+   */
+  bool pop(T &item) {
+    while (!tryPop(item)) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _waitingPop.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool empty = isEmpty();
+      if (empty && _closed) {
+        _waitingPop.fetch_sub(1);
+        return false;
+      }
+      if (empty) {
+        _notEmpty.wait(lock);
+      }
+      _waitingPop.fetch_sub(1);
+    }
+    return true;
+  }
+
+  /** \brief Close the queue, waking all blocked threads.
+   *
+   * Pushing to a closed queue fails, popping drains the remaining elements.
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _notEmpty.notify_all();
+    _notFull.notify_all();
+  }
+
+private:
+  /** Queue cell with the sequence number of its next use. */
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  /** Check if the queue is full, while no element is being pushed. */
+  bool isFull() const {
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    size_t seq = _cells[pos & _mask].sequence.load(std::memory_order_acquire);
+    return intptr_t(seq) - intptr_t(pos) < 0;
+  }
+
+  /** Check if the queue is empty, while no element is being popped. */
+  bool isEmpty() const {
+    size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    size_t seq = _cells[pos & _mask].sequence.load(std::memory_order_acquire);
+    return intptr_t(seq) - intptr_t(pos + 1) < 0;
+  }
+
+  /** Wake the threads sleeping on a condition, if there are any. */
+  void wake(const std::atomic<int> &waiting, std::condition_variable &cond) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      cond.notify_all();
+    }
+  }
+
+  static const size_t CACHE_LINE = 64;
+
+  std::unique_ptr<Cell[]> _cells; ///< ring buffer
+  size_t _mask;                   ///< capacity - 1
+  char _pad0[CACHE_LINE];
+  std::atomic<size_t> _enqueuePos; ///< position of the next push
+  char _pad1[CACHE_LINE];
+  std::atomic<size_t> _dequeuePos; ///< position of the next pop
+  char _pad2[CACHE_LINE];
+
+  std::mutex _mutex;                 ///< lock of the sleeping threads
+  std::condition_variable _notEmpty; ///< signal of a pushed element
+  std::condition_variable _notFull;  ///< signal of a popped element
+  std::atomic<bool> _closed;         ///< flag if the queue was closed
+  std::atomic<int> _waitingPop;      ///< number of threads sleeping in pop
+  std::atomic<int> _waitingPush;     ///< number of threads sleeping in push
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_BOUNDEDQUEUE_H
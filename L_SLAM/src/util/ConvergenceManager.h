@@ -0,0 +1,212 @@
+#ifndef LIDAR_CONVERGENCEMANAGER_H
+#define LIDAR_CONVERGENCEMANAGER_H
+
+#include "math_utils.h"
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <cmath>
+#include <stddef.h>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Iteration control of a scan to map / scan to scan match.
+ *
+ * The nearest neighbor searches and the line / plane fits of the
+ * correspondences dominate the cost of a match iteration. Once the pose
+ * updates get small, the same neighbors are found again, so the manager keeps
+ * the fitted lines and planes of the last association and only asks for a new
+ * association when the pose moved by more than the reassociation thresholds
+ * since then. In between, the residuals and Jacobians are recomputed from the
+ * cached lines and planes at the current pose.
+ *
+ * A step below the convergence thresholds is only accepted as convergence if
+ * it was computed with fresh correspondences, otherwise one more association
+ * is forced.
+ */
+class ConvergenceManager {
+public:
+  /** \brief Cached line correspondence of a corner point. */
+  struct LineMatch {
+    size_t index;           ///< index of the corner point
+    Eigen::Vector3f pointA; ///< first point on the line
+    Eigen::Vector3f pointB; ///< second point on the line
+  };
+
+  /** \brief Cached plane correspondence of a surface point. */
+  struct PlaneMatch {
+    size_t index;          ///< index of the surface point
+    Eigen::Vector4f plane; ///< plane coefficients (normal and offset)
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  typedef std::vector<PlaneMatch, Eigen::aligned_allocator<PlaneMatch>>
+      PlaneMatches;
+
+  /** \brief Construct a new manager.
+   *
+   * @param maxIterations the maximum number of iterations per match
+   * @param deltaRAbort the convergence threshold of the rotation step (deg)
+   * @param deltaTAbort the convergence threshold of the translation step (cm)
+   * @param deltaRReassociate the rotation (deg) since the last association
+   * which triggers a new association, 0 to associate every iteration
+   * @param deltaTReassociate the translation (cm) since the last association
+   * which triggers a new association, 0 to associate every iteration
+   */
+  explicit ConvergenceManager(const size_t &maxIterations = 10,
+                              const float &deltaRAbort = 0.05,
+                              const float &deltaTAbort = 0.05,
+                              const float &deltaRReassociate = 0.2,
+                              const float &deltaTReassociate = 2.0)
+      : _maxIterations(maxIterations), _deltaRAbort(deltaRAbort),
+        _deltaTAbort(deltaTAbort), _deltaRReassociate(deltaRReassociate),
+        _deltaTReassociate(deltaTReassociate) {
+    reset(0);
+  }
+
+  inline void setMaxIterations(const size_t &maxIterations) {
+    _maxIterations = maxIterations;
+  }
+
+  inline void setConvergeThreshold(const float &deltaRAbort,
+                                   const float &deltaTAbort) {
+    _deltaRAbort = deltaRAbort;
+    _deltaTAbort = deltaTAbort;
+  }
+
+  inline void setReassociateThreshold(const float &deltaRReassociate,
+                                      const float &deltaTReassociate) {
+    _deltaRReassociate = deltaRReassociate;
+    _deltaTReassociate = deltaTReassociate;
+  }
+
+  /** \brief The maximum number of iterations per match. */
+  const size_t &maxIterations() const { return _maxIterations; }
+
+  /** \brief Start a new match.
+   *
+   * @param searches the number of nearest neighbor searches of one
+   * association, i.e. the number of feature points
+   */
+  void reset(const size_t &searches) {
+    _searches = searches;
+    _iterations = 0;
+    _associations = 0;
+    _fresh = false;
+    _confirm = false;
+    _sinceAssociation.setZero();
+    _lines.clear();
+    _planes.clear();
+  }
+
+  /** \brief Check if the next iteration has to search new correspondences. */
+  bool reassociate() const {
+    if (_associations == 0 || _confirm || _deltaRReassociate <= 0 ||
+        _deltaTReassociate <= 0) {
+      return true;
+    }
+    return rotationDeg(_sinceAssociation) >= _deltaRReassociate ||
+           translationCm(_sinceAssociation) >= _deltaTReassociate;
+  }
+
+  /** \brief Start a new association, clearing the cached correspondences. */
+  void associate() {
+    _associations++;
+    _fresh = true;
+    _confirm = false;
+    _sinceAssociation.setZero();
+    _lines.clear();
+    _planes.clear();
+  }
+
+  /** \brief Cache a line correspondence of the current association. */
+  void addLine(const size_t &index, const Eigen::Vector3f &pointA,
+               const Eigen::Vector3f &pointB) {
+    _lines.push_back(LineMatch{index, pointA, pointB});
+  }
+
+  /** \brief Cache a plane correspondence of the current association. */
+  void addPlane(const size_t &index, const Eigen::Vector4f &plane) {
+    _planes.push_back(PlaneMatch());
+    _planes.back().index = index;
+    _planes.back().plane = plane;
+  }
+
+  /** \brief The line correspondences of the last association. */
+  const std::vector<LineMatch> &lines() const { return _lines; }
+
+  /** \brief The plane correspondences of the last association. */
+  const PlaneMatches &planes() const { return _planes; }
+
+  /** \brief Record the pose step of an iteration.
+   *
+   * @param step the pose step (rot_x, rot_y, rot_z, x, y, z)
+   * @return true, if the match converged, false otherwise
+   */
+  bool update(const Eigen::Matrix<float, 6, 1> &step) {
+    _iterations++;
+    _sinceAssociation += step;
+    bool small = rotationDeg(step) < _deltaRAbort &&
+                 translationCm(step) < _deltaTAbort;
+    if (small && !_fresh) {
+      // confirm the step with a new association
+      _confirm = true;
+      return false;
+    }
+    _fresh = false;
+    return small;
+  }
+
+  /** \brief The number of iterations of the last match. */
+  const size_t &iterations() const { return _iterations; }
+
+  /** \brief The number of associations of the last match. */
+  const size_t &associations() const { return _associations; }
+
+  /** \brief The number of iterations saved by early termination. */
+  size_t savedIterations() const {
+    return _iterations < _maxIterations ? _maxIterations - _iterations : 0;
+  }
+
+  /** \brief The number of nearest neighbor searches saved by reusing
+   * correspondences. */
+  size_t savedSearches() const {
+    return _iterations > _associations
+               ? (_iterations - _associations) * _searches
+               : 0;
+  }
+
+private:
+  static float rotationDeg(const Eigen::Matrix<float, 6, 1> &step) {
+    return std::sqrt(std::pow(rad2deg(step(0)), 2) +
+                     std::pow(rad2deg(step(1)), 2) +
+                     std::pow(rad2deg(step(2)), 2));
+  }
+
+  static float translationCm(const Eigen::Matrix<float, 6, 1> &step) {
+    return std::sqrt(std::pow(step(3) * 100, 2) + std::pow(step(4) * 100, 2) +
+                     std::pow(step(5) * 100, 2));
+  }
+
+  size_t _maxIterations;    ///< maximum number of iterations
+  float _deltaRAbort;       ///< convergence threshold of the rotation (deg)
+  float _deltaTAbort;       ///< convergence threshold of the translation (cm)
+  float _deltaRReassociate; ///< reassociation threshold of the rotation (deg)
+  float _deltaTReassociate; ///< reassociation threshold of the translation (cm)
+
+  size_t _searches;     ///< nearest neighbor searches per association
+  size_t _iterations;   ///< iterations of the current match
+  size_t _associations; ///< associations of the current match
+  bool _fresh;          ///< flag if the correspondences were just searched
+  bool _confirm;        ///< flag if convergence needs a new association
+  Eigen::Matrix<float, 6, 1> _sinceAssociation; ///< pose change since the
+                                                ///< last association
+  std::vector<LineMatch> _lines; ///< cached line correspondences
+  PlaneMatches _planes;          ///< cached plane correspondences
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_CONVERGENCEMANAGER_H
@@ -108,6 +108,17 @@ public:
     _sensorGloId._depth = sensorGloDepth;
   }
 
+  inline void setupRobustKernel(const RobustKernel &kernel) {
+    _robustKernel = kernel;
+  }
+
+  inline void setupConvergence(const ConvergenceManager &convergence) {
+    _convergence = convergence;
+  }
+
+  /** \brief The iteration statistics of the last scan match. */
+  inline const ConvergenceManager &convergence() const { return _convergence; }
+
   inline void setupWorldCubeSize(float worldCubeSize) {
     _worldCubeSize = worldCubeSize;
   }
@@ -271,6 +282,8 @@ private:
   float _lidarValidDistance; //雷达射程
   float _lidarMaxUpDegree; // 雷达仰角最大值
   float _lidarMaxDownDegree; // 雷达俯角最大值
+  RobustKernel _robustKernel; ///< robust kernel of the match residuals
+  ConvergenceManager _convergence; ///< iteration control of the scan match
   std::string _filePath; // cube块保存、加载路径
 
   bool _firstRead;
@@ -810,7 +823,7 @@ inline bool DynamicFeatureMap<PointT>::scanMatchScan(const PointCloudConstPtr &C
 {
   Twist transform = transformf;
 
-  PointT pointSel, pointOri, pointProj, coeff;
+  PointT pointSel, pointOri, pointProj;
   std::vector<int> pointSearchInd(5, 0);
   std::vector<float> pointSearchSqDis(5, 0);
 
@@ -822,174 +835,103 @@ inline bool DynamicFeatureMap<PointT>::scanMatchScan(const PointCloudConstPtr &C
   size_t SurfNum = SurfCloud->points.size();
   //printf("size: %d %d\n", CornerNum, SurfNum);
 
-  pcl::PointCloud<PointT> laserCloudOri;
-  pcl::PointCloud<PointT> coeffSel;
-
 
   int line_match_count = 0;
   int plane_match_count = 0;
   size_t iterCount;
-  for (iterCount = 0; iterCount < 10; iterCount++) {
-    laserCloudOri.clear();
-    coeffSel.clear();
-    line_match_count = 0;
-    plane_match_count = 0;
-    for (int i = 0; i < CornerNum; i++) {
-      pointOri = CornerCloud->points[i];
-      pointAssociateToMap(transform, pointOri, pointSel);
-      Point3d gloIdx, locIdx, locPosIdx;
-      // printf("point sel: %.3f %.3f %.3f\n", pointSel.x, pointSel.y, pointSel.z);
-      Glo2GloIdx(gloIdx, pointSel);
-      // printf("Point glo Idx: (%d %d %d)\n", gloIdx[0], gloIdx[1], gloIdx[2]);
-      GloIdx2LocIdx(locIdx, gloIdx, _sensorGloId);
-      // printf("Loc Idx: (%d %d %d)\n", locIdx[0], locIdx[1], locIdx[2]);
-      locIdx2LocPosIdx(locPosIdx, locIdx);
-      // printf("Loc Positive Idx: (%d %d %d)\n", locPosIdx[0], locPosIdx[1], locPosIdx[2]);
-      int idx = locPosIdx2IndexValue(locPosIdx);
-      // printf("Point glo Idx: (%d %d %d), sensor glo Idx: (%d %d %d)\n", gloIdx[0], gloIdx[1], gloIdx[2], _sensorGloId[0], _sensorGloId[1], _sensorGloId[2]);
-      if(_oldCornerCube[idx]->points.size() < 5) continue;
-      _kdtreeCorner[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-      if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
-        const Eigen::Vector3f &point = pointSel.getVector3fMap();
-        Eigen::Vector3f lineA, lineB;
-        if (findLine(*_oldCornerCube[idx], pointSearchInd, lineA, lineB)) {
-          PointT coefficients;
-          if (getCornerFeatureCoefficients(lineA, lineB, point, coefficients)) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coefficients);
+  _convergence.reset(CornerNum + SurfNum);
+  for (iterCount = 0; iterCount < _convergence.maxIterations(); iterCount++) {
+    if (_convergence.reassociate()) {
+      // search new correspondences
+      _convergence.associate();
+      line_match_count = 0;
+      plane_match_count = 0;
+      for (int i = 0; i < CornerNum; i++) {
+        pointOri = CornerCloud->points[i];
+        pointAssociateToMap(transform, pointOri, pointSel);
+        Point3d gloIdx, locIdx, locPosIdx;
+        // printf("point sel: %.3f %.3f %.3f\n", pointSel.x, pointSel.y, pointSel.z);
+        Glo2GloIdx(gloIdx, pointSel);
+        // printf("Point glo Idx: (%d %d %d)\n", gloIdx[0], gloIdx[1], gloIdx[2]);
+        GloIdx2LocIdx(locIdx, gloIdx, _sensorGloId);
+        // printf("Loc Idx: (%d %d %d)\n", locIdx[0], locIdx[1], locIdx[2]);
+        locIdx2LocPosIdx(locPosIdx, locIdx);
+        // printf("Loc Positive Idx: (%d %d %d)\n", locPosIdx[0], locPosIdx[1], locPosIdx[2]);
+        int idx = locPosIdx2IndexValue(locPosIdx);
+        // printf("Point glo Idx: (%d %d %d), sensor glo Idx: (%d %d %d)\n", gloIdx[0], gloIdx[1], gloIdx[2], _sensorGloId[0], _sensorGloId[1], _sensorGloId[2]);
+        if(_oldCornerCube[idx]->points.size() < 5) continue;
+        _kdtreeCorner[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+        if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
+          Eigen::Vector3f lineA, lineB;
+          if (findLine(*_oldCornerCube[idx], pointSearchInd, lineA, lineB)) {
+            _convergence.addLine(i, lineA, lineB);
+            line_match_count++;
           }
-          line_match_count++;
         }
       }
-    }
 
-    for (int i = 0; i < SurfNum; i++) {
-      pointOri = SurfCloud->points[i];
-      pointAssociateToMap(transform, pointOri, pointSel);
-      Point3d gloIdx, locIdx, locPosIdx;
-      Glo2GloIdx(gloIdx, pointSel);
-      GloIdx2LocIdx(locIdx, gloIdx, _sensorGloId);
-      locIdx2LocPosIdx(locPosIdx, locIdx);
-      int idx = locPosIdx2IndexValue(locPosIdx);
-      if(_oldSurfCube[idx]->points.size() < 5) continue;
-      _kdtreeSurf[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-      if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
-        Eigen::Vector4f planeCoef;
-        if (findPlane(*_oldSurfCube[idx], pointSearchInd, 0.2, planeCoef)) {
-          PointT coefficients;
-          if (getSurfaceFeatureCoefficients(planeCoef, pointSel,
-                                            coefficients)) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coefficients);
+      for (int i = 0; i < SurfNum; i++) {
+        pointOri = SurfCloud->points[i];
+        pointAssociateToMap(transform, pointOri, pointSel);
+        Point3d gloIdx, locIdx, locPosIdx;
+        Glo2GloIdx(gloIdx, pointSel);
+        GloIdx2LocIdx(locIdx, gloIdx, _sensorGloId);
+        locIdx2LocPosIdx(locPosIdx, locIdx);
+        int idx = locPosIdx2IndexValue(locPosIdx);
+        if(_oldSurfCube[idx]->points.size() < 5) continue;
+        _kdtreeSurf[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+        if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
+          Eigen::Vector4f planeCoef;
+          if (findPlane(*_oldSurfCube[idx], pointSearchInd, 0.2, planeCoef)) {
+            _convergence.addPlane(i, planeCoef);
+            plane_match_count++;
           }
-          plane_match_count++;
         }
       }
     }
 
-    float srx = transform.rot_x.sin();
-    float crx = transform.rot_x.cos();
-    float sry = transform.rot_y.sin();
-    float cry = transform.rot_y.cos();
-    float srz = transform.rot_z.sin();
-    float crz = transform.rot_z.cos();
+    // residuals of the correspondences at the current pose, added straight
+    // into the normal equations
+    GaussNewtonAccumulator normalEquations(_robustKernel);
+    normalEquations.reset(transform);
+    size_t laserCloudSelNum = 0;
+
+    const std::vector<ConvergenceManager::LineMatch> &lines =
+        _convergence.lines();
+    for (size_t i = 0; i < lines.size(); i++) {
+      pointOri = CornerCloud->points[lines[i].index];
+      pointAssociateToMap(transform, pointOri, pointSel);
+      PointT coefficients;
+      if (getCornerFeatureCoefficients(lines[i].pointA, lines[i].pointB,
+                                       pointSel.getVector3fMap(), coefficients,
+                                       !_robustKernel.enabled())) {
+        normalEquations.addPoint(pointOri, coefficients);
+        laserCloudSelNum++;
+      }
+    }
+
+    const ConvergenceManager::PlaneMatches &planes = _convergence.planes();
+    for (size_t i = 0; i < planes.size(); i++) {
+      pointOri = SurfCloud->points[planes[i].index];
+      pointAssociateToMap(transform, pointOri, pointSel);
+      PointT coefficients;
+      if (getSurfaceFeatureCoefficients(planes[i].plane, pointSel,
+                                        coefficients,
+                                        !_robustKernel.enabled())) {
+        normalEquations.addPoint(pointOri, coefficients);
+        laserCloudSelNum++;
+      }
+    }
 
-    size_t laserCloudSelNum = laserCloudOri.points.size();
     if (laserCloudSelNum < 50) {
       ROS_WARN("matched cloud points too few. Matched/Input:  %zd / %zd", laserCloudSelNum, CornerNum+SurfNum);
       break;
     }
 
-    Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-    Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-    Eigen::Matrix<float, 6, 6> matAtA;
-    Eigen::VectorXf matB(laserCloudSelNum);
-    Eigen::VectorXf matAtB;
-    Eigen::VectorXf matX;
-
-
-    for (int i = 0; i < laserCloudSelNum; i++) {
-      pointOri = laserCloudOri.points[i];
-      coeff = coeffSel.points[i];
-
-/*
-      float arx = (crx * sry * srz * pointOri.x + crx * crz * sry * pointOri.y -
-                   srx * sry * pointOri.z) *
-                      coeff.x +
-                  (-srx * srz * pointOri.x - crz * srx * pointOri.y -
-                   crx * pointOri.z) *
-                      coeff.y +
-                  (crx * cry * srz * pointOri.x + crx * cry * crz * pointOri.y -
-                   cry * srx * pointOri.z) *
-                      coeff.z;
-
-      float ary = ((cry * srx * srz - crz * sry) * pointOri.x +
-                   (sry * srz + cry * crz * srx) * pointOri.y +
-                   crx * cry * pointOri.z) *
-                      coeff.x +
-                  ((-cry * crz - srx * sry * srz) * pointOri.x +
-                   (cry * srz - crz * srx * sry) * pointOri.y -
-                   crx * sry * pointOri.z) *
-                      coeff.z;
-
-      float arz = ((crz * srx * sry - cry * srz) * pointOri.x +
-                   (-cry * crz - srx * sry * srz) * pointOri.y) *
-                      coeff.x +
-                  (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y +
-                  ((sry * srz + cry * crz * srx) * pointOri.x +
-                   (crz * sry - cry * srx * srz) * pointOri.y) *
-                      coeff.z;
-                      */
-float arx = ((crz*sry*crx + srz*srx)* pointOri.y +(srz*crx-crz*sry*srx)* pointOri.z)*coeff.x +
-((srz*sry*crx-crz*srx)*pointOri.y -(srz*sry*srx+crz*crx)*pointOri.z)*coeff.y +
-(cry*crx*pointOri.y-cry*srx*pointOri.z)*coeff.z;
-
-float ary = (-crz*sry*pointOri.x+crz*cry*srx*pointOri.y+crz*cry*crx*pointOri.z)*coeff.x +
-(-srz*sry*pointOri.x+srz*cry*srx*pointOri.y +srz*cry*crx*pointOri.z)*coeff.y +
-(-cry*pointOri.x-sry*srx*pointOri.y-sry*crx*pointOri.z)*coeff.z;
-
-float arz = (-srz*cry*pointOri.x -(srz*sry*srx+crz*crx)*pointOri.y+(crz*srx-srz*sry*crx)*pointOri.z)*coeff.x+
-(crz*cry*pointOri.x+ (crz*sry*srx-srz*crx)*pointOri.y+crz*sry*crx+srz*srx*pointOri.z)*coeff.y+
-0*coeff.z;
-
-      matA(i, 0) = arx;
-      matA(i, 1) = ary;
-      matA(i, 2) = arz;
-      matA(i, 3) = coeff.x;
-      matA(i, 4) = coeff.y;
-      matA(i, 5) = coeff.z;
-      matB(i, 0) = -coeff.intensity;
-    }
-
-    matAt = matA.transpose();
-    matAtA = matAt * matA;
-    matAtB = matAt * matB;
-    matX = matAtA.colPivHouseholderQr().solve(matAtB);
+    Eigen::Matrix<float, 6, 1> matX = normalEquations.solve();
 
     if (iterCount == 0) {
-      Eigen::Matrix<float, 1, 6> matE;
-      Eigen::Matrix<float, 6, 6> matV;
-      Eigen::Matrix<float, 6, 6> matV2;
-
-      Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> esolver(matAtA);
-      matE = esolver.eigenvalues().real();
-      matV = esolver.eigenvectors().real();
-
-      matV2 = matV;
-
-      isDegenerate = false;
-      float eignThre[6] = {100, 100, 100, 100, 100, 100};
-      for (int i = 0; i < 6; i++) {
-        if (matE(0, i) < eignThre[i]) {
-          for (int j = 0; j < 6; j++) {
-            matV2(i, j) = 0;
-          }
-          isDegenerate = true;
-        } else {
-          break;
-        }
-      }
-      matP = matV.inverse() * matV2;
+      isDegenerate = normalEquations.degeneracyProjection(100, matP);
     }
 
     if (isDegenerate) {
@@ -1004,18 +946,13 @@ float arz = (-srz*cry*pointOri.x -(srz*sry*srx+crz*crx)*pointOri.y+(crz*srx-srz*
     transform.pos.y() += matX(4, 0);
     transform.pos.z() += matX(5, 0);
 
-    float deltaR =
-        sqrt(pow(rad2deg(matX(0, 0)), 2) + pow(rad2deg(matX(1, 0)), 2) +
-             pow(rad2deg(matX(2, 0)), 2));
-    float deltaT = sqrt(pow(matX(3, 0) * 100, 2) + pow(matX(4, 0) * 100, 2) +
-                        pow(matX(5, 0) * 100, 2));
-
-    if (deltaR < 0.05 && deltaT < 0.05) {
+    if (_convergence.update(matX)) {
       converge = true;
       break;
     }
   }
   transformf = transform;
+  return converge;
 }
 
 
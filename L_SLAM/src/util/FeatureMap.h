@@ -18,7 +18,12 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 
+#include "ConvergenceManager.h"
+#include "GaussNewtonAccumulator.h"
+#include "NdtVoxelGrid.h"
+#include "PrimitiveCache.h"
 #include "Twist.h"
 #include "math_utils.h"
 #include "transform_utils.h"
@@ -64,7 +69,10 @@ public:
         _cubeOriginHeight(std::round(--cubeHeight_ / 2.0)),
         _cubeOriginDepth(std::round(--cubeDepth_ / 2.0)), _worldCubeSize(50.0),
         _lidarValidDistance(150.0), _cloudCornerSwap(new PointCloud()),
-        _cloudSurfSwap(new PointCloud()), _filesDirectory("~") {
+        _cloudSurfSwap(new PointCloud()), _filesDirectory("~"),
+        _cornerRevision(_cubeNum, 0), _surfRevision(_cubeNum, 0),
+        _cornerFilteredRevision(_cubeNum, 0), _surfFilteredRevision(_cubeNum, 0),
+        _revisionCount(0) {
     _downSizeFilterCorner.setLeafSize(0.2, 0.2, 0.2);
     _downSizeFilterSurf.setLeafSize(0.2, 0.2, 0.2);
     _downSizeFilterMap.setLeafSize(0.6, 0.6, 0.6);
@@ -87,6 +95,25 @@ public:
     _cubeOriginDepth = cubeOriginDepth;
   }
 
+  inline void setupRobustKernel(const RobustKernel &kernel) {
+    _robustKernel = kernel;
+  }
+
+  inline void setupConvergence(const ConvergenceManager &convergence) {
+    _convergence = convergence;
+  }
+
+  /** \brief The iteration statistics of the last scan match. */
+  inline const ConvergenceManager &convergence() const { return _convergence; }
+
+  /** \brief Set the voxel size and the minimum number of points per voxel of
+   * the NDT distributions, clears the computed distributions. */
+  inline void setupNdt(float resolution, size_t minPoints) {
+    _ndtPrototype = NdtGrid(resolution, minPoints);
+    _ndtCorner.clear();
+    _ndtSurf.clear();
+  }
+
   inline void setupWorldCubeSize(float worldCubeSize) {
     _worldCubeSize = worldCubeSize;
   }
@@ -118,6 +145,13 @@ public:
 
   void update(const PointT &sensorPose);
   void getSurroundFeature(PointCloud &surroundCorner, PointCloud &surroundSurf);
+
+  /** \brief Get the surround feature clouds together with their segments, one
+   * per valid cube, which keep their revision as long as the cube points are
+   * unchanged. */
+  void getSurroundFeature(PointCloud &surroundCorner, PointCloud &surroundSurf,
+                          CloudSegments &cornerSegments,
+                          CloudSegments &surfSegments);
   void downsizeValidCloud();
   bool getFullMap(PointCloudPtr &mapCloud);
 
@@ -132,6 +166,20 @@ public:
                               const PointCloudConstPtr &SurfCloud,
                               Eigen::Isometry3f &relative_pose);
 
+  /** \brief Match feature clouds against the voxel distributions (NDT) of
+   * the map cubes.
+   *
+   * The distributions of a cube are computed once after it changed, every
+   * point is then matched with a single hash lookup and a Mahalanobis
+   * residual instead of a nearest neighbor search and a line / plane fit.
+   */
+  inline bool scanMatchNdt(const PointCloudConstPtr &CornerCloud,
+                           const PointCloudConstPtr &SurfCloud,
+                           Twist &transformf);
+  inline bool scanMatchNdt(const PointCloudConstPtr &CornerCloud,
+                           const PointCloudConstPtr &SurfCloud,
+                           Eigen::Isometry3f &relative_pose);
+
   inline std::string fileNameFormat(const std::string filesDirectory,
                                     int number) {
     std::stringstream ss;
@@ -152,6 +200,13 @@ private:
   int worldToCube(float world_x, float world_y, float world_z, int &gridI,
                   int &gridJ, int &gridK);
 
+  typedef NdtVoxelGrid<PointT> NdtGrid;
+  typedef std::unordered_map<int, NdtGrid> NdtCubes;
+
+  /** \brief The voxel distributions of a cube, computed on first use. */
+  const NdtGrid &ndtGrid(NdtCubes &cubes, const PointCloudCube<PointT> &cloud,
+                         int index);
+
 private:
   int _cubeWidth, _cubeHeight, _cubeDepth; // the size of cubic gird
 
@@ -162,6 +217,11 @@ private:
   int _cubeNum;         // cube块总个数
   float _worldCubeSize; // cube块的尺度，立方体 m*m*m
   float _lidarValidDistance;
+  RobustKernel _robustKernel; ///< robust kernel of the match residuals
+  ConvergenceManager _convergence; ///< iteration control of the scan match
+  NdtGrid _ndtPrototype; ///< configuration of the cube distributions
+  NdtCubes _ndtCorner;   ///< corner distributions of the unchanged cubes
+  NdtCubes _ndtSurf;     ///< surface distributions of the unchanged cubes
   std::string _filesDirectory; // cube块保存、加载路径
 
   PointCloudCube<PointT> _cornerCube;
@@ -172,6 +232,14 @@ private:
   std::vector<size_t> _cubeValidInd;
   std::vector<size_t> _cubeUpdated;
 
+  std::vector<size_t> _cornerRevision; ///< revision of the corner cubes
+  std::vector<size_t> _surfRevision;   ///< revision of the surface cubes
+  std::vector<size_t>
+      _cornerFilteredRevision; ///< revision of the down sized corner cubes
+  std::vector<size_t>
+      _surfFilteredRevision; ///< revision of the down sized surface cubes
+  size_t _revisionCount;     ///< last assigned cube revision
+
   std::vector< nanoflann::KdTreeFLANN<PointT> > _kdtreeCorner;
   std::vector< nanoflann::KdTreeFLANN<PointT> > _kdtreeSurf;
 
@@ -192,6 +260,8 @@ inline void FeatureMap<PointT>::pushCornerPoint(const PointT &point) {
   worldToCube(point.x, point.y, point.z, gridI, gridJ, gridK);
   if (isIndexValid(gridI, gridJ, gridK)) {
     _cornerCube[toIndex(gridI, gridJ, gridK)]->push_back(point);
+    _cornerRevision[toIndex(gridI, gridJ, gridK)] = ++_revisionCount;
+    _ndtCorner.erase(toIndex(gridI, gridJ, gridK));
   }
 }
 template <typename PointT>
@@ -200,6 +270,8 @@ inline void FeatureMap<PointT>::pushSurfPoint(const PointT &point) {
   worldToCube(point.x, point.y, point.z, gridI, gridJ, gridK);
   if (isIndexValid(gridI, gridJ, gridK)) {
     _surfCube[toIndex(gridI, gridJ, gridK)]->push_back(point);
+    _surfRevision[toIndex(gridI, gridJ, gridK)] = ++_revisionCount;
+    _ndtSurf.erase(toIndex(gridI, gridJ, gridK));
   }
 }
 
@@ -264,6 +336,35 @@ inline void FeatureMap<PointT>::getSurroundFeature(PointCloud &surroundCorner,
   }
 }
 
+template <typename PointT>
+inline void FeatureMap<PointT>::getSurroundFeature(
+    PointCloud &surroundCorner, PointCloud &surroundSurf,
+    CloudSegments &cornerSegments, CloudSegments &surfSegments) {
+  getSurroundFeature(surroundCorner, surroundSurf);
+  cornerSegments.resize(_cubeValidInd.size());
+  surfSegments.resize(_cubeValidInd.size());
+  const size_t layer = size_t(_cubeWidth) * _cubeHeight;
+  for (size_t i = 0; i < _cubeValidInd.size(); i++) {
+    size_t ind = _cubeValidInd[i];
+    cornerSegments[i].revision = _cornerRevision[ind];
+    cornerSegments[i].size = _cornerCube[ind]->size();
+    surfSegments[i].revision = _surfRevision[ind];
+    surfSegments[i].size = _surfCube[ind]->size();
+
+    // the cube covers all points rounded to its center (see worldToCube())
+    Eigen::Vector3f center(
+        float(int(ind % _cubeWidth) - _cubeOriginWidth),
+        float(int(ind % layer / _cubeWidth) - _cubeOriginHeight),
+        float(int(ind / layer) - _cubeOriginDepth));
+    center *= _worldCubeSize;
+    const Eigen::Vector3f halfSize =
+        Eigen::Vector3f::Constant(0.5f * _worldCubeSize);
+    cornerSegments[i].bounds = Eigen::AlignedBox3f(center - halfSize,
+                                                   center + halfSize);
+    surfSegments[i].bounds = cornerSegments[i].bounds;
+  }
+}
+
 template <typename PointT>
 inline bool FeatureMap<PointT>::getFullMap(PointCloudPtr &mapCloud) {
   mapCloud->clear();
@@ -287,21 +388,31 @@ inline bool FeatureMap<PointT>::getFullMap(PointCloudPtr &mapCloud) {
 
 template <typename PointT>
 inline void FeatureMap<PointT>::downsizeValidCloud() {
-  // down size all valid (within field of view) feature cube clouds
+  // down size the valid (within field of view) feature cube clouds with new
+  // points, filtering changes the points and thus the cube revision; cubes
+  // without new points keep their points, revisions and NDT distributions
   size_t validNum = _cubeValidInd.size();
   for (int i = 0; i < validNum; i++) {
     size_t ind = _cubeValidInd[i];
-    _cloudCornerSwap->clear();
-    _downSizeFilterCorner.setInputCloud(_cornerCube[ind]);
-    _downSizeFilterCorner.filter(*_cloudCornerSwap);
-
-    _cloudSurfSwap->clear();
-    _downSizeFilterSurf.setInputCloud(_surfCube[ind]);
-    _downSizeFilterSurf.filter(*_cloudSurfSwap);
+    if (_cornerRevision[ind] != _cornerFilteredRevision[ind]) {
+      _cloudCornerSwap->clear();
+      _downSizeFilterCorner.setInputCloud(_cornerCube[ind]);
+      _downSizeFilterCorner.filter(*_cloudCornerSwap);
+      _cornerCube[ind].swap(_cloudCornerSwap);
+      _cornerRevision[ind] = ++_revisionCount;
+      _cornerFilteredRevision[ind] = _cornerRevision[ind];
+      _ndtCorner.erase(ind);
+    }
 
-    // swap cube clouds for next processing
-    _cornerCube[ind].swap(_cloudCornerSwap);
-    _surfCube[ind].swap(_cloudSurfSwap);
+    if (_surfRevision[ind] != _surfFilteredRevision[ind]) {
+      _cloudSurfSwap->clear();
+      _downSizeFilterSurf.setInputCloud(_surfCube[ind]);
+      _downSizeFilterSurf.filter(*_cloudSurfSwap);
+      _surfCube[ind].swap(_cloudSurfSwap);
+      _surfRevision[ind] = ++_revisionCount;
+      _surfFilteredRevision[ind] = _surfRevision[ind];
+      _ndtSurf.erase(ind);
+    }
   }
 }
 template <typename PointT>
@@ -353,6 +464,9 @@ inline void FeatureMap<PointT>::computeActiveAera(const PointT sensorPose) {
 template <typename PointT>
 inline void FeatureMap<PointT>::shift(int dIndexI, int dIndexJ, int dIndexK) {
   if (dIndexI != 0 || dIndexJ != 0 || dIndexK != 0) {
+    // the cube indices change, the distributions are recomputed on demand
+    _ndtCorner.clear();
+    _ndtSurf.clear();
     for (int i = 0; i < _cubeWidth; i++) {
       for (int j = 0; j < _cubeHeight; j++) {
         for (int k = 0; k < _cubeDepth; k++) {
@@ -364,10 +478,25 @@ inline void FeatureMap<PointT>::shift(int dIndexI, int dIndexJ, int dIndexK) {
                       _cornerCube[toIndex(oldI, oldJ, oldK)]);
             std::swap(_surfCube[toIndex(i, j, k)],
                       _surfCube[toIndex(oldI, oldJ, oldK)]);
+            std::swap(_cornerRevision[toIndex(i, j, k)],
+                      _cornerRevision[toIndex(oldI, oldJ, oldK)]);
+            std::swap(_surfRevision[toIndex(i, j, k)],
+                      _surfRevision[toIndex(oldI, oldJ, oldK)]);
+            std::swap(_cornerFilteredRevision[toIndex(i, j, k)],
+                      _cornerFilteredRevision[toIndex(oldI, oldJ, oldK)]);
+            std::swap(_surfFilteredRevision[toIndex(i, j, k)],
+                      _surfFilteredRevision[toIndex(oldI, oldJ, oldK)]);
           } else {
             //@TODO: savetofiles...
             _cornerCube[toIndex(i, j, k)]->clear();
             _surfCube[toIndex(i, j, k)]->clear();
+            _cornerRevision[toIndex(i, j, k)] = ++_revisionCount;
+            _surfRevision[toIndex(i, j, k)] = ++_revisionCount;
+            // an empty cube needs no down sizing
+            _cornerFilteredRevision[toIndex(i, j, k)] =
+                _cornerRevision[toIndex(i, j, k)];
+            _surfFilteredRevision[toIndex(i, j, k)] =
+                _surfRevision[toIndex(i, j, k)];
           }
         }
       }
@@ -420,6 +549,8 @@ inline bool FeatureMap<PointT>::loadCloudFromFiles() {
     return false;
 
   int count, type, i, j, k, size = 0;
+  _ndtCorner.clear();
+  _ndtSurf.clear();
   while (!fin.eof()) {
     fin >> count >> type >> i >> j >> k >> size;
 
@@ -435,6 +566,9 @@ inline bool FeatureMap<PointT>::loadCloudFromFiles() {
         _downSizeFilterCorner.setInputCloud(cloudCornerPointer);
         _downSizeFilterCorner.filter(*_cloudCornerSwap);
         _cornerCube[toIndex(i, j, k)].swap(_cloudCornerSwap);
+        _cornerRevision[toIndex(i, j, k)] = ++_revisionCount;
+        _cornerFilteredRevision[toIndex(i, j, k)] =
+            _cornerRevision[toIndex(i, j, k)];
         _kdtreeCorner[toIndex(i, j, k)].setInputCloud(_cornerCube[toIndex(i, j, k)]);
         //*_cornerCube[toIndex(i, j, k)] = *cloudCornerPointer;
       }
@@ -450,6 +584,9 @@ inline bool FeatureMap<PointT>::loadCloudFromFiles() {
         _downSizeFilterSurf.setInputCloud(cloudSurfPointer);
         _downSizeFilterSurf.filter(*_cloudSurfSwap);
         _surfCube[toIndex(i, j, k)].swap(_cloudSurfSwap);
+        _surfRevision[toIndex(i, j, k)] = ++_revisionCount;
+        _surfFilteredRevision[toIndex(i, j, k)] =
+            _surfRevision[toIndex(i, j, k)];
         _kdtreeSurf[toIndex(i, j, k)].setInputCloud(_surfCube[toIndex(i, j, k)]);
         //*_surfCube[toIndex(i, j, k)] = *cloudSurfPointer;
       }
@@ -493,7 +630,7 @@ inline bool FeatureMap<PointT>::scanMatchScan(const PointCloudConstPtr &CornerCl
 {
   Twist transform = transformf;
 
-  PointT pointSel, pointOri, pointProj, coeff;
+  PointT pointSel, pointOri, pointProj;
   std::vector<int> pointSearchInd(5, 0);
   std::vector<float> pointSearchSqDis(5, 0);
 
@@ -505,163 +642,93 @@ inline bool FeatureMap<PointT>::scanMatchScan(const PointCloudConstPtr &CornerCl
   size_t SurfNum = SurfCloud->points.size();
   // printf("size: %d %d\n", CornerNum, SurfNum);
 
-  pcl::PointCloud<PointT> laserCloudOri;
-  pcl::PointCloud<PointT> coeffSel;
-
 
   int line_match_count = 0;
   int plane_match_count = 0;
   size_t iterCount;
-  for (iterCount = 0; iterCount < 10; iterCount++) {
-    laserCloudOri.clear();
-    coeffSel.clear();
-    line_match_count = 0;
-    plane_match_count = 0;
-    for (int i = 0; i < CornerNum; i++) {
-      pointOri = CornerCloud->points[i];
-      pointAssociateToMap(transform, pointOri, pointSel);
-      int idx = worldToIndex(pointSel.x, pointSel.y, pointSel.z);
-      if(idx<0) continue;
-      if(_cornerCube[idx]->points.size() < 5) continue;
-      _kdtreeCorner[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-      if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
-        const Eigen::Vector3f &point = pointSel.getVector3fMap();
-        Eigen::Vector3f lineA, lineB;
-        if (findLine(*_cornerCube[idx], pointSearchInd, lineA, lineB)) {
-          PointT coefficients;
-          if (getCornerFeatureCoefficients(lineA, lineB, point, coefficients)) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coefficients);
+  _convergence.reset(CornerNum + SurfNum);
+  for (iterCount = 0; iterCount < _convergence.maxIterations(); iterCount++) {
+    if (_convergence.reassociate()) {
+      // search new correspondences
+      _convergence.associate();
+      line_match_count = 0;
+      plane_match_count = 0;
+      for (int i = 0; i < CornerNum; i++) {
+        pointOri = CornerCloud->points[i];
+        pointAssociateToMap(transform, pointOri, pointSel);
+        int idx = worldToIndex(pointSel.x, pointSel.y, pointSel.z);
+        if(idx<0) continue;
+        if(_cornerCube[idx]->points.size() < 5) continue;
+        _kdtreeCorner[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+        if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
+          Eigen::Vector3f lineA, lineB;
+          if (findLine(*_cornerCube[idx], pointSearchInd, lineA, lineB)) {
+            _convergence.addLine(i, lineA, lineB);
+            line_match_count++;
           }
-          line_match_count++;
         }
       }
-    }
 
-    for (int i = 0; i < SurfNum; i++) {
-      pointOri = SurfCloud->points[i];
-      pointAssociateToMap(transform, pointOri, pointSel);
-      int idx = worldToIndex(pointSel.x, pointSel.y, pointSel.z);
-      if(idx<0) continue;
-      if(_surfCube[idx]->points.size() < 5) continue;
-      _kdtreeSurf[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
-      if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
-        Eigen::Vector4f planeCoef;
-        if (findPlane(*_surfCube[idx], pointSearchInd, 0.2, planeCoef)) {
-          PointT coefficients;
-          if (getSurfaceFeatureCoefficients(planeCoef, pointSel,
-                                            coefficients)) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coefficients);
+      for (int i = 0; i < SurfNum; i++) {
+        pointOri = SurfCloud->points[i];
+        pointAssociateToMap(transform, pointOri, pointSel);
+        int idx = worldToIndex(pointSel.x, pointSel.y, pointSel.z);
+        if(idx<0) continue;
+        if(_surfCube[idx]->points.size() < 5) continue;
+        _kdtreeSurf[idx].nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+        if (pointSearchSqDis.size() >= 5 && pointSearchSqDis[4] < 5.0) {
+          Eigen::Vector4f planeCoef;
+          if (findPlane(*_surfCube[idx], pointSearchInd, 0.2, planeCoef)) {
+            _convergence.addPlane(i, planeCoef);
+            plane_match_count++;
           }
-          plane_match_count++;
         }
       }
     }
 
-    float srx = transform.rot_x.sin();
-    float crx = transform.rot_x.cos();
-    float sry = transform.rot_y.sin();
-    float cry = transform.rot_y.cos();
-    float srz = transform.rot_z.sin();
-    float crz = transform.rot_z.cos();
+    // residuals of the correspondences at the current pose, added straight
+    // into the normal equations
+    GaussNewtonAccumulator normalEquations(_robustKernel);
+    normalEquations.reset(transform);
+    size_t laserCloudSelNum = 0;
+
+    const std::vector<ConvergenceManager::LineMatch> &lines =
+        _convergence.lines();
+    for (size_t i = 0; i < lines.size(); i++) {
+      pointOri = CornerCloud->points[lines[i].index];
+      pointAssociateToMap(transform, pointOri, pointSel);
+      PointT coefficients;
+      if (getCornerFeatureCoefficients(lines[i].pointA, lines[i].pointB,
+                                       pointSel.getVector3fMap(), coefficients,
+                                       !_robustKernel.enabled())) {
+        normalEquations.addPoint(pointOri, coefficients);
+        laserCloudSelNum++;
+      }
+    }
+
+    const ConvergenceManager::PlaneMatches &planes = _convergence.planes();
+    for (size_t i = 0; i < planes.size(); i++) {
+      pointOri = SurfCloud->points[planes[i].index];
+      pointAssociateToMap(transform, pointOri, pointSel);
+      PointT coefficients;
+      if (getSurfaceFeatureCoefficients(planes[i].plane, pointSel,
+                                        coefficients,
+                                        !_robustKernel.enabled())) {
+        normalEquations.addPoint(pointOri, coefficients);
+        laserCloudSelNum++;
+      }
+    }
 
-    size_t laserCloudSelNum = laserCloudOri.points.size();
     // printf("matched number: %d\n", laserCloudSelNum);
     if (laserCloudSelNum < 50) {
       ROS_WARN("matched cloud points too few. Matched/Input:  %zd / %zd", laserCloudSelNum, CornerNum+SurfNum);
       break;
     }
 
-    Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-    Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-    Eigen::Matrix<float, 6, 6> matAtA;
-    Eigen::VectorXf matB(laserCloudSelNum);
-    Eigen::VectorXf matAtB;
-    Eigen::VectorXf matX;
-
-
-    for (int i = 0; i < laserCloudSelNum; i++) {
-      pointOri = laserCloudOri.points[i];
-      coeff = coeffSel.points[i];
-      /*
-      float arx = (crx * sry * srz * pointOri.x + crx * crz * sry * pointOri.y -
-                   srx * sry * pointOri.z) *
-                      coeff.x +
-                  (-srx * srz * pointOri.x - crz * srx * pointOri.y -
-                   crx * pointOri.z) *
-                      coeff.y +
-                  (crx * cry * srz * pointOri.x + crx * cry * crz * pointOri.y -
-                   cry * srx * pointOri.z) *
-                      coeff.z;
-
-      float ary = ((cry * srx * srz - crz * sry) * pointOri.x +
-                   (sry * srz + cry * crz * srx) * pointOri.y +
-                   crx * cry * pointOri.z) *
-                      coeff.x +
-                  ((-cry * crz - srx * sry * srz) * pointOri.x +
-                   (cry * srz - crz * srx * sry) * pointOri.y -
-                   crx * sry * pointOri.z) *
-                      coeff.z;
-
-      float arz = ((crz * srx * sry - cry * srz) * pointOri.x +
-                   (-cry * crz - srx * sry * srz) * pointOri.y) *
-                      coeff.x +
-                  (crx * crz * pointOri.x - crx * srz * pointOri.y) * coeff.y +
-                  ((sry * srz + cry * crz * srx) * pointOri.x +
-                   (crz * sry - cry * srx * srz) * pointOri.y) *
-                      coeff.z;
-      */
-        float arx = ((crz*sry*crx + srz*srx)* pointOri.y +(srz*crx-crz*sry*srx)* pointOri.z)*coeff.x +
-        ((srz*sry*crx-crz*srx)*pointOri.y -(srz*sry*srx+crz*crx)*pointOri.z)*coeff.y +
-        (cry*crx*pointOri.y-cry*srx*pointOri.z)*coeff.z;
-
-        float ary = (-crz*sry*pointOri.x+crz*cry*srx*pointOri.y+crz*cry*crx*pointOri.z)*coeff.x +
-        (-srz*sry*pointOri.x+srz*cry*srx*pointOri.y +srz*cry*crx*pointOri.z)*coeff.y +
-        (-cry*pointOri.x-sry*srx*pointOri.y-sry*crx*pointOri.z)*coeff.z;
-
-        float arz = (-srz*cry*pointOri.x -(srz*sry*srx+crz*crx)*pointOri.y+(crz*srx-srz*sry*crx)*pointOri.z)*coeff.x+
-        (crz*cry*pointOri.x+ (crz*sry*srx-srz*crx)*pointOri.y+crz*sry*crx+srz*srx*pointOri.z)*coeff.y+
-        0*coeff.z;
-
-      matA(i, 0) = arx;
-      matA(i, 1) = ary;
-      matA(i, 2) = arz;
-      matA(i, 3) = coeff.x;
-      matA(i, 4) = coeff.y;
-      matA(i, 5) = coeff.z;
-      matB(i, 0) = -coeff.intensity;
-    }
-
-    matAt = matA.transpose();
-    matAtA = matAt * matA;
-    matAtB = matAt * matB;
-    matX = matAtA.colPivHouseholderQr().solve(matAtB);
+    Eigen::Matrix<float, 6, 1> matX = normalEquations.solve();
 
     if (iterCount == 0) {
-      Eigen::Matrix<float, 1, 6> matE;
-      Eigen::Matrix<float, 6, 6> matV;
-      Eigen::Matrix<float, 6, 6> matV2;
-
-      Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> esolver(matAtA);
-      matE = esolver.eigenvalues().real();
-      matV = esolver.eigenvectors().real();
-
-      matV2 = matV;
-
-      isDegenerate = false;
-      float eignThre[6] = {100, 100, 100, 100, 100, 100};
-      for (int i = 0; i < 6; i++) {
-        if (matE(0, i) < eignThre[i]) {
-          for (int j = 0; j < 6; j++) {
-            matV2(i, j) = 0;
-          }
-          isDegenerate = true;
-        } else {
-          break;
-        }
-      }
-      matP = matV.inverse() * matV2;
+      isDegenerate = normalEquations.degeneracyProjection(100, matP);
     }
 
     if (isDegenerate) {
@@ -676,18 +743,13 @@ inline bool FeatureMap<PointT>::scanMatchScan(const PointCloudConstPtr &CornerCl
     transform.pos.y() += matX(4, 0);
     transform.pos.z() += matX(5, 0);
 
-    float deltaR =
-        sqrt(pow(rad2deg(matX(0, 0)), 2) + pow(rad2deg(matX(1, 0)), 2) +
-             pow(rad2deg(matX(2, 0)), 2));
-    float deltaT = sqrt(pow(matX(3, 0) * 100, 2) + pow(matX(4, 0) * 100, 2) +
-                        pow(matX(5, 0) * 100, 2));
-
-    if (deltaR < 0.05 && deltaT < 0.05) {
+    if (_convergence.update(matX)) {
       converge = true;
       break;
     }
   }
   transformf = transform;
+  return converge;
 }
 
 template <typename PointT>
@@ -701,6 +763,115 @@ inline bool FeatureMap<PointT>::scanMatchScan(const PointCloudConstPtr &CornerCl
   return success;
 }
 
+template <typename PointT>
+inline const NdtVoxelGrid<PointT> &
+FeatureMap<PointT>::ndtGrid(NdtCubes &cubes,
+                            const PointCloudCube<PointT> &cloud, int index) {
+  typename NdtCubes::iterator it = cubes.find(index);
+  if (it == cubes.end()) {
+    it = cubes.insert(std::make_pair(index, _ndtPrototype)).first;
+    it->second.build(*cloud[index]);
+  }
+  return it->second;
+}
+
+template <typename PointT>
+inline bool FeatureMap<PointT>::scanMatchNdt(const PointCloudConstPtr &CornerCloud,
+                                             const PointCloudConstPtr &SurfCloud,
+                                             Twist &transformf) {
+  Twist transform = transformf;
+
+  PointT pointSel, pointOri;
+
+  bool converge = false;
+  bool isDegenerate = false;
+  Eigen::Matrix<float, 6, 6> matP;
+
+  size_t CornerNum = CornerCloud->points.size();
+  size_t SurfNum = SurfCloud->points.size();
+
+  GaussNewtonAccumulator normalEquations(_robustKernel);
+  size_t iterCount;
+  _convergence.reset(CornerNum + SurfNum);
+  for (iterCount = 0; iterCount < _convergence.maxIterations(); iterCount++) {
+    // the voxel lookups are cheap, so every iteration associates anew
+    _convergence.associate();
+    normalEquations.reset(transform);
+    size_t matchedNum = 0;
+
+    for (size_t i = 0; i < CornerNum + SurfNum; i++) {
+      const bool corner = i < CornerNum;
+      pointOri = corner ? CornerCloud->points[i]
+                        : SurfCloud->points[i - CornerNum];
+      pointAssociateToMap(transform, pointOri, pointSel);
+      int idx = worldToIndex(pointSel.x, pointSel.y, pointSel.z);
+      if (idx < 0) continue;
+
+      const NdtGrid &grid = corner ? ndtGrid(_ndtCorner, _cornerCube, idx)
+                                   : ndtGrid(_ndtSurf, _surfCube, idx);
+      const typename NdtGrid::Voxel *voxel =
+          grid.find(pointSel.getVector3fMap());
+      if (voxel == NULL) continue;
+
+      // one residual per principal direction of the voxel distribution
+      Eigen::Vector3f residual =
+          voxel->sqrtInfo * (pointSel.getVector3fMap() - voxel->mean);
+      bool matched = false;
+      for (int k = 0; k < 3; k++) {
+        PointT coefficients;
+        coefficients.getVector3fMap() = voxel->sqrtInfo.row(k).transpose();
+        coefficients.intensity = residual(k);
+        matched |= normalEquations.addPoint(pointOri, coefficients);
+      }
+      if (matched) {
+        matchedNum++;
+      }
+    }
+
+    if (matchedNum < 50) {
+      ROS_WARN("matched cloud points too few. Matched/Input:  %zd / %zd",
+               matchedNum, CornerNum + SurfNum);
+      break;
+    }
+
+    Eigen::Matrix<float, 6, 1> matX = normalEquations.solve();
+
+    if (iterCount == 0) {
+      isDegenerate = normalEquations.degeneracyProjection(100, matP);
+    }
+
+    if (isDegenerate) {
+      Eigen::Matrix<float, 6, 1> matX2(matX);
+      matX = matP * matX2;
+    }
+
+    transform.rot_x += matX(0, 0);
+    transform.rot_y += matX(1, 0);
+    transform.rot_z += matX(2, 0);
+    transform.pos.x() += matX(3, 0);
+    transform.pos.y() += matX(4, 0);
+    transform.pos.z() += matX(5, 0);
+
+    if (_convergence.update(matX)) {
+      converge = true;
+      break;
+    }
+  }
+  transformf = transform;
+  return converge;
+}
+
+template <typename PointT>
+inline bool FeatureMap<PointT>::scanMatchNdt(const PointCloudConstPtr &CornerCloud,
+                                             const PointCloudConstPtr &SurfCloud,
+                                             Eigen::Isometry3f &relative_pose) {
+  Twist transform;
+  convertTransform(relative_pose, transform);
+  bool success = scanMatchNdt(CornerCloud, SurfCloud, transform);
+  convertTransform(transform, relative_pose);
+  return success;
+}
+
 }//namespace lidar_slam
 
 #endif //__FEATURE_MAP_H__
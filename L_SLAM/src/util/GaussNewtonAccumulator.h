@@ -0,0 +1,226 @@
+#ifndef LIDAR_GAUSSNEWTONACCUMULATOR_H
+#define LIDAR_GAUSSNEWTONACCUMULATOR_H
+
+#include "RobustKernel.h"
+#include "Twist.h"
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/QR>
+#include <stddef.h>
+
+namespace lidar_slam {
+
+/** \brief Normal equations of a 6 DoF point to line / point to plane scan
+ * matching step.
+ *
+ * Every residual is added straight into a fixed size 6x6 J^T J and a 6x1 J^T r
+ * accumulator, so the memory use does not depend on the number of matched
+ * points. The Jacobian is taken with respect to the rotation angles
+ * (R = Rz * Ry * Rx) and the position of the linearization transform.
+ *
+ * With a robust kernel, the point residuals are reweighted (IRLS) at every
+ * linearization.
+ */
+class GaussNewtonAccumulator {
+public:
+  typedef Eigen::Matrix<float, 6, 6> Matrix6f;
+  typedef Eigen::Matrix<float, 6, 1> Vector6f;
+
+  /** Flags of the transform parameters, in the order of the update. */
+  enum Dof {
+    ROT_X = 1 << 0,
+    ROT_Y = 1 << 1,
+    ROT_Z = 1 << 2,
+    POS_X = 1 << 3,
+    POS_Y = 1 << 4,
+    POS_Z = 1 << 5,
+    ALL_DOF = (1 << 6) - 1
+  };
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  explicit GaussNewtonAccumulator(const RobustKernel &kernel = RobustKernel())
+      : _kernel(kernel) {
+    reset(Twist());
+  }
+
+  /** \brief Set the robust kernel of the point residuals. */
+  void setRobustKernel(const RobustKernel &kernel) { _kernel = kernel; }
+
+  /** \brief Clear the accumulators and linearize around a new transform.
+   *
+   * @param transform the current transform estimate
+   */
+  void reset(const Twist &transform) {
+    _srx = transform.rot_x.sin();
+    _crx = transform.rot_x.cos();
+    _sry = transform.rot_y.sin();
+    _cry = transform.rot_y.cos();
+    _srz = transform.rot_z.sin();
+    _crz = transform.rot_z.cos();
+    _JtJ.setZero();
+    _Jtr.setZero();
+    _size = 0;
+  }
+
+  /** \brief Add the residual of a matched point.
+   *
+   * @param point the matched point in the source frame
+   * @param coeff the residual direction (x, y, z) and the weighted distance
+   * (intensity), as computed by the feature coefficient functions
+   * @param scale the scale of the residual
+   * @return false, if the robust kernel rejected the residual, true otherwise
+   */
+  template <typename PointT>
+  bool addPoint(const PointT &point, const PointT &coeff,
+                const float &scale = 1) {
+    const float weight = _kernel.weight(coeff.intensity);
+    if (weight <= 0) {
+      return false;
+    }
+
+    Vector6f jacobian;
+    jacobian(0) = ((_crz * _sry * _crx + _srz * _srx) * point.y +
+                   (_srz * _crx - _crz * _sry * _srx) * point.z) *
+                      coeff.x +
+                  ((_srz * _sry * _crx - _crz * _srx) * point.y -
+                   (_srz * _sry * _srx + _crz * _crx) * point.z) *
+                      coeff.y +
+                  (_cry * _crx * point.y - _cry * _srx * point.z) * coeff.z;
+    jacobian(1) = (-_crz * _sry * point.x + _crz * _cry * _srx * point.y +
+                   _crz * _cry * _crx * point.z) *
+                      coeff.x +
+                  (-_srz * _sry * point.x + _srz * _cry * _srx * point.y +
+                   _srz * _cry * _crx * point.z) *
+                      coeff.y +
+                  (-_cry * point.x - _sry * _srx * point.y -
+                   _sry * _crx * point.z) *
+                      coeff.z;
+    jacobian(2) = (-_srz * _cry * point.x -
+                   (_srz * _sry * _srx + _crz * _crx) * point.y +
+                   (_crz * _srx - _srz * _sry * _crx) * point.z) *
+                      coeff.x +
+                  (_crz * _cry * point.x +
+                   (_crz * _sry * _srx - _srz * _crx) * point.y +
+                   (_crz * _sry * _crx + _srz * _srx) * point.z) *
+                      coeff.y;
+    jacobian(3) = coeff.x;
+    jacobian(4) = coeff.y;
+    jacobian(5) = coeff.z;
+    add(jacobian, -scale * coeff.intensity, weight);
+    return true;
+  }
+
+  /** \brief Add a residual with its Jacobian.
+   *
+   * @param jacobian the Jacobian of the residual
+   * @param residual the residual
+   * @param weight the weight of the residual
+   */
+  void add(const Vector6f &jacobian, const float &residual,
+           const float &weight = 1) {
+    _JtJ.noalias() += weight * jacobian * jacobian.transpose();
+    _Jtr.noalias() += (weight * residual) * jacobian;
+    _size++;
+  }
+
+  /** \brief Add the residuals of another accumulator with the same
+   * linearization transform. */
+  void merge(const GaussNewtonAccumulator &other) {
+    _JtJ += other._JtJ;
+    _Jtr += other._Jtr;
+    _size += other._size;
+  }
+
+  /** \brief The number of added residuals. */
+  size_t size() const { return _size; }
+
+  /** \brief The accumulated J^T J. */
+  const Matrix6f &JtJ() const { return _JtJ; }
+
+  /** \brief The accumulated J^T r. */
+  const Vector6f &Jtr() const { return _Jtr; }
+
+  /** \brief Solve the normal equations for the transform update. */
+  Vector6f solve() const { return _JtJ.colPivHouseholderQr().solve(_Jtr); }
+
+  /** \brief Solve the normal equations for a subset of the transform
+   * parameters, keeping the other parameters fixed.
+   *
+   * @param dofs the Dof flags of the free parameters
+   * @return the transform update, zero for the fixed parameters
+   */
+  Vector6f solve(const unsigned &dofs) const {
+    if ((dofs & ALL_DOF) == ALL_DOF) {
+      return solve();
+    }
+
+    int index[6];
+    int n = 0;
+    for (int i = 0; i < 6; i++) {
+      if (dofs & (1u << i)) {
+        index[n++] = i;
+      }
+    }
+
+    Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, 6, 6> A(n, n);
+    Eigen::Matrix<float, Eigen::Dynamic, 1, 0, 6, 1> b(n);
+    for (int r = 0; r < n; r++) {
+      b(r) = _Jtr(index[r]);
+      for (int c = 0; c < n; c++) {
+        A(r, c) = _JtJ(index[r], index[c]);
+      }
+    }
+
+    Vector6f x = Vector6f::Zero();
+    if (n > 0) {
+      Eigen::Matrix<float, Eigen::Dynamic, 1, 0, 6, 1> xs =
+          A.colPivHouseholderQr().solve(b);
+      for (int r = 0; r < n; r++) {
+        x(index[r]) = xs(r);
+      }
+    }
+    return x;
+  }
+
+  /** \brief Compute the projection removing the update along degenerate
+   * directions, i.e. eigenvectors of J^T J with small eigenvalues.
+   *
+   * @param eigenThreshold the eigenvalue threshold of degenerate directions
+   * @param matP the output projection, to be applied to solve()
+   * @return true, if the problem is degenerate, false otherwise
+   */
+  bool degeneracyProjection(const float &eigenThreshold,
+                            Matrix6f &matP) const {
+    Eigen::SelfAdjointEigenSolver<Matrix6f> esolver(_JtJ);
+    Eigen::Matrix<float, 1, 6> matE = esolver.eigenvalues().real();
+    Matrix6f matV = esolver.eigenvectors().real();
+    Matrix6f matV2 = matV;
+
+    bool isDegenerate = false;
+    for (int i = 0; i < 6; i++) {
+      if (matE(0, i) < eigenThreshold) {
+        matV2.row(i).setZero();
+        isDegenerate = true;
+      } else {
+        break;
+      }
+    }
+    matP = matV.inverse() * matV2;
+    return isDegenerate;
+  }
+
+private:
+  float _srx, _crx; ///< sine and cosine of the x rotation
+  float _sry, _cry; ///< sine and cosine of the y rotation
+  float _srz, _crz; ///< sine and cosine of the z rotation
+  Matrix6f _JtJ;    ///< accumulated J^T J
+  Vector6f _Jtr;    ///< accumulated J^T r
+  size_t _size;     ///< number of added residuals
+  RobustKernel _kernel; ///< robust kernel of the point residuals
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_GAUSSNEWTONACCUMULATOR_H
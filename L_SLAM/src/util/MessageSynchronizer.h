@@ -0,0 +1,225 @@
+#ifndef LIDAR_MESSAGESYNCHRONIZER_H
+#define LIDAR_MESSAGESYNCHRONIZER_H
+
+#include <ros/time.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Exact time synchronizer of several message channels.
+ *
+ * The subscriber callbacks add their messages with the message time, and the
+ * processing thread blocks in wait() until every channel holds a message of
+ * the same time. The set is handed over the moment its last message arrives,
+ * so there is no polling period between the callbacks and the processing.
+ *
+ * Messages are type erased, every channel may carry a different message type.
+ * Channel messages older than a complete set are discarded as mismatched, and
+ * a complete set replaced by a newer one before the processing thread took it
+ * is counted as dropped.
+ */
+class MessageSynchronizer {
+public:
+  typedef std::shared_ptr<const void> MessagePtr;
+  typedef std::vector<MessagePtr> MessageSet;
+
+  explicit MessageSynchronizer(const size_t &channels = 0,
+                               const size_t &queueSize = 5)
+      : _shutdown(false), _hasSet(false), _completeSets(0), _droppedSets(0),
+        _mismatchedMessages(0) {
+    setup(channels, queueSize);
+  }
+
+  /** \brief Set the number of channels and clear all queued messages.
+   *
+   * @param channels the number of synchronized channels
+   * @param queueSize the maximum number of unmatched messages per channel
+   */
+  void setup(const size_t &channels, const size_t &queueSize = 5) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _queueSize = queueSize > 0 ? queueSize : 1;
+    _queues.assign(channels, std::deque<StampedMessage>());
+    _set.assign(channels, MessagePtr());
+    _received.assign(channels, 0);
+    _hasSet = false;
+  }
+
+  /** \brief Add a message to a channel.
+   *
+   * @param channel the channel index
+   * @param stamp the message time
+   * @param msg the message pointer (boost or std shared pointer), which is
+   * kept alive until the message set is released
+   */
+  template <typename MessagePtrT>
+  void add(const size_t &channel, const ros::Time &stamp,
+           const MessagePtrT &msg) {
+    // keep a copy of the typed pointer as deleter, so the message type does
+    // not matter here
+    MessagePtr erased(msg.get(), [msg](const void *) {});
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _received[channel]++;
+    std::deque<StampedMessage> &queue = _queues[channel];
+    if (!queue.empty() && stamp <= queue.back().stamp) {
+      // out of order or repeated message
+      _mismatchedMessages++;
+      return;
+    }
+    queue.push_back(StampedMessage{stamp, erased});
+    if (queue.size() > _queueSize) {
+      queue.pop_front();
+      _mismatchedMessages++;
+    }
+
+    for (size_t i = 0; i < _queues.size(); i++) {
+      if (!contains(_queues[i], stamp)) {
+        return;
+      }
+    }
+
+    // complete set, discard everything older
+    for (size_t i = 0; i < _queues.size(); i++) {
+      std::deque<StampedMessage> &q = _queues[i];
+      while (q.front().stamp < stamp) {
+        q.pop_front();
+        _mismatchedMessages++;
+      }
+      _set[i] = q.front().msg;
+      q.pop_front();
+    }
+    if (_hasSet) {
+      _droppedSets++;
+    }
+    _hasSet = true;
+    _stamp = stamp;
+    _completeSets++;
+    _ready.notify_one();
+  }
+
+  /** \brief Wait for the next complete message set.
+   *
+   * @param set the output message set, indexed by channel
+   * @param stamp the output time of the set
+   * @param timeout the maximum waiting time in seconds
+   * @return true, if a set was taken, false on timeout or shutdown
+   */
+  bool wait(MessageSet &set, ros::Time &stamp, const double &timeout) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ready.wait_for(lock, std::chrono::duration<double>(timeout),
+                    [this] { return _hasSet || _shutdown; });
+    if (!_hasSet) {
+      return false;
+    }
+
+    set.swap(_set);
+    _set.assign(set.size(), MessagePtr());
+    stamp = _stamp;
+    _hasSet = false;
+    return true;
+  }
+
+  /** \brief Wake up all waiting threads and refuse to wait any longer. */
+  void shutdown() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _shutdown = true;
+    _ready.notify_all();
+  }
+
+  /** \brief Check if the synchronizer has been shut down. */
+  bool isShutdown() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _shutdown;
+  }
+
+  /** \brief Access a message of a set.
+   *
+   * @param set the message set
+   * @param channel the channel index
+   * @return the message, which has to be of the type added to the channel
+   */
+  template <typename MessageT>
+  static const MessageT &message(const MessageSet &set,
+                                 const size_t &channel) {
+    return *static_cast<const MessageT *>(set[channel].get());
+  }
+
+  /** \brief Share a message of a set without copying it.
+   *
+   * @tparam MessagePtrT the (boost or std) shared pointer type of the message
+   * @param set the message set
+   * @param channel the channel index
+   * @return the message pointer, which keeps the message alive
+   */
+  template <typename MessagePtrT>
+  static MessagePtrT messagePtr(const MessageSet &set, const size_t &channel) {
+    typedef typename MessagePtrT::element_type MessageT;
+    MessagePtr msg = set[channel];
+    return MessagePtrT(static_cast<MessageT *>(msg.get()),
+                       [msg](MessageT *) {});
+  }
+
+  /** \brief The number of complete message sets. */
+  size_t completeSets() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _completeSets;
+  }
+
+  /** \brief The number of messages added to a channel. */
+  size_t receivedMessages(const size_t &channel) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _received[channel];
+  }
+
+  /** \brief The number of complete sets replaced before being taken. */
+  size_t droppedSets() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _droppedSets;
+  }
+
+  /** \brief The number of messages discarded without a matching set. */
+  size_t mismatchedMessages() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _mismatchedMessages;
+  }
+
+private:
+  /** Queued message of a channel. */
+  struct StampedMessage {
+    ros::Time stamp;
+    MessagePtr msg;
+  };
+
+  static bool contains(const std::deque<StampedMessage> &queue,
+                       const ros::Time &stamp) {
+    for (size_t i = 0; i < queue.size(); i++) {
+      if (queue[i].stamp == stamp) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  mutable std::mutex _mutex;         ///< lock of all members
+  std::condition_variable _ready;    ///< signal of a complete set
+  size_t _queueSize;                 ///< maximum messages per channel
+  std::vector<std::deque<StampedMessage>> _queues; ///< unmatched messages
+  std::vector<size_t> _received;     ///< number of messages per channel
+  MessageSet _set;                   ///< last complete set
+  ros::Time _stamp;                  ///< time of the last complete set
+  bool _shutdown;                    ///< flag if waiting was stopped
+  bool _hasSet;                      ///< flag if the last set is not taken
+  size_t _completeSets;              ///< number of complete sets
+  size_t _droppedSets;               ///< number of replaced complete sets
+  size_t _mismatchedMessages;        ///< number of discarded messages
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_MESSAGESYNCHRONIZER_H
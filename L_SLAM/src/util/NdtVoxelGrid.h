@@ -0,0 +1,185 @@
+#ifndef LIDAR_NDTVOXELGRID_H
+#define LIDAR_NDTVOXELGRID_H
+
+#include "eigen_utils.h"
+
+#include <pcl/point_cloud.h>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Normal distributions (NDT) of the points of a cloud per voxel.
+ *
+ * The mean and the covariance of every voxel are computed once when the grid
+ * is built, so matching a point costs a single hash lookup instead of a
+ * nearest neighbor search and an eigen decomposition.
+ *
+ * The covariance of a voxel is stored as its square root information matrix,
+ * regularized and normalized such that the direction of the smallest spread
+ * (e.g. a plane normal) has unit weight and the other directions are down
+ * weighted by their spread. A Mahalanobis residual thus stays in meters and is
+ * comparable to a point to plane distance.
+ */
+template <typename PointT> class NdtVoxelGrid {
+public:
+  /** \brief Distribution of the points of a voxel. */
+  struct Voxel {
+    Eigen::Vector3f mean;     ///< mean of the voxel points
+    Eigen::Matrix3f sqrtInfo; ///< square root information, one residual
+                              ///< direction per row
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /** \brief Construct an empty grid.
+   *
+   * @param resolution the voxel edge length
+   * @param minPoints the minimum number of points of a voxel distribution
+   * @param minEigenRatio the minimum ratio of an eigenvalue to the largest one
+   */
+  explicit NdtVoxelGrid(const float &resolution = 2.0f,
+                        const size_t &minPoints = 5,
+                        const float &minEigenRatio = 0.01f)
+      : _minPoints(std::max<size_t>(minPoints, 3)),
+        _minEigenRatio(minEigenRatio) {
+    setResolution(resolution);
+  }
+
+  /** \brief Set the voxel edge length, clears the grid. */
+  void setResolution(const float &resolution) {
+    _inverseResolution = 1.0f / resolution;
+    clear();
+  }
+
+  /** \brief Set the minimum number of points of a voxel, clears the grid. */
+  void setMinPoints(const size_t &minPoints) {
+    _minPoints = std::max<size_t>(minPoints, 3);
+    clear();
+  }
+
+  void clear() {
+    _index.clear();
+    _voxels.clear();
+  }
+
+  /** \brief The number of voxels with a distribution. */
+  size_t size() const { return _voxels.size(); }
+
+  /** \brief Compute the voxel distributions of a cloud.
+   *
+   * @param cloud the input cloud, non finite points are skipped
+   */
+  void build(const pcl::PointCloud<PointT> &cloud) {
+    clear();
+
+    // accumulate the first and second moments per voxel
+    _moments.clear();
+    for (size_t i = 0; i < cloud.size(); i++) {
+      const PointT &p = cloud[i];
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+        continue;
+      }
+      std::pair<typename std::unordered_map<uint64_t, size_t>::iterator, bool>
+          inserted = _index.insert(std::make_pair(key(p.x, p.y, p.z),
+                                                  _moments.size()));
+      if (inserted.second) {
+        _moments.push_back(Moments());
+      }
+      Moments &m = _moments[inserted.first->second];
+      const Eigen::Vector3d point = p.getVector3fMap().template cast<double>();
+      m.count++;
+      m.sum += point;
+      m.sumSq += point * point.transpose();
+    }
+
+    // compute the distributions of the voxels with enough points
+    typename std::unordered_map<uint64_t, size_t>::iterator it = _index.begin();
+    while (it != _index.end()) {
+      const Moments &m = _moments[it->second];
+      if (m.count < _minPoints) {
+        it = _index.erase(it);
+        continue;
+      }
+      const Eigen::Vector3d mean = m.sum / double(m.count);
+      const Eigen::Matrix3d covarianceD =
+          (m.sumSq - double(m.count) * mean * mean.transpose()) /
+          double(m.count - 1);
+      const Eigen::Matrix3f covariance = covarianceD.cast<float>();
+
+      Eigen::Vector3f values;
+      Eigen::Matrix3f vectors;
+      symmetricEigen3(covariance, values, vectors);
+      if (!(values(2) > 0)) {
+        it = _index.erase(it);
+        continue;
+      }
+
+      // clamp the eigenvalues, then weight the smallest spread by one
+      const float minValue = std::max(values(2) * _minEigenRatio, 1e-6f);
+      const float refValue = std::max(values(0), minValue);
+      Voxel voxel;
+      voxel.mean = mean.cast<float>();
+      for (int k = 0; k < 3; k++) {
+        float weight = std::sqrt(refValue / std::max(values(k), minValue));
+        voxel.sqrtInfo.row(k) = weight * vectors.col(k).transpose();
+      }
+      it->second = _voxels.size();
+      _voxels.push_back(voxel);
+      ++it;
+    }
+    _moments.clear();
+  }
+
+  /** \brief Find the distribution of the voxel containing a point.
+   *
+   * @return the voxel distribution, or NULL if there is none
+   */
+  const Voxel *find(const Eigen::Vector3f &point) const {
+    typename std::unordered_map<uint64_t, size_t>::const_iterator it =
+        _index.find(key(point.x(), point.y(), point.z()));
+    return it == _index.end() ? NULL : &_voxels[it->second];
+  }
+
+private:
+  /** Moments of the points of a voxel. */
+  struct Moments {
+    Moments() : count(0), sum(Eigen::Vector3d::Zero()),
+                sumSq(Eigen::Matrix3d::Zero()) {}
+
+    size_t count;
+    Eigen::Vector3d sum;
+    Eigen::Matrix3d sumSq;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /** Pack the voxel indices into a single key, 21 bits per axis. */
+  uint64_t key(const float &x, const float &y, const float &z) const {
+    const uint64_t mask = (uint64_t(1) << 21) - 1;
+    return (uint64_t(int64_t(std::floor(x * _inverseResolution))) & mask) |
+           ((uint64_t(int64_t(std::floor(y * _inverseResolution))) & mask)
+            << 21) |
+           ((uint64_t(int64_t(std::floor(z * _inverseResolution))) & mask)
+            << 42);
+  }
+
+  float _inverseResolution; ///< inverse voxel edge length
+  size_t _minPoints;        ///< minimum number of points of a distribution
+  float _minEigenRatio;     ///< eigenvalue regularization ratio
+  std::unordered_map<uint64_t, size_t> _index; ///< voxel key to distribution
+  std::vector<Voxel, Eigen::aligned_allocator<Voxel>>
+      _voxels; ///< voxel distributions
+  std::vector<Moments, Eigen::aligned_allocator<Moments>>
+      _moments; ///< moments scratch buffer of build()
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_NDTVOXELGRID_H
@@ -0,0 +1,182 @@
+#ifndef LIDAR_PRIMITIVECACHE_H
+#define LIDAR_PRIMITIVECACHE_H
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Consecutive points of a reference cloud, e.g. the points of a map
+ * cube within a surround cloud. */
+struct CloudSegment {
+  size_t revision; ///< revision of the points, changes whenever they change
+  size_t size;     ///< number of points
+  Eigen::AlignedBox3f bounds; ///< region of the points, e.g. the cube bounds,
+                              ///< no points of other segments lie within
+};
+
+typedef std::vector<CloudSegment> CloudSegments;
+
+/** \brief Line fitted to the neighbors of a reference point. */
+struct LinePrimitive {
+  Eigen::Vector3f pointA; ///< first point on the line
+  Eigen::Vector3f pointB; ///< second point on the line
+};
+
+/** \brief Plane fitted to the neighbors of a reference point. */
+struct PlanePrimitive {
+  Eigen::Vector4f plane; ///< plane coefficients (normal and offset)
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Lazily fitted line / plane primitives per point of a reference
+ * cloud.
+ *
+ * A primitive is fitted the first time a query matches its reference point
+ * and then shared by all later queries. If the reference cloud is described
+ * by segments with revisions, the primitives of unchanged segments are kept
+ * when the next reference cloud is set, even if the segments moved within the
+ * cloud. Otherwise all primitives are dropped.
+ *
+ * Only primitives fitted to neighbors within the bounds of their own segment
+ * are kept, as the neighbors near the bounds may change with the adjacent
+ * segments.
+ */
+template <typename PrimitiveT> class PrimitiveCache {
+public:
+  PrimitiveCache() : _fits(0), _reused(0) {}
+
+  /** \brief Set a new reference cloud.
+   *
+   * @param cloudSize the number of reference points
+   * @param segments the segments of the reference cloud, empty if unknown
+   */
+  void reset(const size_t &cloudSize, const CloudSegments &segments) {
+    _primitives.swap(_oldPrimitives);
+    _states.swap(_oldStates);
+    _primitives.resize(cloudSize);
+    _states.assign(cloudSize, UNKNOWN);
+    _segmentIndex.resize(cloudSize);
+    _fits = 0;
+    _reused = 0;
+
+    size_t segmentsSize = 0;
+    for (size_t s = 0; s < segments.size(); s++) {
+      segmentsSize += segments[s].size;
+    }
+    if (segments.empty() || segmentsSize != cloudSize) {
+      _segments.clear();
+      return;
+    }
+
+    // the locations of the segments in the previous reference cloud
+    _oldBegin.clear();
+    size_t begin = 0;
+    for (size_t s = 0; s < _segments.size(); s++) {
+      if (_segments[s].size > 0) {
+        _oldBegin[_segments[s].revision] =
+            std::make_pair(begin, _segments[s].size);
+      }
+      begin += _segments[s].size;
+    }
+
+    // take over the primitives of the unchanged segments
+    begin = 0;
+    for (size_t s = 0; s < segments.size(); s++) {
+      std::fill(_segmentIndex.begin() + begin,
+                _segmentIndex.begin() + begin + segments[s].size, uint32_t(s));
+      std::unordered_map<size_t, std::pair<size_t, size_t>>::const_iterator
+          it = _oldBegin.find(segments[s].revision);
+      if (it != _oldBegin.end() && it->second.second == segments[s].size) {
+        for (size_t i = 0; i < segments[s].size; i++) {
+          const uint8_t state = _oldStates[it->second.first + i];
+          if (state & LOCAL) {
+            _primitives[begin + i] = _oldPrimitives[it->second.first + i];
+            _states[begin + i] = state;
+            _reused++;
+          }
+        }
+      }
+      begin += segments[s].size;
+    }
+    _segments = segments;
+  }
+
+  /** \brief Get the primitive of a reference point, fitting it on first use.
+   *
+   * @param index the index of the reference point
+   * @param fit the fit function, bool(size_t index, PrimitiveT &primitive,
+   * bool &local), setting local if the fit only depends on the points within
+   * the segment bounds (see withinSegment())
+   * @return the primitive, or NULL if no primitive fits the point
+   */
+  template <typename FitT>
+  const PrimitiveT *get(const size_t &index, FitT &fit) {
+    if (_states[index] == UNKNOWN) {
+      bool local = false;
+      _states[index] = fit(index, _primitives[index], local) ? VALID : INVALID;
+      if (local) {
+        _states[index] |= LOCAL;
+      }
+      _fits++;
+    }
+    return (_states[index] & VALID) ? &_primitives[index] : NULL;
+  }
+
+  /** \brief Check if a neighborhood of a reference point lies within the
+   * bounds of the segment of the point.
+   *
+   * @param index the index of the reference point
+   * @param center the neighborhood center
+   * @param radius the neighborhood radius
+   * @return true, if the neighborhood lies within the segment bounds, false
+   * otherwise or without segments
+   */
+  bool withinSegment(const size_t &index, const Eigen::Vector3f &center,
+                     const float &radius) const {
+    if (_segments.empty()) {
+      return false;
+    }
+    const Eigen::AlignedBox3f &bounds = _segments[_segmentIndex[index]].bounds;
+    const Eigen::Vector3f extent = Eigen::Vector3f::Constant(radius);
+    return bounds.contains(center - extent) && bounds.contains(center + extent);
+  }
+
+  /** \brief The number of primitives fitted since the last reset. */
+  const size_t &fits() const { return _fits; }
+
+  /** \brief The number of reference points taken over by the last reset. */
+  const size_t &reused() const { return _reused; }
+
+private:
+  /** Fit state flags. */
+  enum State : uint8_t { UNKNOWN = 0, VALID = 1, INVALID = 2, LOCAL = 4 };
+
+  typedef std::vector<PrimitiveT, Eigen::aligned_allocator<PrimitiveT>>
+      Primitives;
+
+  Primitives _primitives;       ///< primitive per reference point
+  std::vector<uint8_t> _states; ///< fit state per reference point
+  CloudSegments _segments;      ///< segments of the reference cloud
+  std::vector<uint32_t> _segmentIndex; ///< segment per reference point
+
+  Primitives _oldPrimitives;       ///< primitives of the previous cloud
+  std::vector<uint8_t> _oldStates; ///< fit states of the previous cloud
+  std::unordered_map<size_t, std::pair<size_t, size_t>>
+      _oldBegin; ///< begin and size of the previous segments per revision
+
+  size_t _fits;   ///< primitives fitted since the last reset
+  size_t _reused; ///< reference points taken over by the last reset
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_PRIMITIVECACHE_H
@@ -0,0 +1,92 @@
+#ifndef LIDAR_ROBUSTKERNEL_H
+#define LIDAR_ROBUSTKERNEL_H
+
+#include <cmath>
+#include <string>
+
+namespace lidar_slam {
+
+/** \brief Robust cost function of the scan matching residuals.
+ *
+ * The kernels are applied by iteratively reweighted least squares: every
+ * residual r enters the normal equations with the weight w(r) = rho'(r) / r
+ * of the kernel at the current linearization point. Residuals far beyond the
+ * kernel scale, e.g. of points on moving cars or pedestrians, get a small or
+ * (Tukey) zero weight instead of being cut by fixed distance thresholds.
+ */
+class RobustKernel {
+public:
+  enum Type {
+    NONE,   ///< plain least squares
+    HUBER,  ///< quadratic up to the scale, linear beyond
+    CAUCHY, ///< logarithmic, never fully rejects a residual
+    TUKEY   ///< biweight, rejects residuals beyond the scale
+  };
+
+  explicit RobustKernel(const Type &type = NONE, const float &scale = 0.2f)
+      : _type(type), _scale(scale) {}
+
+  /** \brief Parse a kernel name.
+   *
+   * @param name the kernel name (none, huber, cauchy or tukey)
+   * @param type the parsed kernel type
+   * @return true, if the name is a valid kernel, false otherwise
+   */
+  static bool parseType(const std::string &name, Type &type) {
+    if (name == "none") {
+      type = NONE;
+    } else if (name == "huber") {
+      type = HUBER;
+    } else if (name == "cauchy") {
+      type = CAUCHY;
+    } else if (name == "tukey") {
+      type = TUKEY;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  /** \brief The kernel type. */
+  const Type &type() const { return _type; }
+
+  /** \brief The residual scale (m) of the kernel. */
+  const float &scale() const { return _scale; }
+
+  /** \brief Check if the kernel reweights residuals. */
+  bool enabled() const { return _type != NONE; }
+
+  /** \brief The IRLS weight of a residual.
+   *
+   * @param residual the residual (m)
+   * @return the weight in [0, 1]
+   */
+  float weight(const float &residual) const {
+    const float r = std::fabs(residual);
+    switch (_type) {
+    case HUBER:
+      return r <= _scale ? 1.0f : _scale / r;
+    case CAUCHY: {
+      const float u = r / _scale;
+      return 1.0f / (1.0f + u * u);
+    }
+    case TUKEY: {
+      if (r >= _scale) {
+        return 0.0f;
+      }
+      const float u = r / _scale;
+      return (1.0f - u * u) * (1.0f - u * u);
+    }
+    default:
+      return 1.0f;
+    }
+  }
+
+private:
+  Type _type;   ///< kernel type
+  float _scale; ///< residual scale (m)
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_ROBUSTKERNEL_H
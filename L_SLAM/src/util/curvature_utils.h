@@ -0,0 +1,118 @@
+#ifndef LIDAR_CURVATURE_UTILS_H
+#define LIDAR_CURVATURE_UTILS_H
+
+#include <algorithm>
+#include <stddef.h>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace lidar_slam {
+
+namespace internal {
+
+/** \brief Compute the inclusive prefix sums of a float array in double
+ * precision, with a leading zero.
+ */
+inline void prefixSums(const float *values, const size_t &n, double *sums) {
+  sums[0] = 0;
+  for (size_t i = 0; i < n; i++) {
+    sums[i + 1] = sums[i] + values[i];
+  }
+}
+
+/** \brief Compute the window differences sum(v[i-k..i+k]) - (2k+1) * v[i] for
+ * all points with a full window.
+ *
+ * @param values the values
+ * @param sums the prefix sums of the values
+ * @param n the number of values
+ * @param region the window half size k
+ * @param diff the output differences, indexed by point
+ */
+inline void windowDifferences(const float *values, const double *sums,
+                              const size_t &n, const int &region,
+                              double *diff) {
+  const double weight = 2 * region + 1;
+  size_t i = region;
+#ifdef __AVX2__
+  const __m256d w = _mm256_set1_pd(weight);
+  for (; i + 4 + region <= n; i += 4) {
+    __m256d upper = _mm256_loadu_pd(sums + i + region + 1);
+    __m256d lower = _mm256_loadu_pd(sums + i - region);
+    __m256d center = _mm256_cvtps_pd(_mm_loadu_ps(values + i));
+    __m256d d = _mm256_sub_pd(_mm256_sub_pd(upper, lower),
+                              _mm256_mul_pd(w, center));
+    _mm256_storeu_pd(diff + i, d);
+  }
+#endif
+  for (; i + region < n; i++) {
+    diff[i] = sums[i + region + 1] - sums[i - region] - weight * values[i];
+  }
+}
+
+} // end namespace internal
+
+/** \brief Scratch buffers of the sliding window curvature kernels. */
+struct CurvatureScratch {
+  std::vector<double> sums;  ///< prefix sums of one coordinate
+  std::vector<double> diffX; ///< window differences of the first coordinate
+  std::vector<double> diffY; ///< window differences of the second coordinate
+  std::vector<double> diffZ; ///< window differences of the third coordinate
+};
+
+/** \brief Compute the LOAM curvature of all points of a scan with sliding
+ * window sums.
+ *
+ * The curvature of point i is the squared norm of the summed differences
+ * between its 2 * region neighbors and the point itself, i.e. a scaled squared
+ * distance of the point to the centroid of its neighborhood. The window sums
+ * are taken from double precision prefix sums, so the cost is O(n)
+ * independent of the region size. Points without a full window get zero
+ * curvature.
+ *
+ * @param x the x coordinates of the scan points
+ * @param y the y coordinates of the scan points
+ * @param z the z coordinates of the scan points
+ * @param n the number of scan points
+ * @param region the number of neighbors on each side of a point
+ * @param curvature the output point curvatures
+ * @param scratch the reusable scratch buffers
+ */
+inline void slidingWindowCurvature(const float *x, const float *y,
+                                   const float *z, const size_t &n,
+                                   const int &region, float *curvature,
+                                   CurvatureScratch &scratch) {
+  std::fill(curvature, curvature + n, 0.0f);
+  if (n < size_t(2 * region + 1)) {
+    return;
+  }
+
+  scratch.sums.resize(n + 1);
+  scratch.diffX.resize(n);
+  scratch.diffY.resize(n);
+  scratch.diffZ.resize(n);
+
+  internal::prefixSums(x, n, scratch.sums.data());
+  internal::windowDifferences(x, scratch.sums.data(), n, region,
+                              scratch.diffX.data());
+  internal::prefixSums(y, n, scratch.sums.data());
+  internal::windowDifferences(y, scratch.sums.data(), n, region,
+                              scratch.diffY.data());
+  internal::prefixSums(z, n, scratch.sums.data());
+  internal::windowDifferences(z, scratch.sums.data(), n, region,
+                              scratch.diffZ.data());
+
+  const double *dx = scratch.diffX.data();
+  const double *dy = scratch.diffY.data();
+  const double *dz = scratch.diffZ.data();
+  for (size_t i = region; i + region < n; i++) {
+    curvature[i] = float(dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i]);
+  }
+}
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_CURVATURE_UTILS_H
@@ -0,0 +1,31 @@
+#ifndef LIDAR_EIGEN_UTILS_H
+#define LIDAR_EIGEN_UTILS_H
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+
+namespace lidar_slam {
+
+/** \brief Compute the eigenvalues and eigenvectors of a symmetric 3x3 matrix.
+ *
+ * A thin wrapper around Eigen::SelfAdjointEigenSolver::computeDirect, shared
+ * by the line checks and the NDT voxel covariances so they use the same
+ * solver. The ordering matches the iterative solver: the eigenvalues are
+ * increasing and column i of vectors is the unit eigenvector of eigenvalue i.
+ * Only the lower triangular part of the matrix is read.
+ *
+ * @param A the symmetric matrix
+ * @param values the output eigenvalues
+ * @param vectors the output eigenvectors
+ */
+inline void symmetricEigen3(const Eigen::Matrix3f &A, Eigen::Vector3f &values,
+                            Eigen::Matrix3f &vectors) {
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver;
+  esolver.computeDirect(A);
+  values = esolver.eigenvalues();
+  vectors = esolver.eigenvectors();
+}
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_EIGEN_UTILS_H
@@ -3,8 +3,10 @@
 
 #include "Angle.h"
 #include "Vector3.h"
+#include "eigen_utils.h"
 #include "pcl_util.h"
 
+#include <Eigen/QR>
 #include <cmath>
 
 namespace lidar_slam {
@@ -42,7 +44,8 @@ inline float getSurfacePointDistance(const Eigen::Vector3f &A,
 template <typename PointT>
 inline bool getCornerFeatureCoefficients(const PointT &A, const PointT &B,
                                          const PointT &X, int iterration,
-                                         PointT &coeff) {
+                                         PointT &coeff,
+                                         const bool &distanceWeight = true) {
   Eigen::Vector3f direction;
   float distance = getLinePointDistance(A.getVector3fMap(), B.getVector3fMap(),
                                         X.getVector3fMap(), direction);
@@ -51,7 +54,7 @@ inline bool getCornerFeatureCoefficients(const PointT &A, const PointT &B,
   }
 
   float weight = 1.0;
-  if (iterration >= 5) {
+  if (distanceWeight && iterration >= 5) {
     weight = 1 - 1.8 * fabs(distance); // 1.8
   }
 
@@ -63,11 +66,12 @@ inline bool getCornerFeatureCoefficients(const PointT &A, const PointT &B,
 template <typename PointT>
 inline bool
 getCornerFeatureCoefficients(const Eigen::Vector3f &A, const Eigen::Vector3f &B,
-                             const Eigen::Vector3f &X, PointT &coeff) {
+                             const Eigen::Vector3f &X, PointT &coeff,
+                             const bool &distanceWeight = true) {
   Eigen::Vector3f direction;
   float distance = getLinePointDistance(A, B, X, direction);
 
-  float weight = 1 - 0.9f * fabs(distance);
+  float weight = distanceWeight ? 1 - 0.9f * fabs(distance) : 1.0f;
   coeff.getVector3fMap() = direction * weight;
   coeff.intensity = distance * weight;
 
@@ -78,7 +82,8 @@ template <typename PointT>
 inline bool getSurfaceFeatureCoefficients(const PointT &A, const PointT &B,
                                           const PointT &C, const PointT &X,
                                           int iterration,
-                                          PointT &coefficients) {
+                                          PointT &coefficients,
+                                          const bool &distanceWeight = true) {
 
   Eigen::Vector3f surfNormal;
   float distance = getSurfacePointDistance(
@@ -86,7 +91,7 @@ inline bool getSurfaceFeatureCoefficients(const PointT &A, const PointT &B,
       X.getVector3fMap(), surfNormal);
 
   float weight = 1;
-  if (iterration >= 5) {
+  if (distanceWeight && iterration >= 5) {
     weight = 1 - 1.8 * fabs(distance) / sqrt(X.getVector3fMap().norm()); // 1.8
   }
   coefficients.getVector3fMap() = weight * surfNormal;
@@ -97,9 +102,13 @@ inline bool getSurfaceFeatureCoefficients(const PointT &A, const PointT &B,
 template <typename PointT>
 inline bool getSurfaceFeatureCoefficients(const Eigen::Vector4f &planeCoef,
                                           const PointT &X,
-                                          PointT &coefficients) {
+                                          PointT &coefficients,
+                                          const bool &distanceWeight = true) {
   float distance = planeCoef.head(3).dot(X.getVector3fMap()) + planeCoef(3);
-  float weight = 1 - 0.9 * fabs(distance) / sqrt(X.getVector3fMap().norm());
+  float weight =
+      distanceWeight
+          ? 1 - 0.9 * fabs(distance) / sqrt(X.getVector3fMap().norm())
+          : 1.0f;
   coefficients.getVector3fMap() = planeCoef.head(3) * weight;
   coefficients.intensity = distance * weight;
   return (weight > 0.1);
@@ -111,7 +120,7 @@ bool findLine(const pcl::PointCloud<PointT> &cloud,
               Eigen::Vector3f &lineB) {
 
   Eigen::Matrix3f _lineMatA;
-  Eigen::Matrix<float, 1, 3> _lineMatD;
+  Eigen::Vector3f _lineMatD;
   Eigen::Matrix3f _lineMatV;
   Eigen::Vector3f _lineCentroid;
 
@@ -136,13 +145,10 @@ bool findLine(const pcl::PointCloud<PointT> &cloud,
   _lineMatA /= 5.0;
 
   // compute eigenvalues and eigenvectors
-  //_lineMatD.setZero();
-  //_lineMatV.setZero();
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(_lineMatA);
-  _lineMatD = esolver.eigenvalues().real();
-  _lineMatV = esolver.eigenvectors().real();
+  symmetricEigen3(_lineMatA, _lineMatD, _lineMatV);
+
   // compute corner line and coefficients
-  if (_lineMatD(0, 2) > 5 * _lineMatD(0, 1)) {
+  if (_lineMatD(2) > 5 * _lineMatD(1)) {
     Eigen::Vector3f largestEigenVect = _lineMatV.col(2);
     lineA = _lineCentroid - largestEigenVect * 0.1;
     lineB = _lineCentroid + largestEigenVect * 0.1;
@@ -4,6 +4,7 @@
 #include "Angle.h"
 #include "Vector3.h"
 
+#include <algorithm>
 #include <cmath>
 
 namespace lidar_slam {
@@ -107,6 +108,27 @@ inline float calcSquaredPointDistance(const PointT &p) {
   return p.x * p.x + p.y * p.y + p.z * p.z;
 }
 
+/** \brief Branch free polynomial approximation of std::atan2.
+ *
+ * The maximum absolute error is about 2e-6 rad. All case distinctions are
+ * expressed as selects, so loops calling it are auto-vectorized.
+ *
+ * @param y The y coordinate.
+ * @param x The x coordinate.
+ * @return The angle in rad in the range [-pi, pi].
+ */
+inline float fastAtan2(float y, float x) {
+  float ax = std::fabs(x);
+  float ay = std::fabs(y);
+  float a = std::min(ax, ay) / (std::max(ax, ay) + 1e-30f);
+  float s = a * a;
+  float r = (((((-0.0117212f * s + 0.05265332f) * s - 0.11643287f) * s +
+               0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+  r = ay > ax ? 1.57079633f - r : r;
+  r = x < 0 ? 3.14159265f - r : r;
+  return y < 0 ? -r : r;
+}
+
 /** \brief Rotate the given vector by the specified angle around the x-axis.
  *
  * @param v the vector to rotate
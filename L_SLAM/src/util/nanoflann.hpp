@@ -541,14 +541,25 @@ class PooledAllocator {
   size_t remaining; /* Number of bytes left in current block of storage. */
   void *base;       /* Pointer to base of current block of storage. */
   void *loc;        /* Current location in block to next allocate memory. */
+  void *spare;      /* Pointer to the first block kept by rewind(). */
 
   void internal_init() {
     remaining = 0;
     base = NULL;
+    spare = NULL;
     usedMemory = 0;
     wastedMemory = 0;
   }
 
+  static void free_chain(void *block) {
+    while (block != NULL) {
+      void *prev =
+          *(static_cast<void **>(block)); /* Get pointer to prev block. */
+      ::free(block);
+      block = prev;
+    }
+  }
+
 public:
   size_t usedMemory;
   size_t wastedMemory;
@@ -565,13 +576,26 @@ public:
 
   /** Frees all allocated memory chunks */
   void free_all() {
+    free_chain(base);
+    free_chain(spare);
+    internal_init();
+  }
+
+  /**
+       * Invalidates all memory allocated from this pool, but keeps the blocks
+       * for the following allocations, so filling the pool again with a
+       * similar amount of memory does not touch the system allocator.
+       */
+  void rewind() {
     while (base != NULL) {
-      void *prev =
-          *(static_cast<void **>(base)); /* Get pointer to prev block. */
-      ::free(base);
+      void *prev = *(static_cast<void **>(base));
+      static_cast<void **>(base)[0] = spare;
+      spare = base;
       base = prev;
     }
-    internal_init();
+    remaining = 0;
+    usedMemory = 0;
+    wastedMemory = 0;
   }
 
   /**
@@ -599,11 +623,18 @@ public:
               ? size + sizeof(void *) + (WORDSIZE - 1)
               : BLOCKSIZE;
 
-      // use the standard C malloc to allocate memory
-      void *m = ::malloc(blocksize);
-      if (!m) {
-        fprintf(stderr, "Failed to allocate memory.\n");
-        return NULL;
+      // reuse a kept block (all blocks hold at least BLOCKSIZE bytes), or use
+      // the standard C malloc to allocate memory
+      void *m;
+      if (blocksize == BLOCKSIZE && spare != NULL) {
+        m = spare;
+        spare = *(static_cast<void **>(spare));
+      } else {
+        m = ::malloc(blocksize);
+        if (!m) {
+          fprintf(stderr, "Failed to allocate memory.\n");
+          return NULL;
+        }
       }
 
       /* Fill first word of new block with pointer to previous block. */
@@ -821,6 +852,13 @@ public:
     obj.m_size_at_index_build = 0;
   }
 
+  /** Invalidates the index but keeps its node memory for the next build */
+  void rewindIndex(Derived &obj) {
+    obj.pool.rewind();
+    obj.root_node = NULL;
+    obj.m_size_at_index_build = 0;
+  }
+
   typedef typename Distance::ElementType ElementType;
   typedef typename Distance::DistanceType DistanceType;
 
@@ -1273,7 +1311,8 @@ public:
     BaseClassRef::m_size_at_index_build = BaseClassRef::m_size;
 
     init_vind();
-    this->freeIndex(*this);
+    // rebuilds reuse the node pool and the index array of the previous build
+    this->rewindIndex(*this);
     BaseClassRef::m_size_at_index_build = BaseClassRef::m_size;
     if (BaseClassRef::m_size == 0)
       return;
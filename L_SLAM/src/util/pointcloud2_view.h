@@ -0,0 +1,221 @@
+#ifndef LIDAR_POINTCLOUD2_VIEW_H
+#define LIDAR_POINTCLOUD2_VIEW_H
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Typed read only view over the raw byte buffer of a PointCloud2
+ * message.
+ *
+ * The offsets and data types of the x, y, z, intensity and ring fields are
+ * resolved once and reused for all following messages with the same point
+ * layout, so the points of a message can be read in place without
+ * materializing a PCL cloud. The view keeps a reference to the message.
+ */
+class PointCloud2View {
+public:
+  /** \brief Point on a new message.
+   *
+   * @param msg the cloud message
+   * @return true, if the message provides float x, y, z coordinates and an
+   * intensity field in little endian byte order, and all points lie within
+   * the message data, false otherwise
+   */
+  bool reset(const sensor_msgs::PointCloud2ConstPtr &msg) {
+    _msg = msg;
+    _data = msg->data.data();
+    _pointStep = msg->point_step;
+    _rowStep = msg->row_step;
+    _width = msg->width;
+    _height = msg->height;
+
+    if (!sameLayout(*msg)) {
+      _valid = resolveLayout(*msg);
+    }
+    return _valid && size_t(_width) * _pointStep <= _rowStep &&
+           msg->data.size() >= size_t(_rowStep) * _height;
+  }
+
+  /** \brief The number of points. */
+  size_t size() const { return size_t(_width) * _height; }
+
+  /** \brief The number of points per row. */
+  uint32_t width() const { return _width; }
+
+  /** \brief The number of rows (1 for unorganised clouds). */
+  uint32_t height() const { return _height; }
+
+  /** \brief Check if the message provides a ring field. */
+  bool hasRing() const { return _ring.offset >= 0; }
+
+  /** \brief The x coordinate of point i. */
+  float x(const size_t &i) const { return readFloat(point(i) + _x.offset); }
+
+  /** \brief The y coordinate of point i. */
+  float y(const size_t &i) const { return readFloat(point(i) + _y.offset); }
+
+  /** \brief The z coordinate of point i. */
+  float z(const size_t &i) const { return readFloat(point(i) + _z.offset); }
+
+  /** \brief The intensity of point i. */
+  float intensity(const size_t &i) const {
+    return read(point(i), _intensity);
+  }
+
+  /** \brief The ring of point i, or 0 if the message has no ring field. */
+  uint16_t ring(const size_t &i) const {
+    return hasRing() ? uint16_t(read(point(i), _ring)) : 0;
+  }
+
+  /** \brief The point i at column col of row row of an organised cloud. */
+  size_t index(const uint32_t &col, const uint32_t &row) const {
+    return size_t(row) * _width + col;
+  }
+
+private:
+  /** Resolved offset and data type of a point field. */
+  struct Field {
+    int offset = -1;
+    uint8_t datatype = 0;
+  };
+
+  const uint8_t *point(const size_t &i) const {
+    if (_height <= 1) {
+      return _data + i * _pointStep;
+    }
+    return _data + (i / _width) * _rowStep + (i % _width) * _pointStep;
+  }
+
+  static float readFloat(const uint8_t *p) {
+    float value;
+    std::memcpy(&value, p, sizeof(float));
+    return value;
+  }
+
+  template <typename T> static float readAs(const uint8_t *p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return float(value);
+  }
+
+  /** The size of a point field data type in bytes, 0 for unknown types. */
+  static size_t datatypeSize(const uint8_t &datatype) {
+    switch (datatype) {
+    case sensor_msgs::PointField::INT8:
+    case sensor_msgs::PointField::UINT8:
+      return 1;
+    case sensor_msgs::PointField::INT16:
+    case sensor_msgs::PointField::UINT16:
+      return 2;
+    case sensor_msgs::PointField::INT32:
+    case sensor_msgs::PointField::UINT32:
+    case sensor_msgs::PointField::FLOAT32:
+      return 4;
+    case sensor_msgs::PointField::FLOAT64:
+      return 8;
+    }
+    return 0;
+  }
+
+  /** Check if a resolved field has a known type and lies within a point. */
+  static bool fitsPoint(const Field &field, const uint32_t &pointStep) {
+    size_t size = datatypeSize(field.datatype);
+    return size > 0 && size_t(field.offset) + size <= pointStep;
+  }
+
+  static float read(const uint8_t *p, const Field &field) {
+    p += field.offset;
+    switch (field.datatype) {
+    case sensor_msgs::PointField::FLOAT32:
+      return readFloat(p);
+    case sensor_msgs::PointField::UINT8:
+      return float(*p);
+    case sensor_msgs::PointField::INT8:
+      return float(int8_t(*p));
+    case sensor_msgs::PointField::UINT16:
+      return readAs<uint16_t>(p);
+    case sensor_msgs::PointField::INT16:
+      return readAs<int16_t>(p);
+    case sensor_msgs::PointField::UINT32:
+      return readAs<uint32_t>(p);
+    case sensor_msgs::PointField::INT32:
+      return readAs<int32_t>(p);
+    case sensor_msgs::PointField::FLOAT64:
+      return readAs<double>(p);
+    }
+    return 0;
+  }
+
+  bool sameLayout(const sensor_msgs::PointCloud2 &msg) const {
+    if (msg.fields.size() != _fields.size() ||
+        msg.point_step != _layoutPointStep) {
+      return false;
+    }
+    for (size_t i = 0; i < _fields.size(); i++) {
+      if (msg.fields[i].name != _fields[i].name ||
+          msg.fields[i].offset != _fields[i].offset ||
+          msg.fields[i].datatype != _fields[i].datatype) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool resolveLayout(const sensor_msgs::PointCloud2 &msg) {
+    _fields = msg.fields;
+    _layoutPointStep = msg.point_step;
+    _x = _y = _z = _intensity = _ring = Field();
+
+    for (const sensor_msgs::PointField &f : msg.fields) {
+      Field field;
+      field.offset = f.offset;
+      field.datatype = f.datatype;
+      if (f.name == "x") {
+        _x = field;
+      } else if (f.name == "y") {
+        _y = field;
+      } else if (f.name == "z") {
+        _z = field;
+      } else if (f.name == "intensity") {
+        _intensity = field;
+      } else if (f.name == "ring") {
+        _ring = field;
+      }
+    }
+
+    return !msg.is_bigendian && _x.offset >= 0 && _y.offset >= 0 &&
+           _z.offset >= 0 && _intensity.offset >= 0 &&
+           _x.datatype == sensor_msgs::PointField::FLOAT32 &&
+           _y.datatype == sensor_msgs::PointField::FLOAT32 &&
+           _z.datatype == sensor_msgs::PointField::FLOAT32 &&
+           fitsPoint(_x, msg.point_step) && fitsPoint(_y, msg.point_step) &&
+           fitsPoint(_z, msg.point_step) &&
+           fitsPoint(_intensity, msg.point_step) &&
+           (_ring.offset < 0 || fitsPoint(_ring, msg.point_step));
+  }
+
+  sensor_msgs::PointCloud2ConstPtr _msg; ///< the viewed message
+  const uint8_t *_data = nullptr;        ///< raw point data of the message
+  uint32_t _pointStep = 0;               ///< bytes per point
+  uint32_t _rowStep = 0;                 ///< bytes per row
+  uint32_t _width = 0;                   ///< number of points per row
+  uint32_t _height = 0;                  ///< number of rows
+
+  std::vector<sensor_msgs::PointField> _fields; ///< fields of the resolved layout
+  uint32_t _layoutPointStep = 0; ///< point step of the resolved layout
+  bool _valid = false;           ///< flag if the resolved layout is usable
+  Field _x, _y, _z;              ///< coordinate fields
+  Field _intensity;              ///< intensity field
+  Field _ring;                   ///< optional ring field
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_POINTCLOUD2_VIEW_H
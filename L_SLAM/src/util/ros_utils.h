@@ -6,6 +6,7 @@
 #include <nav_msgs/Odometry.h>
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <tf/transform_datatypes.h>
@@ -34,6 +35,132 @@ inline void publishCloudMsg(ros::Publisher &publisher,
   publisher.publish(msg);
 }
 
+/** \brief Publish a copy of the specified cloud as shared pointer.
+ *
+ * Subscribers in the same process (e.g. nodelets in the same manager)
+ * receiving the same point type get the shared cloud without any
+ * serialization; the cloud is only serialized for out-of-process subscribers.
+ * Nothing is done if there are no subscribers.
+ *
+ * @tparam PointT the point type
+ * @param publisher the publisher instance
+ * @param cloud the cloud to publish
+ * @param stamp the time stamp of the cloud message
+ * @param frameID the message frame ID
+ */
+template <typename PointT>
+inline void publishCloudPtr(ros::Publisher &publisher,
+                            const pcl::PointCloud<PointT> &cloud,
+                            const ros::Time &stamp, std::string frameID) {
+  if (publisher.getNumSubscribers() == 0) {
+    return;
+  }
+
+  boost::shared_ptr<pcl::PointCloud<PointT>> msg(
+      new pcl::PointCloud<PointT>(cloud));
+  msg->header.stamp = pcl_conversions::toPCL(stamp);
+  msg->header.frame_id = frameID;
+  publisher.publish(msg);
+}
+
+/** \brief Publish a copy of the specified cloud as shared pointer, reusing the
+ * message cloud of the last call.
+ *
+ * The message cloud is only reused if neither the publisher nor any
+ * subscriber holds it anymore, otherwise a new message cloud is allocated.
+ * Nothing is done if there are no subscribers.
+ *
+ * @tparam PointT the point type
+ * @param publisher the publisher instance
+ * @param cloud the cloud to publish
+ * @param stamp the time stamp of the cloud message
+ * @param frameID the message frame ID
+ * @param message the message cloud of the publisher, kept between calls
+ */
+template <typename PointT>
+inline void publishCloudPtr(ros::Publisher &publisher,
+                            const pcl::PointCloud<PointT> &cloud,
+                            const ros::Time &stamp, std::string frameID,
+                            boost::shared_ptr<pcl::PointCloud<PointT>> &message) {
+  if (publisher.getNumSubscribers() == 0) {
+    return;
+  }
+
+  if (!message || !message.unique()) {
+    message.reset(new pcl::PointCloud<PointT>());
+  }
+  *message = cloud;
+  message->header.stamp = pcl_conversions::toPCL(stamp);
+  message->header.frame_id = frameID;
+  publisher.publish(boost::shared_ptr<const pcl::PointCloud<PointT>>(message));
+}
+
+/** \brief Prepare the spare cloud of a double buffered output for refilling.
+ *
+ * The spare cloud, published two rounds ago, is reused if neither the
+ * publisher nor any subscriber holds it anymore, otherwise it is replaced by
+ * a new cloud.
+ *
+ * @tparam CloudT the cloud type
+ * @param spare the spare cloud of the output, kept between calls
+ */
+template <typename CloudT>
+inline void reuseReleasedCloud(boost::shared_ptr<CloudT> &spare) {
+  if (!spare || !spare.unique()) {
+    spare.reset(new CloudT());
+  }
+}
+
+/** \brief Publish the specified cloud as shared pointer without copying it.
+ *
+ * The published cloud must not be modified anymore, so the given pointer is
+ * replaced by a new empty cloud.
+ *
+ * @tparam PointT the point type
+ * @param publisher the publisher instance
+ * @param cloud the cloud to hand over, reset to a new empty cloud
+ * @param stamp the time stamp of the cloud message
+ * @param frameID the message frame ID
+ */
+template <typename PointT>
+inline void publishCloudPtr(ros::Publisher &publisher,
+                            boost::shared_ptr<pcl::PointCloud<PointT>> &cloud,
+                            const ros::Time &stamp, std::string frameID) {
+  if (publisher.getNumSubscribers() == 0) {
+    return;
+  }
+
+  cloud->header.stamp = pcl_conversions::toPCL(stamp);
+  cloud->header.frame_id = frameID;
+  publisher.publish(boost::shared_ptr<const pcl::PointCloud<PointT>>(cloud));
+  cloud.reset(new pcl::PointCloud<PointT>());
+}
+
+/** \brief Publish a shared cloud as it is.
+ *
+ * The cloud header has to be set already, and the cloud must not be modified
+ * after publishing.
+ *
+ * @tparam PointT the point type
+ * @param publisher the publisher instance
+ * @param cloud the cloud to publish
+ */
+template <typename PointT>
+inline void
+publishCloudPtr(ros::Publisher &publisher,
+                const boost::shared_ptr<const pcl::PointCloud<PointT>> &cloud) {
+  if (publisher.getNumSubscribers() == 0) {
+    return;
+  }
+
+  publisher.publish(cloud);
+}
+
+/** \brief Get the ROS time stamp of a PCL cloud header. */
+inline ros::Time cloudStamp(const pcl::PCLHeader &header) {
+  return pcl_conversions::fromPCL(header.stamp);
+}
+
 inline void Isometry2TFtransform(const Eigen::Isometry3d& is3d,
                                tf::StampedTransform &tf_trans) {
   Eigen::Quaterniond quat(is3d.rotation());
@@ -0,0 +1,131 @@
+#ifndef LIDAR_VOXEL_DOWNSAMPLER_H
+#define LIDAR_VOXEL_DOWNSAMPLER_H
+
+#include <pcl/point_cloud.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+namespace lidar_slam {
+
+/** \brief Voxel grid filter replacing the points of each occupied voxel by
+ * their centroid, equivalent to pcl::VoxelGrid on x, y, z and intensity.
+ *
+ * Unlike pcl::VoxelGrid, all working memory is owned by the instance and keeps
+ * its capacity between calls, so filtering clouds of similar size repeatedly
+ * does not allocate. The output points are ordered by voxel.
+ */
+template <typename PointT> class VoxelDownsampler {
+public:
+  explicit VoxelDownsampler(const float &leafSize = 0.2f) {
+    setLeafSize(leafSize);
+  }
+
+  /** \brief Set the voxel edge length. */
+  void setLeafSize(const float &leafSize) {
+    _inverseLeafSize = 1.0f / leafSize;
+  }
+
+  /** \brief Down sample a cloud.
+   *
+   * @param input the input cloud, non finite points are skipped
+   * @param output the output cloud, must not alias the input
+   */
+  void filter(const pcl::PointCloud<PointT> &input,
+              pcl::PointCloud<PointT> &output) {
+    output.clear();
+    output.header = input.header;
+    output.is_dense = true;
+    _entries.clear();
+
+    // voxel bounds of the finite points
+    int64_t minIdx[3] = {std::numeric_limits<int64_t>::max(),
+                         std::numeric_limits<int64_t>::max(),
+                         std::numeric_limits<int64_t>::max()};
+    int64_t maxIdx[3] = {std::numeric_limits<int64_t>::min(),
+                         std::numeric_limits<int64_t>::min(),
+                         std::numeric_limits<int64_t>::min()};
+    for (size_t i = 0; i < input.size(); i++) {
+      const PointT &p = input[i];
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+        continue;
+      }
+      const int64_t idx[3] = {voxelIndex(p.x), voxelIndex(p.y),
+                              voxelIndex(p.z)};
+      for (int k = 0; k < 3; k++) {
+        minIdx[k] = std::min(minIdx[k], idx[k]);
+        maxIdx[k] = std::max(maxIdx[k], idx[k]);
+      }
+      _entries.push_back(Entry{0, uint32_t(i)});
+    }
+    if (_entries.empty()) {
+      return;
+    }
+
+    // linear voxel keys, sorted so equal voxels form runs
+    const uint64_t dimX = uint64_t(maxIdx[0] - minIdx[0] + 1);
+    const uint64_t dimY = uint64_t(maxIdx[1] - minIdx[1] + 1);
+    for (size_t e = 0; e < _entries.size(); e++) {
+      const PointT &p = input[_entries[e].index];
+      _entries[e].voxel = uint64_t(voxelIndex(p.x) - minIdx[0]) +
+                          uint64_t(voxelIndex(p.y) - minIdx[1]) * dimX +
+                          uint64_t(voxelIndex(p.z) - minIdx[2]) * dimX * dimY;
+    }
+    std::sort(_entries.begin(), _entries.end());
+
+    // average each run
+    size_t runStart = 0;
+    while (runStart < _entries.size()) {
+      size_t runEnd = runStart + 1;
+      while (runEnd < _entries.size() &&
+             _entries[runEnd].voxel == _entries[runStart].voxel) {
+        runEnd++;
+      }
+
+      float sumX = 0, sumY = 0, sumZ = 0, sumIntensity = 0;
+      for (size_t e = runStart; e < runEnd; e++) {
+        const PointT &p = input[_entries[e].index];
+        sumX += p.x;
+        sumY += p.y;
+        sumZ += p.z;
+        sumIntensity += p.intensity;
+      }
+
+      const float weight = 1.0f / float(runEnd - runStart);
+      PointT centroid = input[_entries[runStart].index];
+      centroid.x = sumX * weight;
+      centroid.y = sumY * weight;
+      centroid.z = sumZ * weight;
+      centroid.intensity = sumIntensity * weight;
+      output.push_back(centroid);
+
+      runStart = runEnd;
+    }
+  }
+
+private:
+  /** Point index with its linear voxel key. */
+  struct Entry {
+    uint64_t voxel;
+    uint32_t index;
+
+    bool operator<(const Entry &other) const {
+      return voxel < other.voxel ||
+             (voxel == other.voxel && index < other.index);
+    }
+  };
+
+  int64_t voxelIndex(const float &value) const {
+    return int64_t(std::floor(value * _inverseLeafSize));
+  }
+
+  float _inverseLeafSize;      ///< inverse voxel edge length
+  std::vector<Entry> _entries; ///< point voxel keys of the current cloud
+};
+
+} // end namespace lidar_slam
+
+#endif // LIDAR_VOXEL_DOWNSAMPLER_H